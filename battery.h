@@ -0,0 +1,109 @@
+// ESP32 Soundpod - Battery Monitor
+// Turns the divider voltage on BATTERY_LEVEL_PIN into a stable state of
+// charge: a burst of calibrated ADC samples, a correction for the sag
+// while the amplifier draws current, a fixed-point low-pass filter and a
+// Li-ion discharge curve instead of a straight line.
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Open-circuit voltage to state of charge for a single Li-ion cell,
+// highest voltage first. Percentages in between are interpolated.
+struct BatteryCurvePoint {
+  uint16_t millivolts;
+  uint8_t percent;
+};
+
+const BatteryCurvePoint batteryCurve[] = {
+  { 4200, 100 }, { 4110, 90 }, { 4020, 80 }, { 3950, 70 }, { 3870, 60 },
+  { 3840, 50 }, { 3800, 40 }, { 3770, 30 }, { 3730, 20 }, { 3690, 10 },
+  { 3610, 5 }, { 3270, 0 }
+};
+#define BATTERY_CURVE_POINTS (sizeof(batteryCurve) / sizeof(batteryCurve[0]))
+
+// Filter state, millivolts in Q4 fixed point
+int32_t batteryFilterQ4 = 0;
+bool batteryFilterSeeded = false;
+
+// Instrumentation
+int batteryLastSampleMv = 0;  // Cell voltage of the last burst, before filtering
+int batteryLastSpreadMv = 0;  // Max - min within the last burst
+
+// Function declarations
+void initBatteryMonitor();
+int sampleBatteryMillivolts();
+int compensateBatteryLoad(int millivolts, bool playing, int volume);
+int filterBatteryMillivolts(int millivolts);
+int batteryPercentFromMillivolts(int millivolts);
+
+// Set up the ADC pin
+void initBatteryMonitor() {
+  pinMode(BATTERY_LEVEL_PIN, INPUT);
+  analogReadResolution(12); // ESP32 has 12-bit ADC
+  batteryFilterSeeded = false;
+}
+
+// Average a burst of readings, returns the cell voltage in millivolts
+// analogReadMilliVolts() applies the per-chip eFuse calibration, which
+// removes most of the ADC's gain and offset error.
+int sampleBatteryMillivolts() {
+  uint32_t sum = 0;
+  uint32_t lowest = UINT32_MAX;
+  uint32_t highest = 0;
+  for (int i = 0; i < BATTERY_OVERSAMPLE; i++) {
+    uint32_t sample = analogReadMilliVolts(BATTERY_LEVEL_PIN);
+    sum += sample;
+    if (sample < lowest) {
+      lowest = sample;
+    }
+    if (sample > highest) {
+      highest = sample;
+    }
+  }
+  
+  batteryLastSpreadMv = highest - lowest;
+  batteryLastSampleMv = (sum * BATTERY_DIVIDER_RATIO + BATTERY_OVERSAMPLE / 2) / BATTERY_OVERSAMPLE;
+  return batteryLastSampleMv;
+}
+
+// Add back the sag caused by playback, the curve is for an unloaded cell
+int compensateBatteryLoad(int millivolts, bool playing, int volume) {
+  if (!playing) {
+    return millivolts;
+  }
+  return millivolts + BATTERY_PLAYING_SAG_MV + volume * BATTERY_SAG_PER_VOLUME_MV;
+}
+
+// Low-pass filter a reading, y += (x - y) / 2^BATTERY_FILTER_SHIFT
+// The first reading seeds the filter so boot starts at the real level.
+int filterBatteryMillivolts(int millivolts) {
+  int32_t sample = (int32_t)millivolts << 4;
+  if (!batteryFilterSeeded) {
+    batteryFilterQ4 = sample;
+    batteryFilterSeeded = true;
+  } else {
+    batteryFilterQ4 += (sample - batteryFilterQ4) >> BATTERY_FILTER_SHIFT;
+  }
+  return (batteryFilterQ4 + 8) >> 4;
+}
+
+// Look up the state of charge on the discharge curve
+int batteryPercentFromMillivolts(int millivolts) {
+  if (millivolts >= batteryCurve[0].millivolts) {
+    return batteryCurve[0].percent;
+  }
+  for (size_t i = 1; i < BATTERY_CURVE_POINTS; i++) {
+    const BatteryCurvePoint& upper = batteryCurve[i - 1];
+    const BatteryCurvePoint& lower = batteryCurve[i];
+    if (millivolts >= lower.millivolts) {
+      return lower.percent + (millivolts - lower.millivolts) * (upper.percent - lower.percent) /
+                             (upper.millivolts - lower.millivolts);
+    }
+  }
+  return 0;
+}
+
+#endif // BATTERY_H
\ No newline at end of file
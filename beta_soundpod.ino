@@ -2,7 +2,6 @@
 #include <WiFi.h>
 #include <SPI.h>
 #include <Wire.h>
-#include <DFRobotDFPlayerMini.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 #include "SPIFFS.h"
@@ -13,28 +12,26 @@
 #include "mp3Handler.h"
 #include "dbHandler.h"
 #include "powerManagement.h"
-
-// Define ESP32 specific pins
-// These are placeholder values - adjust according to your specific ESP32 wiring
-#define DFPLAYER_RX_PIN 16  // Connect to TX on DFPlayer
-#define DFPLAYER_TX_PIN 17  // Connect to RX on DFPlayer
-#define OLED_SDA_PIN 21     // Default ESP32 SDA
-#define OLED_SCL_PIN 22     // Default ESP32 SCL
-#define BUTTON_PREV_PIN 25
-#define BUTTON_PLAY_PIN 26
-#define BUTTON_NEXT_PIN 27
-#define BUTTON_VOL_UP_PIN 32
-#define BUTTON_VOL_DOWN_PIN 33
-#define BATTERY_LEVEL_PIN 34  // ADC pin for battery monitoring
+#include "buttons.h"
+#include "tasks.h"
+#include "boot.h"
 
 // Create a software serial for DFPlayer communication
-HardwareSerial playerSerial(1); // Use UART1 on ESP32
+HardwareSerial playerSerial(DFPLAYER_UART_NUM); // Use UART1 on ESP32
 
-// Variables for button debouncing
-unsigned long lastDebounceTime = 0;
-unsigned long debounceDelay = 50;
+// State deep sleep left in RTC memory, valid when fastResume is set
+RtcResumeState resumeState;
+bool fastResume = false;
 
 // Setup function
+// The ESP32 and the DFPlayer share one card slot, and only one of them may
+// drive the card at a time: the player reads it after power-up, after its
+// reset and while it plays. So the library scan runs to the end first, with
+// the player stopped and no tasks up to send it anything, and only then is
+// the player reset. The splash stays until the player state gives the
+// screen something to show. A button wake from deep sleep skips the scan,
+// the reset and the journal when RTC memory still holds the state it went
+// to sleep with.
 void setup() {
   // Initialize serial communication
   Serial.begin(115200);
@@ -43,123 +40,99 @@ void setup() {
   // Initialize MP3 player serial
   playerSerial.begin(9600, SERIAL_8N1, DFPLAYER_RX_PIN, DFPLAYER_TX_PIN);
   
-  // Initialize SPIFFS for storage
-  if(!SPIFFS.begin(true)) {
-    Serial.println("SPIFFS Mount Failed");
-    return;
+  // Last played track and volume, from RTC memory after a button wake,
+  // else from the state journal partition, before the display takes its
+  // first look at the player state
+  uint64_t wakePins = handleWakeUp();
+  fastResume = wakePins != 0 && takeRtcState(&resumeState);
+  if (fastResume) {
+    restorePlaybackState(rtcPlaybackState(resumeState, wakePins & (1ULL << BUTTON_PLAY_PIN)));
+  } else {
+    loadLastPlayState();
   }
+  bootMark("state restored");
   
   // Use ESP32's built-in LED_BUILTIN if available
   pinMode(LED_BUILTIN, OUTPUT);
   
-  // Setup button pins as inputs with pull-up resistors
-  pinMode(BUTTON_PREV_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_PLAY_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_NEXT_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_VOL_UP_PIN, INPUT_PULLUP);
-  pinMode(BUTTON_VOL_DOWN_PIN, INPUT_PULLUP);
-  
-  // Setup battery monitoring
-  pinMode(BATTERY_LEVEL_PIN, INPUT);
+  // Setup button pins and their edge interrupts
+  initButtons(handleButtonEvent);
   
   // Initialize I2C for OLED
   Wire.begin(OLED_SDA_PIN, OLED_SCL_PIN);
   
-  // Initialize modules
-  initDisplay();      // Setup OLED display
-  initMP3Player();    // Setup DFPlayer Mini
-  initDatabase();     // Setup database/storage
-  initPowerManagement(); // Setup power management
-  
   // Display welcome message
+  initDisplay();
   displayWelcomeScreen();
-  delay(2000);
+  bootMark("splash shown");
+  
+  // After a wake the index from before deep sleep is mapped right away,
+  // else the card is checked while the player keeps off it. SPIFFS holds
+  // the playlists either way.
+  bool libraryResumed = fastResume && resumeTrackInfo(resumeState);
+  if (libraryResumed) {
+    mountDatabase();
+  } else {
+    releasePlayerCard();
+    initDatabase();
+    bootMark("library ready");
+  }
+  
+  // Queue the DFPlayer reset, it goes out once the audio task runs
+  if (fastResume) {
+    initMP3PlayerResumed(resumeState.totalTracks);
+  } else {
+    initMP3Player();
+  }
+  initPowerManagement();
+  bootMark("power ready");
   
-  // Load last played track information
-  loadLastPlayState();
+  // Hand over to the audio, input, UI and storage tasks, the audio task
+  // shows names instead of track numbers from the start
+  startTasks();
+  bootMark("tasks started");
+  postPlayerCommand(PLAYER_LIBRARY_READY);
   
   Serial.println("ESP32 Soundpod Ready!");
 }
 
 // Main loop
+// Everything runs in the tasks started by setup(), see tasks.h. loop() is
+// the lowest priority on core 1 and only light-sleeps the chip between
+// their deadlines.
 void loop() {
-  // Check power status
-  checkPowerStatus();
-  
-  // Handle button input with debouncing
-  handleButtons();
-  
-  // Update display with current status
-  updateDisplay();
-  
-  // Play audio as needed
-  handleAudioPlayback();
-  
-  // Allow ESP32 to handle background tasks
-  yield();
-  
-  // Use ESP32's light sleep to save power during idle periods
-  if (isIdle()) {
-    Serial.println("Entering light sleep mode");
-    esp_sleep_enable_timer_wakeup(5000000); // 5 seconds
-    esp_light_sleep_start();
-    Serial.println("Waking from light sleep");
-  }
+  sleepUntilNextDeadline();
 }
 
-// Button handling function
-void handleButtons() {
-  // Check button states with debouncing
-  if ((millis() - lastDebounceTime) > debounceDelay) {
-    // Previous button
-    if (digitalRead(BUTTON_PREV_PIN) == LOW) {
-      playPreviousTrack();
-      lastDebounceTime = millis();
-    }
-    
-    // Play/Pause button
-    if (digitalRead(BUTTON_PLAY_PIN) == LOW) {
-      togglePlayPause();
-      lastDebounceTime = millis();
-    }
-    
-    // Next button
-    if (digitalRead(BUTTON_NEXT_PIN) == LOW) {
-      playNextTrack();
-      lastDebounceTime = millis();
-    }
-    
-    // Volume up button
-    if (digitalRead(BUTTON_VOL_UP_PIN) == LOW) {
-      increaseVolume();
-      lastDebounceTime = millis();
-    }
-    
-    // Volume down button
-    if (digitalRead(BUTTON_VOL_DOWN_PIN) == LOW) {
-      decreaseVolume();
-      lastDebounceTime = millis();
-    }
-  }
+// Check if the device is in idle state
+// True when no task is running or has work waiting: buttons released and
+// settled, nothing queued for or expected from the DFPlayer and no frame
+// on the display bus
+bool isIdle() {
+  return tasksBlocked() && buttonsIdle() && dfPlayerIdle() && !displayFlushBusy;
 }
 
-// Check if the device is in idle state (could be expanded based on original code)
-bool isIdle() {
-  // Placeholder function - implement based on your requirements
-  // Return true if no activity for certain period
-  return false; // For now, always return false to avoid sleep
+// Print the statistics every module keeps
+// The storage task calls this every STATS_PRINT_INTERVAL, see serviceStats().
+void printStats() {
+  Serial.println("--- Stats ---");
+  printBootTimeline();
+  printTransitionStats();
+  printTrackCacheStats();
+  printSleepStats();
+  printCommandStats();
+  printGovernorStats();
+  printEnergyStats();
+  printRtcStats();
 }
 
 // Load last playback state from storage
+// The audio task resumes it as soon as the DFPlayer is ready.
 void loadLastPlayState() {
-  // Implement loading last play state from SPIFFS
-  Serial.println("Loading last play state");
-  // Code to load from SPIFFS would go here
+  restorePlaybackState(loadPlaybackState());
 }
 
 // Save current playback state to storage
 void savePlayState() {
-  // Implement saving current play state to SPIFFS
-  Serial.println("Saving play state");
-  // Code to save to SPIFFS would go here
+  flushStateSave();
 }
\ No newline at end of file
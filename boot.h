@@ -0,0 +1,64 @@
+// ESP32 Soundpod - Boot Timeline
+// Timestamps of the boot phases since reset, logged as they happen and kept
+// for later, so time-to-first-audio can be compared between builds.
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define BOOT_MAX_PHASES 16
+
+struct BootPhase {
+  const char* name;
+  unsigned long at;       // millis() when the phase finished
+};
+
+BootPhase bootPhases[BOOT_MAX_PHASES];
+uint8_t bootPhaseCount = 0;
+portMUX_TYPE bootLock = portMUX_INITIALIZER_UNLOCKED; // Phases finish in several tasks
+unsigned long bootFirstAudioMs = 0; // Reset to the first track starting, 0 until then
+
+// Function declarations
+void bootMark(const char* name);
+void markFirstAudio();
+void printBootTimeline();
+
+// Record the end of a boot phase
+void bootMark(const char* name) {
+  unsigned long now = millis();
+  portENTER_CRITICAL(&bootLock);
+  if (bootPhaseCount < BOOT_MAX_PHASES) {
+    bootPhases[bootPhaseCount].name = name;
+    bootPhases[bootPhaseCount].at = now;
+    bootPhaseCount++;
+  }
+  portEXIT_CRITICAL(&bootLock);
+  
+  Serial.print("Boot +");
+  Serial.print(now);
+  Serial.print(" ms: ");
+  Serial.println(name);
+}
+
+// Note the first track starting, only the first call counts
+void markFirstAudio() {
+  if (bootFirstAudioMs != 0) {
+    return;
+  }
+  bootFirstAudioMs = millis();
+  bootMark("first audio");
+}
+
+// Print every recorded phase
+void printBootTimeline() {
+  for (uint8_t i = 0; i < bootPhaseCount; i++) {
+    Serial.print("boot,");
+    Serial.print(bootPhases[i].name);
+    Serial.print(",");
+    Serial.println(bootPhases[i].at);
+  }
+}
+
+#endif // BOOT_H
\ No newline at end of file
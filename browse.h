@@ -0,0 +1,118 @@
+// ESP32 Soundpod - Artist Browser
+// Browses the library by artist straight from the index's artist order:
+// the volume buttons jump between initial letters, prev and next step
+// between artists and play starts the selected one. Every move is a binary
+// search in the mapped index, O(log n) flash reads, nothing is copied.
+// The input task moves the browser, the UI task draws it.
+
+#ifndef BROWSE_H
+#define BROWSE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "trackIndex.h"
+
+#define BROWSE_LETTERS 26 // A to Z, other initials are reached by stepping
+#define BROWSE_ROWS 4     // Artists listed on the screen
+
+// Browser state, written by the input task
+volatile bool browseOpen = false;
+volatile int browsePosition = 0;           // Selected artist's first position in artist order
+volatile unsigned long browseLastInput = 0; // millis() of the last button in the browser
+volatile uint32_t browseVersion = 0;       // Bumped on every change, the UI task redraws on it
+
+// Function declarations
+bool openBrowser(int track);
+int closeBrowser();
+bool browserOpen(unsigned long now);
+void browseArtistStep(int direction);
+void browseLetterStep(int direction);
+int artistGroupStart(int position);
+int browseArtistTracks(int position);
+char browseLetterOf(int position);
+
+// Open the browser at the artist of a track (1-based), or the first artist
+// Returns false if the index has no artist order.
+bool openBrowser(int track) {
+  if (getSortedTrack(SORT_BY_ARTIST, 0) < 0) {
+    return false;
+  }
+  
+  TrackInfo info;
+  int count = 0;
+  int position = getIndexedTrack(track - 1, &info) ? findSortedPrefix(SORT_BY_ARTIST, info.artist, &count) : 0;
+  browsePosition = count > 0 ? position : 0;
+  browseOpen = true;
+  browseLastInput = millis();
+  browseVersion++;
+  return true;
+}
+
+// Close the browser, returns the selected artist's first track (1-based)
+int closeBrowser() {
+  int record = getSortedTrack(SORT_BY_ARTIST, browsePosition);
+  browseOpen = false;
+  browseVersion++;
+  return record + 1;
+}
+
+// The browser is open and has not timed out
+bool browserOpen(unsigned long now) {
+  return browseOpen && now - browseLastInput <= BROWSE_TIMEOUT_MS;
+}
+
+// Select the next or previous artist, wrapping around the ends
+void browseArtistStep(int direction) {
+  if (direction > 0) {
+    int next = nextSortedGroup(SORT_BY_ARTIST, browsePosition);
+    browsePosition = next >= 0 ? next : 0;
+  } else {
+    int last = (browsePosition > 0 ? browsePosition : (int)trackIndexCount) - 1;
+    browsePosition = artistGroupStart(last);
+  }
+  browseLastInput = millis();
+  browseVersion++;
+}
+
+// Jump to the first artist under the next or previous initial letter
+// Letters no artist starts with are skipped.
+void browseLetterStep(int direction) {
+  int letter = browseLetterOf(browsePosition) - 'A';
+  if (letter < 0 || letter >= BROWSE_LETTERS) {
+    letter = direction > 0 ? -1 : BROWSE_LETTERS;
+  }
+  
+  for (int i = 0; i < BROWSE_LETTERS; i++) {
+    letter = ((letter + direction) % BROWSE_LETTERS + BROWSE_LETTERS) % BROWSE_LETTERS;
+    char prefix[2] = { (char)('A' + letter), '\0' };
+    int count;
+    int first = findSortedPrefix(SORT_BY_ARTIST, prefix, &count);
+    if (count > 0) {
+      browsePosition = first;
+      break;
+    }
+  }
+  browseLastInput = millis();
+  browseVersion++;
+}
+
+// First position of the artist at a position in artist order
+// The exact name sorts before longer names that start with it.
+int artistGroupStart(int position) {
+  int count;
+  return findSortedPrefix(SORT_BY_ARTIST, sortedKeyAt(SORT_BY_ARTIST, position), &count);
+}
+
+// Tracks by the artist starting at a position
+int browseArtistTracks(int position) {
+  int next = nextSortedGroup(SORT_BY_ARTIST, position);
+  return (next >= 0 ? next : (int)trackIndexCount) - position;
+}
+
+// Initial letter shown for the artist at a position, '#' if not a letter
+char browseLetterOf(int position) {
+  uint8_t c = foldIndexChar(*sortedKeyAt(SORT_BY_ARTIST, position));
+  return (c >= 'a' && c <= 'z') ? c - 0x20 : '#';
+}
+
+#endif // BROWSE_H
\ No newline at end of file
@@ -0,0 +1,254 @@
+// ESP32 Soundpod - Buttons
+// Edge interrupts push timestamped level changes into a lock-free ring,
+// loop() runs one debounce state machine per button and turns them into
+// press, repeat and long-press events
+
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+#include <esp_sleep.h>
+#include "config.h"
+
+// Buttons, in the order of buttonPins[]
+enum ButtonId {
+  BUTTON_PREV,
+  BUTTON_PLAY,
+  BUTTON_NEXT,
+  BUTTON_VOL_UP,
+  BUTTON_VOL_DOWN,
+  BUTTON_COUNT
+};
+
+// What a button did
+enum ButtonEventType {
+  BUTTON_PRESSED,     // Repeating buttons: on press. Others: short press, on release
+  BUTTON_REPEAT,      // Repeating button still held
+  BUTTON_LONG_PRESS   // Non-repeating button held for BUTTON_LONG_PRESS_MS
+};
+
+typedef void (*ButtonHandler)(ButtonId button, ButtonEventType type);
+
+// Level change seen by the interrupt
+struct ButtonEdge {
+  uint8_t button;
+  uint8_t pressed;
+  uint32_t time;          // millis()
+};
+
+// Debounce state of one button
+struct ButtonState {
+  bool rawPressed;        // Level after the last edge
+  bool pressed;           // Debounced level
+  bool longFired;         // Long press already reported for this hold
+  uint32_t lastEdge;      // Time of the last edge
+  uint32_t pressedAt;
+  uint32_t nextRepeat;
+};
+
+const uint8_t buttonPins[BUTTON_COUNT] = {
+  BUTTON_PREV_PIN, BUTTON_PLAY_PIN, BUTTON_NEXT_PIN, BUTTON_VOL_UP_PIN, BUTTON_VOL_DOWN_PIN
+};
+// Held buttons that repeat (skip, volume) instead of long-pressing
+const bool buttonRepeats[BUTTON_COUNT] = { true, false, true, true, true };
+
+// Edge ring, the GPIO interrupt is the only producer and loop() the only consumer
+ButtonEdge buttonEdges[BUTTON_EDGE_QUEUE_SIZE];
+volatile uint8_t buttonEdgeHead = 0; // Next edge to read, written by loop()
+volatile uint8_t buttonEdgeTail = 0; // Next slot to write, written by the interrupt
+volatile bool buttonEdgeOverrun = false;
+
+TaskHandle_t buttonNotifyTask = NULL; // Woken by every edge
+
+ButtonState buttonStates[BUTTON_COUNT];
+ButtonHandler buttonHandler = NULL;
+unsigned long buttonEdgesSeen = 0;
+unsigned long buttonOverruns = 0;
+
+// Function declarations
+void initButtons(ButtonHandler handler);
+void pollButtons();
+bool buttonsIdle();
+void armButtonWake();
+void disarmButtonWake();
+void armDeepSleepWake();
+
+// Record the current level of one button, producer side of the ring
+bool IRAM_ATTR pushButtonEdge(uint8_t button) {
+  uint8_t tail = buttonEdgeTail;
+  uint8_t next = (tail + 1) % BUTTON_EDGE_QUEUE_SIZE;
+  if (next == buttonEdgeHead) {
+    buttonEdgeOverrun = true;
+    return false;
+  }
+  buttonEdges[tail].button = button;
+  buttonEdges[tail].pressed = digitalRead(buttonPins[button]) == LOW;
+  buttonEdges[tail].time = millis();
+  buttonEdgeTail = next;
+  return true;
+}
+
+// GPIO interrupt, records the new level of one button
+void IRAM_ATTR buttonIsr(void* arg) {
+  if (pushButtonEdge((uint8_t)(uintptr_t)arg) && buttonNotifyTask != NULL) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(buttonNotifyTask, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+// Set up the pins and interrupts
+void initButtons(ButtonHandler handler) {
+  buttonHandler = handler;
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    pinMode(buttonPins[i], INPUT_PULLUP);
+    memset(&buttonStates[i], 0, sizeof(buttonStates[i]));
+    attachInterruptArg(buttonPins[i], buttonIsr, (void*)(uintptr_t)i, CHANGE);
+  }
+  Serial.println("Buttons initialized");
+}
+
+// Make a press wake the chip from light sleep
+// Wakeup needs level triggering, which would fire the edge interrupt
+// continuously, so the interrupts are off until disarmButtonWake().
+void armButtonWake() {
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    gpio_intr_disable((gpio_num_t)buttonPins[i]);
+    gpio_wakeup_enable((gpio_num_t)buttonPins[i], GPIO_INTR_LOW_LEVEL);
+  }
+  esp_sleep_enable_gpio_wakeup();
+}
+
+// Back to edge interrupts after light sleep
+// The press that woke the chip came while the interrupts were off, so
+// buttons already down are recorded here. The interrupt runs on this core.
+void disarmButtonWake() {
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    gpio_wakeup_disable((gpio_num_t)buttonPins[i]);
+    gpio_set_intr_type((gpio_num_t)buttonPins[i], GPIO_INTR_ANYEDGE);
+  }
+  
+  portDISABLE_INTERRUPTS();
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    gpio_intr_enable((gpio_num_t)buttonPins[i]);
+    if (digitalRead(buttonPins[i]) == LOW) {
+      pushButtonEdge(i);
+    }
+  }
+  portENABLE_INTERRUPTS();
+  
+  if (buttonNotifyTask != NULL) {
+    xTaskNotifyGive(buttonNotifyTask);
+  }
+}
+
+// Report an event to the handler
+void fireButton(ButtonId button, ButtonEventType type) {
+  if (buttonHandler != NULL) {
+    buttonHandler(button, type);
+  }
+}
+
+// Advance one button's state machine to now
+void updateButton(ButtonId button, uint32_t now) {
+  ButtonState& state = buttonStates[button];
+  
+  // A level counts once it has been stable for the debounce time
+  if (state.rawPressed != state.pressed && now - state.lastEdge >= BUTTON_DEBOUNCE_MS) {
+    state.pressed = state.rawPressed;
+    if (state.pressed) {
+      state.pressedAt = now;
+      state.longFired = false;
+      state.nextRepeat = now + BUTTON_REPEAT_DELAY_MS;
+      if (buttonRepeats[button]) {
+        fireButton(button, BUTTON_PRESSED);
+      }
+    } else if (!buttonRepeats[button] && !state.longFired) {
+      fireButton(button, BUTTON_PRESSED);
+    }
+  }
+  
+  if (!state.pressed) {
+    return;
+  }
+  if (buttonRepeats[button]) {
+    if ((int32_t)(now - state.nextRepeat) >= 0) {
+      state.nextRepeat += BUTTON_REPEAT_MS;
+      fireButton(button, BUTTON_REPEAT);
+    }
+  } else if (!state.longFired && now - state.pressedAt >= BUTTON_LONG_PRESS_MS) {
+    state.longFired = true;
+    fireButton(button, BUTTON_LONG_PRESS);
+  }
+}
+
+// Drain the edge ring and run the state machines
+void pollButtons() {
+  while (buttonEdgeHead != buttonEdgeTail) {
+    const ButtonEdge& edge = buttonEdges[buttonEdgeHead];
+    ButtonState& state = buttonStates[edge.button];
+    
+    // Settle anything that was stable before this edge arrived
+    updateButton((ButtonId)edge.button, edge.time);
+    state.rawPressed = edge.pressed;
+    state.lastEdge = edge.time;
+    
+    buttonEdgeHead = (buttonEdgeHead + 1) % BUTTON_EDGE_QUEUE_SIZE;
+    buttonEdgesSeen++;
+  }
+  
+  // Edges were lost, read the real levels instead
+  if (buttonEdgeOverrun) {
+    buttonEdgeOverrun = false;
+    buttonOverruns++;
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+      buttonStates[i].rawPressed = digitalRead(buttonPins[i]) == LOW;
+      buttonStates[i].lastEdge = millis();
+    }
+  }
+  
+  uint32_t now = millis();
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    updateButton((ButtonId)i, now);
+  }
+}
+
+// True when no button is held or settling, so the loop may sleep
+bool buttonsIdle() {
+  if (buttonEdgeHead != buttonEdgeTail) {
+    return false;
+  }
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    if (buttonStates[i].pressed || buttonStates[i].rawPressed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Make a press wake the chip from deep sleep
+// The RTC pull-ups replace the digital ones, which are off while the chip
+// sleeps. The classic ESP32 can only wake from ext1 when all its pins are
+// low, so there only the play button (ext0) wakes it; later chips wake
+// on any of the five.
+void armDeepSleepWake() {
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    rtc_gpio_pullup_en((gpio_num_t)buttonPins[i]);
+    rtc_gpio_pulldown_dis((gpio_num_t)buttonPins[i]);
+  }
+  esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+  
+#if CONFIG_IDF_TARGET_ESP32
+  esp_sleep_enable_ext0_wakeup((gpio_num_t)BUTTON_PLAY_PIN, LOW);
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    mask |= 1ULL << buttonPins[i];
+  }
+  esp_sleep_enable_ext1_wakeup(mask, ESP_EXT1_WAKEUP_ANY_LOW);
+#endif
+}
+
+#endif // BUTTONS_H
\ No newline at end of file
@@ -8,38 +8,112 @@
 #define DEVICE_NAME "ESP32 Soundpod"
 #define FIRMWARE_VERSION "1.0.0"
 
+// Pin assignments
+// These are placeholder values - adjust according to your specific ESP32 wiring
+#define DFPLAYER_RX_PIN 16  // Connect to TX on DFPlayer
+#define DFPLAYER_TX_PIN 17  // Connect to RX on DFPlayer
+#define DFPLAYER_UART_NUM 1 // UART1
+#define OLED_SDA_PIN 21     // Default ESP32 SDA
+#define OLED_SCL_PIN 22     // Default ESP32 SCL
+#define BUTTON_PREV_PIN 25
+#define BUTTON_PLAY_PIN 26
+#define BUTTON_NEXT_PIN 27
+#define BUTTON_VOL_UP_PIN 32
+#define BUTTON_VOL_DOWN_PIN 33
+#define BATTERY_LEVEL_PIN 34  // ADC pin for battery monitoring
+
+// Button settings
+#define BUTTON_DEBOUNCE_MS 30     // Level must be stable this long to count
+#define BUTTON_LONG_PRESS_MS 800  // Hold time for a long press
+#define BUTTON_REPEAT_DELAY_MS 500 // Hold time before a button starts repeating
+#define BUTTON_REPEAT_MS 150      // Repeat period while held
+#define BUTTON_EDGE_QUEUE_SIZE 32 // Edges buffered between interrupts and loop()
+
 // Display settings
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
 #define OLED_RESET -1       // Reset pin (or -1 if sharing Arduino reset pin)
 #define SCREEN_ADDRESS 0x3C // I2C address for most SSD1306 displays
+#define DISPLAY_MAX_FPS 20  // Upper bound on redraws per second
+#define MARQUEE_STEP_MS 50   // Scroll long names one step every 50 ms
+#define MARQUEE_HOLD_MS 1500 // Pause at the start of each scroll pass
+#define BROWSE_TIMEOUT_MS 10000 // Artist browser closes after this long without a button
+#define DISPLAY_I2C_CLOCK 400000 // Fast mode, the most the SSD1306 datasheet allows
 
 // MP3 Player settings
 #define MAX_VOLUME 30
 #define DEFAULT_VOLUME 15
 #define VOLUME_STEP 2
+#define DFPLAYER_QUEUE_SIZE 16      // Commands waiting to be sent
+#define DFPLAYER_EVENT_QUEUE_SIZE 8 // Unsolicited messages (track finished, card removed...)
+#define DFPLAYER_TIMEOUT_MS 200     // Wait for an ACK or reply before retrying
+#define DFPLAYER_RESET_TIMEOUT_MS 3000 // The module needs a few seconds to read the card
+#define DFPLAYER_RETRIES 2          // Resends before a command is reported as failed
+#define DFPLAYER_RX_QUEUE_SIZE 16   // Frames decoded by the UART callback, waiting for loop()
+#define DFPLAYER_DUPLICATE_MS 500   // The player repeats "finished" messages, ignore repeats this close
+#define TRANSITION_GAP_SAMPLES 64   // Track change gaps kept for p50/p99 statistics
 
 // Battery settings for ESP32 ADC
-#define BATTERY_MIN_VOLTAGE 3.2 // Minimum battery voltage
-#define BATTERY_MAX_VOLTAGE 4.2 // Full battery voltage
 #define BATTERY_READ_INTERVAL 60000 // Read battery every 60 seconds
+#define BATTERY_DIVIDER_RATIO 2     // Cell voltage / ADC pin voltage
+#define BATTERY_OVERSAMPLE 64       // ADC samples averaged per reading
+#define BATTERY_FILTER_SHIFT 2      // Low-pass strength, each reading moves the level 1/4 of the way
+#define BATTERY_PLAYING_SAG_MV 40   // Cell voltage drop with the amplifier running
+#define BATTERY_SAG_PER_VOLUME_MV 3 // Further drop per volume step (0-30) while playing
+#define BATTERY_LOW_PERCENT 10      // Warn at or below this charge
+#define BATTERY_LOW_CLEAR_PERCENT 15 // Clear the warning once back at or above this
+#define BATTERY_CRITICAL_PERCENT 5  // Shut down at or below this charge...
+#define BATTERY_CRITICAL_READINGS 2 // ...on this many readings in a row
 
 // Power management
 #define SLEEP_TIMEOUT 300000 // Sleep after 5 minutes of inactivity
 #define DEEP_SLEEP_TIMEOUT 1800000 // Deep sleep after 30 minutes
+#define PLAYER_STOP_TIMEOUT_MS 1000 // Longest wait for the audio task to stop the player before deep sleep
+#define LIGHT_SLEEP_MIN_MS 20 // Shorter waits just block, light sleep isn't worth the wake-up
+#define LIGHT_SLEEP_UART_EDGES 3 // DFPlayer RX edges that wake from light sleep (those bytes are lost)
+#define NO_DEADLINE 0xFFFFFFFFUL // Next-deadline result when nothing is scheduled
+#define STATS_PRINT_INTERVAL 600000 // Print the runtime statistics every 10 minutes
 
 // ESP32 specific power settings
 #define CPU_FREQ_MHZ_ACTIVE 240  // Full speed when active
 #define CPU_FREQ_MHZ_IDLE 80     // Lower speed when idle
+#define GOVERNOR_MIN_MHZ 40      // Lowest clock the governor picks (crystal frequency)
+#define GOVERNOR_WINDOW_MS 1000  // Load is measured over windows this long
+#define GOVERNOR_TARGET_LOAD 50  // Percent busy the chosen clock should run at
+#define GOVERNOR_CALM_WINDOWS 3  // Light windows in a row before the clock drops
+
+// Energy model, supply current per component in microamps
+#define BATTERY_CAPACITY_MAH 1000        // Cell capacity for the time-left estimate
+#define POWER_MODEL_BASE_UA 20000        // DFPlayer idle, regulator and divider
+#define POWER_MODEL_CPU_BASE_UA 15000    // ESP32 awake, radio off
+#define POWER_MODEL_CPU_UA_PER_MHZ 150   // Plus this per MHz of CPU clock
+#define POWER_MODEL_LIGHT_SLEEP_UA 800   // ESP32 in light sleep
+#define POWER_MODEL_DISPLAY_UA 12000     // OLED panel on
+#define POWER_MODEL_PLAYING_UA 25000     // Decoder and amplifier running
+#define POWER_MODEL_PER_VOLUME_UA 5000   // Speaker current per volume step
+#define ENERGY_AVERAGE_SHIFT 2           // Time-left smoothing, each window moves the average 1/4 of the way
 
 // Storage settings
 #define MAX_FILENAME_LENGTH 64
-#define MAX_TRACKS 100
+#define TRACK_CACHE_SIZE 8 // Decoded tracks kept in RAM, the library itself lives on flash
+// Tag scanning reads the DFPlayer's card over a second SPI path (the card
+// slot wired to both, or a mux), and relies on the DFPlayer's numbering:
+// it numbers every MP3, WAV and WMA file on the card in FAT order, the order
+// the files were copied, which is also the order the directory lists them
+// in. So all audio has to live in MUSIC_DIR, and WAV and WMA files count as
+// tracks even though they carry no ID3 tags.
+#define SD_CS_PIN 5          // Chip select of the SPI path to the DFPlayer's card
+#define MUSIC_DIR "/music"   // Folder holding the tracks, the only one with audio files
+#define TRACK_INDEX_PARTITION "library" // Raw flash partition holding the track index (see partitions.csv)
+#define STATE_JOURNAL_PARTITION "pstate"  // Raw flash partition holding the playback state journal
+#define STATE_SAVE_INTERVAL 5000 // Persist playback state changes at most every 5 seconds
 
 // ESP32 SPIFFS settings
 #define CONFIG_FILE "/config.txt"
 #define PLAYLIST_FILE "/playlist.txt"
-#define LAST_STATE_FILE "/state.txt"
+#define PLAYLIST_MANIFEST_FILE "/playlists.idx" // Names, sizes and IDs of all playlists
+#define SCAN_CHECKPOINT_FILE "/scan.ckpt"
+#define SCAN_CHECKPOINT_INTERVAL 64 // Save library scan progress every 64 directory entries
 
 // Debug settings
 #define DEBUG true // Set to false to disable Serial debugging
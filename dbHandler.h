@@ -6,34 +6,73 @@
 
 #include <Arduino.h>
 #include "SPIFFS.h"
+#include <SD.h>
 #include "config.h"
+#include "trackIndex.h"
+#include "trackCache.h"
+#include "id3Parser.h"
+#include "stateJournal.h"
+#include "playlistFormat.h"
+#include "playerState.h"
+#include "governor.h"
+#include "rtcState.h"
 
-// Track information structure
-struct TrackInfo {
-  String filename;
-  String title;
-  String artist;
-  String album;
-  int trackNumber;
-};
+// Library scan checkpoint
+#define SCAN_CHECKPOINT_MAGIC 0x4B435353 // "SSCK"
 
-// Last playback state structure
-struct PlaybackState {
-  int lastTrack;
-  int lastVolume;
-  bool wasPlaying;
+// IDs a previous manifest gave out, found by name while rebuilding
+// Only a CRC of each name is kept in RAM, a match is confirmed against
+// the entry in the file.
+struct PlaylistIdHints {
+  File manifest;
+  uint32_t count;
+  uint32_t* nameCrcs;
+  uint32_t* ids;          // 0 once taken
+  uint32_t nextId;        // Above every ID the manifest gave out
 };
 
 // Global variables
-TrackInfo trackList[MAX_TRACKS];
 int tracksLoaded = 0;
 PlaybackState lastState;
 
+// Write-behind state: changes collect here and are persisted by serviceStateSave()
+portMUX_TYPE stateSaveLock = portMUX_INITIALIZER_UNLOCKED;
+PlayerState savedView;   // Player state as last seen by persistence
+PlaybackState pendingState;
+PlaybackState persistedState;
+bool stateSavePending = false;
+bool statePersistedValid = false;
+unsigned long lastStateSaveTime = 0;
+unsigned long stateChangeCount = 0;  // Changes requested
+unsigned long statePersistCount = 0; // Records actually written
+
+// Function declarations
+void createDefaultConfig();
+bool mountDatabase();
+void loadTrackInfo();
+bool resumeTrackInfo(const RtcResumeState& state);
+bool scanLibrary();
+bool libraryChanged(File& dir);
+void saveScanCheckpoint(uint32_t entriesDone, uint32_t matchCursor);
+bool loadScanCheckpoint(TrackIndexCheckpoint* checkpoint);
+void savePlaybackState(int track, int volume, bool playing);
+void requestStateSave(int track, int volume, bool playing);
+void serviceStateSave();
+unsigned long stateSaveNextDeadline();
+void flushStateSave();
+bool createPlaylist(String name, int trackCount, const int* trackIndices);
+bool deletePlaylist(String name);
+int listPlaylists(int first, PlaylistEntry* entries, int capacity, int* total);
+bool rebuildPlaylistManifest();
+bool loadPlaylistIdHints(PlaylistIdHints* hints, const char* path);
+uint32_t takePlaylistId(PlaylistIdHints* hints, const char* name);
+void freePlaylistIdHints(PlaylistIdHints* hints);
+bool beginPlaylistManifestUpdate(File* oldManifest, File* newManifest);
+void finishPlaylistManifestUpdate(File& oldManifest, File& newManifest, const char* name, bool keep, int trackCount);
+
 // Initialize database
 void initDatabase() {
-  // Initialize SPIFFS if not already done
-  if (!SPIFFS.begin(true)) {
-    Serial.println("Failed to mount SPIFFS");
+  if (!mountDatabase()) {
     return;
   }
   
@@ -66,66 +105,278 @@ void createDefaultConfig() {
   Serial.println("Default config created");
 }
 
+// Mount SPIFFS, which holds the config and playlists
+bool mountDatabase() {
+  // Initialize SPIFFS if not already done
+  if (!SPIFFS.begin(true)) {
+    Serial.println("Failed to mount SPIFFS");
+    return false;
+  }
+  return true;
+}
+
 // Load track information from SD card
 void loadTrackInfo() {
-  // In a real implementation, this would scan the SD card
-  // and extract ID3 tags from MP3 files
-  
-  // For this example, we'll create some dummy data
-  // In a real implementation, you would parse the SD card
+  Serial.println("Loading track information from SD card...");
   
-  // Reset track counter
-  tracksLoaded = 0;
+  // Map the index from the last scan, then bring it up to date with the
+  // card. Only new or changed files get their tags parsed.
+  // Lookups fall back to plain track numbers until the scan is done
+  trackLibraryReady = false;
+  clearTrackCache();
+  openTrackIndex();
+  bool boosted = governorBoost();
+  scanLibrary();
+  governorRelease(boosted);
   
-  Serial.println("Loading track information from SD card...");
+  tracksLoaded = trackIndexCount;
+  trackLibraryReady = true;
   
-  // Create some placeholder track data
-  // In a real implementation, this would come from scanning the SD card
-  for (int i = 0; i < 10 && i < MAX_TRACKS; i++) {
-    trackList[i].filename = "/music/track" + String(i+1) + ".mp3";
-    trackList[i].title = "Track " + String(i+1);
-    trackList[i].artist = "Demo Artist";
-    trackList[i].album = "Demo Album";
-    trackList[i].trackNumber = i+1;
-    tracksLoaded++;
+  Serial.print("Loaded ");
+  Serial.print(tracksLoaded);
+  Serial.println(" tracks");
+}
+
+// Take the library as it was before deep sleep, without scanning the card
+// Only the index is mapped, and only if it is the one the saved track
+// numbers refer to. False means loadTrackInfo() has to run after all.
+bool resumeTrackInfo(const RtcResumeState& state) {
+  clearTrackCache();
+  if (!openTrackIndex() || trackIndexGeneration != state.indexGeneration ||
+      trackIndexCount != state.libraryTracks) {
+    noteRtcFallback(RTC_FALLBACK_INDEX);
+    return false;
   }
   
-  Serial.print("Loaded ");
+  tracksLoaded = trackIndexCount;
+  trackLibraryReady = true;
+  
+  Serial.print("Resumed ");
   Serial.print(tracksLoaded);
   Serial.println(" tracks");
+  return true;
+}
+
+// Check for a file the DFPlayer plays, and so gives a track number
+bool isTrackFile(const char* name) {
+  size_t length = strlen(name);
+  return length > 4 && (strcasecmp(name + length - 4, ".mp3") == 0 ||
+                        strcasecmp(name + length - 4, ".wav") == 0 ||
+                        strcasecmp(name + length - 4, ".wma") == 0);
+}
+
+// Compare the card against the index without writing anything
+bool libraryChanged(File& dir) {
+  uint32_t matchCursor = 0;
+  uint32_t matched = 0;
+  TrackInfo info;
+  
+  File file = dir.openNextFile();
+  while (file) {
+    if (!file.isDirectory() && isTrackFile(file.name())) {
+      int found = findIndexedFile(file.path(), matchCursor);
+      if (found < 0 || !getIndexedTrack(found, &info) || info.fileSize != file.size() ||
+          info.modified != (uint32_t)file.getLastWrite()) {
+        file.close();
+        return true; // New or changed file
+      }
+      matchCursor = found + 1;
+      matched++;
+    }
+    file.close();
+    file = dir.openNextFile();
+  }
+  
+  // Anything left unmatched in the index was deleted
+  return matched != trackIndexCount;
+}
+
+// Scan the SD card and bring the track index up to date
+// Files are indexed in directory order, which is the order the DFPlayer
+// numbers them in (see MUSIC_DIR in config.h), so index + 1 is the
+// DFPlayer track number. Files whose
+// size and modification time match the current index reuse its entry.
+// Progress is checkpointed so a scan cut short by power loss resumes.
+bool scanLibrary() {
+  if (!SD.begin(SD_CS_PIN)) {
+    Serial.println("Failed to mount SD card");
+    return false;
+  }
+  
+  File dir = SD.open(MUSIC_DIR);
+  if (!dir || !dir.isDirectory()) {
+    Serial.println("Music folder not found: " MUSIC_DIR);
+    return false;
+  }
+  
+  unsigned long start = millis();
+  uint32_t entriesDone = 0;
+  uint32_t matchCursor = 0;
+  int parsed = 0;
+  int reused = 0;
+  
+  TrackIndexCheckpoint checkpoint;
+  if (loadScanCheckpoint(&checkpoint) && resumeTrackIndex(checkpoint)) {
+    // Skip the directory entries the interrupted scan already handled
+    Serial.println("Resuming library scan");
+    entriesDone = checkpoint.entriesDone;
+    matchCursor = checkpoint.matchCursor;
+    for (uint32_t i = 0; i < entriesDone; i++) {
+      File skipped = dir.openNextFile();
+      if (!skipped) {
+        break;
+      }
+      skipped.close();
+    }
+  } else {
+    SPIFFS.remove(SCAN_CHECKPOINT_FILE);
+    
+    // A damaged slot is written again even if the card hasn't changed
+    if (trackIndexGeneration != 0 && !trackIndexDamaged && !libraryChanged(dir)) {
+      dir.close();
+      Serial.print("Library unchanged, checked in ");
+      Serial.print(millis() - start);
+      Serial.println(" ms");
+      return true;
+    }
+    dir.rewindDirectory();
+    
+    if (!beginTrackIndex()) {
+      dir.close();
+      return false;
+    }
+  }
+  
+  TrackTags tags;
+  TrackInfo existing;
+  
+  File file = dir.openNextFile();
+  while (file) {
+    entriesDone++;
+    
+    if (!file.isDirectory() && isTrackFile(file.name())) {
+      uint32_t fileSize = file.size();
+      uint32_t modified = file.getLastWrite();
+      int found = findIndexedFile(file.path(), matchCursor);
+      
+      if (found >= 0 && getIndexedTrack(found, &existing) &&
+          existing.fileSize == fileSize && existing.modified == modified) {
+        // Unchanged since the last scan
+        addIndexedTrack(existing.filename, existing.title, existing.artist, existing.album,
+                        existing.trackNumber, fileSize, modified);
+        reused++;
+      } else {
+        readTrackTags(file, &tags);
+        
+        // Untagged files show their file name
+        if (tags.title[0] == '\0') {
+          strlcpy(tags.title, file.name(), sizeof(tags.title));
+          char* dot = strrchr(tags.title, '.');
+          if (dot != NULL) {
+            *dot = '\0';
+          }
+        }
+        
+        addIndexedTrack(file.path(), tags.title,
+                        tags.artist[0] ? tags.artist : "Unknown Artist",
+                        tags.album[0] ? tags.album : "Unknown Album",
+                        tags.trackNumber, fileSize, modified);
+        parsed++;
+      }
+      
+      if (found >= 0) {
+        matchCursor = found + 1;
+      }
+    }
+    file.close();
+    
+    if (entriesDone % SCAN_CHECKPOINT_INTERVAL == 0) {
+      saveScanCheckpoint(entriesDone, matchCursor);
+    }
+    file = dir.openNextFile();
+  }
+  dir.close();
+  
+  bool committed = commitTrackIndex();
+  SPIFFS.remove(SCAN_CHECKPOINT_FILE);
+  clearTrackCache(); // Track numbers may have moved
+  
+  unsigned long elapsed = millis() - start;
+  Serial.print("Scanned library in ");
+  Serial.print(elapsed);
+  Serial.print(" ms: ");
+  Serial.print(parsed);
+  Serial.print(" parsed, ");
+  Serial.print(reused);
+  Serial.println(" unchanged");
+  
+  return committed;
+}
+
+// Save scan progress so a power cut doesn't restart the scan
+void saveScanCheckpoint(uint32_t entriesDone, uint32_t matchCursor) {
+  TrackIndexCheckpoint checkpoint;
+  getTrackIndexCheckpoint(&checkpoint);
+  checkpoint.magic = SCAN_CHECKPOINT_MAGIC;
+  checkpoint.entriesDone = entriesDone;
+  checkpoint.matchCursor = matchCursor;
+  checkpoint.crc = esp_rom_crc32_le(0, (const uint8_t*)&checkpoint, offsetof(TrackIndexCheckpoint, crc));
+  
+  File checkpointFile = SPIFFS.open(SCAN_CHECKPOINT_FILE, "w");
+  if (!checkpointFile) {
+    return;
+  }
+  checkpointFile.write((const uint8_t*)&checkpoint, sizeof(checkpoint));
+  checkpointFile.close();
+}
+
+// Load the checkpoint of an interrupted scan, if there is a valid one
+bool loadScanCheckpoint(TrackIndexCheckpoint* checkpoint) {
+  if (!SPIFFS.exists(SCAN_CHECKPOINT_FILE)) {
+    return false;
+  }
+  
+  File checkpointFile = SPIFFS.open(SCAN_CHECKPOINT_FILE, "r");
+  if (!checkpointFile) {
+    return false;
+  }
+  size_t length = checkpointFile.read((uint8_t*)checkpoint, sizeof(*checkpoint));
+  checkpointFile.close();
+  
+  return length == sizeof(*checkpoint) && checkpoint->magic == SCAN_CHECKPOINT_MAGIC &&
+         checkpoint->crc == esp_rom_crc32_le(0, (const uint8_t*)checkpoint, offsetof(TrackIndexCheckpoint, crc));
 }
 
 // Get track information by index
+// The returned strings point into the mapped index, nothing is copied.
 TrackInfo getTrackInfo(int index) {
-  if (index >= 0 && index < tracksLoaded) {
-    return trackList[index];
-  } else {
+  TrackInfo info;
+  if (!getIndexedTrack(index, &info)) {
     // Return empty track info if index is invalid
-    TrackInfo emptyTrack;
-    emptyTrack.filename = "";
-    emptyTrack.title = "Invalid Track";
-    emptyTrack.artist = "";
-    emptyTrack.album = "";
-    emptyTrack.trackNumber = 0;
-    return emptyTrack;
+    info.filename = "";
+    info.title = "Invalid Track";
+    info.artist = "";
+    info.album = "";
+    info.trackNumber = 0;
   }
+  return info;
 }
 
 // Save last playback state
 void savePlaybackState(int track, int volume, bool playing) {
-  File stateFile = SPIFFS.open(LAST_STATE_FILE, "w");
-  if (!stateFile) {
-    Serial.println("Failed to open state file for writing");
-    return;
-  }
-  
-  // Write state
-  stateFile.println("lastTrack=" + String(track));
-  stateFile.println("lastVolume=" + String(volume));
-  stateFile.println("wasPlaying=" + String(playing ? "true" : "false"));
+  PlaybackState state;
+  state.lastTrack = track;
+  state.lastVolume = volume;
+  state.wasPlaying = playing;
   
-  stateFile.close();
-  Serial.println("Playback state saved");
+  if (appendStateJournal(state)) {
+    persistedState = state;
+    statePersistedValid = true;
+    statePersistCount++;
+    Serial.print("Playback state saved in ");
+    Serial.print(stateJournalWriteMicros);
+    Serial.println(" us");
+  }
 }
 
 // Load last playback state
@@ -135,122 +386,321 @@ PlaybackState loadPlaybackState() {
   state.lastVolume = DEFAULT_VOLUME;
   state.wasPlaying = false;
   
-  // Check if state file exists
-  if (!SPIFFS.exists(LAST_STATE_FILE)) {
-    Serial.println("State file not found, using defaults");
+  if (!readStateJournal(&state)) {
+    Serial.println("No saved state, using defaults");
     return state;
   }
   
-  File stateFile = SPIFFS.open(LAST_STATE_FILE, "r");
-  if (!stateFile) {
-    Serial.println("Failed to open state file for reading");
-    return state;
+  // The journal already holds this state, don't write it again
+  persistedState = state;
+  statePersistedValid = true;
+  
+  Serial.println("Playback state loaded");
+  return state;
+}
+
+// Note a state change, it is persisted later by serviceStateSave()
+void requestStateSave(int track, int volume, bool playing) {
+  portENTER_CRITICAL(&stateSaveLock);
+  stateChangeCount++;
+  pendingState.lastTrack = track;
+  pendingState.lastVolume = volume;
+  pendingState.wasPlaying = playing;
+  stateSavePending = true;
+  portEXIT_CRITICAL(&stateSaveLock);
+}
+
+// Pick up player state changes that need persisting
+void collectStateChanges() {
+  uint32_t changed = readPlayerState(&savedView, savedView.version);
+  if (PLAYER_CHANGED(changed, PLAYER_FIELD_TRACK) ||
+      PLAYER_CHANGED(changed, PLAYER_FIELD_PLAYING) ||
+      PLAYER_CHANGED(changed, PLAYER_FIELD_VOLUME)) {
+    requestStateSave(savedView.track, savedView.volume, savedView.playing);
   }
+}
+
+// Persist the pending state if the save interval has passed
+void serviceStateSave() {
+  collectStateChanges();
+  if (stateSavePending && millis() - lastStateSaveTime >= STATE_SAVE_INTERVAL) {
+    flushStateSave();
+  }
+}
+
+// Milliseconds until serviceStateSave() writes, NO_DEADLINE with nothing pending
+unsigned long stateSaveNextDeadline() {
+  if (!stateSavePending) {
+    return NO_DEADLINE;
+  }
+  long left = (long)(lastStateSaveTime + STATE_SAVE_INTERVAL - millis());
+  return left > 0 ? left : 0;
+}
+
+// Persist the pending state now, used before sleep or shutdown
+void flushStateSave() {
+  collectStateChanges();
   
-  // Read each line and parse key-value pairs
-  while (stateFile.available()) {
-    String line = stateFile.readStringUntil('\n');
-    int separatorPos = line.indexOf('=');
-    
-    if (separatorPos > 0) {
-      String key = line.substring(0, separatorPos);
-      String value = line.substring(separatorPos + 1);
-      
-      // Remove any trailing whitespace
-      value.trim();
-      
-      if (key == "lastTrack") {
-        state.lastTrack = value.toInt();
-      } else if (key == "lastVolume") {
-        state.lastVolume = value.toInt();
-      } else if (key == "wasPlaying") {
-        state.wasPlaying = (value == "true");
-      }
-    }
+  portENTER_CRITICAL(&stateSaveLock);
+  bool pending = stateSavePending;
+  PlaybackState state = pendingState;
+  stateSavePending = false;
+  portEXIT_CRITICAL(&stateSaveLock);
+  if (!pending) {
+    return;
   }
+  lastStateSaveTime = millis();
   
-  stateFile.close();
-  Serial.println("Playback state loaded");
-  return state;
+  // A burst that ends where it started needs no write
+  if (statePersistedValid &&
+      state.lastTrack == persistedState.lastTrack &&
+      state.lastVolume == persistedState.lastVolume &&
+      state.wasPlaying == persistedState.wasPlaying) {
+    return;
+  }
+  
+  savePlaybackState(state.lastTrack, state.lastVolume, state.wasPlaying);
+  
+  Serial.print("State writes: ");
+  Serial.print(statePersistCount);
+  Serial.print(" for ");
+  Serial.print(stateChangeCount);
+  Serial.println(" changes");
 }
 
 // Create a playlist
-bool createPlaylist(String name, int trackCount, int* trackIndices) {
+bool createPlaylist(String name, int trackCount, const int* trackIndices) {
   String filename = "/" + name + ".playlist";
+  String tempname = "/" + name + ".tmp";
+  
+  if (name.length() == 0 || name.length() > PLAYLIST_NAME_MAX) {
+    Serial.println("Invalid playlist name: " + name);
+    return false;
+  }
   
-  File playlistFile = SPIFFS.open(filename, "w");
+  // Write a temporary file so a failed write keeps the old playlist
+  File playlistFile = SPIFFS.open(tempname, "w");
   if (!playlistFile) {
     Serial.println("Failed to create playlist file");
     return false;
   }
   
-  // Write playlist header
-  playlistFile.println("name=" + name);
-  playlistFile.println("count=" + String(trackCount));
+  bool ok = writePlaylistFile(playlistFile, trackIndices, trackCount);
+  playlistFile.close();
   
-  // Write track indices
-  for (int i = 0; i < trackCount; i++) {
-    playlistFile.println(String(trackIndices[i]));
+  if (!ok) {
+    SPIFFS.remove(tempname);
+    Serial.println("Failed to write playlist: " + name);
+    return false;
+  }
+  
+  // Swap the file in while the manifest is set aside
+  File oldManifest, newManifest;
+  bool tracked = beginPlaylistManifestUpdate(&oldManifest, &newManifest);
+  
+  SPIFFS.remove(filename);
+  bool stored = SPIFFS.rename(tempname, filename);
+  
+  if (tracked) {
+    finishPlaylistManifestUpdate(oldManifest, newManifest, name.c_str(), stored, trackCount);
+  }
+  
+  if (!stored) {
+    Serial.println("Failed to store playlist: " + name);
+    return false;
   }
   
-  playlistFile.close();
   Serial.println("Playlist created: " + name);
   return true;
 }
 
-// Load a playlist
-int* loadPlaylist(String name, int* trackCount) {
+// Delete a playlist
+bool deletePlaylist(String name) {
   String filename = "/" + name + ".playlist";
-  
-  // Default values
-  static int tracks[MAX_TRACKS];
-  *trackCount = 0;
-  
-  // Check if playlist file exists
   if (!SPIFFS.exists(filename)) {
     Serial.println("Playlist file not found: " + name);
-    return tracks;
+    return false;
+  }
+  
+  File oldManifest, newManifest;
+  bool tracked = beginPlaylistManifestUpdate(&oldManifest, &newManifest);
+  
+  bool removed = SPIFFS.remove(filename);
+  
+  if (tracked) {
+    finishPlaylistManifestUpdate(oldManifest, newManifest, name.c_str(), !removed, -1);
   }
   
+  Serial.println((removed ? "Playlist deleted: " : "Failed to delete playlist: ") + name);
+  return removed;
+}
+
+// Load part of a playlist into the caller's buffer
+// Entries [first, first + capacity) are copied to tracks and the playlist
+// length goes to trackCount. Returns the number of entries copied, or -1.
+int loadPlaylist(String name, int first, int* tracks, int capacity, int* trackCount) {
+  String filename = "/" + name + ".playlist";
+  *trackCount = 0;
+  
   File playlistFile = SPIFFS.open(filename, "r");
   if (!playlistFile) {
-    Serial.println("Failed to open playlist file");
-    return tracks;
+    Serial.println("Playlist file not found: " + name);
+    return -1;
+  }
+  
+  PlaylistHeader header;
+  int loaded = -1;
+  if (readPlaylistHeader(playlistFile, &header)) {
+    loaded = readPlaylistFile(playlistFile, header, first, tracks, capacity);
   }
+  playlistFile.close();
   
-  // Read playlist header
-  String line = playlistFile.readStringUntil('\n');
-  // Skip name line
-  line = playlistFile.readStringUntil('\n');
+  if (loaded < 0) {
+    Serial.println("Playlist damaged: " + name);
+    return -1;
+  }
   
-  if (line.startsWith("count=")) {
-    *trackCount = line.substring(6).toInt();
+  *trackCount = header.count;
+  return loaded;
+}
+
+// Manifest updates go through a temporary copy. The old manifest is
+// renamed away first, so if power is lost before the new one is renamed
+// into place there is no manifest at all and the next listPlaylists()
+// rebuilds it from the files.
+#define PLAYLIST_MANIFEST_OLD PLAYLIST_MANIFEST_FILE ".old"
+#define PLAYLIST_MANIFEST_NEW PLAYLIST_MANIFEST_FILE ".new"
+
+// Open the manifest and check its header and size
+bool openPlaylistManifest(File* manifest, PlaylistManifestHeader* header, const char* path) {
+  *manifest = SPIFFS.open(path, "r");
+  if (!*manifest) {
+    return false;
+  }
+  if (manifest->read((uint8_t*)header, sizeof(*header)) == sizeof(*header) &&
+      header->magic == PLAYLIST_MANIFEST_MAGIC &&
+      header->version == PLAYLIST_MANIFEST_VERSION &&
+      header->entrySize == sizeof(PlaylistEntry) &&
+      header->crc == esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(PlaylistManifestHeader, crc)) &&
+      manifest->size() == sizeof(*header) + header->count * sizeof(PlaylistEntry)) {
+    return true;
   }
+  manifest->close();
+  return false;
+}
+
+// Write a manifest header at the current position
+bool writePlaylistManifestHeader(File& manifest, uint32_t count, uint32_t nextId) {
+  PlaylistManifestHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = PLAYLIST_MANIFEST_MAGIC;
+  header.version = PLAYLIST_MANIFEST_VERSION;
+  header.entrySize = sizeof(PlaylistEntry);
+  header.count = count;
+  header.nextId = nextId;
+  header.crc = esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(PlaylistManifestHeader, crc));
+  return manifest.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+}
+
+// Set the manifest aside before changing a playlist file
+// Returns false if there is no valid manifest, it is rebuilt on next use.
+bool beginPlaylistManifestUpdate(File* oldManifest, File* newManifest) {
+  PlaylistManifestHeader header;
+  File check;
+  if (!openPlaylistManifest(&check, &header, PLAYLIST_MANIFEST_FILE)) {
+    return false;
+  }
+  check.close();
+  
+  SPIFFS.remove(PLAYLIST_MANIFEST_OLD);
+  if (!SPIFFS.rename(PLAYLIST_MANIFEST_FILE, PLAYLIST_MANIFEST_OLD) ||
+      !openPlaylistManifest(oldManifest, &header, PLAYLIST_MANIFEST_OLD)) {
+    return false;
+  }
+  
+  *newManifest = SPIFFS.open(PLAYLIST_MANIFEST_NEW, "w");
+  if (!*newManifest) {
+    oldManifest->close();
+    return false;
+  }
+  return true;
+}
+
+// Copy the manifest without name's entry, append it again if keep is set
+// (trackCount -1 keeps the old count) and swap the copy into place
+void finishPlaylistManifestUpdate(File& oldManifest, File& newManifest, const char* name, bool keep, int trackCount) {
+  PlaylistManifestHeader header;
+  oldManifest.seek(0);
+  oldManifest.read((uint8_t*)&header, sizeof(header));
   
-  // Read track indices
-  for (int i = 0; i < *trackCount && i < MAX_TRACKS; i++) {
-    if (playlistFile.available()) {
-      line = playlistFile.readStringUntil('\n');
-      tracks[i] = line.toInt();
-    } else {
-      break;
+  // Header is rewritten once the final count is known
+  bool ok = writePlaylistManifestHeader(newManifest, 0, 0);
+  uint32_t count = 0;
+  uint32_t id = 0;
+  PlaylistEntry entry;
+  
+  for (uint32_t i = 0; ok && i < header.count; i++) {
+    ok = oldManifest.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    if (ok && strcmp(entry.name, name) == 0) {
+      id = entry.id; // Replacing a playlist keeps its ID
+      if (trackCount < 0) {
+        trackCount = entry.trackCount;
+      }
+      continue;
     }
+    ok = ok && newManifest.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    count++;
   }
   
-  playlistFile.close();
-  Serial.println("Playlist loaded: " + name + " with " + String(*trackCount) + " tracks");
-  return tracks;
+  uint32_t nextId = header.nextId;
+  if (ok && keep) {
+    memset(&entry, 0, sizeof(entry));
+    entry.id = id != 0 ? id : nextId++;
+    entry.trackCount = trackCount < 0 ? 0 : trackCount;
+    strlcpy(entry.name, name, sizeof(entry.name));
+    ok = newManifest.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    count++;
+  }
+  
+  ok = ok && newManifest.seek(0) && writePlaylistManifestHeader(newManifest, count, nextId);
+  oldManifest.close();
+  newManifest.close();
+  
+  if (ok && SPIFFS.rename(PLAYLIST_MANIFEST_NEW, PLAYLIST_MANIFEST_FILE)) {
+    SPIFFS.remove(PLAYLIST_MANIFEST_OLD);
+  } else {
+    SPIFFS.remove(PLAYLIST_MANIFEST_NEW);
+    Serial.println("Playlist manifest update failed, will rebuild");
+  }
 }
 
-// List all available playlists
-String* listPlaylists(int* count) {
-  static String playlists[20]; // Maximum 20 playlists
-  *count = 0;
+// Rebuild the manifest by walking the SPIFFS root
+// Playlists keep the IDs the last manifest gave them, whether it is still
+// in place but damaged or an interrupted update left it set aside, so a
+// saved ID stays valid. Playlists it didn't know get IDs above all of its
+// IDs.
+bool rebuildPlaylistManifest() {
+  Serial.println("Rebuilding playlist manifest");
+  
+  PlaylistIdHints hints;
+  if (!loadPlaylistIdHints(&hints, PLAYLIST_MANIFEST_FILE)) {
+    loadPlaylistIdHints(&hints, PLAYLIST_MANIFEST_OLD);
+  }
+  
+  File manifest = SPIFFS.open(PLAYLIST_MANIFEST_NEW, "w");
+  if (!manifest) {
+    freePlaylistIdHints(&hints);
+    Serial.println("Failed to create playlist manifest");
+    return false;
+  }
+  
+  bool ok = writePlaylistManifestHeader(manifest, 0, 0);
+  uint32_t count = 0;
   
   File root = SPIFFS.open("/");
   File file = root.openNextFile();
   
-  while (file && *count < 20) {
+  while (ok && file) {
     String filename = file.name();
     
     // Check if file is a playlist
@@ -258,21 +708,157 @@ String* listPlaylists(int* count) {
       // Remove extension and path
       int lastSlash = filename.lastIndexOf('/');
       int lastDot = filename.lastIndexOf('.');
+      String name = filename.substring(lastSlash + 1, lastDot);
       
-      if (lastSlash < 0) lastSlash = -1;
-      if (lastDot > 0) {
-        playlists[*count] = filename.substring(lastSlash + 1, lastDot);
-        (*count)++;
+      PlaylistHeader header;
+      if (name.length() > 0 && name.length() <= PLAYLIST_NAME_MAX && readPlaylistHeader(file, &header)) {
+        PlaylistEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.id = takePlaylistId(&hints, name.c_str());
+        entry.trackCount = header.count;
+        strlcpy(entry.name, name.c_str(), sizeof(entry.name));
+        ok = manifest.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+        count++;
       }
     }
     
     file = root.openNextFile();
   }
   
+  ok = ok && manifest.seek(0) && writePlaylistManifestHeader(manifest, count, hints.nextId);
+  manifest.close();
+  freePlaylistIdHints(&hints);
+  
+  SPIFFS.remove(PLAYLIST_MANIFEST_FILE);
+  if (!ok || !SPIFFS.rename(PLAYLIST_MANIFEST_NEW, PLAYLIST_MANIFEST_FILE)) {
+    SPIFFS.remove(PLAYLIST_MANIFEST_NEW);
+    Serial.println("Failed to write playlist manifest");
+    return false;
+  }
+  SPIFFS.remove(PLAYLIST_MANIFEST_OLD);
+  return true;
+}
+
+// Read the names and IDs of a manifest for a rebuild
+// A damaged header doesn't stop this: the entries are read as far as the
+// file holds whole ones. Without a manifest (or the RAM for its names)
+// there are no hints and IDs start over at 1.
+bool loadPlaylistIdHints(PlaylistIdHints* hints, const char* path) {
+  hints->count = 0;
+  hints->nameCrcs = NULL;
+  hints->ids = NULL;
+  hints->nextId = 1;
+  
+  PlaylistManifestHeader header;
+  hints->manifest = SPIFFS.open(path, "r");
+  if (!hints->manifest) {
+    return false;
+  }
+  if (hints->manifest.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+      header.magic != PLAYLIST_MANIFEST_MAGIC || header.entrySize != sizeof(PlaylistEntry)) {
+    hints->manifest.close();
+    return false;
+  }
+  
+  // The next ID the header promised only counts if the header is intact
+  if (header.crc == esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(PlaylistManifestHeader, crc)) &&
+      header.nextId > hints->nextId) {
+    hints->nextId = header.nextId;
+  }
+  
+  uint32_t entries = (hints->manifest.size() - sizeof(header)) / sizeof(PlaylistEntry);
+  uint32_t* table = NULL;
+  if (entries > 0) {
+    table = (uint32_t*)malloc(entries * 2 * sizeof(uint32_t));
+    if (table == NULL) {
+      hints->manifest.close();
+      Serial.println("Not enough memory to keep playlist IDs");
+      return false;
+    }
+  }
+  hints->nameCrcs = table;
+  hints->ids = table + entries;
+  
+  PlaylistEntry entry;
+  while (hints->count < entries &&
+         hints->manifest.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+    entry.name[PLAYLIST_NAME_MAX] = '\0';
+    hints->nameCrcs[hints->count] = esp_rom_crc32_le(0, (const uint8_t*)entry.name, strlen(entry.name));
+    hints->ids[hints->count] = entry.id;
+    if (entry.id >= hints->nextId) {
+      hints->nextId = entry.id + 1;
+    }
+    hints->count++;
+  }
+  return true;
+}
+
+// ID for a playlist found by a rebuild: the one the old manifest gave it,
+// else the next unused one
+uint32_t takePlaylistId(PlaylistIdHints* hints, const char* name) {
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)name, strlen(name));
+  for (uint32_t i = 0; i < hints->count; i++) {
+    if (hints->nameCrcs[i] != crc || hints->ids[i] == 0) {
+      continue;
+    }
+    
+    PlaylistEntry entry;
+    if (hints->manifest.seek(sizeof(PlaylistManifestHeader) + i * sizeof(PlaylistEntry)) &&
+        hints->manifest.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry) &&
+        strncmp(entry.name, name, PLAYLIST_NAME_MAX) == 0) {
+      // No other playlist gets this ID, even from a damaged entry
+      uint32_t id = hints->ids[i];
+      for (uint32_t j = 0; j < hints->count; j++) {
+        if (hints->ids[j] == id) {
+          hints->ids[j] = 0;
+        }
+      }
+      return id;
+    }
+  }
+  return hints->nextId++;
+}
+
+// Release what loadPlaylistIdHints() took
+void freePlaylistIdHints(PlaylistIdHints* hints) {
+  hints->manifest.close();
+  free(hints->nameCrcs);
+  hints->nameCrcs = NULL;
+  hints->ids = NULL;
+  hints->count = 0;
+}
+
+// List playlists from the manifest
+// Entries [first, first + capacity) are copied and the number of playlists
+// goes to total. Returns the number of entries copied.
+int listPlaylists(int first, PlaylistEntry* entries, int capacity, int* total) {
+  *total = 0;
+  
+  File manifest;
+  PlaylistManifestHeader header;
+  if (!openPlaylistManifest(&manifest, &header, PLAYLIST_MANIFEST_FILE)) {
+    if (!rebuildPlaylistManifest() ||
+        !openPlaylistManifest(&manifest, &header, PLAYLIST_MANIFEST_FILE)) {
+      return 0;
+    }
+  }
+  
+  *total = header.count;
+  int copied = 0;
+  if (first >= 0 && (uint32_t)first < header.count &&
+      manifest.seek(sizeof(header) + first * sizeof(PlaylistEntry))) {
+    int wanted = min(capacity, (int)header.count - first);
+    size_t length = wanted * sizeof(PlaylistEntry);
+    if (manifest.read((uint8_t*)entries, length) == length) {
+      copied = wanted;
+    }
+  }
+  manifest.close();
+  
   Serial.print("Found ");
-  Serial.print(*count);
+  Serial.print(*total);
   Serial.println(" playlists");
   
-  return playlists;
+  return copied;
 }
 #endif 
\ No newline at end of file
@@ -0,0 +1,437 @@
+// ESP32 Soundpod - DFPlayer Driver
+// Non-blocking DFPlayer Mini driver: commands wait in a FIFO, one is in
+// flight at a time, and replies are matched by a byte-level frame parser.
+// Nothing here waits on the UART. With dfPlayerListen() frames are decoded
+// by the UART receive callback as they arrive and handed to loop() through
+// a single-producer ring, dfPlayerService() does the rest.
+
+#ifndef DFPLAYER_H
+#define DFPLAYER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Frame layout: 7E FF 06 cmd feedback paramH paramL sumH sumL EF
+#define DF_FRAME_SIZE 10
+#define DF_FRAME_START 0x7E
+#define DF_FRAME_VERSION 0xFF
+#define DF_FRAME_LENGTH 0x06
+#define DF_FRAME_END 0xEF
+
+// Commands
+#define DF_CMD_PLAY_TRACK 0x03
+#define DF_CMD_VOLUME 0x06
+#define DF_CMD_EQ 0x07
+#define DF_CMD_OUTPUT_DEVICE 0x09
+#define DF_CMD_RESET 0x0C
+#define DF_CMD_RESUME 0x0D
+#define DF_CMD_PAUSE 0x0E
+#define DF_CMD_STOP 0x16
+#define DF_CMD_QUERY_SD_FILES 0x48
+
+// Messages from the player
+#define DF_MSG_CARD_INSERTED 0x3A
+#define DF_MSG_CARD_REMOVED 0x3B
+#define DF_MSG_PLAY_FINISHED 0x3D
+#define DF_MSG_READY 0x3F
+#define DF_MSG_ERROR 0x40
+#define DF_MSG_ACK 0x41
+
+#define DF_EQ_NORMAL 0
+#define DF_DEVICE_SD 2
+#define DF_ERROR_BUSY 1
+#define DF_POLL_MS 10 // UART polling interval without a receive callback
+
+// Called when a command completes: ok is false after the last retry
+// timed out or the player reported an error. value is the reply parameter.
+typedef void (*DfPlayerCallback)(uint8_t command, bool ok, uint16_t value);
+
+// One queued command
+struct DfCommand {
+  uint8_t command;
+  uint16_t param;
+  uint8_t reply;          // Message that completes it, DF_MSG_ACK for plain commands
+  uint16_t timeout;       // Milliseconds per attempt
+  DfPlayerCallback callback;
+};
+
+// Message from the player that was not a reply
+struct DfEvent {
+  uint8_t type;
+  uint16_t value;
+};
+
+// Driver state, the command queue may be filled from any task
+Stream* dfSerial = NULL;
+portMUX_TYPE dfQueueLock = portMUX_INITIALIZER_UNLOCKED;
+DfCommand dfQueue[DFPLAYER_QUEUE_SIZE];
+uint8_t dfQueueHead = 0;   // Next command to send
+uint8_t dfQueueCount = 0;
+bool dfInFlight = false;   // Head command sent, waiting for its reply
+uint8_t dfAttempts = 0;
+unsigned long dfSentAt = 0;
+DfEvent dfEvents[DFPLAYER_EVENT_QUEUE_SIZE];
+uint8_t dfEventHead = 0;
+uint8_t dfEventCount = 0;
+bool dfPlayerOnline = false;
+
+// Frame parser state
+uint8_t dfRxFrame[DF_FRAME_SIZE];
+uint8_t dfRxLength = 0;
+
+// Decoded frames, written by the UART callback and read by loop()
+HardwareSerial* dfListenSerial = NULL;
+DfEvent dfRxQueue[DFPLAYER_RX_QUEUE_SIZE];
+volatile uint8_t dfRxHead = 0; // Next slot to read, owned by loop()
+volatile uint8_t dfRxTail = 0; // Next slot to write, owned by the callback
+TaskHandle_t dfNotifyTask = NULL; // Woken when a frame arrives
+
+// Instrumentation
+unsigned long dfCommandsSent = 0;
+unsigned long dfRetries = 0;
+unsigned long dfTimeouts = 0;
+unsigned long dfBadFrames = 0;
+unsigned long dfEventsDropped = 0;
+unsigned long dfRxOverruns = 0;
+volatile unsigned long dfFinishedAt = 0; // micros() of the first "finished" message not yet handled, 0 = none
+unsigned long dfGapStart = 0;            // Finish the queued play command is timed from, 0 = not a track change
+unsigned long dfLastGapMicros = 0;       // Finish message to next play command
+unsigned long dfMaxGapMicros = 0;
+unsigned long dfGapCount = 0;            // Gaps measured, dfLastGapMicros is the latest
+
+// Function declarations
+void dfPlayerBegin(Stream& serial);
+void dfPlayerListen(HardwareSerial& serial);
+void dfPlayerOnReceive();
+void dfPlayerReceive(uint8_t data);
+bool dfPlayerSend(uint8_t command, uint16_t param, DfPlayerCallback callback = NULL);
+bool dfPlayerSendFirst(uint8_t command, uint16_t param, DfPlayerCallback callback = NULL);
+bool dfPlayerQuery(uint8_t command, DfPlayerCallback callback);
+bool dfPlayerReset(DfPlayerCallback callback);
+void dfPlayerService();
+bool dfPlayerReadEvent(DfEvent* event);
+unsigned long dfPlayerNextDeadline();
+bool dfPlayerIdle();
+
+// Checksum over version..paramL
+uint16_t dfChecksum(const uint8_t* frame) {
+  uint16_t sum = 0;
+  for (int i = 1; i < 7; i++) {
+    sum += frame[i];
+  }
+  return 0 - sum;
+}
+
+// Start the driver on an already opened UART
+void dfPlayerBegin(Stream& serial) {
+  dfSerial = &serial;
+  dfQueueHead = 0;
+  dfQueueCount = 0;
+  dfInFlight = false;
+  dfEventCount = 0;
+  dfRxLength = 0;
+  dfRxHead = dfRxTail;
+  dfPlayerOnline = false;
+}
+
+// Decode frames from the UART callback instead of polling
+void dfPlayerListen(HardwareSerial& serial) {
+  dfListenSerial = &serial;
+  serial.setRxFIFOFull(DF_FRAME_SIZE); // Wake once per frame
+  serial.onReceive(dfPlayerOnReceive);
+}
+
+// Add a command to the queue, false if it is full
+// With first set it goes ahead of everything not yet sent.
+bool dfPlayerEnqueue(uint8_t command, uint16_t param, uint8_t reply, uint16_t timeout,
+                     DfPlayerCallback callback, bool first = false) {
+  portENTER_CRITICAL(&dfQueueLock);
+  if (dfQueueCount >= DFPLAYER_QUEUE_SIZE) {
+    portEXIT_CRITICAL(&dfQueueLock);
+    Serial.println("DFPlayer queue full");
+    return false;
+  }
+  DfCommand& entry = dfQueue[(dfQueueHead + dfQueueCount) % DFPLAYER_QUEUE_SIZE];
+  entry.command = command;
+  entry.param = param;
+  entry.reply = reply;
+  entry.timeout = timeout;
+  entry.callback = callback;
+  dfQueueCount++;
+  
+  if (first) {
+    // Rotate the new entry back to the front, behind the one in flight
+    uint8_t front = dfInFlight ? 1 : 0;
+    for (uint8_t i = dfQueueCount - 1; i > front; i--) {
+      DfCommand& later = dfQueue[(dfQueueHead + i) % DFPLAYER_QUEUE_SIZE];
+      DfCommand& earlier = dfQueue[(dfQueueHead + i - 1) % DFPLAYER_QUEUE_SIZE];
+      DfCommand swap = later;
+      later = earlier;
+      earlier = swap;
+    }
+  }
+  portEXIT_CRITICAL(&dfQueueLock);
+  
+  // The servicing task may be blocked with nothing to time out
+  if (dfNotifyTask != NULL) {
+    xTaskNotifyGive(dfNotifyTask);
+  }
+  return true;
+}
+
+// Queue a command that completes on the player's ACK
+bool dfPlayerSend(uint8_t command, uint16_t param, DfPlayerCallback callback) {
+  return dfPlayerEnqueue(command, param, DF_MSG_ACK, DFPLAYER_TIMEOUT_MS, callback);
+}
+
+// Queue a command ahead of everything not yet sent
+bool dfPlayerSendFirst(uint8_t command, uint16_t param, DfPlayerCallback callback) {
+  return dfPlayerEnqueue(command, param, DF_MSG_ACK, DFPLAYER_TIMEOUT_MS, callback, true);
+}
+
+// Queue a query, the callback receives the reply parameter
+bool dfPlayerQuery(uint8_t command, DfPlayerCallback callback) {
+  return dfPlayerEnqueue(command, 0, command, DFPLAYER_TIMEOUT_MS, callback);
+}
+
+// Queue a module reset, completes when the player reports it is ready
+bool dfPlayerReset(DfPlayerCallback callback) {
+  return dfPlayerEnqueue(DF_CMD_RESET, 0, DF_MSG_READY, DFPLAYER_RESET_TIMEOUT_MS, callback);
+}
+
+// Send the command at the head of the queue
+void dfPlayerTransmit() {
+  portENTER_CRITICAL(&dfQueueLock);
+  DfCommand entry = dfQueue[dfQueueHead];
+  dfInFlight = true;
+  portEXIT_CRITICAL(&dfQueueLock);
+  
+  uint8_t frame[DF_FRAME_SIZE] = {
+    DF_FRAME_START, DF_FRAME_VERSION, DF_FRAME_LENGTH, entry.command, 1,
+    (uint8_t)(entry.param >> 8), (uint8_t)entry.param, 0, 0, DF_FRAME_END
+  };
+  uint16_t sum = dfChecksum(frame);
+  frame[7] = sum >> 8;
+  frame[8] = sum;
+  
+  dfSerial->write(frame, DF_FRAME_SIZE);
+  
+  // Silence between tracks, from the finish message to the next play
+  if (entry.command == DF_CMD_PLAY_TRACK && dfGapStart != 0) {
+    dfLastGapMicros = micros() - dfGapStart;
+    if (dfLastGapMicros > dfMaxGapMicros) {
+      dfMaxGapMicros = dfLastGapMicros;
+    }
+    dfGapStart = 0;
+    dfGapCount++;
+  }
+  dfAttempts++;
+  dfSentAt = millis();
+  dfCommandsSent++;
+}
+
+// Finish the command in flight and report the result
+void dfPlayerComplete(bool ok, uint16_t value) {
+  portENTER_CRITICAL(&dfQueueLock);
+  DfCommand entry = dfQueue[dfQueueHead];
+  dfQueueHead = (dfQueueHead + 1) % DFPLAYER_QUEUE_SIZE;
+  dfQueueCount--;
+  dfInFlight = false;
+  portEXIT_CRITICAL(&dfQueueLock);
+  dfAttempts = 0;
+  
+  if (entry.command == DF_CMD_RESET) {
+    dfPlayerOnline = ok;
+  }
+  if (!ok) {
+    Serial.print("DFPlayer command 0x");
+    Serial.print(entry.command, HEX);
+    Serial.println(" failed");
+  }
+  if (entry.callback != NULL) {
+    entry.callback(entry.command, ok, value);
+  }
+}
+
+// Keep a message nobody was waiting for
+void dfPlayerPushEvent(uint8_t type, uint16_t value) {
+  if (dfEventCount >= DFPLAYER_EVENT_QUEUE_SIZE) {
+    dfEventsDropped++;
+    return;
+  }
+  DfEvent& event = dfEvents[(dfEventHead + dfEventCount) % DFPLAYER_EVENT_QUEUE_SIZE];
+  event.type = type;
+  event.value = value;
+  dfEventCount++;
+}
+
+// Handle one complete, valid frame
+void dfPlayerHandleFrame(uint8_t type, uint16_t value) {
+  if (dfInFlight) {
+    const DfCommand& entry = dfQueue[dfQueueHead];
+    if (type == entry.reply) {
+      dfPlayerComplete(true, value);
+      return;
+    }
+    if (type == DF_MSG_ERROR) {
+      // Busy means "try again", anything else fails the command
+      if (value == DF_ERROR_BUSY && dfAttempts <= DFPLAYER_RETRIES) {
+        dfInFlight = false;
+        dfRetries++;
+      } else {
+        dfPlayerComplete(false, value);
+      }
+      return;
+    }
+    if (type == DF_MSG_ACK) {
+      return; // Queries are ACKed before the reply arrives
+    }
+  }
+  
+  if (type == DF_MSG_READY) {
+    dfPlayerOnline = true;
+  }
+  dfPlayerPushEvent(type, value);
+}
+
+// Hand a decoded frame to dfPlayerService()
+void dfPlayerQueueFrame(uint8_t type, uint16_t value) {
+  uint8_t next = (dfRxTail + 1) % DFPLAYER_RX_QUEUE_SIZE;
+  if (next == dfRxHead) {
+    dfRxOverruns++;
+    return;
+  }
+  if (type == DF_MSG_PLAY_FINISHED && dfFinishedAt == 0) {
+    dfFinishedAt = micros(); // Repeats of the same finish don't move it
+  }
+  dfRxQueue[dfRxTail].type = type;
+  dfRxQueue[dfRxTail].value = value;
+  dfRxTail = next;
+}
+
+// Drop a rejected frame's start byte and parse the bytes after it again,
+// a frame that began inside it (after a stray 7E or a cut-off frame) is
+// still found
+void dfPlayerResync() {
+  dfBadFrames++;
+  uint8_t length = dfRxLength;
+  dfRxLength = 0;
+  for (uint8_t i = 1; i < length; i++) {
+    dfPlayerReceive(dfRxFrame[i]); // Writes below i, so this is safe in place
+  }
+}
+
+// Feed one received byte to the frame parser
+void dfPlayerReceive(uint8_t data) {
+  // Resynchronise on the start byte
+  if (dfRxLength == 0 && data != DF_FRAME_START) {
+    return;
+  }
+  dfRxFrame[dfRxLength++] = data;
+  
+  if ((dfRxLength == 2 && data != DF_FRAME_VERSION) ||
+      (dfRxLength == 3 && data != DF_FRAME_LENGTH)) {
+    dfPlayerResync();
+    return;
+  }
+  if (dfRxLength < DF_FRAME_SIZE) {
+    return;
+  }
+  
+  uint16_t sum = ((uint16_t)dfRxFrame[7] << 8) | dfRxFrame[8];
+  if (dfRxFrame[9] != DF_FRAME_END || sum != dfChecksum(dfRxFrame)) {
+    dfPlayerResync();
+    return;
+  }
+  dfRxLength = 0;
+  dfPlayerQueueFrame(dfRxFrame[3], ((uint16_t)dfRxFrame[5] << 8) | dfRxFrame[6]);
+}
+
+// UART receive callback, runs in the UART event task
+void dfPlayerOnReceive() {
+  while (dfListenSerial->available() > 0) {
+    dfPlayerReceive(dfListenSerial->read());
+  }
+  if (dfNotifyTask != NULL && dfRxHead != dfRxTail) {
+    xTaskNotifyGive(dfNotifyTask);
+  }
+}
+
+// Read replies, time out and retry, and send the next command
+void dfPlayerService() {
+  if (dfSerial == NULL) {
+    return;
+  }
+  
+  // Without a receive callback the bytes are parsed here
+  if (dfListenSerial == NULL) {
+    while (dfSerial->available() > 0) {
+      dfPlayerReceive(dfSerial->read());
+    }
+  }
+  
+  // Handle every frame that arrived since the last call
+  while (dfRxHead != dfRxTail) {
+    DfEvent frame = dfRxQueue[dfRxHead];
+    dfRxHead = (dfRxHead + 1) % DFPLAYER_RX_QUEUE_SIZE;
+    dfPlayerHandleFrame(frame.type, frame.value);
+  }
+  
+  if (dfInFlight && millis() - dfSentAt >= dfQueue[dfQueueHead].timeout) {
+    dfTimeouts++;
+    if (dfAttempts <= DFPLAYER_RETRIES) {
+      dfInFlight = false;
+      dfRetries++;
+    } else {
+      dfPlayerComplete(false, 0);
+    }
+  }
+  
+  if (!dfInFlight && dfQueueCount > 0) {
+    dfPlayerTransmit();
+  }
+}
+
+// Take the oldest unsolicited message, false if there is none
+bool dfPlayerReadEvent(DfEvent* event) {
+  if (dfEventCount == 0) {
+    return false;
+  }
+  *event = dfEvents[dfEventHead];
+  dfEventHead = (dfEventHead + 1) % DFPLAYER_EVENT_QUEUE_SIZE;
+  dfEventCount--;
+  return true;
+}
+
+// Milliseconds until dfPlayerService() has work, NO_DEADLINE if it only
+// waits for the player (arriving frames notify dfNotifyTask)
+unsigned long dfPlayerNextDeadline() {
+  if (dfSerial == NULL) {
+    return NO_DEADLINE;
+  }
+  if (dfRxHead != dfRxTail || dfEventCount > 0) {
+    return 0;
+  }
+  
+  portENTER_CRITICAL(&dfQueueLock);
+  bool inFlight = dfInFlight;
+  uint8_t count = dfQueueCount;
+  uint16_t timeout = dfQueue[dfQueueHead].timeout;
+  portEXIT_CRITICAL(&dfQueueLock);
+  
+  if (inFlight) {
+    long left = (long)(dfSentAt + timeout - millis());
+    return left > 0 ? left : 0;
+  }
+  if (count > 0) {
+    return 0;
+  }
+  return dfListenSerial == NULL ? DF_POLL_MS : NO_DEADLINE;
+}
+
+// True when nothing is queued, in flight or waiting to be handled
+bool dfPlayerIdle() {
+  return dfQueueCount == 0 && !dfInFlight && dfRxHead == dfRxTail && dfEventCount == 0;
+}
+
+#endif // DFPLAYER_H
\ No newline at end of file
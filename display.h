@@ -7,6 +7,13 @@
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 #include "config.h"
+#include "playerState.h"
+#include "browse.h"
+
+// External references
+extern bool governorBoost();
+extern void governorRelease(bool boosted);
+extern void recordTaskWork(unsigned long startMicros);
 
 // Create the OLED display object
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
@@ -17,21 +24,71 @@ enum DisplayState {
   DISPLAY_NOW_PLAYING,
   DISPLAY_MENU,
   DISPLAY_VOLUME,
-  DISPLAY_BATTERY_LOW
+  DISPLAY_BATTERY_LOW,
+  DISPLAY_BROWSE
 };
 
 DisplayState currentDisplayState = DISPLAY_WELCOME;
+bool displayPowered = false; // Panel initialized and switched on
 unsigned long lastDisplayUpdate = 0;
 unsigned long displayTimeout = 3000; // Time to show temporary screens (like volume)
 
-// Track information
-String currentTrackName = "";
-String currentArtistName = "";
-int currentTrackNumber = 0;
-int totalTracks = 0;
-int currentVolume = DEFAULT_VOLUME;
-int batteryPercentage = 100;
-bool isPlaying = false;
+// Dirty-page flush state
+// The SSD1306 stores the frame as 8-row pages. Rendering draws into the
+// Adafruit buffer (back buffer). A flush copies the changed column span of
+// each page into panelFrame (front buffer) and hands it to a background task
+// that does the I2C transfer, so the caller never waits on the bus.
+#define DISPLAY_PAGE_COUNT (SCREEN_HEIGHT / 8)
+#define DISPLAY_I2C_CHUNK 64 // Data bytes per I2C transaction
+#define DISPLAY_FLUSH_TASK_STACK 2048
+#define DISPLAY_FLUSH_TASK_PRIORITY 1
+#define DISPLAY_FLUSH_TASK_CORE 0 // loop() runs on core 1
+
+uint8_t panelFrame[DISPLAY_PAGE_COUNT * SCREEN_WIDTH];
+int16_t pageSpanFirst[DISPLAY_PAGE_COUNT]; // First changed column per page, -1 if clean
+int16_t pageSpanLast[DISPLAY_PAGE_COUNT];  // Last changed column per page
+bool panelFrameValid = false;             // False until a full frame has been sent
+volatile bool displayFlushBusy = false;   // Front buffer owned by the flush task
+TaskHandle_t displayFlushTaskHandle = NULL;
+unsigned long displayBytesLastFlush = 0;  // I2C bytes sent by the last flush
+unsigned long displayBytesTotal = 0;      // I2C bytes sent since boot
+uint8_t displayPagesLastFlush = 0;        // Pages sent by the last flush
+unsigned long displayFlushMicros = 0;     // Bus time of the last flush
+
+// Render scheduling
+// Player state changes mark the view dirty; updateDisplay() only redraws a
+// dirty view and never more often than DISPLAY_MAX_FPS, so bursts of changes
+// share a frame.
+bool displayDirty = true;
+unsigned long lastFrameTime = 0;
+unsigned long framesRendered = 0; // Frames actually drawn
+unsigned long framesSkipped = 0;  // updateDisplay() calls that drew nothing
+
+// Marquee scrolling for names wider than the screen
+// Each marquee draws straight from its text buffer at a pixel offset, so
+// scrolling never builds a String.
+#define DISPLAY_CHAR_WIDTH 6 // 5px glyph + 1px spacing at text size 1
+#define MARQUEE_STEP_PX 2
+#define MARQUEE_GAP_PX 30    // Blank space before the text repeats
+#define TITLE_ROW_Y 16
+#define ARTIST_ROW_Y 26
+#define RUNTIME_ROW_Y 8 // Under the status bar
+
+struct Marquee {
+  const char* text;
+  int16_t textWidth;       // Rendered width in pixels
+  int16_t offset;          // Current scroll offset in pixels
+  unsigned long holdUntil; // Don't scroll before this time
+};
+
+Marquee titleMarquee;
+Marquee artistMarquee;
+unsigned long lastMarqueeStep = 0;
+bool marqueeDirty = false; // Only the text rows need redrawing
+
+// Snapshot of the player state being shown, the marquees point into it
+PlayerState shownState;
+uint32_t shownBrowseVersion = 0; // Artist browser change last drawn
 
 // Add these function declarations after the variable declarations 
 // but before any function definitions in display.h
@@ -42,13 +99,19 @@ void displayNowPlaying();
 void displayMenu();
 void displayVolume();
 void displayBatteryLow();
+void displayBrowse();
 void updateDisplay();
-void setTrackInfo(String trackName, String artistName, int trackNum, int total);
-void setPlayingStatus(bool playing);
-void setVolume(int volume);
-void setBatteryPercentage(int percentage);
+unsigned long displayNextDeadline();
+void syncPlayerState();
+void syncBrowser();
 void showMenu();
 void showNowPlaying();
+bool flushDisplay();
+void sendDisplayFrame();
+void displayFlushTask(void* param);
+void resetMarquee(Marquee& marquee, const char* text);
+void drawMarquee(const Marquee& marquee, int y);
+void tickMarquee(unsigned long now);
 
 // Initialize the display
 void initDisplay() {
@@ -57,11 +120,27 @@ void initDisplay() {
     Serial.println(F("SSD1306 allocation failed"));
     for(;;); // Don't proceed, loop forever
   }
+  displayPowered = true;
   
   // Clear the buffer
   display.clearDisplay();
   display.setTextColor(SSD1306_WHITE);
   display.cp437(true); // Use full 256 char 'Code Page 437' font
+  display.setTextWrap(false); // Marquee text runs off the edges
+  
+  readPlayerState(&shownState, 0);
+  resetMarquee(titleMarquee, shownState.title);
+  resetMarquee(artistMarquee, shownState.artist);
+  
+  // Run the bus as fast as the panel allows, the transfer happens off-loop
+  Wire.setClock(DISPLAY_I2C_CLOCK);
+  
+  // Panel RAM contents are unknown after power-up, force a full first frame
+  panelFrameValid = false;
+  
+  xTaskCreatePinnedToCore(displayFlushTask, "displayFlush", DISPLAY_FLUSH_TASK_STACK,
+                          NULL, DISPLAY_FLUSH_TASK_PRIORITY, &displayFlushTaskHandle,
+                          DISPLAY_FLUSH_TASK_CORE);
   
   if (DEBUG) {
     Serial.println("Display initialized");
@@ -85,22 +164,62 @@ void displayWelcomeScreen() {
   display.print(F("v"));
   display.println(FIRMWARE_VERSION);
   
-  display.display();
+  // The flush task may still be sending an earlier frame, updateDisplay()
+  // draws the splash again once the bus is free
   currentDisplayState = DISPLAY_WELCOME;
+  if (!flushDisplay()) {
+    displayDirty = true;
+  }
 }
 
 // Update the display based on current state
 void updateDisplay() {
+  unsigned long now = millis();
+  
+  syncPlayerState();
+  syncBrowser();
+  
   // Check if we need to transition from temporary displays
   if ((currentDisplayState == DISPLAY_VOLUME || currentDisplayState == DISPLAY_BATTERY_LOW) && 
-      (millis() - lastDisplayUpdate > displayTimeout)) {
+      (now - lastDisplayUpdate > displayTimeout)) {
+    currentDisplayState = DISPLAY_NOW_PLAYING;
+    displayDirty = true;
+  }
+  if (currentDisplayState == DISPLAY_BROWSE && !browserOpen(now)) {
     currentDisplayState = DISPLAY_NOW_PLAYING;
+    displayDirty = true;
   }
   
+  tickMarquee(now);
+  
+  // Nothing changed, the last frame was too recent to draw another,
+  // or the previous frame is still on the bus
+  if (!(displayDirty || marqueeDirty) || (now - lastFrameTime < 1000 / DISPLAY_MAX_FPS) || displayFlushBusy) {
+    framesSkipped++;
+    return;
+  }
+  
+  lastFrameTime = now;
+  framesRendered++;
+  
+  // A scroll step alone only touches the text rows
+  if (!displayDirty) {
+    marqueeDirty = false;
+    display.fillRect(0, TITLE_ROW_Y, SCREEN_WIDTH, ARTIST_ROW_Y + 8 - TITLE_ROW_Y, SSD1306_BLACK);
+    drawMarquee(titleMarquee, TITLE_ROW_Y);
+    drawMarquee(artistMarquee, ARTIST_ROW_Y);
+    flushDisplay();
+    return;
+  }
+  
+  displayDirty = false;
+  marqueeDirty = false;
+  
   // Update display based on state
   switch (currentDisplayState) {
     case DISPLAY_WELCOME:
-      // Already handled in displayWelcomeScreen()
+      // Again, in case displayWelcomeScreen() could not flush it
+      displayWelcomeScreen();
       break;
       
     case DISPLAY_NOW_PLAYING:
@@ -118,7 +237,61 @@ void updateDisplay() {
     case DISPLAY_BATTERY_LOW:
       displayBatteryLow();
       break;
+      
+    case DISPLAY_BROWSE:
+      displayBrowse();
+      break;
+  }
+}
+
+// Milliseconds until updateDisplay() has work, NO_DEADLINE if nothing is
+// scheduled. Player state changes wake the UI task on their own.
+unsigned long displayNextDeadline() {
+  unsigned long now = millis();
+  unsigned long deadline = NO_DEADLINE;
+  
+  // Next frame slot, or poll for the bus while the last frame is sent
+  if (displayDirty || marqueeDirty) {
+    long left = (long)(lastFrameTime + 1000 / DISPLAY_MAX_FPS - now);
+    deadline = left > 0 ? left : (displayFlushBusy ? 1 : 0);
+  }
+  
+  // Temporary screen ending
+  if (currentDisplayState == DISPLAY_VOLUME || currentDisplayState == DISPLAY_BATTERY_LOW) {
+    long left = (long)(lastDisplayUpdate + displayTimeout - now) + 1;
+    unsigned long timeout = left > 0 ? left : 0;
+    if (timeout < deadline) {
+      deadline = timeout;
+    }
+  }
+  if (currentDisplayState == DISPLAY_BROWSE) {
+    long left = (long)(browseLastInput + BROWSE_TIMEOUT_MS - now) + 1;
+    unsigned long timeout = left > 0 ? left : 0;
+    if (timeout < deadline) {
+      deadline = timeout;
+    }
+  }
+  
+  // Next scroll step of a marquee that moves
+  if (currentDisplayState == DISPLAY_NOW_PLAYING) {
+    const Marquee* marquees[2] = { &titleMarquee, &artistMarquee };
+    for (int i = 0; i < 2; i++) {
+      if (marquees[i]->textWidth <= SCREEN_WIDTH) {
+        continue;
+      }
+      unsigned long due = lastMarqueeStep + MARQUEE_STEP_MS;
+      if ((long)(marquees[i]->holdUntil - due) > 0) {
+        due = marquees[i]->holdUntil;
+      }
+      long left = (long)(due - now);
+      unsigned long step = left > 0 ? left : 0;
+      if (step < deadline) {
+        deadline = step;
+      }
+    }
   }
+  
+  return deadline;
 }
 
 // Display now playing screen
@@ -129,37 +302,37 @@ void displayNowPlaying() {
   display.setTextSize(1);
   display.setCursor(0, 0);
   display.print(F("Track: "));
-  display.print(currentTrackNumber);
+  display.print(shownState.track);
   display.print(F("/"));
-  display.print(totalTracks);
+  display.print(shownState.totalTracks);
   
   // Battery indicator on the right
   display.setCursor(98, 0);
   display.print(F("Bat:"));
-  display.print(batteryPercentage);
+  display.print(shownState.battery);
   display.print(F("%"));
   
-  // Track info - truncate if too long
-  display.setCursor(0, 16);
-  display.setTextSize(1);
-  String trackDisplay = currentTrackName;
-  if (trackDisplay.length() > 21) {
-    trackDisplay = trackDisplay.substring(0, 18) + "...";
-  }
-  display.println(trackDisplay);
+  // Track and artist info, scrolled if too long
+  drawMarquee(titleMarquee, TITLE_ROW_Y);
+  drawMarquee(artistMarquee, ARTIST_ROW_Y);
   
-  // Artist info
-  display.setCursor(0, 26);
-  String artistDisplay = currentArtistName;
-  if (artistDisplay.length() > 21) {
-    artistDisplay = artistDisplay.substring(0, 18) + "...";
+  // Estimated battery time left
+  if (shownState.runtimeMinutes >= 0) {
+    display.setCursor(0, RUNTIME_ROW_Y);
+    display.print(F("Left: "));
+    display.print(shownState.runtimeMinutes / 60);
+    display.print(F("h"));
+    if (shownState.runtimeMinutes % 60 < 10) {
+      display.print(F("0"));
+    }
+    display.print(shownState.runtimeMinutes % 60);
+    display.print(F("m"));
   }
-  display.println(artistDisplay);
   
   // Play/pause status
   display.setCursor(0, 40);
   display.setTextSize(2);
-  if (isPlaying) {
+  if (shownState.playing) {
     display.println(F("Playing"));
   } else {
     display.println(F("Paused"));
@@ -171,11 +344,11 @@ void displayNowPlaying() {
   display.print(F("Vol: "));
   
   // Draw simple volume bar
-  int barWidth = map(currentVolume, 0, MAX_VOLUME, 0, 70);
+  int barWidth = map(shownState.volume, 0, MAX_VOLUME, 0, 70);
   display.drawRect(30, 56, 70, 8, SSD1306_WHITE);
   display.fillRect(30, 56, barWidth, 8, SSD1306_WHITE);
 
-  display.display();
+  flushDisplay();
 }
 
 // Display menu screen
@@ -199,7 +372,7 @@ void displayMenu() {
   display.setCursor(0, 15);
   display.print(F(">"));  // Cursor indicator
   
-  display.display();
+  flushDisplay();
 }
 
 // Display volume change screen
@@ -212,15 +385,52 @@ void displayVolume() {
   // Display numeric volume
   display.setTextSize(2);
   display.setCursor(48, 25);
-  display.print(currentVolume);
+  display.print(shownState.volume);
   
   // Draw volume bar
   display.drawRect(14, 48, 100, 10, SSD1306_WHITE);
-  int barWidth = map(currentVolume, 0, MAX_VOLUME, 0, 100);
+  int barWidth = map(shownState.volume, 0, MAX_VOLUME, 0, 100);
   display.fillRect(14, 48, barWidth, 10, SSD1306_WHITE);
   
-  display.display();
-  lastDisplayUpdate = millis();
+  flushDisplay();
+}
+
+// Display the artist browser: the selected artist, the ones after it and
+// the selected artist's track count
+void displayBrowse() {
+  int position = browsePosition;
+  if (getSortedTrack(SORT_BY_ARTIST, position) < 0) {
+    // The index went away under the browser
+    currentDisplayState = DISPLAY_NOW_PLAYING;
+    displayNowPlaying();
+    return;
+  }
+  
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setCursor(0, 0);
+  display.print(F("ARTISTS"));
+  char letter[2] = { browseLetterOf(position), '\0' };
+  display.setCursor(SCREEN_WIDTH - DISPLAY_CHAR_WIDTH, 0);
+  display.print(letter);
+  display.drawLine(0, 10, 128, 10, SSD1306_WHITE);
+  
+  // One row per artist, each next one is a binary search away
+  int row = position;
+  for (int i = 0; i < BROWSE_ROWS && row >= 0; i++) {
+    const char* artist = sortedKeyAt(SORT_BY_ARTIST, row);
+    display.setCursor(8, 14 + i * 10);
+    display.print(artist[0] != '\0' ? artist : "(no artist)");
+    row = nextSortedGroup(SORT_BY_ARTIST, row);
+  }
+  display.setCursor(0, 14);
+  display.print(F(">"));  // Cursor indicator
+  
+  display.setCursor(0, 56);
+  display.print(browseArtistTracks(position));
+  display.print(F(" tracks"));
+  
+  flushDisplay();
 }
 
 // Display low battery warning
@@ -237,56 +447,230 @@ void displayBatteryLow() {
   display.drawRect(96, 53, 6, 8, SSD1306_WHITE);
   
   // Fill battery based on percentage
-  int fillWidth = map(batteryPercentage, 0, 100, 0, 64);
+  int fillWidth = map(shownState.battery, 0, 100, 0, 64);
   display.fillRect(32, 50, fillWidth, 14, SSD1306_WHITE);
   
-  display.display();
-  lastDisplayUpdate = millis();
+  flushDisplay();
 }
 
-// Set current track info
-void setTrackInfo(String trackName, String artistName, int trackNum, int total) {
-  currentTrackName = trackName;
-  currentArtistName = artistName;
-  currentTrackNumber = trackNum;
-  totalTracks = total;
+// Take the latest player state and react to what changed
+void syncPlayerState() {
+  uint32_t changed = readPlayerState(&shownState, shownState.version);
+  if (changed == 0) {
+    return;
+  }
+  displayDirty = true;
   
-  // Update display next time updateDisplay is called
-  currentDisplayState = DISPLAY_NOW_PLAYING;
-}
-
-// Set playing status
-void setPlayingStatus(bool playing) {
-  isPlaying = playing;
-  // Update display next time updateDisplay is called
-}
-
-// Set volume and show volume screen
-void setVolume(int volume) {
-  currentVolume = volume;
-  currentDisplayState = DISPLAY_VOLUME;
-  lastDisplayUpdate = millis();
-}
-
-// Set battery percentage and show warning if low
-void setBatteryPercentage(int percentage) {
-  batteryPercentage = percentage;
+  // New names restart the scroll
+  if (PLAYER_CHANGED(changed, PLAYER_FIELD_NAMES)) {
+    resetMarquee(titleMarquee, shownState.title);
+    resetMarquee(artistMarquee, shownState.artist);
+  }
+  // The browser stays up while tracks change under it
+  if ((PLAYER_CHANGED(changed, PLAYER_FIELD_TRACK) || PLAYER_CHANGED(changed, PLAYER_FIELD_NAMES)) &&
+      currentDisplayState != DISPLAY_BROWSE) {
+    currentDisplayState = DISPLAY_NOW_PLAYING;
+  }
   
-  // Show warning if battery is low
-  if (percentage <= 15) {
+  // Volume changes show the volume screen for a while
+  if (PLAYER_CHANGED(changed, PLAYER_FIELD_VOLUME)) {
+    currentDisplayState = DISPLAY_VOLUME;
+    lastDisplayUpdate = millis();
+  }
+  
+  // Show the warning once when the battery turns low, not on every reading
+  if (PLAYER_CHANGED(changed, PLAYER_FIELD_BATTERY_LOW) && shownState.batteryLow) {
     currentDisplayState = DISPLAY_BATTERY_LOW;
     lastDisplayUpdate = millis();
   }
 }
 
+// Follow the artist browser the input task moves
+void syncBrowser() {
+  uint32_t version = browseVersion;
+  if (version == shownBrowseVersion) {
+    return;
+  }
+  shownBrowseVersion = version;
+  currentDisplayState = browseOpen ? DISPLAY_BROWSE : DISPLAY_NOW_PLAYING;
+  displayDirty = true;
+}
+
 // Show menu screen
 void showMenu() {
   currentDisplayState = DISPLAY_MENU;
+  displayDirty = true;
 }
 
 // Return to now playing screen
 void showNowPlaying() {
   currentDisplayState = DISPLAY_NOW_PLAYING;
+  displayDirty = true;
+}
+
+// Point a marquee at new text and rewind it
+void resetMarquee(Marquee& marquee, const char* text) {
+  marquee.text = text;
+  marquee.textWidth = strlen(text) * DISPLAY_CHAR_WIDTH;
+  marquee.offset = 0;
+  marquee.holdUntil = millis() + MARQUEE_HOLD_MS;
+}
+
+// Draw a marquee row, clipped to the screen
+void drawMarquee(const Marquee& marquee, int y) {
+  int16_t period = marquee.textWidth + MARQUEE_GAP_PX;
+  
+  // Draw the text once, plus a trailing copy while it wraps around
+  for (int16_t base = -marquee.offset; base < SCREEN_WIDTH; base += period) {
+    int16_t x = base;
+    for (const char* c = marquee.text; *c && x < SCREEN_WIDTH; c++, x += DISPLAY_CHAR_WIDTH) {
+      if (x > -DISPLAY_CHAR_WIDTH) {
+        display.drawChar(x, y, *c, SSD1306_WHITE, SSD1306_WHITE, 1);
+      }
+    }
+    if (marquee.textWidth <= SCREEN_WIDTH) {
+      break; // Fits on screen, never scrolls
+    }
+  }
+}
+
+// Advance one marquee, returns true if it moved
+bool stepMarquee(Marquee& marquee, unsigned long now) {
+  if (marquee.textWidth <= SCREEN_WIDTH || (long)(now - marquee.holdUntil) < 0) {
+    return false;
+  }
+  
+  marquee.offset += MARQUEE_STEP_PX;
+  if (marquee.offset >= marquee.textWidth + MARQUEE_GAP_PX) {
+    // Back at the start, pause before the next pass
+    marquee.offset = 0;
+    marquee.holdUntil = now + MARQUEE_HOLD_MS;
+  }
+  return true;
+}
+
+// Advance the now-playing marquees on their timer
+void tickMarquee(unsigned long now) {
+  if (currentDisplayState != DISPLAY_NOW_PLAYING || now - lastMarqueeStep < MARQUEE_STEP_MS) {
+    return;
+  }
+  lastMarqueeStep = now;
+  
+  bool titleMoved = stepMarquee(titleMarquee, now);
+  bool artistMoved = stepMarquee(artistMarquee, now);
+  if (titleMoved || artistMoved) {
+    marqueeDirty = true;
+  }
+}
+
+// Send one page (or part of it) to the panel
+void sendDisplayPage(uint8_t page, uint8_t firstCol, uint8_t lastCol, const uint8_t* data) {
+  // Set the page and column window in a single command transaction
+  Wire.beginTransmission(SCREEN_ADDRESS);
+  Wire.write((uint8_t)0x00); // Co = 0, D/C = 0: command stream
+  Wire.write((uint8_t)SSD1306_PAGEADDR);
+  Wire.write(page);
+  Wire.write(page);
+  Wire.write((uint8_t)SSD1306_COLUMNADDR);
+  Wire.write(firstCol);
+  Wire.write(lastCol);
+  Wire.endTransmission();
+  displayBytesLastFlush += 7;
+  
+  // Stream the column data in chunks that fit the Wire buffer
+  int remaining = lastCol - firstCol + 1;
+  const uint8_t* src = data + firstCol;
+  while (remaining > 0) {
+    int chunk = remaining > DISPLAY_I2C_CHUNK ? DISPLAY_I2C_CHUNK : remaining;
+    Wire.beginTransmission(SCREEN_ADDRESS);
+    Wire.write((uint8_t)0x40); // Co = 0, D/C = 1: data stream
+    Wire.write(src, chunk);
+    Wire.endTransmission();
+    displayBytesLastFlush += chunk + 1;
+    src += chunk;
+    remaining -= chunk;
+  }
+}
+
+// Hand the changed parts of the framebuffer to the flush task
+// Returns immediately. Returns false if the previous frame is still being
+// sent; callers going through updateDisplay() never hit that case.
+bool flushDisplay() {
+  if (displayFlushBusy) {
+    return false;
+  }
+  
+  uint8_t* frame = display.getBuffer();
+  bool anyChanged = false;
+  
+  for (uint8_t page = 0; page < DISPLAY_PAGE_COUNT; page++) {
+    uint8_t* src = frame + page * SCREEN_WIDTH;
+    uint8_t* shown = panelFrame + page * SCREEN_WIDTH;
+    pageSpanFirst[page] = -1;
+    
+    // Find the changed column span within this page
+    int firstCol = 0;
+    int lastCol = SCREEN_WIDTH - 1;
+    if (panelFrameValid) {
+      while (firstCol < SCREEN_WIDTH && src[firstCol] == shown[firstCol]) {
+        firstCol++;
+      }
+      if (firstCol == SCREEN_WIDTH) {
+        continue; // Page unchanged
+      }
+      while (src[lastCol] == shown[lastCol]) {
+        lastCol--;
+      }
+    }
+    
+    memcpy(shown + firstCol, src + firstCol, lastCol - firstCol + 1);
+    pageSpanFirst[page] = firstCol;
+    pageSpanLast[page] = lastCol;
+    anyChanged = true;
+  }
+  
+  panelFrameValid = true;
+  if (!anyChanged) {
+    displayBytesLastFlush = 0;
+    displayPagesLastFlush = 0;
+    return true;
+  }
+  
+  displayFlushBusy = true;
+  xTaskNotifyGive(displayFlushTaskHandle);
+  return true;
+}
+
+// Send the page spans flushDisplay() handed over and free the front buffer
+void sendDisplayFrame() {
+  // I2C timing follows the APB clock, keep it up for the transfer
+  bool boosted = governorBoost();
+  unsigned long start = micros();
+  displayBytesLastFlush = 0;
+  displayPagesLastFlush = 0;
+  
+  for (uint8_t page = 0; page < DISPLAY_PAGE_COUNT; page++) {
+    if (pageSpanFirst[page] < 0) {
+      continue;
+    }
+    sendDisplayPage(page, pageSpanFirst[page], pageSpanLast[page],
+                    panelFrame + page * SCREEN_WIDTH);
+    displayPagesLastFlush++;
+  }
+  
+  displayFlushMicros = micros() - start;
+  displayBytesTotal += displayBytesLastFlush;
+  displayFlushBusy = false;
+  recordTaskWork(start);
+  governorRelease(boosted);
+}
+
+// Background task that sends the front buffer to the panel
+void displayFlushTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    sendDisplayFrame();
+  }
 }
 
 #endif // DISPLAY_H
\ No newline at end of file
@@ -0,0 +1,216 @@
+// ESP32 Soundpod - Energy Accounting
+// Splits uptime by what draws current: power state, CPU clock, display,
+// playback and volume. A per-component current model turns the same
+// intervals into charge used, which gives the playing time left.
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "playerState.h"
+
+// External references
+extern bool displayPowered;
+
+// Power states that are accounted separately
+enum EnergyPowerState {
+  ENERGY_ACTIVE,
+  ENERGY_LOW_POWER,
+  ENERGY_LIGHT_SLEEP,
+  ENERGY_STATE_COUNT
+};
+
+// CPU clocks with their own residency counter, anything else counts as the next lower one
+const uint16_t energyCpuSteps[] = { 240, 160, 80, 40 };
+#define ENERGY_CPU_STEPS (sizeof(energyCpuSteps) / sizeof(energyCpuSteps[0]))
+#define ENERGY_VOLUME_BANDS 4 // Playback volume 0-30 split into four bands
+
+// Counter names in the exported stats
+const char* const energyStateNames[ENERGY_STATE_COUNT] = {
+  "active_ms", "low_power_ms", "light_sleep_ms"
+};
+const char* const energyCpuNames[ENERGY_CPU_STEPS] = {
+  "cpu_240mhz_ms", "cpu_160mhz_ms", "cpu_80mhz_ms", "cpu_40mhz_ms"
+};
+const char* const energyVolumeNames[ENERGY_VOLUME_BANDS] = {
+  "volume_band0_ms", "volume_band1_ms", "volume_band2_ms", "volume_band3_ms"
+};
+
+// What was drawing current during an interval
+struct EnergySnapshot {
+  uint8_t powerState;
+  uint16_t cpuMhz;
+  bool displayOn;
+  bool playing;
+  uint8_t volume;
+};
+
+// Residency since boot, in milliseconds
+unsigned long energyStateMillis[ENERGY_STATE_COUNT];
+unsigned long energyCpuMillis[ENERGY_CPU_STEPS]; // Awake time only
+unsigned long energyDisplayOnMillis = 0;
+unsigned long energyPlayingMillis = 0;
+unsigned long energyVolumeMillis[ENERGY_VOLUME_BANDS]; // Playing time per volume band
+uint64_t energyChargeMicroAmpMs = 0; // Modelled charge used since boot
+
+// Accounting state, updated from several tasks
+portMUX_TYPE energyLock = portMUX_INITIALIZER_UNLOCKED;
+EnergySnapshot energyCurrent = { ENERGY_ACTIVE, CPU_FREQ_MHZ_ACTIVE, false, false, DEFAULT_VOLUME };
+uint8_t energyAwakeState = ENERGY_ACTIVE; // State to return to after light sleep
+unsigned long energyLastAccounted = 0;
+
+// Runtime estimate
+int32_t energyAverageMicroAmps = 0; // Filtered draw over recent estimate windows
+uint64_t energyChargeAtEstimate = 0;
+unsigned long energyLastEstimate = 0;
+
+// Function declarations
+void accountEnergy();
+void setEnergyPowerState(EnergyPowerState state);
+void energyEnterSleep();
+void energyLeaveSleep();
+int32_t modelCurrentMicroAmps(const EnergySnapshot& snapshot);
+int updateRuntimeEstimate(int batteryPercent);
+void printEnergyStats();
+
+// Modelled supply current for one combination of states
+int32_t modelCurrentMicroAmps(const EnergySnapshot& snapshot) {
+  int32_t current = POWER_MODEL_BASE_UA;
+  if (snapshot.powerState == ENERGY_LIGHT_SLEEP) {
+    current += POWER_MODEL_LIGHT_SLEEP_UA;
+  } else {
+    current += POWER_MODEL_CPU_BASE_UA + POWER_MODEL_CPU_UA_PER_MHZ * snapshot.cpuMhz;
+  }
+  if (snapshot.displayOn) {
+    current += POWER_MODEL_DISPLAY_UA;
+  }
+  if (snapshot.playing) {
+    current += POWER_MODEL_PLAYING_UA + POWER_MODEL_PER_VOLUME_UA * snapshot.volume;
+  }
+  return current;
+}
+
+// Charge the time since the last call to what was drawing current then,
+// and take the current state for the next interval
+void accountEnergy() {
+  PlayerState state;
+  readPlayerState(&state, 0);
+  uint16_t cpuMhz = getCpuFrequencyMhz();
+  
+  portENTER_CRITICAL(&energyLock);
+  unsigned long now = millis();
+  unsigned long elapsed = now - energyLastAccounted;
+  energyLastAccounted = now;
+  
+  const EnergySnapshot& last = energyCurrent;
+  energyStateMillis[last.powerState] += elapsed;
+  if (last.powerState != ENERGY_LIGHT_SLEEP) {
+    size_t step = 0;
+    while (step < ENERGY_CPU_STEPS - 1 && last.cpuMhz < energyCpuSteps[step]) {
+      step++;
+    }
+    energyCpuMillis[step] += elapsed;
+  }
+  if (last.displayOn) {
+    energyDisplayOnMillis += elapsed;
+  }
+  if (last.playing) {
+    energyPlayingMillis += elapsed;
+    energyVolumeMillis[last.volume * ENERGY_VOLUME_BANDS / (MAX_VOLUME + 1)] += elapsed;
+  }
+  energyChargeMicroAmpMs += (uint64_t)modelCurrentMicroAmps(last) * elapsed;
+  
+  energyCurrent.cpuMhz = cpuMhz;
+  energyCurrent.displayOn = displayPowered;
+  energyCurrent.playing = state.playing;
+  energyCurrent.volume = constrain(state.volume, 0, MAX_VOLUME);
+  portEXIT_CRITICAL(&energyLock);
+}
+
+// Switch between active and low power, time so far goes to the old state
+void setEnergyPowerState(EnergyPowerState state) {
+  accountEnergy();
+  portENTER_CRITICAL(&energyLock);
+  energyAwakeState = state;
+  if (energyCurrent.powerState != ENERGY_LIGHT_SLEEP) {
+    energyCurrent.powerState = state;
+  }
+  portEXIT_CRITICAL(&energyLock);
+}
+
+// Light sleep starts now
+void energyEnterSleep() {
+  accountEnergy();
+  portENTER_CRITICAL(&energyLock);
+  energyCurrent.powerState = ENERGY_LIGHT_SLEEP;
+  portEXIT_CRITICAL(&energyLock);
+}
+
+// Awake again, the sleep is charged at the light sleep current
+void energyLeaveSleep() {
+  accountEnergy();
+  portENTER_CRITICAL(&energyLock);
+  energyCurrent.powerState = energyAwakeState;
+  portEXIT_CRITICAL(&energyLock);
+}
+
+// Estimated minutes left at the recent average draw, -1 until known
+// Call at a steady interval, each call closes one averaging window.
+int updateRuntimeEstimate(int batteryPercent) {
+  accountEnergy();
+  
+  portENTER_CRITICAL(&energyLock);
+  uint64_t charge = energyChargeMicroAmpMs;
+  portEXIT_CRITICAL(&energyLock);
+  unsigned long now = millis();
+  unsigned long elapsed = now - energyLastEstimate;
+  if (elapsed == 0) {
+    return -1;
+  }
+  
+  int32_t windowMicroAmps = (charge - energyChargeAtEstimate) / elapsed;
+  energyChargeAtEstimate = charge;
+  energyLastEstimate = now;
+  if (energyAverageMicroAmps == 0) {
+    energyAverageMicroAmps = windowMicroAmps;
+  } else {
+    energyAverageMicroAmps += (windowMicroAmps - energyAverageMicroAmps) >> ENERGY_AVERAGE_SHIFT;
+  }
+  if (energyAverageMicroAmps <= 0) {
+    return -1;
+  }
+  
+  // Remaining charge in microamp-hours over the draw in microamps
+  uint64_t remaining = (uint64_t)BATTERY_CAPACITY_MAH * 1000 * batteryPercent / 100;
+  return remaining * 60 / energyAverageMicroAmps;
+}
+
+// One "energy,<name>,<value>" line of the exported stats
+void printEnergyCounter(const char* name, unsigned long value) {
+  Serial.print("energy,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.println(value);
+}
+
+// Print the residency counters, the lines can be diffed between builds
+void printEnergyStats() {
+  accountEnergy();
+  
+  for (int i = 0; i < ENERGY_STATE_COUNT; i++) {
+    printEnergyCounter(energyStateNames[i], energyStateMillis[i]);
+  }
+  for (size_t i = 0; i < ENERGY_CPU_STEPS; i++) {
+    printEnergyCounter(energyCpuNames[i], energyCpuMillis[i]);
+  }
+  printEnergyCounter("display_on_ms", energyDisplayOnMillis);
+  printEnergyCounter("playing_ms", energyPlayingMillis);
+  for (int i = 0; i < ENERGY_VOLUME_BANDS; i++) {
+    printEnergyCounter(energyVolumeNames[i], energyVolumeMillis[i]);
+  }
+  printEnergyCounter("charge_uah", energyChargeMicroAmpMs / 3600000);
+  printEnergyCounter("average_ua", energyAverageMicroAmps);
+}
+
+#endif // ENERGY_H
\ No newline at end of file
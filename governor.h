@@ -0,0 +1,224 @@
+// ESP32 Soundpod - Frequency Governor
+// Sets the CPU clock from measured work instead of inactivity alone. Tasks
+// report how long each wake-up kept them busy; once per window the DFS
+// floor (the clock used when nothing holds a lock) moves to the lowest step
+// that runs that work at GOVERNOR_TARGET_LOAD. Rendering, DFPlayer traffic
+// and library scans hold the boost lock, which lifts the clock to the
+// ceiling while they run.
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include "config.h"
+
+// External references
+extern void accountEnergy();
+
+// Clocks the floor can be set to, lowest first
+const uint16_t governorSteps[] = { 40, 80, 160, 240 };
+#define GOVERNOR_STEP_COUNT (sizeof(governorSteps) / sizeof(governorSteps[0]))
+
+// ESP32 specific power management
+esp_pm_config_esp32_t pm_config;
+SemaphoreHandle_t governorMutex = NULL; // Orders changes to pm_config
+esp_pm_lock_handle_t governorBoostLock = NULL;
+volatile bool governorReady = false; // Boost lock created, boosts before that are skipped
+uint16_t governorFloorMhz = CPU_FREQ_MHZ_ACTIVE;
+uint16_t governorCeilingMhz = CPU_FREQ_MHZ_ACTIVE;
+uint8_t governorCalmWindows = 0; // Windows in a row that wanted a lower floor
+bool governorDisabled = false;   // DFS configuration was rejected, the clock is left alone
+
+// Work in the current window, per core, in microseconds times MHz
+portMUX_TYPE governorWorkLock = portMUX_INITIALIZER_UNLOCKED;
+uint64_t governorWorkCycles[2] = { 0, 0 };
+unsigned long governorWindowStart = 0;
+
+// Instrumentation
+unsigned long governorChanges = 0;
+unsigned long governorBoosts = 0;
+unsigned long governorLastLoad = 0; // Busiest core in the last window, percent of the floor clock
+
+// Function declarations
+void initGovernor();
+bool governorBoost();
+void governorRelease(bool boosted);
+void recordTaskWork(unsigned long startMicros);
+void setGovernorCeiling(uint16_t ceilingMhz);
+void serviceGovernor();
+unsigned long governorNextDeadline();
+void printGovernorStats();
+
+// Apply a floor and ceiling to the DFS configuration
+void applyGovernor(uint16_t floorMhz, uint16_t ceilingMhz) {
+  if (floorMhz > ceilingMhz) {
+    floorMhz = ceilingMhz;
+  }
+  
+  xSemaphoreTake(governorMutex, portMAX_DELAY);
+  if (governorDisabled) {
+    xSemaphoreGive(governorMutex);
+    return;
+  }
+  pm_config.max_freq_mhz = ceilingMhz;
+  pm_config.min_freq_mhz = floorMhz;
+  esp_err_t result = esp_pm_configure(&pm_config);
+  if (result == ESP_OK) {
+    governorFloorMhz = floorMhz;
+    governorCeilingMhz = ceilingMhz;
+    governorChanges++;
+  } else {
+    governorDisabled = true;
+  }
+  xSemaphoreGive(governorMutex);
+  
+  // Time so far is charged to the old clock
+  accountEnergy();
+  
+  if (result != ESP_OK) {
+    // The same request would only be rejected again every window
+    Serial.println("Governor: DFS configuration rejected, governor off");
+  } else if (DEBUG) {
+    Serial.print("Governor: ");
+    Serial.print(floorMhz);
+    Serial.print("-");
+    Serial.print(ceilingMhz);
+    Serial.println(" MHz");
+  }
+}
+
+// Set up DFS and the boost lock
+void initGovernor() {
+  governorMutex = xSemaphoreCreateMutex();
+  if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "boost", &governorBoostLock) == ESP_OK) {
+    governorReady = true;
+  }
+  
+  // loop() starts light sleep itself (see tasks.h). Automatic light sleep
+  // needs tickless idle, and without it esp_pm_configure() rejects the
+  // whole configuration.
+  pm_config.light_sleep_enable = false;
+  
+  governorWindowStart = millis();
+  applyGovernor(CPU_FREQ_MHZ_ACTIVE, CPU_FREQ_MHZ_ACTIVE);
+}
+
+// Run at the ceiling until governorRelease(), calls nest across tasks
+// Returns whether the lock was taken, pass it on to governorRelease(),
+// a boost that started before initGovernor() must not release one.
+bool governorBoost() {
+  if (!governorReady) {
+    return false;
+  }
+  esp_pm_lock_acquire(governorBoostLock);
+  __atomic_fetch_add(&governorBoosts, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// End a boost
+void governorRelease(bool boosted) {
+  if (boosted) {
+    esp_pm_lock_release(governorBoostLock);
+  }
+}
+
+// Add the time since startMicros to this core's work in the current window
+// The time is weighted by the clock it ran at, so a boosted task calls this
+// before governorRelease(), while the ceiling still holds.
+void recordTaskWork(unsigned long startMicros) {
+  uint64_t cycles = (uint64_t)(micros() - startMicros) * getCpuFrequencyMhz();
+  int core = xPortGetCoreID();
+  portENTER_CRITICAL(&governorWorkLock);
+  governorWorkCycles[core] += cycles;
+  portEXIT_CRITICAL(&governorWorkLock);
+}
+
+// Limit the clock, CPU_FREQ_MHZ_IDLE in low power mode
+void setGovernorCeiling(uint16_t ceilingMhz) {
+  if (ceilingMhz != governorCeilingMhz) {
+    applyGovernor(governorFloorMhz, ceilingMhz);
+  }
+}
+
+// Close the window and move the floor to fit the work it saw
+// Raising happens at once, lowering only after GOVERNOR_CALM_WINDOWS.
+void serviceGovernor() {
+  if (governorDisabled) {
+    return;
+  }
+  unsigned long now = millis();
+  unsigned long elapsed = now - governorWindowStart;
+  if (elapsed < GOVERNOR_WINDOW_MS) {
+    return;
+  }
+  governorWindowStart = now;
+  
+  portENTER_CRITICAL(&governorWorkLock);
+  uint64_t busiest = max(governorWorkCycles[0], governorWorkCycles[1]);
+  governorWorkCycles[0] = 0;
+  governorWorkCycles[1] = 0;
+  portEXIT_CRITICAL(&governorWorkLock);
+  
+  // Clock that runs the busiest core's work at the target load
+  uint64_t windowMicros = (uint64_t)elapsed * 1000;
+  uint64_t neededMhz = busiest * 100 / (windowMicros * GOVERNOR_TARGET_LOAD);
+  governorLastLoad = busiest * 100 / (windowMicros * governorFloorMhz);
+  
+  uint16_t target = governorSteps[GOVERNOR_STEP_COUNT - 1];
+  for (size_t i = 0; i < GOVERNOR_STEP_COUNT; i++) {
+    if (governorSteps[i] >= GOVERNOR_MIN_MHZ && governorSteps[i] >= neededMhz) {
+      target = governorSteps[i];
+      break;
+    }
+  }
+  if (target > governorCeilingMhz) {
+    target = governorCeilingMhz;
+  }
+  
+  if (target > governorFloorMhz) {
+    governorCalmWindows = 0;
+    applyGovernor(target, governorCeilingMhz);
+  } else if (target < governorFloorMhz) {
+    if (++governorCalmWindows >= GOVERNOR_CALM_WINDOWS) {
+      governorCalmWindows = 0;
+      applyGovernor(target, governorCeilingMhz);
+    }
+  } else {
+    governorCalmWindows = 0;
+  }
+}
+
+// Milliseconds until serviceGovernor() closes the window, NO_DEADLINE when
+// the floor is already at the bottom and no work is waiting to be judged,
+// or when the governor is off
+unsigned long governorNextDeadline() {
+  if (governorDisabled) {
+    return NO_DEADLINE;
+  }
+  portENTER_CRITICAL(&governorWorkLock);
+  bool idle = governorWorkCycles[0] == 0 && governorWorkCycles[1] == 0;
+  portEXIT_CRITICAL(&governorWorkLock);
+  if (idle && governorFloorMhz <= GOVERNOR_MIN_MHZ) {
+    return NO_DEADLINE;
+  }
+  long left = (long)(governorWindowStart + GOVERNOR_WINDOW_MS - millis());
+  return left > 0 ? left : 0;
+}
+
+// Print the current clock range and how often it moved
+void printGovernorStats() {
+  Serial.print("Governor: floor ");
+  Serial.print(governorFloorMhz);
+  Serial.print(" MHz, ceiling ");
+  Serial.print(governorCeilingMhz);
+  Serial.print(" MHz, load ");
+  Serial.print(governorLastLoad);
+  Serial.print("%, ");
+  Serial.print(governorChanges);
+  Serial.print(" changes, ");
+  Serial.print(governorBoosts);
+  Serial.println(" boosts");
+}
+
+#endif // GOVERNOR_H
\ No newline at end of file
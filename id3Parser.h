@@ -0,0 +1,389 @@
+// ESP32 Soundpod - ID3 Tag Parser
+// Streaming ID3v2.2/2.3/2.4 and ID3v1 reader. Only the tag header and the
+// frames we need are read, through a small fixed buffer.
+
+#ifndef ID3PARSER_H
+#define ID3PARSER_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "config.h"
+
+#define TAG_TEXT_MAX 63       // Longest title/artist/album kept
+#define ID3_BUFFER_SIZE 128   // File read buffer
+#define ID3_FRAME_MAX (TAG_TEXT_MAX * 2 + 4) // Enough for a UTF-16 value plus BOM
+
+// Tags extracted from one file, empty strings if not present
+struct TrackTags {
+  char title[TAG_TEXT_MAX + 1];
+  char artist[TAG_TEXT_MAX + 1];
+  char album[TAG_TEXT_MAX + 1];
+  int trackNumber;
+};
+
+// Buffered reader over the ID3v2 tag area of a file
+struct Id3Reader {
+  File* file;
+  uint8_t buffer[ID3_BUFFER_SIZE];
+  uint16_t length;     // Valid bytes in buffer
+  uint16_t pos;        // Next byte in buffer
+  uint32_t filePos;    // File offset just past the buffered bytes
+  uint32_t remaining;  // Stored tag bytes not yet consumed
+  bool unsync;         // ID3v2.3 tag-level unsynchronisation
+  uint8_t last;        // Previous stored byte, for unsynchronisation
+};
+
+// Function declarations
+bool readTrackTags(File& file, TrackTags* tags);
+
+// Next stored byte of the tag, -1 at the end of the tag or file
+int id3RawByte(Id3Reader& r) {
+  if (r.remaining == 0) {
+    return -1;
+  }
+  if (r.pos >= r.length) {
+    uint32_t want = r.remaining < ID3_BUFFER_SIZE ? r.remaining : ID3_BUFFER_SIZE;
+    r.length = r.file->read(r.buffer, want);
+    r.pos = 0;
+    r.filePos += r.length;
+    if (r.length == 0) {
+      r.remaining = 0;
+      return -1;
+    }
+  }
+  r.remaining--;
+  return r.buffer[r.pos++];
+}
+
+// Skip stored bytes, seeking past anything not already buffered
+void id3RawSkip(Id3Reader& r, uint32_t count) {
+  if (count > r.remaining) {
+    count = r.remaining;
+  }
+  r.remaining -= count;
+  
+  uint16_t buffered = r.length - r.pos;
+  if (count <= buffered) {
+    r.pos += count;
+    return;
+  }
+  r.filePos += count - buffered;
+  r.file->seek(r.filePos);
+  r.pos = r.length = 0;
+}
+
+// Next tag byte with ID3v2.3 unsynchronisation removed
+int id3TagByte(Id3Reader& r) {
+  int b = id3RawByte(r);
+  if (r.unsync && r.last == 0xFF && b == 0x00) {
+    b = id3RawByte(r);
+  }
+  r.last = b < 0 ? 0 : b;
+  return b;
+}
+
+// Skip bytes counted after unsynchronisation
+void id3TagSkip(Id3Reader& r, uint32_t count) {
+  if (!r.unsync) {
+    id3RawSkip(r, count);
+    return;
+  }
+  while (count-- > 0 && id3TagByte(r) >= 0) {
+  }
+}
+
+// Read a frame body into out, skipping whatever does not fit
+// ID3v2.3 sizes count bytes after unsynchronisation, ID3v2.4 sizes count
+// stored bytes and frames may carry their own unsynchronisation.
+uint16_t id3ReadBody(Id3Reader& r, uint32_t size, bool frameUnsync, uint8_t* out, uint16_t cap) {
+  uint16_t n = 0;
+  
+  if (r.unsync) {
+    while (n < cap && size > 0) {
+      int b = id3TagByte(r);
+      if (b < 0) {
+        return n;
+      }
+      out[n++] = b;
+      size--;
+    }
+    id3TagSkip(r, size);
+    return n;
+  }
+  
+  uint8_t prev = 0;
+  while (n < cap && size > 0) {
+    int b = id3RawByte(r);
+    if (b < 0) {
+      return n;
+    }
+    size--;
+    if (frameUnsync && prev == 0xFF && b == 0x00) {
+      prev = 0;
+      continue;
+    }
+    prev = b;
+    out[n++] = b;
+  }
+  id3RawSkip(r, size);
+  return n;
+}
+
+// Append a code point to a Latin-1 output string
+void id3PutChar(char* out, uint16_t& n, uint32_t codePoint) {
+  if (n < TAG_TEXT_MAX) {
+    out[n++] = codePoint < 0x100 ? (char)codePoint : '?';
+  }
+}
+
+// Decode an ID3 text value (first string only) into Latin-1
+void id3DecodeText(const uint8_t* data, uint16_t length, char* out) {
+  uint16_t n = 0;
+  out[0] = '\0';
+  if (length < 1) {
+    return;
+  }
+  
+  uint8_t encoding = data[0];
+  const uint8_t* p = data + 1;
+  const uint8_t* end = data + length;
+  
+  if (encoding == 1 || encoding == 2) {
+    // UTF-16 with BOM (1) or big-endian without BOM (2)
+    bool bigEndian = (encoding == 2);
+    if (encoding == 1 && end - p >= 2) {
+      bigEndian = (p[0] == 0xFE && p[1] == 0xFF);
+      if ((p[0] == 0xFE && p[1] == 0xFF) || (p[0] == 0xFF && p[1] == 0xFE)) {
+        p += 2;
+      }
+    }
+    while (end - p >= 2) {
+      uint16_t unit = bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+      p += 2;
+      if (unit == 0) {
+        break;
+      }
+      id3PutChar(out, n, unit);
+    }
+  } else if (encoding == 3) {
+    // UTF-8
+    while (p < end && *p != 0) {
+      uint8_t c = *p++;
+      if (c < 0x80) {
+        id3PutChar(out, n, c);
+      } else if ((c & 0xE0) == 0xC0 && p < end) {
+        id3PutChar(out, n, ((c & 0x1F) << 6) | (*p++ & 0x3F));
+      } else {
+        // Longer sequences are outside Latin-1, skip continuation bytes
+        while (p < end && (*p & 0xC0) == 0x80) {
+          p++;
+        }
+        id3PutChar(out, n, '?');
+      }
+    }
+  } else {
+    // ISO-8859-1
+    while (p < end && *p != 0) {
+      id3PutChar(out, n, *p++);
+    }
+  }
+  
+  // Trim trailing spaces
+  while (n > 0 && out[n - 1] == ' ') {
+    n--;
+  }
+  out[n] = '\0';
+}
+
+// Copy a fixed-width, space or NUL padded ID3v1 field
+void id3CopyV1Field(const uint8_t* field, uint8_t width, char* out) {
+  uint16_t n = 0;
+  for (uint8_t i = 0; i < width && field[i] != 0; i++) {
+    id3PutChar(out, n, field[i]);
+  }
+  while (n > 0 && out[n - 1] == ' ') {
+    n--;
+  }
+  out[n] = '\0';
+}
+
+// Decode a syncsafe integer (7 bits per byte)
+uint32_t id3Syncsafe(const uint8_t* b) {
+  return ((uint32_t)(b[0] & 0x7F) << 21) | ((uint32_t)(b[1] & 0x7F) << 14) |
+         ((uint32_t)(b[2] & 0x7F) << 7) | (b[3] & 0x7F);
+}
+
+// Parse the ID3v2 tag at the start of the file, returns false if there is none
+bool readId3v2(File& file, TrackTags* tags) {
+  uint8_t header[10];
+  file.seek(0);
+  if (file.read(header, 10) != 10 || header[0] != 'I' || header[1] != 'D' || header[2] != '3' ||
+      header[3] < 2 || header[3] > 4) {
+    return false;
+  }
+  
+  uint8_t version = header[3];
+  uint8_t flags = header[5];
+  
+  // ID3v2.2 used this bit for a compression scheme that was never defined,
+  // such a tag has to be ignored as a whole
+  if (version == 2 && (flags & 0x40)) {
+    return false;
+  }
+  
+  Id3Reader r;
+  r.file = &file;
+  r.length = r.pos = 0;
+  r.filePos = 10;
+  r.remaining = id3Syncsafe(header + 6);
+  r.unsync = (version < 4) && (flags & 0x80);
+  r.last = 0;
+  bool allUnsync = (version == 4) && (flags & 0x80);
+  
+  // Skip the extended header
+  if (version >= 3 && (flags & 0x40)) {
+    uint8_t sizeBytes[4];
+    for (int i = 0; i < 4; i++) {
+      int b = id3TagByte(r);
+      if (b < 0) {
+        return true;
+      }
+      sizeBytes[i] = b;
+    }
+    if (version == 4) {
+      id3TagSkip(r, id3Syncsafe(sizeBytes) - 4); // Size includes itself
+    } else {
+      id3TagSkip(r, ((uint32_t)sizeBytes[0] << 24) | ((uint32_t)sizeBytes[1] << 16) |
+                    ((uint32_t)sizeBytes[2] << 8) | sizeBytes[3]);
+    }
+  }
+  
+  uint8_t idLength = (version == 2) ? 3 : 4;
+  uint8_t headerLength = (version == 2) ? 6 : 10;
+  uint8_t body[ID3_FRAME_MAX];
+  bool haveTitle = false, haveArtist = false, haveAlbum = false, haveTrack = false;
+  
+  while (!(haveTitle && haveArtist && haveAlbum && haveTrack)) {
+    uint8_t fh[10];
+    for (uint8_t i = 0; i < headerLength; i++) {
+      int b = id3TagByte(r);
+      if (b < 0) {
+        return true;
+      }
+      fh[i] = b;
+    }
+    if (fh[0] == 0) {
+      break; // Padding
+    }
+  
+    uint32_t size;
+    uint16_t frameFlags = 0;
+    if (version == 2) {
+      size = ((uint32_t)fh[3] << 16) | ((uint32_t)fh[4] << 8) | fh[5];
+    } else if (version == 3) {
+      size = ((uint32_t)fh[4] << 24) | ((uint32_t)fh[5] << 16) | ((uint32_t)fh[6] << 8) | fh[7];
+      frameFlags = (fh[8] << 8) | fh[9];
+    } else {
+      size = id3Syncsafe(fh + 4);
+      frameFlags = (fh[8] << 8) | fh[9];
+    }
+  
+    // Which field, if any, this frame fills
+    char* target = NULL;
+    bool* have = NULL;
+    if (!memcmp(fh, idLength == 3 ? "TT2" : "TIT2", idLength)) {
+      target = tags->title;
+      have = &haveTitle;
+    } else if (!memcmp(fh, idLength == 3 ? "TP1" : "TPE1", idLength)) {
+      target = tags->artist;
+      have = &haveArtist;
+    } else if (!memcmp(fh, idLength == 3 ? "TAL" : "TALB", idLength)) {
+      target = tags->album;
+      have = &haveAlbum;
+    } else if (!memcmp(fh, idLength == 3 ? "TRK" : "TRCK", idLength)) {
+      have = &haveTrack;
+    }
+  
+    // Compressed or encrypted frames can't be read in place
+    bool unreadable = (version == 3 && (frameFlags & 0x00C0)) ||
+                      (version == 4 && (frameFlags & 0x000C));
+    if (have == NULL || *have || unreadable) {
+      id3TagSkip(r, size);
+      continue;
+    }
+  
+    // Grouping byte and data length indicator precede the body
+    uint32_t extra = 0;
+    if (version == 3 && (frameFlags & 0x0020)) {
+      extra = 1;
+    } else if (version == 4) {
+      extra = ((frameFlags & 0x0040) ? 1 : 0) + ((frameFlags & 0x0001) ? 4 : 0);
+    }
+    if (extra > size) {
+      id3TagSkip(r, size);
+      continue;
+    }
+    id3TagSkip(r, extra);
+  
+    bool frameUnsync = allUnsync || (version == 4 && (frameFlags & 0x0002));
+    uint16_t length = id3ReadBody(r, size - extra, frameUnsync, body, sizeof(body));
+  
+    // A field only counts once it has a value, an empty frame leaves it
+    // to a later frame or the ID3v1 tag
+    if (target == NULL) {
+      char number[TAG_TEXT_MAX + 1];
+      id3DecodeText(body, length, number);
+      tags->trackNumber = atoi(number); // "3/12" reads as 3
+      *have = tags->trackNumber > 0;
+    } else {
+      id3DecodeText(body, length, target);
+      *have = target[0] != '\0';
+    }
+  }
+  
+  return true;
+}
+
+// Read the ID3v1 tag at the end of the file into any fields still empty
+bool readId3v1(File& file, TrackTags* tags) {
+  size_t size = file.size();
+  uint8_t tag[128];
+  if (size < 128 || !file.seek(size - 128) || file.read(tag, 128) != 128 ||
+      tag[0] != 'T' || tag[1] != 'A' || tag[2] != 'G') {
+    return false;
+  }
+  
+  if (tags->title[0] == '\0') {
+    id3CopyV1Field(tag + 3, 30, tags->title);
+  }
+  if (tags->artist[0] == '\0') {
+    id3CopyV1Field(tag + 33, 30, tags->artist);
+  }
+  if (tags->album[0] == '\0') {
+    id3CopyV1Field(tag + 63, 30, tags->album);
+  }
+  // ID3v1.1 keeps the track number in the last comment byte
+  if (tags->trackNumber == 0 && tag[125] == 0 && tag[126] != 0) {
+    tags->trackNumber = tag[126];
+  }
+  return true;
+}
+
+// Read title, artist, album and track number from an MP3 file
+// Returns false if the file has no usable tag at all.
+bool readTrackTags(File& file, TrackTags* tags) {
+  tags->title[0] = '\0';
+  tags->artist[0] = '\0';
+  tags->album[0] = '\0';
+  tags->trackNumber = 0;
+  
+  bool found = readId3v2(file, tags);
+  
+  // Fall back to ID3v1 only for what the ID3v2 tag didn't provide
+  if (tags->title[0] == '\0' || tags->artist[0] == '\0' || tags->album[0] == '\0') {
+    found = readId3v1(file, tags) || found;
+  }
+  return found;
+}
+
+#endif // ID3PARSER_H
\ No newline at end of file
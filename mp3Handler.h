@@ -4,48 +4,121 @@
 #ifndef MP3HANDLER_H
 #define MP3HANDLER_H
 
-#include <DFRobotDFPlayerMini.h>
 #include "config.h"
+#include "dfPlayer.h"
+#include "playOrder.h"
+#include "playerState.h"
+#include "trackCache.h"
+#include "stateJournal.h"
+#include "boot.h"
+#include "rtcState.h"
 
 // External references
 extern HardwareSerial playerSerial;
-extern void setTrackInfo(String trackName, String artistName, int trackNum, int total);
-extern void setPlayingStatus(bool playing);
-extern void setVolume(int volume);
 
-// Create MP3 player instance
-DFRobotDFPlayerMini mp3Player;
-
-// MP3 player status variables
+// MP3 player status variables, owned by the audio task and published
+// through playerState.h
 int currentVolume = DEFAULT_VOLUME;
 int currentTrack = 1;
 int totalTracks = 0;
 bool isPlaying = false;
-unsigned long lastTrackCheckTime = 0;
-unsigned long trackCheckInterval = 1000; // Check if track finished every second
+uint16_t lastFinishedTrack = 0;
+unsigned long lastFinishedTime = 0;
+bool resumePending = true;  // Last session not picked up yet
+bool resumePlaying = false; // It ended while playing
+int resumeExpectedTracks = 0; // Track count before deep sleep, for a wake without reset
+unsigned long transitionGapsSeen = 0; // dfGapCount already recorded
+
+// Function declarations
+void onPlayerReady(uint8_t command, bool ok, uint16_t value);
+void onFileCount(uint8_t command, bool ok, uint16_t value);
+void onResumeFileCount(uint8_t command, bool ok, uint16_t value);
+void releasePlayerCard();
+void startPlayback();
+void stopPlayback();
+void resumeLastTrack();
+void publishCurrentTrack();
 
 // Initialize MP3 player
 void initMP3Player() {
   Serial.println("Initializing DFPlayer Mini...");
   
-  if (!mp3Player.begin(playerSerial)) {
+  // Everything is queued, the replies arrive through dfPlayerService()
+  dfPlayerBegin(playerSerial);
+  dfPlayerListen(playerSerial);
+  dfPlayerReset(onPlayerReady);
+}
+
+// Take over the player as deep sleep left it
+// It stays powered while the ESP32 sleeps, so one track count query
+// replaces the reset and confirms the same card is still in.
+void initMP3PlayerResumed(int expectedTracks) {
+  Serial.println("Resuming DFPlayer Mini...");
+  
+  resumeExpectedTracks = expectedTracks;
+  dfPlayerBegin(playerSerial);
+  dfPlayerListen(playerSerial);
+  dfPlayerSend(DF_CMD_VOLUME, currentVolume);
+  dfPlayerQuery(DF_CMD_QUERY_SD_FILES, onResumeFileCount);
+}
+
+// Keep the player off the shared card while the ESP32 scans it
+// Only one of the two may drive the card at a time. After power-up the
+// player reads the card on its own for a few seconds, and after a reset of
+// the ESP32 alone it may still be playing. Runs in setup(), before the
+// audio task owns the player and before initMP3Player() resets it.
+void releasePlayerCard() {
+  if (esp_reset_reason() == ESP_RST_POWERON) {
+    long left = (long)(DFPLAYER_RESET_TIMEOUT_MS - millis());
+    if (left > 0) {
+      delay(left);
+    }
+    return;
+  }
+  
+  dfPlayerBegin(playerSerial);
+  dfPlayerSend(DF_CMD_STOP, 0);
+  unsigned long start = millis();
+  while (!dfPlayerIdle() && millis() - start < DFPLAYER_TIMEOUT_MS * (DFPLAYER_RETRIES + 1)) {
+    dfPlayerService();
+    delay(1);
+  }
+}
+
+// Take over the last session's track and volume, before the player is up
+// Publishing the volume before the display takes its first snapshot keeps
+// it from showing the volume screen at boot.
+void restorePlaybackState(const PlaybackState& state) {
+  currentTrack = state.lastTrack > 0 ? state.lastTrack : 1;
+  currentVolume = constrain(state.lastVolume, 0, MAX_VOLUME);
+  resumePlaying = state.wasPlaying;
+  publishVolume(currentVolume);
+}
+
+// Player finished its reset, configure it
+void onPlayerReady(uint8_t command, bool ok, uint16_t value) {
+  if (!ok) {
     Serial.println("Unable to begin DFPlayer Mini");
     Serial.println("1.Please recheck the connection!");
     Serial.println("2.Please insert the SD card!");
-    while(true) {
-      delay(0); // Code to halt
-    }
+    resumeLastTrack(); // Leaves the splash screen with nothing to play
+    return;
   }
   
+  bootMark("player ready");
   Serial.println("DFPlayer Mini online.");
   
-  // Set volume
-  mp3Player.volume(currentVolume);
+  dfPlayerSend(DF_CMD_OUTPUT_DEVICE, DF_DEVICE_SD);
+  dfPlayerSend(DF_CMD_VOLUME, currentVolume);
+  dfPlayerSend(DF_CMD_EQ, DF_EQ_NORMAL);
   
   // Get total number of tracks on SD card
-  delay(100); // Small delay before command
-  totalTracks = mp3Player.readFileCounts();
-  delay(100);
+  dfPlayerQuery(DF_CMD_QUERY_SD_FILES, onFileCount);
+}
+
+// Track count reply
+void onFileCount(uint8_t command, bool ok, uint16_t value) {
+  totalTracks = ok ? value : 0;
   
   if (totalTracks <= 0) {
     totalTracks = 0;
@@ -54,25 +127,84 @@ void initMP3Player() {
     Serial.print("Total tracks: ");
     Serial.println(totalTracks);
   }
+  publishTotalTracks(totalTracks);
+  resumeLastTrack();
+}
+
+// Track count reply after a deep sleep wake
+void onResumeFileCount(uint8_t command, bool ok, uint16_t value) {
+  if (!ok) {
+    // Lost power or stuck, start over with a reset
+    noteRtcFallback(RTC_FALLBACK_PLAYER);
+    dfPlayerReset(onPlayerReady);
+    return;
+  }
   
-  // Set EQ
-  mp3Player.EQ(DFPLAYER_EQ_NORMAL);
+  dfPlayerOnline = true;
+  bootMark("player ready");
+  if (value != resumeExpectedTracks) {
+    // Names from the index would belong to the old card
+    noteRtcFallback(RTC_FALLBACK_CARD);
+    trackLibraryReady = false;
+  }
+  noteRtcFastResume();
+  onFileCount(command, ok, value);
+}
+
+// Continue the last session as soon as the player knows its tracks
+// Runs once, later track counts (card swapped) don't restart anything.
+void resumeLastTrack() {
+  if (!resumePending) {
+    return;
+  }
+  resumePending = false;
   
-  // Set device
-  mp3Player.outputDevice(DFPLAYER_DEVICE_SD);
+  if (currentTrack > totalTracks) {
+    currentTrack = 1;
+  }
+  orderPosition = positionOfTrack(currentTrack);
+  if (resumePlaying && totalTracks > 0) {
+    startPlayback();
+  } else {
+    publishCurrentTrack();
+    armNextTrack();
+  }
+}
+
+// The library scan finished, show real names instead of track numbers
+void onLibraryReady() {
+  if (resumePending) {
+    return; // resumeLastTrack() publishes them
+  }
+  publishCurrentTrack();
+  armNextTrack();
+}
+
+// Publish the current track with its names from the library
+void publishCurrentTrack() {
+  const CachedTrack* track = getCachedTrack(currentTrack - 1);
+  if (track != NULL) {
+    publishTrack(currentTrack, totalTracks, track->title, track->artist);
+  } else {
+    char title[16];
+    snprintf(title, sizeof(title), "Track %d", currentTrack);
+    publishTrack(currentTrack, totalTracks, title, "Unknown Artist");
+  }
 }
 
 // Start playing current track
 void startPlayback() {
   if (totalTracks > 0) {
-    mp3Player.play(currentTrack);
+    dfPlayerSend(DF_CMD_PLAY_TRACK, currentTrack);
     isPlaying = true;
-    setPlayingStatus(true);
+    publishPlaying(true);
+    markFirstAudio();
     
     // Get track info from database and update display
-    String trackName = "Track " + String(currentTrack); // Placeholder
-    String artistName = "Unknown Artist"; // Placeholder
-    setTrackInfo(trackName, artistName, currentTrack, totalTracks);
+    publishCurrentTrack();
+    
+    // Have the next and previous tracks ready before the user skips
+    armNextTrack();
     
     Serial.print("Playing track: ");
     Serial.println(currentTrack);
@@ -83,17 +215,17 @@ void startPlayback() {
 
 // Pause playback
 void pausePlayback() {
-  mp3Player.pause();
+  dfPlayerSend(DF_CMD_PAUSE, 0);
   isPlaying = false;
-  setPlayingStatus(false);
+  publishPlaying(false);
   Serial.println("Playback paused");
 }
 
 // Resume playback
 void resumePlayback() {
-  mp3Player.start();
+  dfPlayerSend(DF_CMD_RESUME, 0);
   isPlaying = true;
-  setPlayingStatus(true);
+  publishPlaying(true);
   Serial.println("Playback resumed");
 }
 
@@ -108,10 +240,16 @@ void togglePlayPause() {
 
 // Play next track
 void playNextTrack() {
-  if (currentTrack < totalTracks) {
-    currentTrack++;
+  if (armedNext.position >= 0) {
+    orderPosition = armedNext.position;
+    currentTrack = armedNext.track;
   } else {
-    currentTrack = 1; // Loop back to first track
+    // End of the order with repeat off, skipping still wraps around
+    orderPosition = 0;
+    currentTrack = trackAtPosition(0);
+  }
+  if (currentTrack == 0) {
+    return;
   }
   
   startPlayback();
@@ -121,10 +259,14 @@ void playNextTrack() {
 
 // Play previous track
 void playPreviousTrack() {
-  if (currentTrack > 1) {
-    currentTrack--;
-  } else {
-    currentTrack = totalTracks; // Loop to last track
+  int length = playOrderLength();
+  if (length == 0) {
+    return;
+  }
+  orderPosition = (orderPosition > 0) ? orderPosition - 1 : length - 1; // Loop to last track
+  currentTrack = trackAtPosition(orderPosition);
+  if (currentTrack == 0) {
+    return;
   }
   
   startPlayback();
@@ -132,6 +274,44 @@ void playPreviousTrack() {
   Serial.println(currentTrack);
 }
 
+// Record the gap of a track change once its play command is out
+// A command in flight holds it back, then a later pass sends it.
+void collectTransitionGap() {
+  if (dfGapCount != transitionGapsSeen) {
+    transitionGapsSeen = dfGapCount;
+    recordTransitionGap(dfLastGapMicros);
+  }
+}
+
+// Move to the armed track when the current one finishes at finishedAt
+// The play command goes out first, everything else follows it.
+void advanceOnFinish(unsigned long finishedAt) {
+  int track = (repeatMode == REPEAT_ONE) ? currentTrack : armedNext.track;
+  if (track == 0) {
+    stopPlayback();
+    Serial.println("End of play order");
+    return;
+  }
+  
+  dfGapStart = finishedAt;
+  dfPlayerSendFirst(DF_CMD_PLAY_TRACK, track);
+  dfPlayerService();
+  collectTransitionGap();
+  
+  if (repeatMode != REPEAT_ONE) {
+    orderPosition = armedNext.position;
+    currentTrack = track;
+    publishTrack(currentTrack, totalTracks, armedNext.title, armedNext.artist);
+    armNextTrack();
+  }
+  
+  Serial.print("Playing track: ");
+  Serial.print(currentTrack);
+  Serial.print(", gap ");
+  Serial.print(dfLastGapMicros);
+  Serial.println(" us");
+}
+
 // Increase volume
 void increaseVolume() {
   if (currentVolume < MAX_VOLUME) {
@@ -139,8 +319,8 @@ void increaseVolume() {
     if (currentVolume > MAX_VOLUME) {
       currentVolume = MAX_VOLUME;
     }
-    mp3Player.volume(currentVolume);
-    setVolume(currentVolume);
+    dfPlayerSend(DF_CMD_VOLUME, currentVolume);
+    publishVolume(currentVolume);
     Serial.print("Volume up: ");
     Serial.println(currentVolume);
   }
@@ -153,8 +333,8 @@ void decreaseVolume() {
     if (currentVolume < 0) {
       currentVolume = 0;
     }
-    mp3Player.volume(currentVolume);
-    setVolume(currentVolume);
+    dfPlayerSend(DF_CMD_VOLUME, currentVolume);
+    publishVolume(currentVolume);
     Serial.print("Volume down: ");
     Serial.println(currentVolume);
   }
@@ -163,7 +343,12 @@ void decreaseVolume() {
 // Set specific track by number
 void playTrackByNumber(int trackNumber) {
   if (trackNumber > 0 && trackNumber <= totalTracks) {
+    // Picking a library track leaves playlist mode
+    if (activePlaylist[0] != '\0') {
+      setActivePlaylist(NULL);
+    }
     currentTrack = trackNumber;
+    orderPosition = positionOfTrack(trackNumber);
     startPlayback();
   } else {
     Serial.print("Invalid track number: ");
@@ -171,45 +356,84 @@ void playTrackByNumber(int trackNumber) {
   }
 }
 
-// Handle audio playback in main loop
-void handleAudioPlayback() {
-  // Check if current track has finished playing
-  if (isPlaying && (millis() - lastTrackCheckTime > trackCheckInterval)) {
-    lastTrackCheckTime = millis();
-    
-    // On ESP32, we can use the DFPlayer's available() method more reliably
-    if (mp3Player.available()) {
-      uint8_t type = mp3Player.readType();
-      int value = mp3Player.read();
-      
-      // Check if track finished
-      if (type == DFPlayerPlayFinished) {
+// React to a message from the player
+void handlePlayerEvent(const DfEvent& event) {
+  switch (event.type) {
+    case DF_MSG_PLAY_FINISHED: {
+      // The player reports each finish more than once, only the first
+      // starts the next track and times its gap
+      unsigned long finishedAt = dfFinishedAt;
+      dfFinishedAt = 0;
+      if (event.value == lastFinishedTrack && millis() - lastFinishedTime < DFPLAYER_DUPLICATE_MS) {
+        break;
+      }
+      lastFinishedTrack = event.value;
+      lastFinishedTime = millis();
+      if (isPlaying) {
+        advanceOnFinish(finishedAt); // Auto-play next track
         Serial.print("Track finished: ");
-        Serial.println(value);
-        playNextTrack(); // Auto-play next track
+        Serial.println(event.value);
       }
+      break;
     }
+    case DF_MSG_CARD_REMOVED:
+      Serial.println("SD card removed");
+      isPlaying = false;
+      publishPlaying(false);
+      break;
+    case DF_MSG_CARD_INSERTED:
+      Serial.println("SD card inserted");
+      dfPlayerQuery(DF_CMD_QUERY_SD_FILES, onFileCount);
+      break;
+    case DF_MSG_ERROR:
+      Serial.print("DFPlayer error: ");
+      Serial.println(event.value);
+      break;
+    default:
+      break;
+  }
+}
+
+// Handle audio playback in main loop
+void handleAudioPlayback() {
+  // Move queued commands and replies along
+  dfPlayerService();
+  
+  // Handle every pending player message right away
+  DfEvent event;
+  bool handled = false;
+  while (dfPlayerReadEvent(&event)) {
+    handlePlayerEvent(event);
+    handled = true;
+  }
+  
+  // Send whatever the handlers queued without waiting for the next pass
+  if (handled) {
+    dfPlayerService();
   }
+  collectTransitionGap();
 }
 
 // Stop playback
 void stopPlayback() {
-  mp3Player.stop();
+  dfPlayerSend(DF_CMD_STOP, 0);
   isPlaying = false;
-  setPlayingStatus(false);
+  publishPlaying(false);
   Serial.println("Playback stopped");
 }
 
 // Set equalizer mode
 void setEQ(uint8_t eq) {
-  mp3Player.EQ(eq);
+  dfPlayerSend(DF_CMD_EQ, eq);
 }
 
 // Get current status information
 String getPlayerStatus() {
-  String status = "Track: " + String(currentTrack) + "/" + String(totalTracks);
-  status += ", Volume: " + String(currentVolume);
-  status += ", Status: " + String(isPlaying ? "Playing" : "Paused");
+  PlayerState state;
+  readPlayerState(&state, 0);
+  String status = "Track: " + String(state.track) + "/" + String(state.totalTracks);
+  status += ", Volume: " + String(state.volume);
+  status += ", Status: " + String(state.playing ? "Playing" : "Paused");
   return status;
 }
 
@@ -0,0 +1,302 @@
+// ESP32 Soundpod - Play Order
+// Decides which track comes next (library or playlist order, shuffle and
+// repeat) and prepares it while the current one plays, so a track change
+// only has to send the play command
+
+#ifndef PLAYORDER_H
+#define PLAYORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "trackCache.h"
+#include "playlistFormat.h"
+
+// External references
+extern int totalTracks;
+extern int loadPlaylist(String name, int first, int* tracks, int capacity, int* trackCount);
+
+// What happens at the end of a track
+enum RepeatMode {
+  REPEAT_OFF,   // Stop after the last track
+  REPEAT_ALL,   // Start the order again
+  REPEAT_ONE    // Play the same track again
+};
+
+// Next track in the order, ready to play
+struct ArmedTrack {
+  int position;           // Position in the play order, -1 = end of order
+  int track;              // DFPlayer track number
+  char title[TRACK_CACHE_TEXT_MAX + 1];
+  char artist[TRACK_CACHE_TEXT_MAX + 1];
+};
+
+// Play order state
+RepeatMode repeatMode = REPEAT_ALL;
+bool shuffleEnabled = false;
+int orderPosition = 0;            // Position of the current track
+char activePlaylist[PLAYLIST_NAME_MAX + 1] = ""; // Empty = whole library
+int activePlaylistLength = 0;
+int* activePlaylistTracks = NULL; // Library indices of the active playlist, decoded once
+ArmedTrack armedNext = { -1, 0, "", "" };
+
+// Shuffle is an order array, position -> order index, filled by a
+// Fisher-Yates shuffle. DFPlayer track numbers are 16 bits, so entries are
+// too; 2 bytes per track. NULL plays the order unshuffled (out of memory).
+uint16_t* shuffleOrder = NULL;
+int shuffleLength = 0;
+
+// Gap between a finish message and the next play command, last samples
+unsigned long transitionGaps[TRANSITION_GAP_SAMPLES];
+int transitionGapCount = 0;
+int transitionGapNext = 0;
+
+// Function declarations
+int playOrderLength();
+int trackAtPosition(int position);
+int positionOfTrack(int track);
+void prefetchOrderNeighbours();
+void armNextTrack();
+void setRepeatMode(RepeatMode mode);
+void setShuffle(bool enabled);
+bool setActivePlaylist(const char* name);
+void recordTransitionGap(unsigned long gap);
+void printTransitionStats();
+
+// Number of positions in the current order
+int playOrderLength() {
+  return activePlaylist[0] != '\0' ? activePlaylistLength : totalTracks;
+}
+
+// Pick a new shuffle permutation for the current order length
+void reshuffle() {
+  int length = playOrderLength();
+  if (length != shuffleLength || shuffleOrder == NULL) {
+    free(shuffleOrder);
+    shuffleOrder = NULL;
+    shuffleLength = length;
+    if (length < 2 || length > 0xFFFF) {
+      return;
+    }
+    shuffleOrder = (uint16_t*)malloc(length * sizeof(uint16_t));
+    if (shuffleOrder == NULL) {
+      Serial.println("Not enough memory to shuffle");
+      return;
+    }
+  }
+  
+  for (int i = 0; i < length; i++) {
+    shuffleOrder[i] = i;
+  }
+  for (int i = length - 1; i > 0; i--) {
+    int j = random(i + 1);
+    uint16_t swap = shuffleOrder[i];
+    shuffleOrder[i] = shuffleOrder[j];
+    shuffleOrder[j] = swap;
+  }
+}
+
+// Order index behind a position, applying the shuffle
+int orderIndexAt(int position) {
+  if (!shuffleEnabled) {
+    return position;
+  }
+  if (shuffleLength != playOrderLength()) {
+    reshuffle();
+  }
+  return shuffleOrder != NULL ? shuffleOrder[position] : position;
+}
+
+// DFPlayer track number at a position of the order, 0 if there is none
+int trackAtPosition(int position) {
+  int length = playOrderLength();
+  if (position < 0 || position >= length) {
+    return 0;
+  }
+  int index = orderIndexAt(position);
+  
+  if (activePlaylist[0] != '\0') {
+    return activePlaylistTracks[index] + 1;
+  }
+  return index + 1;
+}
+
+// Position of a track in the current order, undoing the shuffle with a
+// search of the order array, this only runs when the order changes. In a
+// playlist that holds the track more than once the
+// first entry wins, one that doesn't hold it gives position 0.
+int positionOfTrack(int track) {
+  int index = track - 1;
+  if (activePlaylist[0] != '\0') {
+    index = 0;
+    for (int i = 0; i < activePlaylistLength; i++) {
+      if (activePlaylistTracks[i] == track - 1) {
+        index = i;
+        break;
+      }
+    }
+  }
+  if (!shuffleEnabled) {
+    return index;
+  }
+  if (shuffleLength != playOrderLength()) {
+    reshuffle();
+  }
+  if (shuffleOrder == NULL) {
+    return index;
+  }
+  for (int position = 0; position < shuffleLength; position++) {
+    if (shuffleOrder[position] == index) {
+      return position;
+    }
+  }
+  return 0;
+}
+
+// Load the tracks before and after the current position into the track
+// cache, so next and previous are hits in shuffle and playlist order too
+void prefetchOrderNeighbours() {
+  int length = playOrderLength();
+  if (length == 0) {
+    return;
+  }
+  prefetchTrack(trackAtPosition((orderPosition + 1) % length) - 1);
+  prefetchTrack(trackAtPosition((orderPosition + length - 1) % length) - 1);
+}
+
+// Work out the track after the current one and load its names
+// Every change of position or order ends here, so this is also where the
+// neighbours are prefetched.
+void armNextTrack() {
+  int length = playOrderLength();
+  armedNext.position = -1;
+  armedNext.track = 0;
+  if (length == 0) {
+    return;
+  }
+  prefetchOrderNeighbours();
+  
+  int position = orderPosition + 1;
+  if (position >= length) {
+    if (repeatMode == REPEAT_OFF) {
+      return;
+    }
+    position = 0;
+  }
+  
+  armedNext.track = trackAtPosition(position);
+  if (armedNext.track == 0) {
+    return;
+  }
+  armedNext.position = position;
+  
+  const CachedTrack* track = getCachedTrack(armedNext.track - 1);
+  if (track != NULL) {
+    strlcpy(armedNext.title, track->title, sizeof(armedNext.title));
+    strlcpy(armedNext.artist, track->artist, sizeof(armedNext.artist));
+  } else {
+    snprintf(armedNext.title, sizeof(armedNext.title), "Track %d", armedNext.track);
+    strlcpy(armedNext.artist, "Unknown Artist", sizeof(armedNext.artist));
+  }
+}
+
+// Change what happens at the end of a track
+void setRepeatMode(RepeatMode mode) {
+  repeatMode = mode;
+  armNextTrack();
+}
+
+// Turn shuffle on or off, keeping the current track's place
+void setShuffle(bool enabled) {
+  int track = trackAtPosition(orderPosition);
+  shuffleEnabled = enabled;
+  if (enabled) {
+    reshuffle();
+  } else {
+    free(shuffleOrder);
+    shuffleOrder = NULL;
+    shuffleLength = 0;
+  }
+  if (track > 0) {
+    orderPosition = positionOfTrack(track);
+  }
+  armNextTrack();
+}
+
+// Play from a playlist, or from the whole library with NULL
+// The playlist is decoded here once, so stepping through it on the audio
+// task never touches SPIFFS.
+bool setActivePlaylist(const char* name) {
+  if (name == NULL) {
+    activePlaylist[0] = '\0';
+    activePlaylistLength = 0;
+    free(activePlaylistTracks);
+    activePlaylistTracks = NULL;
+  } else {
+    int count;
+    if (loadPlaylist(name, 0, NULL, 0, &count) < 0 || count == 0) {
+      return false;
+    }
+    int* tracks = (int*)malloc(count * sizeof(int));
+    if (tracks == NULL || loadPlaylist(name, 0, tracks, count, &count) != count) {
+      if (tracks == NULL) {
+        Serial.println("Not enough memory for playlist");
+      }
+      free(tracks);
+      return false;
+    }
+    free(activePlaylistTracks);
+    activePlaylistTracks = tracks;
+    strlcpy(activePlaylist, name, sizeof(activePlaylist));
+    activePlaylistLength = count;
+    
+    Serial.print("Playlist loaded: ");
+    Serial.print(activePlaylist);
+    Serial.print(" with ");
+    Serial.print(count);
+    Serial.println(" tracks");
+  }
+  orderPosition = 0;
+  if (shuffleEnabled) {
+    reshuffle();
+  }
+  armNextTrack();
+  return true;
+}
+
+// Keep a gap sample for the statistics
+void recordTransitionGap(unsigned long gap) {
+  transitionGaps[transitionGapNext] = gap;
+  transitionGapNext = (transitionGapNext + 1) % TRANSITION_GAP_SAMPLES;
+  if (transitionGapCount < TRANSITION_GAP_SAMPLES) {
+    transitionGapCount++;
+  }
+}
+
+// Report the median and 99th percentile of the recent gaps
+void printTransitionStats() {
+  if (transitionGapCount == 0) {
+    return;
+  }
+  
+  // Insertion sort of a copy, the sample set is small
+  unsigned long sorted[TRANSITION_GAP_SAMPLES];
+  for (int i = 0; i < transitionGapCount; i++) {
+    unsigned long value = transitionGaps[i];
+    int j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  
+  Serial.print("Track gap p50 ");
+  Serial.print(sorted[(transitionGapCount - 1) / 2]);
+  Serial.print(" us, p99 ");
+  Serial.print(sorted[(transitionGapCount - 1) * 99 / 100]);
+  Serial.print(" us over ");
+  Serial.print(transitionGapCount);
+  Serial.println(" transitions");
+}
+
+#endif // PLAYORDER_H
\ No newline at end of file
@@ -0,0 +1,183 @@
+// ESP32 Soundpod - Player State
+// The one copy of what the player is doing. Writers publish changes under a
+// sequence lock; readers (display, persistence, status) take a consistent
+// snapshot without blocking the writer and learn which fields changed
+// since their previous snapshot.
+
+#ifndef PLAYERSTATE_H
+#define PLAYERSTATE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define PLAYER_TEXT_MAX 63 // Longer names are cut short
+#define PLAYER_STATE_MAX_WATCHERS 4
+
+// Fields, as bits in the change masks
+enum PlayerField {
+  PLAYER_FIELD_TRACK,     // track, totalTracks
+  PLAYER_FIELD_NAMES,     // title, artist
+  PLAYER_FIELD_PLAYING,
+  PLAYER_FIELD_VOLUME,
+  PLAYER_FIELD_BATTERY,   // battery, runtimeMinutes
+  PLAYER_FIELD_BATTERY_LOW,
+  PLAYER_FIELD_COUNT
+};
+
+#define PLAYER_CHANGED(mask, field) (((mask) >> (field)) & 1)
+
+struct PlayerState {
+  int track;
+  int totalTracks;
+  bool playing;
+  int volume;
+  int battery;            // Percent
+  int runtimeMinutes;     // Estimated time left, -1 until known
+  bool batteryLow;        // Below BATTERY_LOW_PERCENT, until back above BATTERY_LOW_CLEAR_PERCENT
+  char title[PLAYER_TEXT_MAX + 1];
+  char artist[PLAYER_TEXT_MAX + 1];
+  uint32_t version;       // Bumped by every published change
+  uint32_t fieldVersion[PLAYER_FIELD_COUNT]; // Version that last changed each field
+};
+
+// Published state. playerStateSequence is odd while a write is in progress.
+PlayerState playerState = { 1, 0, false, DEFAULT_VOLUME, 100, -1, false, "", "", 0, { 0 } };
+volatile uint32_t playerStateSequence = 0;
+portMUX_TYPE playerStateWriteLock = portMUX_INITIALIZER_UNLOCKED; // Orders writers only
+unsigned long playerStateRetries = 0; // Reads that raced a write
+
+// Tasks notified after every change, so readers can block instead of polling
+TaskHandle_t playerStateWatchers[PLAYER_STATE_MAX_WATCHERS];
+uint8_t playerStateWatcherCount = 0;
+
+// Function declarations
+uint32_t readPlayerState(PlayerState* snapshot, uint32_t sinceVersion);
+void watchPlayerState(TaskHandle_t task);
+void publishTrack(int track, int totalTracks, const char* title, const char* artist);
+void publishTotalTracks(int totalTracks);
+void publishPlaying(bool playing);
+void publishVolume(int volume);
+void publishBattery(int battery, int runtimeMinutes, bool low);
+
+// Start a change, readers retry until it ends
+void beginPlayerStateWrite() {
+  portENTER_CRITICAL(&playerStateWriteLock);
+  playerStateSequence++;
+  __sync_synchronize();
+}
+
+// Finish a change and stamp the fields that changed
+void endPlayerStateWrite(uint32_t changed) {
+  if (changed != 0) {
+    playerState.version++;
+    for (int field = 0; field < PLAYER_FIELD_COUNT; field++) {
+      if (PLAYER_CHANGED(changed, field)) {
+        playerState.fieldVersion[field] = playerState.version;
+      }
+    }
+  }
+  __sync_synchronize();
+  playerStateSequence++;
+  portEXIT_CRITICAL(&playerStateWriteLock);
+  
+  if (changed != 0) {
+    for (uint8_t i = 0; i < playerStateWatcherCount; i++) {
+      xTaskNotifyGive(playerStateWatchers[i]);
+    }
+  }
+}
+
+// Notify a task whenever the state changes
+void watchPlayerState(TaskHandle_t task) {
+  if (playerStateWatcherCount < PLAYER_STATE_MAX_WATCHERS) {
+    playerStateWatchers[playerStateWatcherCount] = task;
+    __sync_synchronize();
+    playerStateWatcherCount++;
+  }
+}
+
+// Copy a consistent snapshot, returns the fields changed after sinceVersion
+// Pass the version of the reader's previous snapshot, or 0 for everything.
+uint32_t readPlayerState(PlayerState* snapshot, uint32_t sinceVersion) {
+  for (;;) {
+    uint32_t sequence = playerStateSequence;
+    if ((sequence & 1) == 0) {
+      __sync_synchronize();
+      memcpy(snapshot, (const void*)&playerState, sizeof(*snapshot));
+      __sync_synchronize();
+      if (playerStateSequence == sequence) {
+        break;
+      }
+    }
+    playerStateRetries++;
+  }
+  
+  uint32_t changed = 0;
+  for (int field = 0; field < PLAYER_FIELD_COUNT; field++) {
+    if (snapshot->fieldVersion[field] > sinceVersion || sinceVersion == 0) {
+      changed |= 1UL << field;
+    }
+  }
+  return changed;
+}
+
+// Publish the current track and its names
+void publishTrack(int track, int totalTracks, const char* title, const char* artist) {
+  beginPlayerStateWrite();
+  uint32_t changed = 0;
+  if (playerState.track != track || playerState.totalTracks != totalTracks) {
+    playerState.track = track;
+    playerState.totalTracks = totalTracks;
+    changed |= 1UL << PLAYER_FIELD_TRACK;
+  }
+  if (strncmp(playerState.title, title, PLAYER_TEXT_MAX) != 0 ||
+      strncmp(playerState.artist, artist, PLAYER_TEXT_MAX) != 0) {
+    strlcpy(playerState.title, title, sizeof(playerState.title));
+    strlcpy(playerState.artist, artist, sizeof(playerState.artist));
+    changed |= 1UL << PLAYER_FIELD_NAMES;
+  }
+  endPlayerStateWrite(changed);
+}
+
+// Publish the number of tracks on the card
+void publishTotalTracks(int totalTracks) {
+  beginPlayerStateWrite();
+  bool changed = playerState.totalTracks != totalTracks;
+  playerState.totalTracks = totalTracks;
+  endPlayerStateWrite(changed ? 1UL << PLAYER_FIELD_TRACK : 0);
+}
+
+// Publish play/pause
+void publishPlaying(bool playing) {
+  beginPlayerStateWrite();
+  bool changed = playerState.playing != playing;
+  playerState.playing = playing;
+  endPlayerStateWrite(changed ? 1UL << PLAYER_FIELD_PLAYING : 0);
+}
+
+// Publish the volume
+void publishVolume(int volume) {
+  beginPlayerStateWrite();
+  bool changed = playerState.volume != volume;
+  playerState.volume = volume;
+  endPlayerStateWrite(changed ? 1UL << PLAYER_FIELD_VOLUME : 0);
+}
+
+// Publish the battery level, the time it is expected to last and whether
+// it is low
+void publishBattery(int battery, int runtimeMinutes, bool low) {
+  beginPlayerStateWrite();
+  uint32_t changed = 0;
+  if (playerState.battery != battery || playerState.runtimeMinutes != runtimeMinutes) {
+    changed |= 1UL << PLAYER_FIELD_BATTERY;
+  }
+  if (playerState.batteryLow != low) {
+    changed |= 1UL << PLAYER_FIELD_BATTERY_LOW;
+  }
+  playerState.battery = battery;
+  playerState.runtimeMinutes = runtimeMinutes;
+  playerState.batteryLow = low;
+  endPlayerStateWrite(changed);
+}
+
+#endif // PLAYERSTATE_H
\ No newline at end of file
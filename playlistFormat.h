@@ -0,0 +1,164 @@
+// ESP32 Soundpod - Playlist Format
+// Binary playlist files: a fixed header followed by the track indices as
+// zigzag varint deltas, so sequential runs cost one byte per entry
+
+#ifndef PLAYLISTFORMAT_H
+#define PLAYLISTFORMAT_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <esp_rom_crc.h>
+
+#define PLAYLIST_MAGIC 0x31534C50 // "PLS1"
+#define PLAYLIST_VERSION 1
+#define PLAYLIST_IO_CHUNK 256 // Bytes buffered per read/write
+#define PLAYLIST_NAME_MAX 21  // "/" + name + ".playlist" must fit a SPIFFS path
+#define PLAYLIST_MANIFEST_MAGIC 0x464E4D50 // "PMNF"
+#define PLAYLIST_MANIFEST_VERSION 1
+
+// File header, the body follows directly
+struct PlaylistHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t count;         // Number of tracks
+  uint32_t bodySize;      // Bytes of varint data
+  uint32_t bodyCrc;       // CRC-32 of the body
+  uint32_t crc;           // CRC-32 of the fields above
+};
+
+// Manifest header, count fixed-size entries follow
+struct PlaylistManifestHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entrySize;
+  uint32_t count;
+  uint32_t nextId;        // ID for the next playlist created
+  uint32_t crc;           // CRC-32 of the fields above
+};
+
+// One playlist in the manifest
+struct PlaylistEntry {
+  uint32_t id;
+  uint32_t trackCount;
+  char name[PLAYLIST_NAME_MAX + 1];
+};
+
+// Encode one track index as a zigzag varint delta, returns bytes used
+size_t encodePlaylistEntry(int track, int previous, uint8_t* out) {
+  int32_t delta = (int32_t)track - (int32_t)previous;
+  uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+// Run the encoder over all entries, sending full chunks to the file
+// With file == NULL only the size and CRC are computed.
+bool encodePlaylistBody(File* file, const int* tracks, int count, uint32_t* size, uint32_t* crc) {
+  uint8_t chunk[PLAYLIST_IO_CHUNK];
+  size_t used = 0;
+  int previous = 0;
+  *size = 0;
+  *crc = 0;
+  
+  for (int i = 0; i <= count; i++) {
+    // Flush when another entry might not fit, and once at the end
+    if (i == count || used > PLAYLIST_IO_CHUNK - 5) {
+      *crc = esp_rom_crc32_le(*crc, chunk, used);
+      *size += used;
+      if (file != NULL && file->write(chunk, used) != used) {
+        return false;
+      }
+      used = 0;
+    }
+    if (i < count) {
+      used += encodePlaylistEntry(tracks[i], previous, chunk + used);
+      previous = tracks[i];
+    }
+  }
+  return true;
+}
+
+// Write a playlist file
+bool writePlaylistFile(File& file, const int* tracks, int count) {
+  PlaylistHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = PLAYLIST_MAGIC;
+  header.version = PLAYLIST_VERSION;
+  header.count = count;
+  
+  // Size the body first so the header can go in front without seeking
+  encodePlaylistBody(NULL, tracks, count, &header.bodySize, &header.bodyCrc);
+  header.crc = esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(PlaylistHeader, crc));
+  
+  if (file.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+    return false;
+  }
+  uint32_t size, crc;
+  return encodePlaylistBody(&file, tracks, count, &size, &crc);
+}
+
+// Read and check a playlist header
+bool readPlaylistHeader(File& file, PlaylistHeader* header) {
+  if (file.read((uint8_t*)header, sizeof(*header)) != sizeof(*header)) {
+    return false;
+  }
+  return header->magic == PLAYLIST_MAGIC &&
+         header->version == PLAYLIST_VERSION &&
+         header->crc == esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(PlaylistHeader, crc));
+}
+
+// Decode entries [first, first + capacity) of a playlist into tracks
+// The whole body is read so its CRC can be checked. Returns the number of
+// entries stored, or -1 if the file is damaged.
+int readPlaylistFile(File& file, const PlaylistHeader& header, int first, int* tracks, int capacity) {
+  uint8_t chunk[PLAYLIST_IO_CHUNK];
+  uint32_t remaining = header.bodySize;
+  uint32_t crc = 0;
+  uint32_t value = 0;
+  int shift = 0;
+  int32_t previous = 0;
+  uint32_t decoded = 0;
+  int stored = 0;
+  
+  while (remaining > 0) {
+    size_t length = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+    if (file.read(chunk, length) != length) {
+      return -1;
+    }
+    crc = esp_rom_crc32_le(crc, chunk, length);
+    remaining -= length;
+    
+    for (size_t i = 0; i < length; i++) {
+      value |= (uint32_t)(chunk[i] & 0x7F) << shift;
+      if (chunk[i] & 0x80) {
+        shift += 7;
+        if (shift > 28) {
+          return -1;
+        }
+        continue;
+      }
+      
+      // Undo the zigzag and delta
+      previous += (int32_t)((value >> 1) ^ (0 - (value & 1)));
+      if ((int)decoded >= first && stored < capacity) {
+        tracks[stored++] = previous;
+      }
+      decoded++;
+      value = 0;
+      shift = 0;
+    }
+  }
+  
+  if (crc != header.bodyCrc || decoded != header.count || shift != 0) {
+    return -1;
+  }
+  return stored;
+}
+
+#endif // PLAYLISTFORMAT_H
\ No newline at end of file
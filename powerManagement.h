@@ -8,37 +8,43 @@
 #include <esp_sleep.h>
 #include <esp_pm.h>
 #include "config.h"
+#include "playerState.h"
+#include "battery.h"
+#include "energy.h"
+#include "governor.h"
+#include "rtcState.h"
 
 // External references
-extern void setBatteryPercentage(int percentage);
-extern void stopPlayback();
-extern void savePlaybackState(int track, int volume, bool playing);
-extern int currentTrack;
-extern int currentVolume;
-extern bool isPlaying;
+extern bool requestPlayerStop();
+extern void flushStateSave();
+extern void armDeepSleepWake();
 
 // Power management variables
 unsigned long lastActivityTime = 0;
 unsigned long lastBatteryCheckTime = 0;
 int batteryPercentage = 100;
+int batteryMillivolts = 0;   // Filtered, load-compensated cell voltage
 bool lowPowerMode = false;
 bool batteryLow = false;
+uint8_t batteryCriticalReadings = 0; // Consecutive readings at or below critical
+PlayerState batteryView;     // Player state for load compensation
 
-// ESP32 specific power management
-esp_pm_config_esp32_t pm_config;
+// Function declarations
+void checkBatteryLevel();
+void handleLowBattery();
+void enterLowPowerMode();
+void enterDeepSleep();
+bool stopPlaybackAndWait();
+unsigned long powerNextDeadline();
+uint64_t handleWakeUp();
 
 // Initialize power management
 void initPowerManagement() {
   // Configure ADC for battery monitoring
-  pinMode(BATTERY_LEVEL_PIN, INPUT);
-  analogReadResolution(12); // ESP32 has 12-bit ADC
+  initBatteryMonitor();
   
-  // Set up ESP32 power management if dynamic frequency scaling is desired
-  pm_config.max_freq_mhz = CPU_FREQ_MHZ_ACTIVE;
-  pm_config.min_freq_mhz = CPU_FREQ_MHZ_IDLE;
-  pm_config.light_sleep_enable = true;
-  
-  esp_pm_configure(&pm_config);
+  // Dynamic frequency scaling, the governor picks the clock from the load
+  initGovernor();
   
   Serial.println("Power management initialized");
   
@@ -53,50 +59,66 @@ void recordActivity() {
   // If in low power mode, exit it
   if (lowPowerMode) {
     lowPowerMode = false;
-    // Set CPU to full speed
-    pm_config.max_freq_mhz = CPU_FREQ_MHZ_ACTIVE;
-    esp_pm_configure(&pm_config);
+    setEnergyPowerState(ENERGY_ACTIVE);
+    // Allow full speed again
+    setGovernorCeiling(CPU_FREQ_MHZ_ACTIVE);
     Serial.println("Exiting low power mode");
   }
 }
 
 // Check battery level
 void checkBatteryLevel() {
-  // Only check battery periodically to save power
-  if (millis() - lastBatteryCheckTime < BATTERY_READ_INTERVAL) {
+  // Only check battery periodically to save power, the first reading is
+  // taken straight away
+  if (batteryFilterSeeded && millis() - lastBatteryCheckTime < BATTERY_READ_INTERVAL) {
     return;
   }
   
   lastBatteryCheckTime = millis();
   
-  // Read battery voltage
-  int rawValue = analogRead(BATTERY_LEVEL_PIN);
-  float voltage = rawValue * (3.3 / 4095.0) * 2; // Assuming voltage divider
-  
-  // Convert to percentage
-  float percentage = (voltage - BATTERY_MIN_VOLTAGE) / 
-                    (BATTERY_MAX_VOLTAGE - BATTERY_MIN_VOLTAGE) * 100.0;
-  
-  // Constrain to valid range
-  percentage = constrain(percentage, 0, 100);
+  // Read, undo the playback sag and filter
+  readPlayerState(&batteryView, batteryView.version);
+  int sample = sampleBatteryMillivolts();
+  batteryMillivolts = filterBatteryMillivolts(
+      compensateBatteryLoad(sample, batteryView.playing, batteryView.volume));
   
   // Update battery percentage
-  batteryPercentage = (int)percentage;
-  setBatteryPercentage(batteryPercentage);
+  batteryPercentage = batteryPercentFromMillivolts(batteryMillivolts);
+  int runtimeMinutes = updateRuntimeEstimate(batteryPercentage);
   
   Serial.print("Battery: ");
   Serial.print(batteryPercentage);
   Serial.print("% (");
-  Serial.print(voltage);
-  Serial.println("V)");
+  Serial.print(batteryMillivolts);
+  Serial.print("mV, sampled ");
+  Serial.print(sample);
+  Serial.print("mV), ");
+  Serial.print(runtimeMinutes);
+  Serial.println(" min left");
   
-  // Check for low battery
-  if (batteryPercentage <= 10 && !batteryLow) {
+  // Shutdown needs several low readings in a row, not one bad one
+  if (batteryPercentage <= BATTERY_CRITICAL_PERCENT) {
+    if (batteryCriticalReadings < BATTERY_CRITICAL_READINGS) {
+      batteryCriticalReadings++;
+    }
+  } else {
+    batteryCriticalReadings = 0;
+  }
+  
+  // Check for low battery, the warning clears only well above the trigger
+  bool wasLow = batteryLow;
+  if (!batteryLow && batteryPercentage <= BATTERY_LOW_PERCENT) {
     batteryLow = true;
-    handleLowBattery();
-  } else if (batteryPercentage > 15) {
+  } else if (batteryPercentage >= BATTERY_LOW_CLEAR_PERCENT) {
     batteryLow = false;
   }
+  
+  // The display shows its warning when batteryLow turns on
+  publishBattery(batteryPercentage, runtimeMinutes, batteryLow);
+  
+  if (batteryLow && (!wasLow || batteryCriticalReadings >= BATTERY_CRITICAL_READINGS)) {
+    handleLowBattery();
+  }
 }
 
 // Handle low battery condition
@@ -104,14 +126,18 @@ void handleLowBattery() {
   Serial.println("WARNING: Low battery!");
   
   // Save state before potential shutdown
-  savePlaybackState(currentTrack, currentVolume, isPlaying);
+  flushStateSave();
   
   // If battery is critically low, enter deep sleep
-  if (batteryPercentage <= 5) {
+  if (batteryCriticalReadings >= BATTERY_CRITICAL_READINGS) {
     Serial.println("CRITICAL: Battery critically low, entering deep sleep");
     
     // Stop playback to reduce power consumption
-    stopPlayback();
+    stopPlaybackAndWait();
+    
+    // No wake source at all, a timer left armed by light sleep would
+    // reboot into the same empty cell over and over
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
     
     // Wait for serial output to complete
     delay(500);
@@ -123,6 +149,10 @@ void handleLowBattery() {
 
 // Check if device should enter sleep mode
 void checkPowerStatus() {
+  // Charge the time since the last check, this task also wakes on every
+  // player state change so playback and volume are split accurately
+  accountEnergy();
+  
   // Check battery level
   checkBatteryLevel();
   
@@ -140,14 +170,47 @@ void checkPowerStatus() {
   }
 }
 
+// Milliseconds until checkPowerStatus() has work: the next battery reading
+// or an inactivity timeout
+unsigned long powerNextDeadline() {
+  unsigned long now = millis();
+  long left = (long)(lastBatteryCheckTime + BATTERY_READ_INTERVAL - now);
+  if (!lowPowerMode) {
+    left = min(left, (long)(lastActivityTime + SLEEP_TIMEOUT - now) + 1);
+  }
+  left = min(left, (long)(lastActivityTime + DEEP_SLEEP_TIMEOUT - now) + 1);
+  return left > 0 ? left : 0;
+}
+
+// Stop the player before the chip goes down
+// This runs in the storage task, and the audio task owns the DFPlayer
+// queue, so the stop goes through the command queue. Returns once the
+// player state shows it stopped, or false after PLAYER_STOP_TIMEOUT_MS.
+bool stopPlaybackAndWait() {
+  requestPlayerStop();
+  unsigned long start = millis();
+  PlayerState state;
+  for (;;) {
+    readPlayerState(&state, 0);
+    if (!state.playing) {
+      return true;
+    }
+    if (millis() - start >= PLAYER_STOP_TIMEOUT_MS) {
+      Serial.println("Player did not stop in time");
+      return false;
+    }
+    delay(10);
+  }
+}
+
 // Enter low power mode
 void enterLowPowerMode() {
   Serial.println("Entering low power mode");
   lowPowerMode = true;
   
-  // Reduce CPU frequency
-  pm_config.max_freq_mhz = CPU_FREQ_MHZ_IDLE;
-  esp_pm_configure(&pm_config);
+  // Cap the CPU frequency
+  setGovernorCeiling(CPU_FREQ_MHZ_IDLE);
+  setEnergyPowerState(ENERGY_LOW_POWER);
   
   // Dim display or other power-saving measures could be added here
 }
@@ -157,16 +220,21 @@ void enterDeepSleep() {
   Serial.println("Entering deep sleep mode");
   
   // Save current state
-  savePlaybackState(currentTrack, currentVolume, isPlaying);
+  flushStateSave();
+  
+  // Keep what a button wake needs in RTC memory, so it can skip the
+  // journal, the library scan and the DFPlayer reset
+  PlayerState state;
+  readPlayerState(&state, 0);
+  saveRtcState(state.track, state.volume, state.playing, state.totalTracks);
   
   // Stop playback
-  stopPlayback();
+  stopPlaybackAndWait();
   
   // Configure wake-up sources for ESP32
-  // Configure button GPIOs as wake sources
-  esp_sleep_enable_ext0_wakeup(BUTTON_PLAY_PIN, LOW); // Any button press can wake
-  
-  // Additional wake sources could be added here
+  // Drop the light sleep timer so only a button wakes the chip
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  armDeepSleepWake();
   
   // Wait for serial output to complete
   delay(500);
@@ -178,12 +246,19 @@ void enterDeepSleep() {
 }
 
 // Wake from sleep
-void handleWakeUp() {
+// Returns the pins of the buttons that woke the chip, 0 for any other boot
+uint64_t handleWakeUp() {
   esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
+  uint64_t pins = 0;
   
   Serial.print("Wakeup caused by: ");
   switch(wakeup_reason) {
     case ESP_SLEEP_WAKEUP_EXT0:
+      pins = 1ULL << BUTTON_PLAY_PIN;
+      Serial.println("Button press");
+      break;
+    case ESP_SLEEP_WAKEUP_EXT1:
+      pins = esp_sleep_get_ext1_wakeup_status();
       Serial.println("Button press");
       break;
     case ESP_SLEEP_WAKEUP_TIMER:
@@ -196,6 +271,7 @@ void handleWakeUp() {
   
   // Record activity to prevent immediate sleep
   recordActivity();
+  return pins;
 }
 
 #endif // POWERMANAGEMENT_H
\ No newline at end of file
@@ -0,0 +1,129 @@
+// ESP32 Soundpod - Deep Sleep Resume State
+// What a button wake needs to carry on where deep sleep left off, kept in
+// RTC slow memory: the playback state, the DFPlayer's track count and the
+// track index its numbers were mapped with. It is only trusted after a
+// button wake and with a good CRC; anything else boots the long way.
+
+#ifndef RTCSTATE_H
+#define RTCSTATE_H
+
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include "config.h"
+#include "stateJournal.h"
+#include "trackIndex.h"
+
+#define RTC_STATE_MAGIC 0x52534D50UL // "PMSR"
+
+// Why a button wake took the long way
+enum RtcFallback {
+  RTC_FALLBACK_INVALID,   // Bad magic or CRC, e.g. power was lost
+  RTC_FALLBACK_INDEX,     // Track index changed since the state was saved
+  RTC_FALLBACK_PLAYER,    // DFPlayer did not answer, it was reset
+  RTC_FALLBACK_CARD,      // DFPlayer reports a different track count
+  RTC_FALLBACK_COUNT
+};
+
+// Saved just before deep sleep
+struct RtcResumeState {
+  uint32_t magic;
+  uint16_t track;
+  uint8_t volume;
+  uint8_t flags;            // Bit 0 = playing
+  uint16_t totalTracks;     // DFPlayer file count
+  uint16_t libraryTracks;   // Tracks in the index
+  uint32_t indexGeneration; // Index the track numbers map into
+  uint32_t crc;             // CRC-32 of the fields above
+};
+
+// RTC slow memory keeps its contents through deep sleep, a power-on
+// reset leaves it zero
+RTC_DATA_ATTR RtcResumeState rtcResumeState;
+RTC_DATA_ATTR uint32_t rtcFastResumes = 0;
+RTC_DATA_ATTR uint32_t rtcFallbacks[RTC_FALLBACK_COUNT];
+bool rtcResumeFellBack = false; // This boot hit a fallback already
+
+// Counter names in the exported stats
+const char* const rtcFallbackNames[RTC_FALLBACK_COUNT] = {
+  "fallback_invalid", "fallback_index", "fallback_player", "fallback_card"
+};
+
+// Function declarations
+void saveRtcState(int track, int volume, bool playing, int totalTracks);
+bool takeRtcState(RtcResumeState* state);
+PlaybackState rtcPlaybackState(const RtcResumeState& state, bool play);
+void noteRtcFallback(RtcFallback reason);
+void noteRtcFastResume();
+void printRtcStats();
+
+// CRC of the state's payload
+uint32_t rtcStateCrc(const RtcResumeState& state) {
+  return esp_rom_crc32_le(0, (const uint8_t*)&state, offsetof(RtcResumeState, crc));
+}
+
+// Keep the state for the next button wake
+void saveRtcState(int track, int volume, bool playing, int totalTracks) {
+  rtcResumeState.magic = RTC_STATE_MAGIC;
+  rtcResumeState.track = track;
+  rtcResumeState.volume = volume;
+  rtcResumeState.flags = playing ? 1 : 0;
+  rtcResumeState.totalTracks = totalTracks;
+  rtcResumeState.libraryTracks = trackIndexCount;
+  rtcResumeState.indexGeneration = trackIndexGeneration;
+  rtcResumeState.crc = rtcStateCrc(rtcResumeState);
+}
+
+// Copy out the saved state if it is valid, false otherwise
+// Either way it is used up, so a later reset can't resume from it again.
+bool takeRtcState(RtcResumeState* state) {
+  *state = rtcResumeState;
+  rtcResumeState.magic = 0;
+  
+  if (state->magic != RTC_STATE_MAGIC || state->crc != rtcStateCrc(*state) ||
+      state->track == 0 || state->volume > MAX_VOLUME ||
+      state->track > state->totalTracks) {
+    noteRtcFallback(RTC_FALLBACK_INVALID);
+    return false;
+  }
+  return true;
+}
+
+// The saved state as the journal would have returned it
+// A wake from the play button plays, any other just shows where it was.
+PlaybackState rtcPlaybackState(const RtcResumeState& state, bool play) {
+  PlaybackState playback;
+  playback.lastTrack = state.track;
+  playback.lastVolume = state.volume;
+  playback.wasPlaying = play;
+  return playback;
+}
+
+// Count and log a wake that could not use the saved state
+void noteRtcFallback(RtcFallback reason) {
+  rtcFallbacks[reason]++;
+  rtcResumeFellBack = true;
+  Serial.print("Deep sleep resume: ");
+  Serial.println(rtcFallbackNames[reason]);
+}
+
+// Count a wake that resumed without any fallback
+// Called once the DFPlayer has confirmed the card, the last check.
+void noteRtcFastResume() {
+  if (!rtcResumeFellBack) {
+    rtcFastResumes++;
+  }
+}
+
+// Print how often a wake resumed from RTC memory and why it didn't
+void printRtcStats() {
+  Serial.print("rtc,fast_resume,");
+  Serial.println(rtcFastResumes);
+  for (int i = 0; i < RTC_FALLBACK_COUNT; i++) {
+    Serial.print("rtc,");
+    Serial.print(rtcFallbackNames[i]);
+    Serial.print(",");
+    Serial.println(rtcFallbacks[i]);
+  }
+}
+
+#endif // RTCSTATE_H
\ No newline at end of file
@@ -0,0 +1,210 @@
+// ESP32 Soundpod - State Journal
+// Append-only playback state log on a raw flash partition. Every save adds
+// one small CRC-protected record instead of rewriting a file, so a power cut
+// can at worst lose the record being written.
+
+#ifndef STATEJOURNAL_H
+#define STATEJOURNAL_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include "config.h"
+
+// The partition is a ring of erase sectors filled with fixed records. The
+// record with the highest sequence number and a good CRC is the current
+// state. When the write cursor reaches the next sector that sector is
+// erased, which drops the oldest records and spreads wear over the ring.
+#define STATE_JOURNAL_SECTOR 4096
+#define STATE_JOURNAL_MIN_SECTORS 2 // The newest record must survive an erase
+#define STATE_JOURNAL_RETRIES 4     // Slots tried when a write does not verify
+
+// Last playback state structure
+struct PlaybackState {
+  int lastTrack;
+  int lastVolume;
+  bool wasPlaying;
+};
+
+// One journal record, erased flash (all 0xFF) marks a free slot
+struct StateRecord {
+  uint32_t sequence;
+  uint16_t track;
+  uint8_t volume;
+  uint8_t flags;          // Bit 0 = playing
+  uint32_t reserved;
+  uint32_t crc;           // CRC-32 of the fields above
+};
+
+#define STATE_RECORD_PLAYING 0x01
+#define STATE_RECORDS_PER_SECTOR (STATE_JOURNAL_SECTOR / sizeof(StateRecord))
+
+// Journal state
+const esp_partition_t* stateJournalPartition = NULL;
+uint32_t stateJournalSlots = 0;   // Record slots in the partition
+uint32_t stateJournalCursor = 0;  // Next slot to write
+uint32_t stateJournalSequence = 0; // Sequence of the newest record, 0 = empty
+bool stateJournalReady = false;
+
+// Write cost instrumentation
+unsigned long stateJournalWrites = 0;
+unsigned long stateJournalErases = 0;
+unsigned long stateJournalFailures = 0;
+unsigned long stateJournalWriteMicros = 0; // Time spent in the last append
+
+// Function declarations
+bool openStateJournal();
+bool appendStateJournal(const PlaybackState& state);
+bool readStateJournal(PlaybackState* state);
+
+// CRC of a record's payload
+uint32_t stateRecordCrc(const StateRecord& record) {
+  return esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(StateRecord, crc));
+}
+
+// Check whether a slot is still erased
+bool stateSlotErased(const StateRecord& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  for (size_t i = 0; i < sizeof(record); i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Read one record slot
+bool readStateSlot(uint32_t slot, StateRecord* record) {
+  return esp_partition_read(stateJournalPartition, slot * sizeof(StateRecord),
+                            record, sizeof(*record)) == ESP_OK;
+}
+
+// Locate the journal and find the newest record and the write cursor
+bool openStateJournal() {
+  if (stateJournalReady) {
+    return true;
+  }
+  
+  stateJournalPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                   ESP_PARTITION_SUBTYPE_ANY,
+                                                   STATE_JOURNAL_PARTITION);
+  if (stateJournalPartition == NULL) {
+    Serial.println("State journal partition not found");
+    return false;
+  }
+  
+  uint32_t sectors = stateJournalPartition->size / STATE_JOURNAL_SECTOR;
+  if (sectors < STATE_JOURNAL_MIN_SECTORS) {
+    Serial.println("State journal partition too small");
+    return false;
+  }
+  stateJournalSlots = sectors * STATE_RECORDS_PER_SECTOR;
+  
+  // Find the newest valid record. Torn records fail their CRC and are
+  // skipped, so recovery falls back to the record written before them.
+  uint32_t newest = 0;
+  stateJournalSequence = 0;
+  StateRecord record;
+  for (uint32_t slot = 0; slot < stateJournalSlots; slot++) {
+    if (!readStateSlot(slot, &record) || stateSlotErased(record)) {
+      continue;
+    }
+    if (record.crc == stateRecordCrc(record) && record.sequence > stateJournalSequence) {
+      stateJournalSequence = record.sequence;
+      newest = slot;
+    }
+  }
+  
+  if (stateJournalSequence == 0) {
+    // Empty or unreadable journal, start over from the first sector
+    stateJournalCursor = 0;
+    if (esp_partition_erase_range(stateJournalPartition, 0, STATE_JOURNAL_SECTOR) != ESP_OK) {
+      Serial.println("Failed to erase state journal");
+      return false;
+    }
+    stateJournalErases++;
+  } else {
+    // Continue after the newest record, past any slots a torn write dirtied
+    stateJournalCursor = newest + 1;
+    while (stateJournalCursor % STATE_RECORDS_PER_SECTOR != 0) {
+      if (readStateSlot(stateJournalCursor, &record) && stateSlotErased(record)) {
+        break;
+      }
+      stateJournalCursor++;
+    }
+    stateJournalCursor %= stateJournalSlots;
+  }
+  
+  stateJournalReady = true;
+  return true;
+}
+
+// Append a state record, erasing the next sector when the cursor enters it
+bool appendStateJournal(const PlaybackState& state) {
+  if (!openStateJournal()) {
+    return false;
+  }
+  
+  unsigned long start = micros();
+  StateRecord record;
+  memset(&record, 0, sizeof(record));
+  record.sequence = stateJournalSequence + 1;
+  record.track = state.lastTrack;
+  record.volume = state.lastVolume;
+  record.flags = state.wasPlaying ? STATE_RECORD_PLAYING : 0;
+  record.crc = stateRecordCrc(record);
+  
+  for (int attempt = 0; attempt < STATE_JOURNAL_RETRIES; attempt++) {
+    uint32_t slot = stateJournalCursor;
+    stateJournalCursor = (stateJournalCursor + 1) % stateJournalSlots;
+    
+    if (slot % STATE_RECORDS_PER_SECTOR == 0) {
+      // Entering a sector, its records are the oldest in the ring
+      if (esp_partition_erase_range(stateJournalPartition, slot * sizeof(StateRecord),
+                                    STATE_JOURNAL_SECTOR) != ESP_OK) {
+        continue;
+      }
+      stateJournalErases++;
+    }
+    
+    // Verify the write, a slot that reads back wrong is skipped
+    StateRecord check;
+    if (esp_partition_write(stateJournalPartition, slot * sizeof(StateRecord),
+                            &record, sizeof(record)) == ESP_OK &&
+        readStateSlot(slot, &check) && memcmp(&check, &record, sizeof(record)) == 0) {
+      stateJournalSequence = record.sequence;
+      stateJournalWrites++;
+      stateJournalWriteMicros = micros() - start;
+      return true;
+    }
+  }
+  
+  stateJournalFailures++;
+  stateJournalWriteMicros = micros() - start;
+  Serial.println("Failed to append state journal");
+  return false;
+}
+
+// Read the newest state, false if the journal holds none
+bool readStateJournal(PlaybackState* state) {
+  if (!openStateJournal() || stateJournalSequence == 0) {
+    return false;
+  }
+  
+  // The newest record sits just before the cursor
+  uint32_t slot = stateJournalCursor;
+  StateRecord record;
+  for (uint32_t i = 0; i < stateJournalSlots; i++) {
+    slot = (slot + stateJournalSlots - 1) % stateJournalSlots;
+    if (readStateSlot(slot, &record) && !stateSlotErased(record) &&
+        record.crc == stateRecordCrc(record) && record.sequence == stateJournalSequence) {
+      state->lastTrack = record.track;
+      state->lastVolume = record.volume;
+      state->wasPlaying = (record.flags & STATE_RECORD_PLAYING) != 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif // STATEJOURNAL_H
\ No newline at end of file
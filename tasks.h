@@ -0,0 +1,518 @@
+// ESP32 Soundpod - Tasks
+// Splits the firmware into FreeRTOS tasks. Audio and input share core 1
+// with audio on top, rendering and storage run on core 0 next to the
+// display flush task. Input reaches the audio task through a bounded
+// command queue.
+// No task polls: each blocks until a notification or the next deadline its
+// modules report, and loop() light-sleeps the chip when all of them wait.
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include <esp_sleep.h>
+#include "config.h"
+#include "buttons.h"
+#include "playerState.h"
+
+// Task layout
+#define AUDIO_TASK_STACK 4096
+#define AUDIO_TASK_PRIORITY 4
+#define AUDIO_TASK_CORE 1
+#define INPUT_TASK_STACK 3072
+#define INPUT_TASK_PRIORITY 3
+#define INPUT_TASK_CORE 1
+#define INPUT_TASK_PERIOD_MS 10 // Debounce and repeat timing while a button is active
+#define UI_TASK_STACK 4096
+#define UI_TASK_PRIORITY 2
+#define UI_TASK_CORE 0
+#define STORAGE_TASK_STACK 4096
+#define STORAGE_TASK_PRIORITY 1
+#define STORAGE_TASK_CORE 0
+#define PLAYER_COMMAND_QUEUE_SIZE 16
+
+// External references
+extern void handleAudioPlayback();
+extern void playNextTrack();
+extern void playPreviousTrack();
+extern void togglePlayPause();
+extern void increaseVolume();
+extern void decreaseVolume();
+extern void stopPlayback();
+extern void playTrackByNumber(int trackNumber);
+extern int currentTrack;
+extern void setShuffle(bool enabled);
+extern bool shuffleEnabled;
+extern void onLibraryReady();
+extern void updateDisplay();
+extern void serviceStateSave();
+extern void checkPowerStatus();
+extern unsigned long dfPlayerNextDeadline();
+extern unsigned long displayNextDeadline();
+extern unsigned long stateSaveNextDeadline();
+extern unsigned long powerNextDeadline();
+extern bool isIdle();
+extern void energyEnterSleep();
+extern void energyLeaveSleep();
+extern void recordActivity();
+extern bool governorBoost();
+extern void governorRelease(bool boosted);
+extern void recordTaskWork(unsigned long startMicros);
+extern void serviceGovernor();
+extern unsigned long governorNextDeadline();
+extern void printStats();
+extern TaskHandle_t dfNotifyTask;
+extern TaskHandle_t displayFlushTaskHandle;
+extern bool openBrowser(int track);
+extern int closeBrowser();
+extern bool browserOpen(unsigned long now);
+extern void browseArtistStep(int direction);
+extern void browseLetterStep(int direction);
+
+// Requests from input to the audio task
+enum PlayerCommandType {
+  PLAYER_NEXT,
+  PLAYER_PREVIOUS,
+  PLAYER_TOGGLE,
+  PLAYER_VOLUME_UP,
+  PLAYER_VOLUME_DOWN,
+  PLAYER_SHUFFLE,
+  PLAYER_LIBRARY_READY,
+  PLAYER_STOP,
+  PLAYER_PLAY_TRACK
+};
+
+struct PlayerCommand {
+  uint8_t type;
+  uint16_t track;         // PLAYER_PLAY_TRACK: track number to play
+  uint32_t postedAt;      // micros() when queued, for latency tracking
+};
+
+TaskHandle_t audioTaskHandle = NULL;
+TaskHandle_t inputTaskHandle = NULL;
+TaskHandle_t uiTaskHandle = NULL;
+TaskHandle_t storageTaskHandle = NULL;
+TaskHandle_t sleepTaskHandle = NULL; // Arduino loop task
+QueueHandle_t playerCommandQueue = NULL;
+PlayerState sleepView; // Player state as last seen by the sleep scheduler
+
+// Instrumentation
+unsigned long playerCommandsDropped = 0;
+unsigned long commandLatencyLast = 0; // Queue to execution, microseconds
+unsigned long commandLatencyMax = 0;
+unsigned long audioWakeups = 0;
+unsigned long inputWakeups = 0;
+unsigned long uiWakeups = 0;
+unsigned long storageWakeups = 0;
+unsigned long lightSleepCount = 0;
+unsigned long lightSleepEarlyWakes = 0; // Woken by a button or the DFPlayer
+unsigned long lightSleepMillis = 0;     // Time spent in light sleep
+unsigned long lastStatsPrint = 0;
+
+// Function declarations
+void startTasks();
+bool postPlayerCommand(PlayerCommandType type, int track = 0);
+bool requestPlayerStop();
+void handleButtonEvent(ButtonId button, ButtonEventType type);
+void handleBrowseButton(ButtonId button, ButtonEventType type);
+void audioTask(void* param);
+void inputTask(void* param);
+void uiTask(void* param);
+void storageTask(void* param);
+void audioTaskPass();
+void inputTaskPass();
+void uiTaskPass();
+void storageTaskPass();
+unsigned long storageNextDeadline();
+TickType_t ticksUntil(unsigned long ms);
+unsigned long nextDeadline();
+bool tasksBlocked();
+void sleepUntilNextDeadline();
+void printSleepStats();
+void printCommandStats();
+unsigned long statsNextDeadline();
+void serviceStats();
+
+// Create the queues and start every task
+void startTasks() {
+  playerCommandQueue = xQueueCreate(PLAYER_COMMAND_QUEUE_SIZE, sizeof(PlayerCommand));
+  
+  xTaskCreatePinnedToCore(audioTask, "audio", AUDIO_TASK_STACK, NULL,
+                          AUDIO_TASK_PRIORITY, &audioTaskHandle, AUDIO_TASK_CORE);
+  xTaskCreatePinnedToCore(inputTask, "input", INPUT_TASK_STACK, NULL,
+                          INPUT_TASK_PRIORITY, &inputTaskHandle, INPUT_TASK_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", UI_TASK_STACK, NULL,
+                          UI_TASK_PRIORITY, &uiTaskHandle, UI_TASK_CORE);
+  xTaskCreatePinnedToCore(storageTask, "storage", STORAGE_TASK_STACK, NULL,
+                          STORAGE_TASK_PRIORITY, &storageTaskHandle, STORAGE_TASK_CORE);
+  
+  // Wake the audio task for player replies and the input task for edges
+  dfNotifyTask = audioTaskHandle;
+  buttonNotifyTask = inputTaskHandle;
+  
+  // Rendering, persistence and the sleep scheduler follow the player state.
+  // setup() runs in the loop task, so this is the task loop() runs in.
+  sleepTaskHandle = xTaskGetCurrentTaskHandle();
+  watchPlayerState(uiTaskHandle);
+  watchPlayerState(storageTaskHandle);
+  watchPlayerState(sleepTaskHandle);
+  
+  Serial.println("Tasks started");
+}
+
+// Queue a request for the audio task
+bool postPlayerCommand(PlayerCommandType type, int track) {
+  PlayerCommand command;
+  command.type = type;
+  command.track = track;
+  command.postedAt = micros();
+  if (xQueueSend(playerCommandQueue, &command, 0) != pdTRUE) {
+    playerCommandsDropped++;
+    return false;
+  }
+  xTaskNotifyGive(audioTaskHandle);
+  return true;
+}
+
+// Ask the audio task to stop the player, for tasks that don't own it
+bool requestPlayerStop() {
+  return postPlayerCommand(PLAYER_STOP);
+}
+
+// Button event handler, runs in the input task
+// Holding play opens the artist browser, which then takes the buttons.
+// Without an artist order it toggles shuffle instead.
+void handleButtonEvent(ButtonId button, ButtonEventType type) {
+  recordActivity();
+  
+  if (browserOpen(millis())) {
+    handleBrowseButton(button, type);
+    return;
+  }
+  
+  switch (button) {
+    case BUTTON_PREV:
+      postPlayerCommand(PLAYER_PREVIOUS); // Held: step back through the list
+      break;
+    case BUTTON_NEXT:
+      postPlayerCommand(PLAYER_NEXT);     // Held: step forward through the list
+      break;
+    case BUTTON_VOL_UP:
+      postPlayerCommand(PLAYER_VOLUME_UP); // Held: ramp the volume
+      break;
+    case BUTTON_VOL_DOWN:
+      postPlayerCommand(PLAYER_VOLUME_DOWN);
+      break;
+    case BUTTON_PLAY:
+      if (type != BUTTON_LONG_PRESS) {
+        postPlayerCommand(PLAYER_TOGGLE);
+      } else if (openBrowser(currentTrack)) {
+        xTaskNotifyGive(uiTaskHandle);
+      } else {
+        postPlayerCommand(PLAYER_SHUFFLE);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Buttons while the artist browser is open: prev and next step between
+// artists, the volume buttons between initial letters, play starts the
+// selected artist and holding play toggles shuffle
+void handleBrowseButton(ButtonId button, ButtonEventType type) {
+  switch (button) {
+    case BUTTON_PREV:
+      browseArtistStep(-1);
+      break;
+    case BUTTON_NEXT:
+      browseArtistStep(1);
+      break;
+    case BUTTON_VOL_UP:
+      browseLetterStep(-1);
+      break;
+    case BUTTON_VOL_DOWN:
+      browseLetterStep(1);
+      break;
+    case BUTTON_PLAY:
+      if (type == BUTTON_LONG_PRESS) {
+        closeBrowser();
+        postPlayerCommand(PLAYER_SHUFFLE);
+      } else {
+        postPlayerCommand(PLAYER_PLAY_TRACK, closeBrowser());
+      }
+      break;
+    default:
+      break;
+  }
+  xTaskNotifyGive(uiTaskHandle);
+}
+
+// Carry out one queued request
+void executePlayerCommand(const PlayerCommand& command) {
+  switch (command.type) {
+    case PLAYER_NEXT:
+      playNextTrack();
+      break;
+    case PLAYER_PREVIOUS:
+      playPreviousTrack();
+      break;
+    case PLAYER_TOGGLE:
+      togglePlayPause();
+      break;
+    case PLAYER_VOLUME_UP:
+      increaseVolume();
+      break;
+    case PLAYER_VOLUME_DOWN:
+      decreaseVolume();
+      break;
+    case PLAYER_SHUFFLE:
+      setShuffle(!shuffleEnabled);
+      Serial.println(shuffleEnabled ? "Shuffle on" : "Shuffle off");
+      break;
+    case PLAYER_LIBRARY_READY:
+      onLibraryReady();
+      break;
+    case PLAYER_STOP:
+      stopPlayback();
+      break;
+    case PLAYER_PLAY_TRACK:
+      playTrackByNumber(command.track);
+      break;
+    default:
+      break;
+  }
+}
+
+// Player control: commands from input, DFPlayer replies and events
+void audioTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, ticksUntil(dfPlayerNextDeadline()));
+    audioWakeups++;
+    audioTaskPass();
+  }
+}
+
+// Run the queued commands, then the player's replies and events
+void audioTaskPass() {
+  // Commands and player replies come in short bursts, run them at speed
+  unsigned long workStart = micros();
+  bool boosted = governorBoost();
+  
+  PlayerCommand command;
+  while (xQueueReceive(playerCommandQueue, &command, 0) == pdTRUE) {
+    // Time from the button event to the command being acted on
+    commandLatencyLast = micros() - command.postedAt;
+    if (commandLatencyLast > commandLatencyMax) {
+      commandLatencyMax = commandLatencyLast;
+    }
+    executePlayerCommand(command);
+  }
+  
+  handleAudioPlayback();
+  
+  recordTaskWork(workStart);
+  governorRelease(boosted);
+}
+
+// Button debouncing, sleeps until an edge when no button is active
+void inputTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, buttonsIdle() ? portMAX_DELAY : pdMS_TO_TICKS(INPUT_TASK_PERIOD_MS));
+    inputWakeups++;
+    inputTaskPass();
+  }
+}
+
+// Debounce the edges since the last pass and fire the button events
+void inputTaskPass() {
+  unsigned long workStart = micros();
+  pollButtons();
+  recordTaskWork(workStart);
+}
+
+// Rendering, woken by player state changes and the display's own deadlines
+void uiTask(void* param) {
+  for (;;) {
+    uiTaskPass();
+    ulTaskNotifyTake(pdTRUE, ticksUntil(displayNextDeadline()));
+    uiWakeups++;
+  }
+}
+
+// Draw a frame if one is due
+void uiTaskPass() {
+  // A frame is a burst of drawing, run it at speed
+  unsigned long workStart = micros();
+  bool boosted = governorBoost();
+  updateDisplay();
+  recordTaskWork(workStart);
+  governorRelease(boosted);
+}
+
+// Persistence, battery checks, the frequency governor and the statistics,
+// nothing here is time-critical
+void storageTask(void* param) {
+  for (;;) {
+    storageTaskPass();
+    ulTaskNotifyTake(pdTRUE, ticksUntil(storageNextDeadline()));
+    storageWakeups++;
+  }
+}
+
+// Run whichever of the storage task's services are due
+void storageTaskPass() {
+  unsigned long workStart = micros();
+  serviceStateSave();
+  checkPowerStatus();
+  recordTaskWork(workStart);
+  serviceGovernor();
+  serviceStats();
+}
+
+// Milliseconds until one of the storage task's services is due
+unsigned long storageNextDeadline() {
+  unsigned long deadlines[] = {
+    stateSaveNextDeadline(), powerNextDeadline(), governorNextDeadline(), statsNextDeadline()
+  };
+  unsigned long wait = NO_DEADLINE;
+  for (size_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); i++) {
+    if (deadlines[i] < wait) {
+      wait = deadlines[i];
+    }
+  }
+  return wait;
+}
+
+// Block time for a deadline in milliseconds, rounded up to whole ticks
+TickType_t ticksUntil(unsigned long ms) {
+  if (ms == NO_DEADLINE) {
+    return portMAX_DELAY;
+  }
+  return (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+// Earliest deadline of any module, in milliseconds from now
+unsigned long nextDeadline() {
+  unsigned long deadlines[] = {
+    dfPlayerNextDeadline(), displayNextDeadline(), stateSaveNextDeadline(), powerNextDeadline(),
+    governorNextDeadline(), statsNextDeadline()
+  };
+  unsigned long earliest = NO_DEADLINE;
+  for (size_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); i++) {
+    if (deadlines[i] < earliest) {
+      earliest = deadlines[i];
+    }
+  }
+  return earliest;
+}
+
+// True when every task is waiting for a notification or a timeout
+bool tasksBlocked() {
+  TaskHandle_t tasks[] = {
+    audioTaskHandle, inputTaskHandle, uiTaskHandle, storageTaskHandle, displayFlushTaskHandle
+  };
+  for (size_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+    if (tasks[i] != NULL && eTaskGetState(tasks[i]) != eBlocked) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Light sleep until the next deadline, a button press or DFPlayer traffic
+// Runs from loop(), below every task on core 1.
+void sleepUntilNextDeadline() {
+  readPlayerState(&sleepView, sleepView.version);
+  
+  // UART wakeup loses the bytes that wake the chip, and the player's
+  // "finished" message must arrive whole, so only wait for a pause
+  if (sleepView.playing) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return;
+  }
+  
+  // Too close to be worth it, or a task is still working: look again soon
+  unsigned long wait = nextDeadline();
+  if (wait < LIGHT_SLEEP_MIN_MS || !isIdle()) {
+    unsigned long recheck = wait < LIGHT_SLEEP_MIN_MS ? wait : LIGHT_SLEEP_MIN_MS;
+    ulTaskNotifyTake(pdTRUE, ticksUntil(recheck > 0 ? recheck : 1));
+    return;
+  }
+  
+  armButtonWake();
+  uart_set_wakeup_threshold(DFPLAYER_UART_NUM, LIGHT_SLEEP_UART_EDGES);
+  esp_sleep_enable_uart_wakeup(DFPLAYER_UART_NUM);
+  if (wait != NO_DEADLINE) {
+    esp_sleep_enable_timer_wakeup((uint64_t)wait * 1000);
+  } else {
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  }
+  
+  energyEnterSleep();
+  unsigned long start = millis();
+  esp_light_sleep_start();
+  lightSleepMillis += millis() - start;
+  energyLeaveSleep();
+  lightSleepCount++;
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) {
+    lightSleepEarlyWakes++;
+  }
+  
+  disarmButtonWake();
+  
+  // The tick count stood still while asleep, so the blocked tasks
+  // recompute their deadlines from millis()
+  xTaskNotifyGive(audioTaskHandle);
+  xTaskNotifyGive(uiTaskHandle);
+  xTaskNotifyGive(storageTaskHandle);
+}
+
+// Milliseconds until the statistics are due
+unsigned long statsNextDeadline() {
+  unsigned long elapsed = millis() - lastStatsPrint;
+  return elapsed >= STATS_PRINT_INTERVAL ? 0 : STATS_PRINT_INTERVAL - elapsed;
+}
+
+// Print every module's statistics once per interval, one place for all of
+// them so none goes unread
+void serviceStats() {
+  if (statsNextDeadline() != 0) {
+    return;
+  }
+  lastStatsPrint = millis();
+  printStats();
+}
+
+// Print how much of the uptime was spent in light sleep and how often tasks woke
+void printSleepStats() {
+  unsigned long uptime = millis();
+  if (uptime == 0) {
+    return;
+  }
+  unsigned long wakeups = audioWakeups + inputWakeups + uiWakeups + storageWakeups;
+  
+  Serial.print("Light sleep: ");
+  Serial.print(lightSleepCount);
+  Serial.print(" times, ");
+  Serial.print(lightSleepMillis * 100.0 / uptime);
+  Serial.print("% of uptime, ");
+  Serial.print(lightSleepEarlyWakes);
+  Serial.println(" woken early");
+  Serial.print("Task wakeups per minute: ");
+  Serial.println(wakeups * 60000.0 / uptime);
+}
+
+// Print how long button commands waited for the audio task
+void printCommandStats() {
+  Serial.print("Commands: last ");
+  Serial.print(commandLatencyLast);
+  Serial.print(" us, max ");
+  Serial.print(commandLatencyMax);
+  Serial.print(" us from queue to execution, ");
+  Serial.print(playerCommandsDropped);
+  Serial.println(" dropped");
+}
+
+#endif // TASKS_H
\ No newline at end of file
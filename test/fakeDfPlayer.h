@@ -0,0 +1,131 @@
+// ESP32 Soundpod - Host Test Fake DFPlayer
+// A scripted player on the other end of the UART. It answers after a
+// latency, can drop commands or report busy, and lets a test push raw
+// bytes or frames of its own.
+
+#ifndef TEST_FAKE_DFPLAYER_H
+#define TEST_FAKE_DFPLAYER_H
+
+#include <deque>
+#include <map>
+#include <vector>
+#include "dfPlayer.h"
+
+// A byte on its way to the driver, readable from a given time
+struct FakeByte {
+  unsigned long at;
+  uint8_t data;
+};
+
+// A command the fake player received
+struct FakeCommand {
+  uint8_t command;
+  uint16_t param;
+};
+
+// Scripted DFPlayer on the other end of the UART
+class FakeDfPlayer : public HardwareSerial {
+public:
+  std::vector<FakeCommand> received;
+  std::map<uint8_t, uint16_t> queryReplies; // Reply parameter per query command
+  unsigned long latency = 5;   // Milliseconds before an answer
+  int dropCommands = 0;        // Ignore this many commands
+  int busyCommands = 0;        // Answer this many with a busy error
+  int badFrames = 0;           // Frames from the driver that did not check out
+  
+  int available() override {
+    int count = 0;
+    for (const FakeByte& pending : incoming) {
+      if (pending.at > millis()) {
+        break;
+      }
+      count++;
+    }
+    return count;
+  }
+  
+  int read() override {
+    if (available() == 0) {
+      return -1;
+    }
+    uint8_t data = incoming.front().data;
+    incoming.pop_front();
+    return data;
+  }
+  
+  size_t write(uint8_t data) override {
+    outgoing.push_back(data);
+    if (outgoing.size() == DF_FRAME_SIZE) {
+      receiveFrame();
+      outgoing.clear();
+    }
+    return 1;
+  }
+  
+  using HardwareSerial::write;
+  
+  // Queue raw bytes, readable after delayMs
+  void sendBytes(const std::vector<uint8_t>& bytes, unsigned long delayMs = 0) {
+    // Bytes arrive in time order, whatever order they were queued in
+    unsigned long at = millis() + delayMs;
+    auto it = incoming.end();
+    while (it != incoming.begin() && (it - 1)->at > at) {
+      --it;
+    }
+    for (uint8_t data : bytes) {
+      it = incoming.insert(it, { at, data }) + 1;
+    }
+  }
+  
+  // Queue a frame from the player
+  void sendFrame(uint8_t type, uint16_t value, unsigned long delayMs = 0) {
+    sendBytes(frame(type, value), delayMs);
+  }
+  
+  // A well-formed frame
+  static std::vector<uint8_t> frame(uint8_t type, uint16_t value) {
+    std::vector<uint8_t> bytes = {
+      DF_FRAME_START, DF_FRAME_VERSION, DF_FRAME_LENGTH, type, 0,
+      (uint8_t)(value >> 8), (uint8_t)value, 0, 0, DF_FRAME_END
+    };
+    uint16_t sum = dfChecksum(bytes.data());
+    bytes[7] = sum >> 8;
+    bytes[8] = sum;
+    return bytes;
+  }
+  
+private:
+  std::deque<FakeByte> incoming;
+  std::vector<uint8_t> outgoing;
+  
+  // Answer one command from the driver
+  void receiveFrame() {
+    uint16_t sum = ((uint16_t)outgoing[7] << 8) | outgoing[8];
+    if (outgoing[0] != DF_FRAME_START || outgoing[9] != DF_FRAME_END || sum != dfChecksum(outgoing.data())) {
+      badFrames++;
+      return;
+    }
+    uint8_t command = outgoing[3];
+    received.push_back({ command, (uint16_t)(((uint16_t)outgoing[5] << 8) | outgoing[6]) });
+    
+    if (dropCommands > 0) {
+      dropCommands--;
+      return;
+    }
+    if (busyCommands > 0) {
+      busyCommands--;
+      sendFrame(DF_MSG_ERROR, DF_ERROR_BUSY, latency);
+      return;
+    }
+    if (command == DF_CMD_RESET) {
+      sendFrame(DF_MSG_READY, DF_DEVICE_SD, 1000);
+      return;
+    }
+    sendFrame(DF_MSG_ACK, 0, latency);
+    if (queryReplies.count(command) > 0) {
+      sendFrame(command, queryReplies[command], latency + 5);
+    }
+  }
+};
+
+#endif // TEST_FAKE_DFPLAYER_H
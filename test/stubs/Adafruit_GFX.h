@@ -0,0 +1,91 @@
+// ESP32 Soundpod - Host Test Stubs: graphics
+// Draws into whatever drawPixel() writes to. Text uses a made-up 5x8 font
+// whose glyphs differ per character, enough for the frame to change where
+// the text does.
+
+#ifndef TEST_STUB_ADAFRUIT_GFX_H
+#define TEST_STUB_ADAFRUIT_GFX_H
+
+#include <Arduino.h>
+
+class Adafruit_GFX {
+public:
+  Adafruit_GFX(int16_t w, int16_t h) : width(w), height(h) {}
+  virtual ~Adafruit_GFX() {}
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+  
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    for (int16_t i = x; i < x + w; i++) {
+      for (int16_t j = y; j < y + h; j++) {
+        drawPixel(i, j, color);
+      }
+    }
+  }
+  
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    drawLine(x, y, x + w - 1, y, color);
+    drawLine(x, y + h - 1, x + w - 1, y + h - 1, color);
+    drawLine(x, y, x, y + h - 1, color);
+    drawLine(x + w - 1, y, x + w - 1, y + h - 1, color);
+  }
+  
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+    int16_t steps = max(abs(x1 - x0), abs(y1 - y0));
+    for (int16_t i = 0; i <= steps; i++) {
+      drawPixel(x0 + (steps ? (x1 - x0) * i / steps : 0), y0 + (steps ? (y1 - y0) * i / steps : 0), color);
+    }
+  }
+  
+  // Glyph columns from the character code, bit 7 kept clear as spacing
+  void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size) {
+    for (int8_t col = 0; col < 6; col++) {
+      uint8_t bits = (col < 5) ? (uint8_t)((c * 37 + col * 11) ^ (c >> 1)) & 0x7F : 0;
+      for (int8_t row = 0; row < 8; row++) {
+        if ((bits >> row) & 1) {
+          fillRect(x + col * size, y + row * size, size, size, color);
+        } else if (bg != color) {
+          fillRect(x + col * size, y + row * size, size, size, bg);
+        }
+      }
+    }
+  }
+  
+  void setCursor(int16_t x, int16_t y) { cursorX = x; cursorY = y; }
+  void setTextSize(uint8_t size) { textSize = size; }
+  void setTextColor(uint16_t color) { textColor = color; }
+  void setTextWrap(bool wrap) {}
+  void cp437(bool enable) {}
+  
+  void print(const char* text) {
+    for (; *text; text++) {
+      write(*text);
+    }
+  }
+  void print(long value) {
+    char text[16];
+    snprintf(text, sizeof(text), "%ld", value);
+    print(text);
+  }
+  void print(int value) { print((long)value); }
+  template <typename T> void println(T value) { print(value); write('\n'); }
+  
+  void write(char c) {
+    if (c == '\n') {
+      cursorX = 0;
+      cursorY += 8 * textSize;
+      return;
+    }
+    drawChar(cursorX, cursorY, c, textColor, textColor, textSize);
+    cursorX += 6 * textSize;
+  }
+  
+protected:
+  int16_t width;
+  int16_t height;
+  int16_t cursorX = 0;
+  int16_t cursorY = 0;
+  uint8_t textSize = 1;
+  uint16_t textColor = 1;
+};
+
+#endif // TEST_STUB_ADAFRUIT_GFX_H
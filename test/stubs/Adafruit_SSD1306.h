@@ -0,0 +1,40 @@
+// ESP32 Soundpod - Host Test Stubs: SSD1306 panel
+// The Adafruit buffer layout, one byte per column of each 8-row page. The
+// firmware sends the buffer itself, so the panel only needs to draw.
+
+#ifndef TEST_STUB_ADAFRUIT_SSD1306_H
+#define TEST_STUB_ADAFRUIT_SSD1306_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <vector>
+#include "Adafruit_GFX.h"
+
+#define SSD1306_BLACK 0
+#define SSD1306_WHITE 1
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_COLUMNADDR 0x21
+#define SSD1306_PAGEADDR 0x22
+
+class Adafruit_SSD1306 : public Adafruit_GFX {
+public:
+  Adafruit_SSD1306(int16_t w, int16_t h, TwoWire* wire, int8_t reset)
+    : Adafruit_GFX(w, h), buffer(w * h / 8, 0) {}
+  
+  bool begin(uint8_t vcc, uint8_t address) { return true; }
+  void clearDisplay() { std::fill(buffer.begin(), buffer.end(), 0); }
+  uint8_t* getBuffer() { return buffer.data(); }
+  
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    if (x < 0 || y < 0 || x >= width || y >= height) {
+      return;
+    }
+    uint8_t& column = buffer[x + (y / 8) * width];
+    column = color ? (column | (1 << (y & 7))) : (column & ~(1 << (y & 7)));
+  }
+  
+private:
+  std::vector<uint8_t> buffer;
+};
+
+#endif // TEST_STUB_ADAFRUIT_SSD1306_H
@@ -0,0 +1,305 @@
+// ESP32 Soundpod - Host Test Stubs: Arduino core
+// Just enough of the Arduino and FreeRTOS API for the pure-logic headers
+// to build on the host. Time only moves when a test advances it, pins are
+// plain variables and Serial output is collected instead of printed.
+
+#ifndef TEST_STUB_ARDUINO_H
+#define TEST_STUB_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "WString.h"
+
+typedef uint8_t byte;
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define F(text) (text)
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define CHANGE 0x03
+#define DEC 10
+#define HEX 16
+
+// Host time, advanced by the tests
+unsigned long fakeMicros = 0;
+
+unsigned long micros() {
+  return fakeMicros;
+}
+
+unsigned long millis() {
+  return fakeMicros / 1000;
+}
+
+void advanceMillis(unsigned long ms) {
+  fakeMicros += ms * 1000;
+}
+
+void delay(unsigned long ms) {
+  advanceMillis(ms);
+}
+
+template <typename T, typename U> typename std::common_type<T, U>::type min(T a, U b) { return a < b ? a : b; }
+template <typename T, typename U> typename std::common_type<T, U>::type max(T a, U b) { return a > b ? a : b; }
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+long random(long limit) {
+  return limit > 0 ? rand() % limit : 0;
+}
+
+// BSD string copy, not every host libc has it
+size_t testStrlcpy(char* dst, const char* src, size_t size) {
+  size_t length = strlen(src);
+  if (size > 0) {
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return length;
+}
+#define strlcpy testStrlcpy
+
+// Pins, indexed by GPIO number
+#define FAKE_PIN_COUNT 40
+typedef void (*FakeIsr)(void* arg);
+int fakePinLevel[FAKE_PIN_COUNT];
+FakeIsr fakePinIsr[FAKE_PIN_COUNT];
+void* fakePinIsrArg[FAKE_PIN_COUNT];
+uint32_t fakeAdcMillivolts = 0;       // What analogReadMilliVolts() returns...
+uint32_t (*fakeAdcSource)() = NULL;   // ...unless this supplies each sample
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP) {
+    fakePinLevel[pin] = HIGH;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return fakePinLevel[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  fakePinLevel[pin] = level;
+}
+
+void attachInterruptArg(uint8_t pin, FakeIsr isr, void* arg, int mode) {
+  fakePinIsr[pin] = isr;
+  fakePinIsrArg[pin] = arg;
+}
+
+// Change a pin's level, running its CHANGE interrupt like the GPIO would
+void setFakePin(uint8_t pin, int level) {
+  if (fakePinLevel[pin] == level) {
+    return;
+  }
+  fakePinLevel[pin] = level;
+  if (fakePinIsr[pin] != NULL) {
+    fakePinIsr[pin](fakePinIsrArg[pin]);
+  }
+}
+
+// Reset cause, a test sets what the next boot sees
+typedef enum { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_DEEPSLEEP } esp_reset_reason_t;
+esp_reset_reason_t fakeResetReason = ESP_RST_POWERON;
+
+esp_reset_reason_t esp_reset_reason() {
+  return fakeResetReason;
+}
+
+// CPU clock, the esp_pm stub moves it with the DFS configuration
+uint32_t fakeCpuMhz = 240;
+
+uint32_t getCpuFrequencyMhz() {
+  return fakeCpuMhz;
+}
+
+void analogReadResolution(int bits) {
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return fakeAdcSource != NULL ? fakeAdcSource() : fakeAdcMillivolts;
+}
+
+// FreeRTOS, single-threaded on the host
+typedef int portMUX_TYPE;
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portDISABLE_INTERRUPTS()
+#define portENABLE_INTERRUPTS()
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+#define pdFALSE 0
+#define pdTRUE 1
+
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+typedef uint32_t TickType_t;
+
+typedef int* SemaphoreHandle_t;
+int fakeSemaphore = 0;
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return &fakeSemaphore; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, unsigned long ticks) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+BaseType_t xPortGetCoreID() { return 1; }
+
+unsigned long fakeTaskNotifications = 0;
+void (*fakeNotifyHook)(TaskHandle_t task) = NULL; // Lets a test schedule the notified task
+
+void xTaskNotifyGive(TaskHandle_t task) {
+  fakeTaskNotifications++;
+  if (fakeNotifyHook != NULL) {
+    fakeNotifyHook(task);
+  }
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+  xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, unsigned long ticks) {
+  return 0;
+}
+
+// Tasks never run on the host, tests call their bodies directly. Each
+// gets a handle to where it would run, for tests that schedule them.
+struct FakeTask {
+  const char* name;
+  unsigned priority;
+  BaseType_t core;
+};
+std::deque<FakeTask> fakeTasks;
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack, void* param,
+                                   unsigned priority, TaskHandle_t* handle, BaseType_t core) {
+  fakeTasks.push_back({ name, priority, core });
+  if (handle != NULL) {
+    *handle = &fakeTasks.back();
+  }
+  return pdTRUE;
+}
+
+// Every task but the caller is waiting, as far as a host test can tell
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+eTaskState eTaskGetState(TaskHandle_t task) {
+  return eBlocked;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return NULL;
+}
+
+// Queues, a bounded FIFO of fixed-size items that never blocks
+struct FakeQueue {
+  size_t capacity;
+  size_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+typedef FakeQueue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(size_t capacity, size_t itemSize) {
+  return new FakeQueue{ capacity, itemSize, {} };
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, unsigned long ticks) {
+  if (queue->items.size() >= queue->capacity) {
+    return pdFALSE;
+  }
+  const uint8_t* bytes = (const uint8_t*)item;
+  queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, unsigned long ticks) {
+  if (queue->items.empty()) {
+    return pdFALSE;
+  }
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+// Byte stream, the base of Serial and the DFPlayer's UART
+class Stream {
+public:
+  virtual ~Stream() {}
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual size_t write(uint8_t data) { return 1; }
+  virtual size_t write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      write(data[i]);
+    }
+    return length;
+  }
+
+  void print(const char* text) { output += text; }
+  void print(const std::string& text) { output += text; }
+  void print(const String& text) { output += text.value; }
+  void print(char c) { output += c; }
+  void print(long value, int base = DEC) { printNumber(value, base); }
+  void print(int value, int base = DEC) { printNumber(value, base); }
+  void print(unsigned long value, int base = DEC) { printNumber((long long)value, base); }
+  void print(unsigned int value, int base = DEC) { printNumber(value, base); }
+  void print(unsigned char value, int base = DEC) { printNumber(value, base); }
+  void print(unsigned long long value, int base = DEC) { printNumber((long long)value, base); }
+  void print(double value) { output += std::to_string(value); }
+  template <typename T> void println(T value) { print(value); output += "\n"; }
+  template <typename T> void println(T value, int base) { print(value, base); output += "\n"; }
+  void println() { output += "\n"; }
+
+  std::string output; // Everything printed so far
+
+private:
+  void printNumber(long long value, int base) {
+    char text[32];
+    snprintf(text, sizeof(text), base == HEX ? "%llX" : "%lld", value);
+    output += text;
+  }
+};
+
+class HardwareSerial : public Stream {
+public:
+  void setRxFIFOFull(uint8_t bytes) {}
+  void onReceive(void (*callback)()) {}
+};
+
+HardwareSerial Serial;
+
+// Heap figures, a test sets them to what it wants reported
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return freeHeap; }
+  uint32_t getMinFreeHeap() { return minFreeHeap; }
+  uint32_t freeHeap = 200000;
+  uint32_t minFreeHeap = 200000;
+};
+
+EspClass ESP;
+
+#endif // TEST_STUB_ARDUINO_H
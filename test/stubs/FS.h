@@ -0,0 +1,239 @@
+// ESP32 Soundpod - Host Test Stubs: files
+// A File over an in-memory byte vector. writeLimit makes writes fail once
+// the file would grow past it, like a full filesystem. Opens, reads and
+// seeks are counted, for what a card would have to deliver. FakeFS keeps
+// files by path and lists directories in the order files were added, like
+// FAT.
+
+#ifndef TEST_STUB_FS_H
+#define TEST_STUB_FS_H
+
+#include <Arduino.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+unsigned long fakeFileReads = 0;
+unsigned long fakeFileBytesRead = 0;
+unsigned long fakeFileSeeks = 0;
+unsigned long fakeFileOpens = 0; // Files opened by path or from a directory listing
+
+class File {
+public:
+  File() : pos(0), writeLimit((size_t)-1), open(false) {}
+  explicit File(const std::vector<uint8_t>& contents)
+    : data(new std::vector<uint8_t>(contents)), pos(0), writeLimit((size_t)-1), open(true) {}
+
+  // An empty file open for writing
+  static File empty() {
+    return File(std::vector<uint8_t>());
+  }
+
+  size_t read(uint8_t* buf, size_t size) {
+    size_t n = pos < data->size() ? min(size, data->size() - pos) : 0;
+    memcpy(buf, data->data() + pos, n);
+    pos += n;
+    fakeFileReads++;
+    fakeFileBytesRead += n;
+    return n;
+  }
+
+  int read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+
+  size_t write(const uint8_t* buf, size_t size) {
+    size_t n = pos < writeLimit ? min(size, writeLimit - pos) : 0;
+    if (pos + n > data->size()) {
+      data->resize(pos + n);
+    }
+    memcpy(data->data() + pos, buf, n);
+    pos += n;
+    return n;
+  }
+
+  size_t write(uint8_t b) {
+    return write(&b, 1);
+  }
+
+  void println(const String& line) {
+    write((const uint8_t*)line.c_str(), line.length());
+    write('\n');
+  }
+
+  bool seek(uint32_t offset) {
+    if (offset > data->size()) {
+      return false;
+    }
+    pos = offset;
+    fakeFileSeeks++;
+    return true;
+  }
+
+  size_t size() const { return data ? data->size() : 0; }
+  size_t position() const { return pos; }
+  int available() { return (int)(data->size() - min(pos, data->size())); }
+  void close() { open = false; }
+  operator bool() const { return open; }
+
+  // Directories
+  bool isDirectory() const { return children != nullptr; }
+  const char* name() const { return fileName.c_str(); }
+  const char* path() const { return filePath.c_str(); }
+  long getLastWrite() const { return lastWrite; }
+
+  File openNextFile() {
+    if (children == nullptr || nextChild >= children->size()) {
+      return File();
+    }
+    fakeFileOpens++;
+    return (*children)[nextChild++];
+  }
+
+  void rewindDirectory() {
+    nextChild = 0;
+  }
+
+  // Stub only
+  std::vector<uint8_t>& contents() { return *data; }
+  std::shared_ptr<std::vector<uint8_t>> data;
+  size_t pos;
+  size_t writeLimit;
+  std::string filePath;
+  std::string fileName;
+  long lastWrite = 0;
+  std::shared_ptr<std::vector<File>> children;
+  size_t nextChild = 0;
+
+private:
+  bool open;
+  friend class FakeFS;
+};
+
+// One stored file
+struct FakeFileEntry {
+  std::shared_ptr<std::vector<uint8_t>> data;
+  long modified;
+  unsigned long order; // Directory position
+};
+
+class FakeFS {
+public:
+  bool begin(int arg = 0) { return mounted; }
+
+  File open(const String& path, const char* mode = "r") {
+    fakeFileOpens++;
+    std::string name = path.value;
+    auto it = files.find(name);
+    if (mode[0] == 'w') {
+      FakeFileEntry& entry = files[name];
+      entry.data = std::make_shared<std::vector<uint8_t>>();
+      entry.modified = ++clock;
+      if (it == files.end()) {
+        entry.order = nextOrder++;
+      }
+      return handle(name, entry);
+    }
+    if (it != files.end()) {
+      File file = handle(name, it->second);
+      if (mode[0] == 'a') {
+        file.pos = file.data->size();
+      }
+      return file;
+    }
+    return openDirectory(name);
+  }
+
+  bool exists(const String& path) {
+    return files.count(path.value) != 0;
+  }
+
+  bool remove(const String& path) {
+    return files.erase(path.value) != 0;
+  }
+
+  bool rename(const String& from, const String& to) {
+    auto it = files.find(from.value);
+    if (it == files.end()) {
+      return false;
+    }
+    FakeFileEntry entry = it->second;
+    files.erase(it);
+    files[to.value] = entry;
+    return true;
+  }
+
+  // Stub only
+  void addFile(const std::string& path, const std::vector<uint8_t>& contents, long modified = 0) {
+    FakeFileEntry& entry = files[path];
+    entry.data = std::make_shared<std::vector<uint8_t>>(contents);
+    entry.modified = modified;
+    entry.order = nextOrder++;
+  }
+
+  void clear() {
+    files.clear();
+  }
+
+  std::map<std::string, FakeFileEntry> files;
+  bool mounted = true;
+
+private:
+  File handle(const std::string& path, const FakeFileEntry& entry) {
+    File file;
+    file.data = entry.data;
+    file.open = true;
+    file.filePath = path;
+    file.fileName = path.substr(path.rfind('/') + 1);
+    file.lastWrite = entry.modified;
+    return file;
+  }
+
+  // A directory listing of whatever lies under path, in directory order
+  File openDirectory(const std::string& path) {
+    std::string prefix = (path == "/") ? "/" : path + "/";
+    std::vector<std::pair<unsigned long, File>> found;
+    std::vector<std::string> subdirectories;
+    for (auto& it : files) {
+      if (it.first.compare(0, prefix.size(), prefix) != 0) {
+        continue;
+      }
+      size_t slash = it.first.find('/', prefix.size());
+      if (slash == std::string::npos) {
+        found.push_back({ it.second.order, handle(it.first, it.second) });
+        continue;
+      }
+      std::string subdirectory = it.first.substr(0, slash);
+      if (std::find(subdirectories.begin(), subdirectories.end(), subdirectory) == subdirectories.end()) {
+        subdirectories.push_back(subdirectory);
+        File directory = openDirectory(subdirectory);
+        found.push_back({ it.second.order, directory });
+      }
+    }
+    if (found.empty()) {
+      return File();
+    }
+    std::sort(found.begin(), found.end(),
+              [](const std::pair<unsigned long, File>& a, const std::pair<unsigned long, File>& b) {
+                return a.first < b.first;
+              });
+
+    File directory;
+    directory.open = true;
+    directory.filePath = path;
+    directory.fileName = path.substr(path.rfind('/') + 1);
+    directory.children = std::make_shared<std::vector<File>>();
+    for (auto& entry : found) {
+      directory.children->push_back(entry.second);
+    }
+    return directory;
+  }
+
+  unsigned long nextOrder = 0;
+  long clock = 0;
+};
+
+#endif // TEST_STUB_FS_H
@@ -0,0 +1,11 @@
+// ESP32 Soundpod - Host Test Stubs: SD card
+// The card the library scan walks, in memory.
+
+#ifndef TEST_STUB_SD_H
+#define TEST_STUB_SD_H
+
+#include <FS.h>
+
+FakeFS SD;
+
+#endif // TEST_STUB_SD_H
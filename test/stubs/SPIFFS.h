@@ -0,0 +1,11 @@
+// ESP32 Soundpod - Host Test Stubs: SPIFFS
+// The internal flash filesystem, in memory.
+
+#ifndef TEST_STUB_SPIFFS_H
+#define TEST_STUB_SPIFFS_H
+
+#include <FS.h>
+
+FakeFS SPIFFS;
+
+#endif // TEST_STUB_SPIFFS_H
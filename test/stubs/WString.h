@@ -0,0 +1,42 @@
+// ESP32 Soundpod - Host Test Stubs: String
+// The part of the Arduino String the firmware uses, over std::string.
+
+#ifndef TEST_STUB_WSTRING_H
+#define TEST_STUB_WSTRING_H
+
+#include <string>
+
+class String {
+public:
+  String(const char* text = "") : value(text) {}
+  String(const std::string& text) : value(text) {}
+  String(char c) : value(1, c) {}
+  String(int number) : value(std::to_string(number)) {}
+  String(long number) : value(std::to_string(number)) {}
+  String(unsigned int number) : value(std::to_string(number)) {}
+  String(unsigned long number) : value(std::to_string(number)) {}
+  
+  const char* c_str() const { return value.c_str(); }
+  unsigned int length() const { return value.size(); }
+  bool endsWith(const String& suffix) const {
+    return value.size() >= suffix.value.size() &&
+           value.compare(value.size() - suffix.value.size(), suffix.value.size(), suffix.value) == 0;
+  }
+  int lastIndexOf(char c) const {
+    size_t found = value.rfind(c);
+    return found == std::string::npos ? -1 : (int)found;
+  }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to ? String(value.substr(from, to - from)) : String();
+  }
+  bool operator==(const String& other) const { return value == other.value; }
+  String& operator+=(const String& other) { value += other.value; return *this; }
+  
+  std::string value;
+};
+
+inline String operator+(const String& a, const String& b) { return String(a.value + b.value); }
+inline String operator+(const char* a, const String& b) { return String(a + b.value); }
+inline String operator+(const String& a, const char* b) { return String(a.value + b); }
+
+#endif // TEST_STUB_WSTRING_H
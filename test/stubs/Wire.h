@@ -0,0 +1,45 @@
+// ESP32 Soundpod - Host Test Stubs: I2C
+// Counts what each transaction puts on the bus and charges its bus time to
+// the fake clock at the set bus speed, so a test can run the display
+// against a slow bus.
+
+#ifndef TEST_STUB_WIRE_H
+#define TEST_STUB_WIRE_H
+
+#include <Arduino.h>
+
+#define I2C_BITS_PER_BYTE 9 // 8 data bits and the ACK
+#define I2C_FRAMING_BITS 2  // Start and stop condition
+
+class TwoWire {
+public:
+  void begin(int sda = -1, int scl = -1) {}
+  void setClock(uint32_t hz) { clock = hz; }
+  
+  void beginTransmission(uint8_t address) { pending = 1; } // Address byte
+  size_t write(uint8_t data) { pending++; return 1; }
+  size_t write(const uint8_t* data, size_t length) { pending += length; return length; }
+  
+  uint8_t endTransmission() {
+    transactions++;
+    bytesSent += pending - 1;
+    unsigned long bits = pending * I2C_BITS_PER_BYTE + I2C_FRAMING_BITS;
+    unsigned long micros = (bits * 1000000UL + clock - 1) / clock;
+    busMicros += micros;
+    fakeMicros += micros;
+    pending = 0;
+    return 0;
+  }
+  
+  uint32_t clock = 100000;
+  unsigned long transactions = 0;
+  unsigned long bytesSent = 0; // Everything after the address byte
+  unsigned long busMicros = 0;
+  
+private:
+  unsigned long pending = 0;
+};
+
+TwoWire Wire;
+
+#endif // TEST_STUB_WIRE_H
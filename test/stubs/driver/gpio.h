@@ -0,0 +1,19 @@
+// ESP32 Soundpod - Host Test Stubs: GPIO driver
+// Interrupt and wakeup settings are accepted and ignored, pins live in
+// the Arduino stub.
+
+#ifndef TEST_STUB_DRIVER_GPIO_H
+#define TEST_STUB_DRIVER_GPIO_H
+
+#include <Arduino.h>
+
+typedef int gpio_num_t;
+typedef enum { GPIO_INTR_DISABLE, GPIO_INTR_POSEDGE, GPIO_INTR_NEGEDGE, GPIO_INTR_ANYEDGE, GPIO_INTR_LOW_LEVEL, GPIO_INTR_HIGH_LEVEL } gpio_int_type_t;
+
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) { return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t pin) { return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) { return ESP_OK; }
+esp_err_t gpio_intr_enable(gpio_num_t pin) { return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t pin) { return ESP_OK; }
+
+#endif // TEST_STUB_DRIVER_GPIO_H
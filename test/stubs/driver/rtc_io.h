@@ -0,0 +1,11 @@
+// ESP32 Soundpod - Host Test Stubs: RTC GPIO driver
+
+#ifndef TEST_STUB_DRIVER_RTC_IO_H
+#define TEST_STUB_DRIVER_RTC_IO_H
+
+#include <driver/gpio.h>
+
+esp_err_t rtc_gpio_pullup_en(gpio_num_t pin) { return ESP_OK; }
+esp_err_t rtc_gpio_pulldown_dis(gpio_num_t pin) { return ESP_OK; }
+
+#endif // TEST_STUB_DRIVER_RTC_IO_H
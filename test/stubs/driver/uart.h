@@ -0,0 +1,11 @@
+// ESP32 Soundpod - Host Test Stubs: UART driver
+// Light sleep wakeup settings are accepted and ignored.
+
+#ifndef TEST_STUB_DRIVER_UART_H
+#define TEST_STUB_DRIVER_UART_H
+
+#include <Arduino.h>
+
+esp_err_t uart_set_wakeup_threshold(int uart, int edges) { return ESP_OK; }
+
+#endif // TEST_STUB_DRIVER_UART_H
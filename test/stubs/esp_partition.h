@@ -0,0 +1,172 @@
+// ESP32 Soundpod - Host Test Stubs: flash partitions
+// Partitions are RAM buffers with NOR flash rules: an erase sets a sector to
+// 0xFF and a write can only clear bits. A test can cut the power after a
+// budget of programmed bytes to leave a write or an erase half done. A
+// partition can also live in a file mapped into memory, so the firmware's
+// mapped reads go through the page cache the way they go through the flash
+// cache on the device.
+
+#ifndef TEST_STUB_ESP_PARTITION_H
+#define TEST_STUB_ESP_PARTITION_H
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_PARTITION_TYPE_DATA 0x01
+#define ESP_PARTITION_SUBTYPE_ANY 0xFF
+#define ESP_PARTITION_MMAP_DATA 0
+#define FAKE_FLASH_SECTOR 4096
+
+typedef int esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+typedef int esp_partition_mmap_memory_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+
+struct esp_partition_t {
+  uint32_t size;
+  const char* label;
+  uint8_t* fakeData; // Stub only, the partition's contents
+};
+
+// One fake partition and its contents
+struct FakePartition {
+  esp_partition_t info;
+  std::vector<uint8_t> data; // Empty for a file-mapped partition
+};
+
+std::map<std::string, FakePartition*> fakePartitions;
+unsigned long fakePartitionMaps = 0; // esp_partition_mmap() calls
+long fakeFlashBudget = -1; // Bytes left before the power cut, -1 = never
+bool fakeFlashDead = false; // Power is off, every access fails
+
+// Add an erased partition
+void addFakePartition(const char* label, uint32_t size) {
+  FakePartition* partition = new FakePartition;
+  partition->info.size = size;
+  partition->info.label = label;
+  partition->data.assign(size, 0xFF);
+  partition->info.fakeData = partition->data.data();
+  fakePartitions[label] = partition;
+}
+
+// Add an erased partition backed by a file at path, mapped shared
+void addFileMappedPartition(const char* label, uint32_t size, const char* path) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, size) != 0) {
+    perror(path);
+    abort();
+  }
+  void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    perror(path);
+    abort();
+  }
+  FakePartition* partition = new FakePartition;
+  partition->info.size = size;
+  partition->info.label = label;
+  partition->info.fakeData = (uint8_t*)mapping;
+  memset(mapping, 0xFF, size);
+  fakePartitions[label] = partition;
+}
+
+// Contents of a fake partition kept in RAM
+std::vector<uint8_t>& fakePartitionData(const char* label) {
+  return fakePartitions[label]->data;
+}
+
+// Cut the power after this many more programmed bytes, an erase costs one
+void cutFlashPowerAfter(long bytes) {
+  fakeFlashBudget = bytes;
+  fakeFlashDead = false;
+}
+
+// Power back on, with no cut pending
+void restoreFlashPower() {
+  fakeFlashBudget = -1;
+  fakeFlashDead = false;
+}
+
+// Spend budget, false once the power is gone
+bool spendFlashBudget() {
+  if (fakeFlashDead) {
+    return false;
+  }
+  if (fakeFlashBudget == 0) {
+    fakeFlashDead = true;
+    return false;
+  }
+  if (fakeFlashBudget > 0) {
+    fakeFlashBudget--;
+  }
+  return true;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  auto it = fakePartitions.find(label);
+  return it == fakePartitions.end() ? NULL : &it->second->info;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+  if (fakeFlashDead || offset + size > partition->size) {
+    return ESP_FAIL;
+  }
+  memcpy(dst, partition->fakeData + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+  if (offset + size > partition->size) {
+    return ESP_FAIL;
+  }
+  uint8_t* flash = partition->fakeData + offset;
+  const uint8_t* bytes = (const uint8_t*)src;
+  for (size_t i = 0; i < size; i++) {
+    if (!spendFlashBudget()) {
+      return ESP_FAIL;
+    }
+    flash[i] &= bytes[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+  if (offset % FAKE_FLASH_SECTOR != 0 || size % FAKE_FLASH_SECTOR != 0 || offset + size > partition->size) {
+    return ESP_FAIL;
+  }
+  uint8_t* flash = partition->fakeData + offset;
+  bool wasDead = fakeFlashDead;
+  if (!spendFlashBudget()) {
+    // Power lost during this erase, only the first half got erased
+    if (!wasDead) {
+      memset(flash, 0xFF, size / 2);
+    }
+    return ESP_FAIL;
+  }
+  memset(flash, 0xFF, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out,
+                             esp_partition_mmap_handle_t* handle) {
+  if (fakeFlashDead || offset + size > partition->size) {
+    return ESP_FAIL;
+  }
+  *out = partition->fakeData + offset;
+  *handle = 0;
+  fakePartitionMaps++;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+}
+
+#endif // TEST_STUB_ESP_PARTITION_H
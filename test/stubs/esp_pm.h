@@ -0,0 +1,59 @@
+// ESP32 Soundpod - Host Test Stubs: power management
+// The clock follows the DFS configuration like the driver would: the
+// ceiling while a CPU_FREQ_MAX lock is held, the floor otherwise. A test
+// can have configurations rejected.
+
+#ifndef TEST_STUB_ESP_PM_H
+#define TEST_STUB_ESP_PM_H
+
+#include <Arduino.h>
+
+typedef struct {
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_t;
+typedef esp_pm_config_t esp_pm_config_esp32_t;
+typedef int* esp_pm_lock_handle_t;
+typedef enum { ESP_PM_CPU_FREQ_MAX, ESP_PM_APB_FREQ_MAX, ESP_PM_NO_LIGHT_SLEEP } esp_pm_lock_type_t;
+
+int fakePmLock = 0; // Boost locks held
+int fakePmMinMhz = 240;
+int fakePmMaxMhz = 240;
+bool fakePmReject = false;
+unsigned long fakePmConfigures = 0;
+
+void fakePmUpdateClock() {
+  fakeCpuMhz = fakePmLock > 0 ? fakePmMaxMhz : fakePmMinMhz;
+}
+
+esp_err_t esp_pm_configure(const void* config) {
+  fakePmConfigures++;
+  if (fakePmReject) {
+    return ESP_FAIL;
+  }
+  const esp_pm_config_t* pm = (const esp_pm_config_t*)config;
+  fakePmMinMhz = pm->min_freq_mhz;
+  fakePmMaxMhz = pm->max_freq_mhz;
+  fakePmUpdateClock();
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char* name, esp_pm_lock_handle_t* handle) {
+  *handle = &fakePmLock;
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+  (*handle)++;
+  fakePmUpdateClock();
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+  (*handle)--;
+  fakePmUpdateClock();
+  return ESP_OK;
+}
+
+#endif // TEST_STUB_ESP_PM_H
@@ -0,0 +1,28 @@
+// ESP32 Soundpod - Host Test Stubs: ROM CRC
+// Table-driven CRC-32 with the same chaining as the ROM's esp_rom_crc32_le.
+
+#ifndef TEST_STUB_ESP_ROM_CRC_H
+#define TEST_STUB_ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; bit++) {
+        value = (value >> 1) ^ (0xEDB88320UL & (0 - (value & 1)));
+      }
+      table[i] = value;
+    }
+  }
+  
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc = (crc >> 8) ^ table[(crc ^ buf[i]) & 0xFF];
+  }
+  return ~crc;
+}
+
+#endif // TEST_STUB_ESP_ROM_CRC_H
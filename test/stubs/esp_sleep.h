@@ -0,0 +1,53 @@
+// ESP32 Soundpod - Host Test Stubs: sleep
+// Light sleep moves the fake clock on to the armed timer, and a sleep with
+// no timer returns at once. Other wake sources are accepted and ignored,
+// deep sleep only counts.
+
+#ifndef TEST_STUB_ESP_SLEEP_H
+#define TEST_STUB_ESP_SLEEP_H
+
+#include <Arduino.h>
+
+typedef enum { ESP_EXT1_WAKEUP_ALL_LOW, ESP_EXT1_WAKEUP_ANY_HIGH, ESP_EXT1_WAKEUP_ANY_LOW } esp_sleep_ext1_wakeup_mode_t;
+typedef enum { ESP_PD_DOMAIN_RTC_PERIPH } esp_sleep_pd_domain_t;
+typedef enum { ESP_PD_OPTION_OFF, ESP_PD_OPTION_ON, ESP_PD_OPTION_AUTO } esp_sleep_pd_option_t;
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_ALL, ESP_SLEEP_WAKEUP_EXT0, ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_GPIO, ESP_SLEEP_WAKEUP_UART
+} esp_sleep_wakeup_cause_t;
+
+unsigned long fakeDeepSleeps = 0; // esp_deep_sleep_start() calls, it returns here
+unsigned long fakeLightSleeps = 0;
+uint64_t fakeSleepTimerMicros = 0; // Armed light sleep timer, 0 = none
+esp_sleep_wakeup_cause_t fakeWakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+esp_err_t esp_sleep_enable_uart_wakeup(int uart) { return ESP_OK; }
+void esp_deep_sleep_start() { fakeDeepSleeps++; }
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return fakeWakeupCause; }
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t micros) {
+  fakeSleepTimerMicros = micros;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_wakeup_cause_t source) {
+  if (source == ESP_SLEEP_WAKEUP_TIMER || source == ESP_SLEEP_WAKEUP_ALL) {
+    fakeSleepTimerMicros = 0;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start() {
+  fakeLightSleeps++;
+  fakeMicros += fakeSleepTimerMicros;
+  fakeWakeupCause = fakeSleepTimerMicros != 0 ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+  return ESP_OK;
+}
+uint64_t esp_sleep_get_ext1_wakeup_status() { return 0; }
+esp_err_t esp_sleep_enable_ext0_wakeup(int pin, int level) { return ESP_OK; }
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode) { return ESP_OK; }
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option) { return ESP_OK; }
+
+#endif // TEST_STUB_ESP_SLEEP_H
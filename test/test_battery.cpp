@@ -0,0 +1,226 @@
+// ESP32 Soundpod - Battery Monitor Tests
+// Feeds noisy ADC traces through the real checkBatteryLevel(): a slow
+// discharge with sample noise, ADC spikes and playback sag, and checks
+// that the low-battery warning and the shutdown each trigger exactly once
+// and never on a single bad reading.
+
+#include "testing.h"
+#include "powerManagement.h"
+
+// What the rest of the firmware would do
+bool displayPowered = true;
+unsigned long stateSaves = 0; // flushStateSave() calls, one per handleLowBattery()
+unsigned long playbackStops = 0; // requestPlayerStop() calls
+bool playerAnswersStop = true;    // The audio task acts on the stop
+
+void flushStateSave() {
+  stateSaves++;
+}
+
+bool requestPlayerStop() {
+  playbackStops++;
+  if (playerAnswersStop) {
+    publishPlaying(false);
+  }
+  return true;
+}
+
+void armDeepSleepWake() {
+}
+
+// The simulated cell
+int cellMillivolts = 4000;   // Open-circuit voltage
+int sagMillivolts = 0;       // Drop under the current load
+int noiseMillivolts = 40;    // Peak noise per sample at the ADC pin
+int spikeEvery = 50;         // Every n-th sample reads this far low, 0 = never
+int spikeMillivolts = 400;
+uint32_t noiseState = 12345;
+unsigned long sampleCount = 0;
+
+// One ADC sample of the divided cell voltage
+uint32_t noisySample() {
+  noiseState = noiseState * 1103515245 + 12345;
+  int noise = (int)((noiseState >> 16) % (2 * noiseMillivolts + 1)) - noiseMillivolts;
+  int pin = (cellMillivolts - sagMillivolts) / BATTERY_DIVIDER_RATIO + noise;
+  sampleCount++;
+  if (spikeEvery > 0 && sampleCount % spikeEvery == 0) {
+    pin -= spikeMillivolts;
+  }
+  return pin > 0 ? pin : 0;
+}
+
+// Fresh monitor on a full cell, not playing
+void resetBattery() {
+  fakeAdcSource = noisySample;
+  cellMillivolts = 4100;
+  sagMillivolts = 0;
+  noiseMillivolts = 40;
+  spikeEvery = 50;
+  batteryFilterSeeded = false;
+  batteryLow = false;
+  batteryCriticalReadings = 0;
+  batteryPercentage = 100;
+  stateSaves = 0;
+  playbackStops = 0;
+  fakeDeepSleeps = 0;
+  publishPlaying(false);
+  publishVolume(DEFAULT_VOLUME);
+}
+
+// Advance to the next reading and take it
+void nextReading() {
+  advanceMillis(BATTERY_READ_INTERVAL);
+  checkBatteryLevel();
+}
+
+// The curve is monotonic, clamped and hits its table points
+void testCurve() {
+  CHECK_EQ(batteryPercentFromMillivolts(4300), 100);
+  CHECK_EQ(batteryPercentFromMillivolts(4200), 100);
+  CHECK_EQ(batteryPercentFromMillivolts(3840), 50);
+  CHECK_EQ(batteryPercentFromMillivolts(3270), 0);
+  CHECK_EQ(batteryPercentFromMillivolts(3000), 0);
+  CHECK_EQ(batteryPercentFromMillivolts(3710), 15);
+  int previous = 0;
+  for (int mv = 3000; mv <= 4300; mv++) {
+    int percent = batteryPercentFromMillivolts(mv);
+    CHECK(percent >= previous);
+    previous = percent;
+  }
+}
+
+// A slow discharge warns once, then shuts down once after two critical readings
+void testDischarge() {
+  resetBattery();
+  checkBatteryLevel();
+  int previous = batteryPercentage;
+  int rises = 0;
+  bool warned = false;
+  int readingsWhenWarned = 0;
+  int reading = 0;
+  
+  while (fakeDeepSleeps == 0 && reading < 2000) {
+    cellMillivolts -= 2;
+    nextReading();
+    reading++;
+    if (batteryPercentage > previous + 1) {
+      rises++;
+    }
+    previous = batteryPercentage;
+    if (batteryLow && !warned) {
+      warned = true;
+      readingsWhenWarned = reading;
+      CHECK(batteryPercentage <= BATTERY_LOW_PERCENT);
+      CHECK_EQ(stateSaves, 1);
+    }
+  }
+  
+  CHECK(warned);
+  CHECK_EQ(rises, 0);
+  CHECK_EQ(fakeDeepSleeps, 1);
+  CHECK_EQ(playbackStops, 1);
+  CHECK(batteryPercentage <= BATTERY_CRITICAL_PERCENT);
+  CHECK(reading > readingsWhenWarned);
+  // Warning edge, then the first critical reading, then the shutdown
+  CHECK_EQ(stateSaves, 2);
+}
+
+// Noise around the warning level turns it on once and doesn't flap
+void testHysteresis() {
+  resetBattery();
+  cellMillivolts = 3760; // About 22%
+  noiseMillivolts = 150;
+  checkBatteryLevel();
+  int toggles = 0;
+  bool wasLow = batteryLow;
+  for (int i = 0; i < 300; i++) {
+    cellMillivolts = 3690 + (i % 7) * 5 - 15; // Wanders across 10%
+    nextReading();
+    if (batteryLow != wasLow) {
+      toggles++;
+      wasLow = batteryLow;
+    }
+  }
+  CHECK_EQ(toggles, 1);
+  CHECK_EQ(fakeDeepSleeps, 0);
+  
+  // Charging clears it only well above the trigger
+  for (int i = 0; i < 20 && batteryLow; i++) {
+    cellMillivolts = 3760; // About 22%
+    nextReading();
+  }
+  CHECK(!batteryLow);
+}
+
+// A single bad burst never shuts down, and a moderate one doesn't warn
+void testSingleBadReading() {
+  resetBattery();
+  cellMillivolts = 3900;
+  checkBatteryLevel();
+  for (int i = 0; i < 5; i++) {
+    nextReading();
+  }
+  cellMillivolts = 3600; // A load transient
+  nextReading();
+  cellMillivolts = 3900;
+  nextReading();
+  CHECK(!batteryLow);
+  CHECK_EQ(stateSaves, 0);
+  
+  cellMillivolts = 3000; // A brown-out, the filter only moves a quarter of the way
+  nextReading();
+  cellMillivolts = 3900;
+  for (int i = 0; i < 10; i++) {
+    nextReading();
+  }
+  CHECK(!batteryLow);
+  CHECK_EQ(fakeDeepSleeps, 0);
+  CHECK_EQ(playbackStops, 0);
+}
+
+// Playback sag at full volume is compensated, a healthy cell stays healthy
+void testPlaybackSag() {
+  resetBattery();
+  cellMillivolts = 3740; // About 22% open circuit
+  checkBatteryLevel();
+  int idle = batteryMillivolts;
+  
+  publishPlaying(true);
+  publishVolume(MAX_VOLUME);
+  sagMillivolts = BATTERY_PLAYING_SAG_MV + MAX_VOLUME * BATTERY_SAG_PER_VOLUME_MV;
+  for (int i = 0; i < 30; i++) {
+    nextReading();
+  }
+  CHECK(!batteryLow);
+  CHECK_EQ(fakeDeepSleeps, 0);
+  CHECK(abs(batteryMillivolts - idle) <= 30); // Burst noise, the sag itself is gone
+}
+
+// Shutdown waits for the audio task to stop the player, but not forever
+void testStopWaitsForPlayer() {
+  resetBattery();
+  publishPlaying(true);
+  unsigned long start = millis();
+  CHECK(stopPlaybackAndWait());
+  CHECK_EQ(millis() - start, 0);
+  CHECK_EQ(playbackStops, 1);
+  
+  playerAnswersStop = false;
+  publishPlaying(true);
+  start = millis();
+  CHECK(!stopPlaybackAndWait());
+  CHECK(millis() - start >= PLAYER_STOP_TIMEOUT_MS);
+  CHECK(millis() - start < PLAYER_STOP_TIMEOUT_MS + 20);
+  playerAnswersStop = true;
+  publishPlaying(false);
+}
+
+int main() {
+  testCurve();
+  testDischarge();
+  testHysteresis();
+  testSingleBadReading();
+  testPlaybackSag();
+  testStopWaitsForPlayer();
+  return testResult("test_battery");
+}
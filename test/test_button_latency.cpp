@@ -0,0 +1,267 @@
+// ESP32 Soundpod - Button Latency Tests
+// Schedules the firmware's tasks on two simulated cores by priority, with a
+// modelled CPU time for each pass and the real I2C time for each flush, and
+// presses bouncing volume buttons while the display is busy. Measures the
+// time from the first edge of a press to the audio task acting on it.
+
+#include <algorithm>
+#include <vector>
+#include "testing.h"
+#include "display.h"
+#include "mp3Handler.h"
+#include "dbHandler.h"
+#include "powerManagement.h"
+#include "buttons.h"
+#include "tasks.h"
+#include "fakeDfPlayer.h"
+
+#define STEP_US 50           // Scheduler resolution
+#define AUDIO_PASS_US 300    // Modelled CPU time of each task pass
+#define INPUT_PASS_US 50
+#define UI_PASS_US 200
+#define FRAME_RENDER_US 4000 // Drawing a frame into the buffer
+#define STORAGE_PASS_US 500
+#define PRESSES 100
+
+HardwareSerial playerSerial;
+FakeDfPlayer player;
+
+// What the sketch does
+bool isIdle() {
+  return tasksBlocked() && buttonsIdle() && dfPlayerIdle() && !displayFlushBusy;
+}
+
+void printStats() {
+}
+
+// A task as the simulated scheduler sees it
+struct SimTask {
+  TaskHandle_t handle;
+  unsigned long (*pass)();     // Runs one pass, returns its CPU time in us
+  unsigned long (*deadline)(); // Block time after a pass, in ms
+  unsigned long wakeAt;        // us, NO_DEADLINE to wait for a notification only
+  bool notified;
+  unsigned long busyLeft;      // CPU time of the current pass still to run
+};
+
+unsigned long audioPass() {
+  audioTaskPass();
+  return AUDIO_PASS_US;
+}
+
+unsigned long inputPass() {
+  inputTaskPass();
+  return INPUT_PASS_US;
+}
+
+unsigned long inputDeadline() {
+  return buttonsIdle() ? NO_DEADLINE : INPUT_TASK_PERIOD_MS;
+}
+
+unsigned long uiPass() {
+  unsigned long frames = framesRendered;
+  uiTaskPass();
+  return UI_PASS_US + (framesRendered != frames ? FRAME_RENDER_US : 0);
+}
+
+// The flush task holds the bus for as long as the stub Wire says the
+// transfer takes, and the frame stays busy until then
+unsigned long flushPass() {
+  unsigned long start = fakeMicros;
+  sendDisplayFrame();
+  unsigned long busMicros = fakeMicros - start;
+  fakeMicros = start;
+  displayFlushBusy = true;
+  return busMicros;
+}
+
+unsigned long flushDeadline() {
+  displayFlushBusy = false;
+  return NO_DEADLINE;
+}
+
+unsigned long storagePass() {
+  storageTaskPass();
+  return STORAGE_PASS_US;
+}
+
+std::vector<SimTask> simTasks;
+
+// Notifications make the task ready, also while it runs
+void notifySimTask(TaskHandle_t handle) {
+  for (SimTask& task : simTasks) {
+    if (task.handle == handle) {
+      task.notified = true;
+    }
+  }
+}
+
+// Run each core's highest-priority ready task for one step
+void stepCores() {
+  unsigned long now = fakeMicros;
+  for (BaseType_t core = 0; core < 2; core++) {
+    SimTask* running = NULL;
+    for (SimTask& task : simTasks) {
+      FakeTask* info = (FakeTask*)task.handle;
+      bool ready = task.busyLeft > 0 || task.notified || now >= task.wakeAt;
+      if (info->core == core && ready &&
+          (running == NULL || info->priority > ((FakeTask*)running->handle)->priority)) {
+        running = &task;
+      }
+    }
+    if (running == NULL) {
+      continue;
+    }
+    if (running->busyLeft == 0) {
+      running->notified = false;
+      running->busyLeft = max(running->pass(), 1UL);
+    }
+    running->busyLeft -= min(running->busyLeft, (unsigned long)STEP_US);
+    if (running->busyLeft == 0) {
+      unsigned long wait = running->deadline();
+      running->wakeAt = wait == NO_DEADLINE ? NO_DEADLINE : now + STEP_US + wait * 1000;
+    }
+  }
+}
+
+// Latencies of one scenario, edge to action
+struct LatencyReport {
+  unsigned long p50;
+  unsigned long p99;
+  unsigned long max;
+  unsigned long framesDrawn;
+};
+
+// Bounce a pin to a level over a few ms, as a worn contact does
+// Returns when the pin settles.
+unsigned long scheduleBounce(std::vector<std::pair<unsigned long, int>>& edges, unsigned long at, int level) {
+  int bounces = random(5);
+  for (int i = 0; i < bounces; i++) {
+    edges.push_back({ at, level });
+    at += 100 + random(1400);
+    edges.push_back({ at, !level });
+    at += 100 + random(1400);
+  }
+  edges.push_back({ at, level });
+  return at;
+}
+
+// Press volume up and down in turn while the display does its thing
+LatencyReport pressButtons(const char* name) {
+  commandLatencyMax = 0;
+  unsigned long frames = framesRendered;
+  std::vector<unsigned long> latencies;
+  bool up = true;
+
+  for (int press = 0; press < PRESSES; press++) {
+    uint8_t pin = buttonPins[up ? BUTTON_VOL_UP : BUTTON_VOL_DOWN];
+    std::vector<std::pair<unsigned long, int>> edges;
+    // Some presses land on the volume screen, most on the scrolling title
+    unsigned long pressAt = fakeMicros + (500 + random(displayTimeout + 1000)) * 1000;
+    unsigned long settled = scheduleBounce(edges, pressAt, LOW);
+    scheduleBounce(edges, settled + (100 + random(150)) * 1000, HIGH);
+
+    int volume = currentVolume;
+    unsigned long actedAt = 0;
+    size_t next = 0;
+    while (next < edges.size() || !buttonsIdle()) {
+      while (next < edges.size() && edges[next].first <= fakeMicros) {
+        setFakePin(pin, edges[next].second);
+        next++;
+      }
+      if (player.available() > 0) {
+        dfPlayerOnReceive();
+      }
+      stepCores();
+      if (actedAt == 0 && currentVolume != volume) {
+        actedAt = fakeMicros;
+      }
+      fakeMicros += STEP_US;
+    }
+    CHECK(actedAt != 0);
+    latencies.push_back(actedAt - pressAt);
+    up = !up;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  LatencyReport report;
+  report.p50 = latencies[(latencies.size() - 1) / 2];
+  report.p99 = latencies[(latencies.size() - 1) * 99 / 100];
+  report.max = latencies.back();
+  report.framesDrawn = framesRendered - frames;
+  printf("%-10s press to action p50 %5lu us, p99 %5lu us, max %5lu us; queue to action max %4lu us; %lu frames\n",
+         name, report.p50, report.p99, report.max, commandLatencyMax, report.framesDrawn);
+  return report;
+}
+
+// Boot the modules and put the tasks on the simulated cores
+void bootFirmware() {
+  addFakePartition(STATE_JOURNAL_PARTITION, 0x4000);
+  initDisplay();
+  initButtons(handleButtonEvent);
+  player.latency = 30;
+  dfPlayerBegin(player);
+  dfPlayerListen(player);
+  fakeAdcMillivolts = 1950;
+  totalTracks = 50;
+  resumePending = false;
+  initPowerManagement();
+  startTasks();
+  recordActivity();
+
+  simTasks = {
+    { audioTaskHandle, audioPass, dfPlayerNextDeadline, 0, false, 0 },
+    { inputTaskHandle, inputPass, inputDeadline, NO_DEADLINE, false, 0 },
+    { uiTaskHandle, uiPass, displayNextDeadline, 0, false, 0 },
+    { displayFlushTaskHandle, flushPass, flushDeadline, NO_DEADLINE, false, 0 },
+    { storageTaskHandle, storagePass, storageNextDeadline, 0, false, 0 },
+  };
+  fakeNotifyHook = notifySimTask;
+
+  srand(5);
+  currentTrack = 1;
+  currentVolume = 15;
+  startPlayback();
+}
+
+// Display load sits on core 0 and doesn't hold up the buttons on core 1
+void testLatencyUnderDisplayLoad() {
+  publishTrack(currentTrack, totalTracks, "Short", "Artist");
+  LatencyReport quiet = pressButtons("quiet");
+
+  publishTrack(currentTrack, totalTracks, "A title much too long for the screen to show", "Artist");
+  LatencyReport scrolling = pressButtons("scrolling");
+  CHECK(scrolling.framesDrawn > quiet.framesDrawn * 2);
+
+  Wire.setClock(100000);
+  LatencyReport slowBus = pressButtons("slow bus");
+  Wire.setClock(DISPLAY_I2C_CLOCK);
+
+  // Debounce after the last bounce, then at most one input period
+  unsigned long bound = (BUTTON_DEBOUNCE_MS + INPUT_TASK_PERIOD_MS + 10) * 1000;
+  CHECK(quiet.max <= bound);
+  CHECK(scrolling.max <= bound);
+  CHECK(slowBus.max <= bound);
+  CHECK(scrolling.max <= quiet.max + 1000);
+  CHECK(slowBus.max <= quiet.max + 1000);
+
+  // The audio task preempts the input task the moment a command is queued
+  CHECK(commandLatencyMax <= AUDIO_PASS_US);
+  CHECK_EQ(playerCommandsDropped, 0);
+}
+
+// The command latency goes out with the other statistics
+void testCommandStats() {
+  commandLatencyLast = 120;
+  commandLatencyMax = 250;
+  Serial.output.clear();
+  printCommandStats();
+  CHECK(Serial.output == "Commands: last 120 us, max 250 us from queue to execution, 0 dropped\n");
+}
+
+int main() {
+  bootFirmware();
+  testLatencyUnderDisplayLoad();
+  testCommandStats();
+  return testResult("test_button_latency");
+}
@@ -0,0 +1,216 @@
+// ESP32 Soundpod - Button Tests
+// Drives the pins with synthetic waveforms, bounce included, through the
+// edge interrupt and checks the events the debouncer reports and when.
+
+#include <vector>
+#include "testing.h"
+#include "buttons.h"
+
+// One level change of a waveform, at a time from its start
+struct Edge {
+  uint32_t at;
+  bool pressed;
+};
+
+// An event the handler received
+struct Fired {
+  ButtonId button;
+  ButtonEventType type;
+  uint32_t at;
+};
+std::vector<Fired> fired;
+
+void recordButton(ButtonId button, ButtonEventType type) {
+  fired.push_back({ button, type, (uint32_t)millis() });
+}
+
+// All buttons up, debouncers and ring cleared, a fresh timeline
+void resetButtons() {
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    fakePinLevel[buttonPins[i]] = HIGH;
+  }
+  buttonEdgeHead = 0;
+  buttonEdgeTail = 0;
+  buttonEdgeOverrun = false;
+  buttonOverruns = 0;
+  initButtons(recordButton);
+  advanceMillis(1000);
+  fired.clear();
+}
+
+// Play a waveform on one button for durationMs, polling every pollMs
+// Returns the time the waveform started.
+uint32_t playWaveform(ButtonId button, const std::vector<Edge>& edges, uint32_t durationMs,
+                      uint32_t pollMs = 1) {
+  uint32_t start = millis();
+  size_t next = 0;
+  for (uint32_t t = 0; t <= durationMs; t++) {
+    while (next < edges.size() && edges[next].at == t) {
+      setFakePin(buttonPins[button], edges[next].pressed ? LOW : HIGH);
+      next++;
+    }
+    if (t % pollMs == 0) {
+      pollButtons();
+    }
+    advanceMillis(1);
+  }
+  return start;
+}
+
+// Count the events of one type
+int countFired(ButtonEventType type) {
+  int count = 0;
+  for (const Fired& event : fired) {
+    if (event.type == type) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// A clean press reports once, a debounce time after the edge
+void testCleanPress() {
+  resetButtons();
+  uint32_t start = playWaveform(BUTTON_NEXT, { { 0, true }, { 100, false } }, 200);
+  CHECK_EQ(fired.size(), 1);
+  if (fired.size() == 1) {
+    CHECK_EQ(fired[0].button, BUTTON_NEXT);
+    CHECK_EQ(fired[0].type, BUTTON_PRESSED);
+    CHECK_EQ(fired[0].at - start, BUTTON_DEBOUNCE_MS);
+  }
+  CHECK(buttonsIdle());
+}
+
+// Contact bounce on press settles into one press, timed from the last edge
+void testPressBounce() {
+  resetButtons();
+  uint32_t start = playWaveform(BUTTON_VOL_UP, {
+    { 0, true }, { 2, false }, { 4, true }, { 7, false }, { 9, true }, { 150, false }
+  }, 250);
+  CHECK_EQ(fired.size(), 1);
+  if (fired.size() == 1) {
+    CHECK_EQ(fired[0].type, BUTTON_PRESSED);
+    CHECK_EQ(fired[0].at - start, 9 + BUTTON_DEBOUNCE_MS);
+  }
+}
+
+// Bounce on release adds nothing, and the next press still counts
+void testReleaseBounce() {
+  resetButtons();
+  playWaveform(BUTTON_PREV, {
+    { 0, true }, { 200, false }, { 203, true }, { 205, false }, { 210, true }, { 212, false },
+    { 300, true }, { 350, false }
+  }, 400);
+  CHECK_EQ(fired.size(), 2);
+  CHECK_EQ(countFired(BUTTON_PRESSED), 2);
+  CHECK(buttonsIdle());
+}
+
+// A glitch shorter than the debounce time is ignored
+void testGlitch() {
+  resetButtons();
+  playWaveform(BUTTON_NEXT, { { 0, true }, { BUTTON_DEBOUNCE_MS - 5, false } }, 200);
+  playWaveform(BUTTON_PLAY, { { 0, true }, { 3, false }, { 5, true }, { 8, false } }, 200);
+  CHECK_EQ(fired.size(), 0);
+  CHECK(buttonsIdle());
+}
+
+// Play reports a short press on release, and a long press instead of it
+void testPlayButton() {
+  resetButtons();
+  uint32_t start = playWaveform(BUTTON_PLAY, { { 0, true }, { 200, false } }, 300);
+  CHECK_EQ(fired.size(), 1);
+  if (fired.size() == 1) {
+    CHECK_EQ(fired[0].type, BUTTON_PRESSED);
+    CHECK_EQ(fired[0].at - start, 200 + BUTTON_DEBOUNCE_MS);
+  }
+  
+  fired.clear();
+  start = playWaveform(BUTTON_PLAY, { { 0, true }, { 1500, false } }, 1600);
+  CHECK_EQ(fired.size(), 1);
+  if (fired.size() == 1) {
+    CHECK_EQ(fired[0].type, BUTTON_LONG_PRESS);
+    CHECK_EQ(fired[0].at - start, BUTTON_DEBOUNCE_MS + BUTTON_LONG_PRESS_MS);
+  }
+}
+
+// A held skip or volume button repeats after the delay
+void testRepeat() {
+  resetButtons();
+  uint32_t hold = BUTTON_DEBOUNCE_MS + BUTTON_REPEAT_DELAY_MS + 3 * BUTTON_REPEAT_MS + 10;
+  uint32_t start = playWaveform(BUTTON_VOL_DOWN, { { 0, true }, { hold, false } }, hold + 100);
+  CHECK_EQ(countFired(BUTTON_PRESSED), 1);
+  CHECK_EQ(countFired(BUTTON_REPEAT), 4);
+  CHECK_EQ(countFired(BUTTON_LONG_PRESS), 0);
+  if (fired.size() == 5) {
+    CHECK_EQ(fired[1].at - start, BUTTON_DEBOUNCE_MS + BUTTON_REPEAT_DELAY_MS);
+    CHECK_EQ(fired[2].at - fired[1].at, BUTTON_REPEAT_MS);
+  }
+}
+
+// A press made while loop() was busy is not lost
+void testLatePolling() {
+  resetButtons();
+  playWaveform(BUTTON_NEXT, { { 0, true }, { 3, false }, { 5, true }, { 100, false } }, 400, 400);
+  playWaveform(BUTTON_PLAY, { { 0, true }, { 100, false } }, 400, 400);
+  CHECK_EQ(fired.size(), 2);
+  if (fired.size() == 2) {
+    CHECK_EQ(fired[0].button, BUTTON_NEXT);
+    CHECK_EQ(fired[0].type, BUTTON_PRESSED);
+    CHECK_EQ(fired[1].button, BUTTON_PLAY);
+    CHECK_EQ(fired[1].type, BUTTON_PRESSED);
+  }
+}
+
+// Each button debounces on its own, one bouncing does not block another
+void testIndependentButtons() {
+  resetButtons();
+  uint32_t start = millis();
+  for (uint32_t t = 0; t < 200; t++) {
+    if (t < 20) {
+      setFakePin(BUTTON_VOL_UP_PIN, t % 2 ? LOW : HIGH);
+    }
+    if (t == 5) {
+      setFakePin(BUTTON_PREV_PIN, LOW);
+    }
+    pollButtons();
+    advanceMillis(1);
+  }
+  CHECK_EQ(fired.size(), 2);
+  if (fired.size() == 2) {
+    CHECK_EQ(fired[0].button, BUTTON_PREV);
+    CHECK_EQ(fired[0].at - start, 5 + BUTTON_DEBOUNCE_MS);
+    CHECK_EQ(fired[1].button, BUTTON_VOL_UP);
+  }
+}
+
+// When the ring overflows the real levels are read instead
+void testOverrun() {
+  resetButtons();
+  for (int i = 0; i < BUTTON_EDGE_QUEUE_SIZE * 2; i++) {
+    setFakePin(BUTTON_NEXT_PIN, i % 2 ? HIGH : LOW);
+  }
+  setFakePin(BUTTON_NEXT_PIN, LOW);
+  CHECK(buttonEdgeOverrun);
+  uint32_t start = playWaveform(BUTTON_NEXT, { { 100, false } }, 200);
+  CHECK_EQ(buttonOverruns, 1);
+  CHECK_EQ(countFired(BUTTON_PRESSED), 1);
+  if (!fired.empty()) {
+    CHECK_EQ(fired[0].button, BUTTON_NEXT);
+    CHECK_EQ(fired[0].at - start, BUTTON_DEBOUNCE_MS);
+  }
+  CHECK(buttonsIdle());
+}
+
+int main() {
+  testCleanPress();
+  testPressBounce();
+  testReleaseBounce();
+  testGlitch();
+  testPlayButton();
+  testRepeat();
+  testLatePolling();
+  testIndependentButtons();
+  testOverrun();
+  return testResult("test_buttons");
+}
@@ -0,0 +1,261 @@
+// ESP32 Soundpod - DFPlayer Driver Tests
+// Runs the command queue and frame parser against a scripted fake player
+// that answers after a latency, can drop commands or report busy, and lets
+// a test push raw bytes to check how the parser resynchronises.
+
+#include <vector>
+#include "testing.h"
+#include "dfPlayer.h"
+#include "fakeDfPlayer.h"
+
+// Completed commands, in order
+struct Completion {
+  uint8_t command;
+  bool ok;
+  uint16_t value;
+};
+std::vector<Completion> completions;
+
+void recordCompletion(uint8_t command, bool ok, uint16_t value) {
+  completions.push_back({ command, ok, value });
+}
+
+// Fresh driver and counters on a new fake player
+FakeDfPlayer* startPlayer() {
+  static FakeDfPlayer* player = NULL;
+  delete player;
+  player = new FakeDfPlayer;
+  dfPlayerBegin(*player);
+  completions.clear();
+  dfBadFrames = 0;
+  dfRetries = 0;
+  dfTimeouts = 0;
+  dfEventsDropped = 0;
+  dfRxOverruns = 0;
+  return player;
+}
+
+// Service the driver every millisecond
+void runFor(unsigned long ms) {
+  for (unsigned long i = 0; i < ms; i++) {
+    dfPlayerService();
+    advanceMillis(1);
+  }
+  dfPlayerService();
+}
+
+// Expect exactly these unsolicited messages, in order
+void checkEvents(const std::vector<DfEvent>& expected) {
+  DfEvent event = { 0, 0 };
+  for (const DfEvent& want : expected) {
+    CHECK(dfPlayerReadEvent(&event));
+    CHECK_EQ(event.type, want.type);
+    CHECK_EQ(event.value, want.value);
+  }
+  CHECK(!dfPlayerReadEvent(&event));
+}
+
+// A frame split over several reads is decoded once it is complete
+void testSplitFrame() {
+  FakeDfPlayer* player = startPlayer();
+  std::vector<uint8_t> frame = FakeDfPlayer::frame(DF_MSG_PLAY_FINISHED, 7);
+  player->sendBytes(std::vector<uint8_t>(frame.begin(), frame.begin() + 4));
+  player->sendBytes(std::vector<uint8_t>(frame.begin() + 4, frame.end()), 3);
+  runFor(1);
+  checkEvents({});
+  runFor(3);
+  checkEvents({ { DF_MSG_PLAY_FINISHED, 7 } });
+  CHECK_EQ(dfBadFrames, 0);
+}
+
+// Noise is skipped, broken frames are counted and dropped
+void testGarbageAndBadFrames() {
+  FakeDfPlayer* player = startPlayer();
+  player->sendBytes({ 0x00, 0x12, 0xEF, 0xFF });
+  player->sendFrame(DF_MSG_CARD_INSERTED, 1);
+  
+  std::vector<uint8_t> badSum = FakeDfPlayer::frame(DF_MSG_CARD_REMOVED, 2);
+  badSum[8] ^= 0x01;
+  player->sendBytes(badSum);
+  std::vector<uint8_t> badEnd = FakeDfPlayer::frame(DF_MSG_CARD_REMOVED, 3);
+  badEnd[9] = 0x00;
+  player->sendBytes(badEnd);
+  
+  player->sendFrame(DF_MSG_PLAY_FINISHED, 4);
+  runFor(1);
+  checkEvents({ { DF_MSG_CARD_INSERTED, 1 }, { DF_MSG_PLAY_FINISHED, 4 } });
+  CHECK_EQ(dfBadFrames, 2);
+}
+
+// A frame right after a stray start byte or a cut-off frame is still found
+void testResync() {
+  FakeDfPlayer* player = startPlayer();
+  player->sendBytes({ DF_FRAME_START });
+  player->sendFrame(DF_MSG_PLAY_FINISHED, 5);
+  
+  std::vector<uint8_t> cut = FakeDfPlayer::frame(DF_MSG_CARD_REMOVED, 6);
+  player->sendBytes(std::vector<uint8_t>(cut.begin(), cut.begin() + 5));
+  player->sendFrame(DF_MSG_CARD_INSERTED, 8);
+  runFor(1);
+  checkEvents({ { DF_MSG_PLAY_FINISHED, 5 }, { DF_MSG_CARD_INSERTED, 8 } });
+  CHECK(dfBadFrames > 0);
+}
+
+// A plain command completes on the ACK
+void testAck() {
+  FakeDfPlayer* player = startPlayer();
+  CHECK(dfPlayerSend(DF_CMD_VOLUME, 20, recordCompletion));
+  runFor(2);
+  CHECK_EQ(completions.size(), 0);
+  runFor(10);
+  CHECK_EQ(completions.size(), 1);
+  CHECK_EQ(completions[0].command, DF_CMD_VOLUME);
+  CHECK(completions[0].ok);
+  CHECK_EQ(player->received.size(), 1);
+  CHECK_EQ(player->received[0].param, 20);
+  CHECK_EQ(player->badFrames, 0);
+  CHECK(dfPlayerIdle());
+}
+
+// A query skips the ACK and completes with the reply's value
+void testQuery() {
+  FakeDfPlayer* player = startPlayer();
+  player->queryReplies[DF_CMD_QUERY_SD_FILES] = 42;
+  CHECK(dfPlayerQuery(DF_CMD_QUERY_SD_FILES, recordCompletion));
+  runFor(8);
+  CHECK_EQ(completions.size(), 0);
+  runFor(10);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(completions[0].ok);
+  CHECK_EQ(completions[0].value, 42);
+  checkEvents({});
+}
+
+// Busy is retried at once, other errors fail the command
+void testErrors() {
+  FakeDfPlayer* player = startPlayer();
+  player->busyCommands = 1;
+  CHECK(dfPlayerSend(DF_CMD_PLAY_TRACK, 3, recordCompletion));
+  runFor(20);
+  CHECK_EQ(player->received.size(), 2);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(completions[0].ok);
+  CHECK_EQ(dfRetries, 1);
+  CHECK_EQ(dfTimeouts, 0);
+  
+  player = startPlayer();
+  player->busyCommands = DFPLAYER_RETRIES + 1;
+  CHECK(dfPlayerSend(DF_CMD_PLAY_TRACK, 3, recordCompletion));
+  runFor(50);
+  CHECK_EQ(player->received.size(), DFPLAYER_RETRIES + 1);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(!completions[0].ok);
+  CHECK_EQ(completions[0].value, DF_ERROR_BUSY);
+}
+
+// A dropped command is resent after the timeout
+void testDroppedCommand() {
+  FakeDfPlayer* player = startPlayer();
+  player->dropCommands = 1;
+  CHECK(dfPlayerSend(DF_CMD_PAUSE, 0, recordCompletion));
+  runFor(DFPLAYER_TIMEOUT_MS - 1);
+  CHECK_EQ(player->received.size(), 1);
+  runFor(20);
+  CHECK_EQ(player->received.size(), 2);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(completions[0].ok);
+  CHECK_EQ(dfTimeouts, 1);
+  CHECK_EQ(dfRetries, 1);
+}
+
+// A missing player fails the command after the last retry, then moves on
+void testMissingPlayer() {
+  FakeDfPlayer* player = startPlayer();
+  player->dropCommands = DFPLAYER_RETRIES + 1;
+  CHECK(dfPlayerSend(DF_CMD_STOP, 0, recordCompletion));
+  CHECK(dfPlayerSend(DF_CMD_VOLUME, 10, recordCompletion));
+  runFor((DFPLAYER_RETRIES + 1) * DFPLAYER_TIMEOUT_MS + 20);
+  CHECK_EQ(completions.size(), 2);
+  CHECK_EQ(completions[0].command, DF_CMD_STOP);
+  CHECK(!completions[0].ok);
+  CHECK_EQ(completions[1].command, DF_CMD_VOLUME);
+  CHECK(completions[1].ok);
+  CHECK_EQ(dfTimeouts, DFPLAYER_RETRIES + 1);
+}
+
+// A reset completes when the player reports it is ready
+void testReset() {
+  startPlayer();
+  CHECK(dfPlayerReset(recordCompletion));
+  runFor(DFPLAYER_TIMEOUT_MS * 2);
+  CHECK_EQ(completions.size(), 0);
+  runFor(1000);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(completions[0].ok);
+  CHECK(dfPlayerOnline);
+  CHECK_EQ(dfTimeouts, 0);
+}
+
+// Messages nobody waits for become events, even with a command in flight
+void testEventsDuringCommand() {
+  FakeDfPlayer* player = startPlayer();
+  player->latency = 30;
+  CHECK(dfPlayerSend(DF_CMD_PLAY_TRACK, 9, recordCompletion));
+  runFor(1);
+  player->sendFrame(DF_MSG_PLAY_FINISHED, 8, 5);
+  player->sendFrame(DF_MSG_CARD_REMOVED, 2, 10);
+  runFor(40);
+  CHECK_EQ(completions.size(), 1);
+  CHECK(completions[0].ok);
+  checkEvents({ { DF_MSG_PLAY_FINISHED, 8 }, { DF_MSG_CARD_REMOVED, 2 } });
+}
+
+// Frames that arrive together are all handled in one service pass
+void testBurst() {
+  FakeDfPlayer* player = startPlayer();
+  for (int i = 0; i < DFPLAYER_EVENT_QUEUE_SIZE; i++) {
+    player->sendFrame(DF_MSG_PLAY_FINISHED, i);
+  }
+  dfPlayerService();
+  std::vector<DfEvent> expected;
+  for (int i = 0; i < DFPLAYER_EVENT_QUEUE_SIZE; i++) {
+    expected.push_back({ DF_MSG_PLAY_FINISHED, (uint16_t)i });
+  }
+  checkEvents(expected);
+  CHECK_EQ(dfEventsDropped, 0);
+  CHECK_EQ(dfRxOverruns, 0);
+}
+
+// sendFirst goes ahead of everything queued but not of the one in flight
+void testSendFirst() {
+  FakeDfPlayer* player = startPlayer();
+  CHECK(dfPlayerSend(DF_CMD_VOLUME, 1));
+  CHECK(dfPlayerSend(DF_CMD_VOLUME, 2));
+  CHECK(dfPlayerSend(DF_CMD_VOLUME, 3));
+  runFor(1);
+  CHECK(dfPlayerSendFirst(DF_CMD_PAUSE, 0));
+  runFor(100);
+  CHECK_EQ(player->received.size(), 4);
+  if (player->received.size() == 4) {
+    CHECK_EQ(player->received[0].param, 1);
+    CHECK_EQ(player->received[1].command, DF_CMD_PAUSE);
+    CHECK_EQ(player->received[2].param, 2);
+    CHECK_EQ(player->received[3].param, 3);
+  }
+}
+
+int main() {
+  testSplitFrame();
+  testGarbageAndBadFrames();
+  testResync();
+  testAck();
+  testQuery();
+  testErrors();
+  testDroppedCommand();
+  testMissingPlayer();
+  testReset();
+  testEventsDuringCommand();
+  testBurst();
+  testSendFirst();
+  return testResult("test_dfplayer");
+}
@@ -0,0 +1,210 @@
+// ESP32 Soundpod - Display Flush Tests
+// Renders the real screens into the stub panel and counts the I2C bytes
+// each flush sends: a full frame first, nothing for an identical frame and
+// only the changed column span of each touched page after that.
+
+#include "testing.h"
+#include "display.h"
+
+bool governorBoost() {
+  return false;
+}
+
+void governorRelease(bool boosted) {
+}
+
+void recordTaskWork(unsigned long startMicros) {
+}
+
+// Bytes one page span costs: the window command, then the data in chunks
+unsigned long spanBytes(int columns) {
+  int chunks = (columns + DISPLAY_I2C_CHUNK - 1) / DISPLAY_I2C_CHUNK;
+  return 7 + columns + chunks;
+}
+
+// Draw a screen and send what its flush handed over, as the flush task
+// would. Returns the bytes sent and checks the bus saw the same.
+unsigned long drawAndSend(void (*screen)()) {
+  unsigned long before = Wire.bytesSent;
+  screen();
+  if (displayFlushBusy) {
+    sendDisplayFrame();
+  }
+  CHECK_EQ(Wire.bytesSent - before, displayBytesLastFlush);
+  return displayBytesLastFlush;
+}
+
+// Take the published player state like the UI task does
+void showState() {
+  syncPlayerState();
+  displayDirty = false;
+}
+
+// The first frame after power-up is sent whole, page by page
+void testFirstFrameIsFull() {
+  initDisplay();
+  unsigned long bytes = drawAndSend(displayNowPlaying);
+  CHECK_EQ(displayPagesLastFlush, DISPLAY_PAGE_COUNT);
+  CHECK_EQ(bytes, DISPLAY_PAGE_COUNT * spanBytes(SCREEN_WIDTH));
+}
+
+// Redrawing the same state sends nothing and doesn't wake the flush task
+void testIdenticalFrameSendsNothing() {
+  drawAndSend(displayNowPlaying);
+  unsigned long notifications = fakeTaskNotifications;
+  CHECK_EQ(drawAndSend(displayNowPlaying), 0);
+  CHECK_EQ(displayPagesLastFlush, 0);
+  CHECK_EQ(fakeTaskNotifications, notifications);
+  CHECK(!displayFlushBusy);
+}
+
+// One changed column costs one page with a one-column span
+void testOneColumn() {
+  drawAndSend(displayNowPlaying);
+
+  // Toggle a pixel in page 3, column 77
+  bool lit = (display.getBuffer()[3 * SCREEN_WIDTH + 77] >> 2) & 1;
+  display.drawPixel(77, 3 * 8 + 2, lit ? SSD1306_BLACK : SSD1306_WHITE);
+  flushDisplay();
+  CHECK(displayFlushBusy);
+  sendDisplayFrame();
+  CHECK_EQ(displayPagesLastFlush, 1);
+  CHECK_EQ(displayBytesLastFlush, spanBytes(1));
+  CHECK_EQ(pageSpanFirst[3], 77);
+  CHECK_EQ(pageSpanLast[3], 77);
+  for (uint8_t page = 0; page < DISPLAY_PAGE_COUNT; page++) {
+    if (page != 3) {
+      CHECK_EQ(pageSpanFirst[page], -1);
+    }
+  }
+
+  // The panel copy matches what was drawn, so drawing it back is one more span
+  display.drawPixel(77, 3 * 8 + 2, lit ? SSD1306_WHITE : SSD1306_BLACK);
+  flushDisplay();
+  sendDisplayFrame();
+  CHECK_EQ(displayBytesLastFlush, spanBytes(1));
+}
+
+// A whole frame is never sent while the previous one is on the bus
+void testBusyFlushIsRefused() {
+  display.fillRect(10, 40, 4, 4, SSD1306_WHITE);
+  CHECK(flushDisplay());
+  CHECK(!flushDisplay());
+  sendDisplayFrame();
+  CHECK(flushDisplay());
+}
+
+// Bytes per frame for the three screens the request names, each after a
+// one-step change of what it shows, against a full frame
+void testScreenChanges() {
+  unsigned long full = DISPLAY_PAGE_COUNT * spanBytes(SCREEN_WIDTH);
+
+  publishTrack(3, 40, "Song Three", "Some Artist");
+  showState();
+  drawAndSend(displayNowPlaying);
+  publishPlaying(true);
+  showState();
+  unsigned long nowPlaying = drawAndSend(displayNowPlaying);
+  CHECK(nowPlaying > 0);
+  CHECK(nowPlaying < full / 2);
+  CHECK(displayPagesLastFlush <= 2); // The "Playing" row is 16 pixels high
+
+  publishVolume(10);
+  showState();
+  drawAndSend(displayVolume);
+  publishVolume(11);
+  showState();
+  unsigned long volume = drawAndSend(displayVolume);
+  CHECK(volume > 0);
+  CHECK(volume < full / 2);
+
+  publishBattery(15, -1, true);
+  showState();
+  drawAndSend(displayBatteryLow);
+  publishBattery(14, -1, true);
+  showState();
+  unsigned long batteryLow = drawAndSend(displayBatteryLow);
+  CHECK(batteryLow < full / 2);
+
+  // Screen switches cost more, but still only the pages that differ
+  unsigned long toNowPlaying = drawAndSend(displayNowPlaying);
+  CHECK(toNowPlaying <= full);
+  CHECK_EQ(drawAndSend(displayNowPlaying), 0);
+
+  printf("bytes per frame: full %lu, now playing %lu, volume %lu, battery low %lu\n",
+         full, nowPlaying, volume, batteryLow);
+}
+
+// Run the UI loop against a slow bus for a while, with the transfer in the
+// background like the flush task does it. Volume steps every 30 ms keep it
+// busy. Returns the longest updateDisplay() call in bus time.
+unsigned long runUiLoop(uint32_t busHz, unsigned long* worstFlush, unsigned long* frames) {
+  Wire.setClock(busHz);
+  unsigned long busFreeAt = 0;
+  unsigned long worstCall = 0;
+  unsigned long rendered = framesRendered;
+  *worstFlush = 0;
+  showNowPlaying();
+  
+  for (int ms = 0; ms < 2000; ms++) {
+    if (ms % 30 == 0) {
+      publishVolume(ms % 60 == 0 ? 12 : 13);
+    }
+    
+    unsigned long start = micros();
+    updateDisplay();
+    worstCall = max(worstCall, micros() - start);
+    
+    // The flush task picks the frame up and owns the bus until it is sent
+    if (displayFlushBusy && busFreeAt == 0) {
+      unsigned long sendStart = micros();
+      sendDisplayFrame();
+      busFreeAt = micros();
+      fakeMicros = sendStart;
+      displayFlushBusy = true;
+      *worstFlush = max(*worstFlush, busFreeAt - sendStart);
+    }
+    advanceMillis(1);
+    if (busFreeAt != 0 && micros() >= busFreeAt) {
+      displayFlushBusy = false;
+      busFreeAt = 0;
+    }
+  }
+  *frames = framesRendered - rendered;
+  return worstCall;
+}
+
+// updateDisplay() never waits for the bus, however slow it is. A slow bus
+// only lowers the frame rate, and fast mode sends a full frame within one
+// frame period.
+void testSlowBusLoopLatency() {
+  unsigned long worstFlush;
+  unsigned long frames;
+  unsigned long slowCall = runUiLoop(100000, &worstFlush, &frames);
+  CHECK_EQ(slowCall, 0);
+  CHECK(worstFlush > 0);
+  printf("100 kHz bus: loop blocked %lu us at worst, %lu frames in 2 s, "
+         "a blocking flush would stall it %lu us\n", slowCall, frames, worstFlush);
+  
+  unsigned long fastCall = runUiLoop(DISPLAY_I2C_CLOCK, &worstFlush, &frames);
+  CHECK_EQ(fastCall, 0);
+  printf("%d kHz bus: loop blocked %lu us at worst, %lu frames in 2 s, "
+         "a blocking flush would stall it %lu us\n", DISPLAY_I2C_CLOCK / 1000, fastCall, frames, worstFlush);
+  
+  // A whole frame, the worst case, at the configured clock
+  panelFrameValid = false;
+  Wire.setClock(DISPLAY_I2C_CLOCK);
+  flushDisplay();
+  sendDisplayFrame();
+  CHECK(displayFlushMicros < 1000000UL / DISPLAY_MAX_FPS);
+}
+
+int main() {
+  testFirstFrameIsFull();
+  testIdenticalFrameSendsNothing();
+  testOneColumn();
+  testBusyFlushIsRefused();
+  testScreenChanges();
+  testSlowBusLoopLatency();
+  return testResult("test_display");
+}
@@ -0,0 +1,213 @@
+// ESP32 Soundpod - Frequency Governor Tests
+// Replays traces of task work through the real governor, once with it
+// moving the clock and once fixed at the ceiling, and compares the charge
+// the power model gives each. Work is a cycle count, so it takes longer at
+// a lower clock. Also checks that boosted work is weighed at the clock it
+// ran at, and that a rejected DFS configuration turns the governor off.
+
+#include <vector>
+#include "testing.h"
+#include "energy.h"
+#include "governor.h"
+
+bool displayPowered = true;
+
+// Something a task does over and over
+struct TraceWork {
+  unsigned long periodMs;
+  uint32_t cycles;   // CPU cycles, MHz times microseconds
+  bool boosted;      // Held under the boost lock
+};
+
+// Charge while replaying, integrated at the clock the stub is at
+double chargeMicroAmpMicros = 0;
+unsigned long settledAt = 0;
+unsigned long clockMicros[GOVERNOR_STEP_COUNT];
+
+// Draw while playing with the display on, only the clock varies
+int32_t playingMicroAmps(uint16_t cpuMhz) {
+  EnergySnapshot snapshot = { ENERGY_ACTIVE, cpuMhz, true, true, 15 };
+  return modelCurrentMicroAmps(snapshot);
+}
+
+// Charge the time since the last call at the current clock
+void settle() {
+  unsigned long elapsed = micros() - settledAt;
+  settledAt = micros();
+  chargeMicroAmpMicros += (double)playingMicroAmps(getCpuFrequencyMhz()) * elapsed;
+  for (size_t i = 0; i < GOVERNOR_STEP_COUNT; i++) {
+    if (governorSteps[i] == getCpuFrequencyMhz()) {
+      clockMicros[i] += elapsed;
+    }
+  }
+}
+
+// Run one piece of work the way the tasks do
+void runWork(const TraceWork& work) {
+  settle();
+  unsigned long start = micros();
+  bool boosted = work.boosted ? governorBoost() : false;
+  settle();
+  fakeMicros += work.cycles / getCpuFrequencyMhz();
+  settle();
+  recordTaskWork(start);
+  governorRelease(boosted);
+}
+
+// Fresh governor at full speed, fixed there unless adaptive
+void startGovernor(bool adaptive) {
+  fakeMicros = 0;
+  fakePmLock = 0;
+  fakePmReject = false;
+  governorReady = false;
+  governorDisabled = false;
+  governorCalmWindows = 0;
+  governorChanges = 0;
+  governorWorkCycles[0] = 0;
+  governorWorkCycles[1] = 0;
+  initGovernor();
+  governorDisabled = !adaptive;
+  chargeMicroAmpMicros = 0;
+  settledAt = 0;
+  memset(clockMicros, 0, sizeof(clockMicros));
+}
+
+// What one replay cost
+struct ReplayResult {
+  double averageMicroAmps;
+  unsigned long maxLateMicros; // Longest a millisecond tick found work still running
+};
+
+// Replay the trace for durationMs and return the average draw
+ReplayResult replay(const std::vector<TraceWork>& trace, unsigned long durationMs, bool adaptive) {
+  startGovernor(adaptive);
+  ReplayResult result = { 0, 0 };
+  for (unsigned long ms = 0; ms < durationMs; ms++) {
+    unsigned long tick = ms * 1000;
+    if (fakeMicros < tick) {
+      settle();
+      fakeMicros = tick;
+    } else {
+      result.maxLateMicros = max(result.maxLateMicros, fakeMicros - tick);
+    }
+    for (const TraceWork& work : trace) {
+      if (ms % work.periodMs == 0) {
+        runWork(work);
+      }
+    }
+    settle();
+    serviceGovernor();
+  }
+  settle();
+  fakeMicros = durationMs * 1000;
+  settle();
+  result.averageMicroAmps = chargeMicroAmpMicros / fakeMicros;
+  return result;
+}
+
+// Replay with and without the governor, returns the percentage saved
+double compare(const char* name, const std::vector<TraceWork>& trace, unsigned long durationMs) {
+  ReplayResult fixed = replay(trace, durationMs, false);
+  CHECK_EQ(clockMicros[GOVERNOR_STEP_COUNT - 1], durationMs * 1000);
+  ReplayResult adaptive = replay(trace, durationMs, true);
+  double saved = (fixed.averageMicroAmps - adaptive.averageMicroAmps) * 100 / fixed.averageMicroAmps;
+
+  printf("%-10s %6.1f mA vs %6.1f mA at %d MHz, %4.1f%% saved; floor %u MHz, %lu changes; time at",
+         name, adaptive.averageMicroAmps / 1000, fixed.averageMicroAmps / 1000, CPU_FREQ_MHZ_ACTIVE,
+         saved, governorFloorMhz, governorChanges);
+  for (size_t i = 0; i < GOVERNOR_STEP_COUNT; i++) {
+    printf(" %u: %.1f%%", governorSteps[i], clockMicros[i] * 100.0 / (durationMs * 1000));
+  }
+  printf("\n");
+
+  // The slower clock still gets each piece of work done before it is due again
+  unsigned long shortestPeriod = NO_DEADLINE;
+  for (const TraceWork& work : trace) {
+    shortestPeriod = min(shortestPeriod, work.periodMs);
+  }
+  CHECK(adaptive.maxLateMicros < shortestPeriod * 1000);
+  CHECK(governorLastLoad <= 100);
+  return saved;
+}
+
+// Playing with a scrolling title: a frame and its flush every 50 ms under
+// the boost lock, the storage task's bookkeeping once a second without it
+void testPlayingTrace() {
+  std::vector<TraceWork> trace = {
+    { MARQUEE_STEP_MS, 300000, true },  // Render a frame
+    { MARQUEE_STEP_MS, 100000, true },  // Send it to the panel
+    { 1000, 50000, false },             // Save state, battery, stats
+  };
+  double saved = compare("playing", trace, 600000);
+  CHECK_EQ(governorFloorMhz, GOVERNOR_MIN_MHZ);
+  CHECK(saved > 10);
+}
+
+// A button held: the input task polls every 10 ms unboosted, repeats step
+// through the list and redraw
+void testBrowsingTrace() {
+  std::vector<TraceWork> trace = {
+    { 10, 20000, false },                   // Debounce and repeat timing
+    { BUTTON_REPEAT_MS, 100000, true },      // Audio task acts on the repeat
+    { 1000 / DISPLAY_MAX_FPS, 1000000, true }, // Redraw the list
+  };
+  double saved = compare("browsing", trace, 120000);
+  CHECK(saved > 5);
+}
+
+// Heavy work outside the boost lock lifts the floor until it fits
+void testBackgroundTrace() {
+  std::vector<TraceWork> trace = {
+    { 10, 400000, false }, // Needs 40 MHz busy, 80 MHz at the target load
+  };
+  double saved = compare("background", trace, 60000);
+  CHECK(governorFloorMhz >= 80);
+  CHECK(governorFloorMhz < CPU_FREQ_MHZ_ACTIVE);
+  CHECK(saved > 0);
+}
+
+// Work under the boost lock is weighed at the ceiling even with a low floor
+void testBoostedWorkAtCeiling() {
+  startGovernor(true);
+  applyGovernor(GOVERNOR_MIN_MHZ, CPU_FREQ_MHZ_ACTIVE);
+  CHECK_EQ(getCpuFrequencyMhz(), GOVERNOR_MIN_MHZ);
+  governorWorkCycles[1] = 0;
+
+  TraceWork frame = { 1, CPU_FREQ_MHZ_ACTIVE * 1000, true };
+  runWork(frame);
+  CHECK_EQ(governorWorkCycles[1], CPU_FREQ_MHZ_ACTIVE * 1000);
+  CHECK_EQ(getCpuFrequencyMhz(), GOVERNOR_MIN_MHZ);
+
+  TraceWork poll = { 1, GOVERNOR_MIN_MHZ * 1000, false };
+  runWork(poll);
+  CHECK_EQ(governorWorkCycles[1], (CPU_FREQ_MHZ_ACTIVE + GOVERNOR_MIN_MHZ) * 1000);
+}
+
+// A rejected configuration is not retried, and the storage task stops
+// waking for the governor
+void testRejectedConfiguration() {
+  startGovernor(true);
+  fakePmReject = true;
+  applyGovernor(GOVERNOR_MIN_MHZ, CPU_FREQ_MHZ_ACTIVE);
+  CHECK(governorDisabled);
+  CHECK_EQ(governorFloorMhz, CPU_FREQ_MHZ_ACTIVE);
+  CHECK_EQ(governorNextDeadline(), NO_DEADLINE);
+
+  unsigned long configures = fakePmConfigures;
+  TraceWork light = { 1, 1000, false };
+  for (int i = 0; i < 10; i++) {
+    runWork(light);
+    advanceMillis(GOVERNOR_WINDOW_MS);
+    serviceGovernor();
+  }
+  CHECK_EQ(fakePmConfigures, configures);
+}
+
+int main() {
+  testPlayingTrace();
+  testBrowsingTrace();
+  testBackgroundTrace();
+  testBoostedWorkAtCeiling();
+  testRejectedConfiguration();
+  return testResult("test_governor");
+}
@@ -0,0 +1,265 @@
+// ESP32 Soundpod - ID3 Parser Tests
+// A corpus of tag variants built byte by byte: ID3v1/v1.1, ID3v2.2, v2.3
+// with unsynchronisation and an extended header, v2.4 with syncsafe sizes
+// and per-frame flags, and the cases the parser has to skip or fall back on.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "testing.h"
+#include "id3Parser.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+Bytes operator+(Bytes a, const Bytes& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+Bytes text(const std::string& value) {
+  return Bytes(value.begin(), value.end());
+}
+
+Bytes syncsafe(uint32_t n) {
+  return { (uint8_t)((n >> 21) & 0x7F), (uint8_t)((n >> 14) & 0x7F), (uint8_t)((n >> 7) & 0x7F), (uint8_t)(n & 0x7F) };
+}
+
+Bytes bigEndian(uint32_t n, int width) {
+  Bytes out;
+  for (int i = width - 1; i >= 0; i--) {
+    out.push_back((uint8_t)(n >> (8 * i)));
+  }
+  return out;
+}
+
+// A text frame body: encoding byte, then the value
+Bytes latin1(const std::string& value) {
+  return Bytes{ 0 } + text(value);
+}
+
+// Insert a zero after every 0xFF
+Bytes unsynchronise(const Bytes& data) {
+  Bytes out;
+  for (uint8_t b : data) {
+    out.push_back(b);
+    if (b == 0xFF) {
+      out.push_back(0);
+    }
+  }
+  return out;
+}
+
+Bytes frameV22(const char* id, const Bytes& body) {
+  return text(id) + bigEndian(body.size(), 3) + body;
+}
+
+Bytes frameV23(const char* id, const Bytes& body, uint16_t flags = 0) {
+  return text(id) + bigEndian(body.size(), 4) + bigEndian(flags, 2) + body;
+}
+
+Bytes frameV24(const char* id, const Bytes& body, uint16_t flags = 0) {
+  return text(id) + syncsafe(body.size()) + bigEndian(flags, 2) + body;
+}
+
+// A whole ID3v2 tag around its frames, with some padding
+Bytes tagV2(uint8_t version, uint8_t flags, const Bytes& frames) {
+  Bytes padded = frames + Bytes(20, 0);
+  return text("ID3") + Bytes{ version, 0, flags } + syncsafe(padded.size()) + padded;
+}
+
+// A 128-byte ID3v1.1 tag
+Bytes tagV1(const std::string& title, const std::string& artist, const std::string& album, uint8_t track) {
+  Bytes tag(128, 0);
+  memcpy(&tag[0], "TAG", 3);
+  memcpy(&tag[3], title.data(), min(title.size(), (size_t)30));
+  memcpy(&tag[33], artist.data(), min(artist.size(), (size_t)30));
+  memcpy(&tag[63], album.data(), min(album.size(), (size_t)30));
+  tag[126] = track;
+  return tag;
+}
+
+// Some stand-in audio between the tags
+Bytes audio() {
+  Bytes data(3000);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (uint8_t)(i * 37);
+  }
+  return data;
+}
+
+// Parse a file image and return its tags
+bool parse(const Bytes& image, TrackTags* tags) {
+  File file(image);
+  return readTrackTags(file, tags);
+}
+
+void checkTags(const TrackTags& tags, const char* title, const char* artist, const char* album, int track) {
+  CHECK(strcmp(tags.title, title) == 0);
+  CHECK(strcmp(tags.artist, artist) == 0);
+  CHECK(strcmp(tags.album, album) == 0);
+  CHECK_EQ(tags.trackNumber, track);
+  if (strcmp(tags.title, title) != 0 || strcmp(tags.artist, artist) != 0 || strcmp(tags.album, album) != 0) {
+    fprintf(stderr, "  got \"%s\" / \"%s\" / \"%s\"\n", tags.title, tags.artist, tags.album);
+  }
+}
+
+// No tag at all
+void testNoTag() {
+  TrackTags tags;
+  CHECK(!parse(audio(), &tags));
+  checkTags(tags, "", "", "", 0);
+  CHECK(!parse(Bytes(), &tags));
+}
+
+// ID3v1.1 only, padded with spaces
+void testV1() {
+  TrackTags tags;
+  CHECK(parse(audio() + tagV1("Song Title    ", "Band", "Record", 7), &tags));
+  checkTags(tags, "Song Title", "Band", "Record", 7);
+}
+
+// ID3v2.2 three-letter frames
+void testV22() {
+  Bytes frames = frameV22("TT2", latin1("Old Song")) + frameV22("TP1", latin1("Old Band")) +
+                 frameV22("TAL", latin1("Old Album")) + frameV22("TRK", latin1("3/12"));
+  TrackTags tags;
+  CHECK(parse(tagV2(2, 0, frames) + audio(), &tags));
+  checkTags(tags, "Old Song", "Old Band", "Old Album", 3);
+}
+
+// A compressed ID3v2.2 tag is ignored as a whole, ID3v1 fills in
+void testV22Compressed() {
+  Bytes frames = frameV22("TT2", latin1("Packed")) + frameV22("TP1", latin1("Packed"));
+  TrackTags tags;
+  CHECK(parse(tagV2(2, 0x40, frames) + audio() + tagV1("V1 Title", "V1 Artist", "V1 Album", 2), &tags));
+  checkTags(tags, "V1 Title", "V1 Artist", "V1 Album", 2);
+}
+
+// ID3v2.3 with UTF-16, an extended header, a skipped picture and
+// tag-level unsynchronisation
+void testV23() {
+  Bytes utf16 = { 1, 0xFF, 0xFE, 'C', 0, 'a', 0, 'f', 0, 0xE9, 0, 0, 0 };
+  Bytes picture(600, 0xFF);
+  Bytes frames = frameV23("APIC", picture) + frameV23("TIT2", utf16) +
+                 frameV23("TPE1", latin1("Art\xFFist")) + frameV23("TALB", latin1("Album")) +
+                 frameV23("TRCK", latin1("11"));
+  Bytes extended = bigEndian(6, 4) + Bytes(6, 0);
+  Bytes body = unsynchronise(extended + frames) + Bytes(20, 0);
+  Bytes image = text("ID3") + Bytes{ 3, 0, 0xC0 } + syncsafe(body.size()) + body + audio();
+  
+  TrackTags tags;
+  CHECK(parse(image, &tags));
+  checkTags(tags, "Caf\xE9", "Art\xFFist", "Album", 11);
+}
+
+// ID3v2.4 with UTF-8, a data length indicator and frame unsynchronisation
+void testV24() {
+  Bytes title = Bytes{ 3 } + text("Na\xC3\xAFve \xE2\x82\xAC");
+  Bytes artist = Bytes{ 0, 0, 0, 6 } + latin1("\xFFtwo");
+  Bytes frames = frameV24("TIT2", title) + frameV24("TPE1", unsynchronise(artist), 0x0003) +
+                 frameV24("TALB", Bytes{ 0xAA } + latin1("Grouped"), 0x0040) +
+                 frameV24("TRCK", latin1("5"));
+  TrackTags tags;
+  CHECK(parse(tagV2(4, 0, frames) + audio(), &tags));
+  checkTags(tags, "Na\xEFve ?", "\xFFtwo", "Grouped", 5);
+}
+
+// Compressed or encrypted frames are skipped, a later copy is used
+void testUnreadableFrames() {
+  Bytes frames = frameV23("TIT2", latin1("Zipped"), 0x0080) + frameV23("TIT2", latin1("Plain")) +
+                 frameV23("TPE1", latin1("Locked"), 0x0040) + frameV23("TALB", latin1("Album"));
+  TrackTags tags;
+  CHECK(parse(tagV2(3, 0, frames) + audio() + tagV1("", "V1 Artist", "", 0), &tags));
+  checkTags(tags, "Plain", "V1 Artist", "Album", 0);
+}
+
+// An empty frame does not stop a later one, or the ID3v1 fallback
+void testEmptyFrames() {
+  Bytes frames = frameV23("TIT2", latin1("")) + frameV23("TIT2", latin1("Second")) +
+                 frameV23("TPE1", Bytes{ 0 }) + frameV23("TRCK", latin1("")) +
+                 frameV23("TRCK", latin1("9"));
+  TrackTags tags;
+  CHECK(parse(tagV2(3, 0, frames) + audio() + tagV1("V1", "V1 Artist", "V1 Album", 4), &tags));
+  checkTags(tags, "Second", "V1 Artist", "V1 Album", 9);
+}
+
+// Long values are cut to TAG_TEXT_MAX
+void testLongValue() {
+  std::string longTitle(300, 'x');
+  TrackTags tags;
+  CHECK(parse(tagV2(3, 0, frameV23("TIT2", latin1(longTitle))) + audio(), &tags));
+  CHECK_EQ(strlen(tags.title), TAG_TEXT_MAX);
+}
+
+// A tag that claims more bytes than the file holds ends cleanly
+void testTruncatedTag() {
+  Bytes frames = frameV23("TIT2", latin1("Cut")) + frameV23("TPE1", latin1("Off at the end"));
+  Bytes image = tagV2(3, 0, frames);
+  image.resize(10 + 15 + 10 + 5);
+  TrackTags tags;
+  CHECK(parse(image, &tags));
+  checkTags(tags, "Cut", "Off a", "", 0);
+}
+
+// Card model for the throughput estimate: an SD card on SPI at 20 MHz
+// streams about 2 MB/s, and each jump to a new position costs an access.
+#define CARD_BYTES_PER_MS 2000
+#define CARD_ACCESS_US 1000
+
+// Throughput over a library of the common layouts, a 64 KB cover picture
+// ahead of the text frames included. Reports files per second parsed on
+// the host and estimated from the card traffic, and checks the parser
+// only reads the tag bytes it needs.
+void testThroughput() {
+  Bytes picture(64 * 1024, 0x5A);
+  Bytes withCover = frameV23("APIC", picture) + frameV23("TIT2", latin1("Covered")) +
+                    frameV23("TPE1", latin1("Artist")) + frameV23("TALB", latin1("Album"));
+  Bytes v24 = frameV24("TIT2", Bytes{ 3 } + text("Plain")) + frameV24("TPE1", latin1("Artist")) +
+              frameV24("TALB", latin1("Album")) + frameV24("TRCK", latin1("3"));
+  std::vector<Bytes> layouts = {
+    text("ID3") + Bytes{ 3, 0, 0 } + syncsafe(withCover.size()) + withCover + audio(),
+    tagV2(4, 0, v24) + audio(),
+    audio() + tagV1("Only v1", "Artist", "Album", 4),
+    audio(),
+  };
+  std::vector<File> library;
+  for (int i = 0; i < 256; i++) {
+    library.push_back(File(layouts[i % layouts.size()]));
+  }
+  
+  unsigned long reads = fakeFileReads;
+  unsigned long bytes = fakeFileBytesRead;
+  unsigned long seeks = fakeFileSeeks;
+  int tagged = 0;
+  TrackTags tags;
+  auto start = std::chrono::steady_clock::now();
+  for (File& file : library) {
+    tagged += readTrackTags(file, &tags) ? 1 : 0;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  CHECK_EQ(tagged, 192);
+  
+  // Per file on average, the cover picture is seeked over, never read
+  double perFileBytes = (double)(fakeFileBytesRead - bytes) / library.size();
+  double perFileAccesses = (double)(fakeFileSeeks - seeks) / library.size();
+  CHECK(perFileBytes < 1024);
+  double cardMs = perFileBytes / CARD_BYTES_PER_MS + perFileAccesses * CARD_ACCESS_US / 1000.0;
+  printf("tag throughput: %.0f files/s on the host, %.1f reads, %.0f bytes and %.1f card accesses per file, "
+         "about %.0f files/s from the card\n", library.size() / seconds,
+         (double)(fakeFileReads - reads) / library.size(), perFileBytes, perFileAccesses, 1000 / cardMs);
+}
+
+int main() {
+  testNoTag();
+  testV1();
+  testV22();
+  testV22Compressed();
+  testV23();
+  testV24();
+  testUnreadableFrames();
+  testEmptyFrames();
+  testLongValue();
+  testTruncatedTag();
+  testThroughput();
+  return testResult("test_id3_parser");
+}
@@ -0,0 +1,222 @@
+// ESP32 Soundpod - Library Scan Tests
+// Scans a 5000-file fake card into the flash track index, then rescans it
+// with 1% of the files changed and compares what each scan costs. Also
+// damages the index on flash and checks it is caught and rebuilt.
+
+#include <chrono>
+#include <vector>
+#include "testing.h"
+#include "dbHandler.h"
+
+#define LIBRARY_FILES 5000
+#define CHANGED_FILES (LIBRARY_FILES / 100)
+#define INDEX_PARTITION_SIZE 0x200000
+
+// Card model, as in test_id3_parser: about 2 MB/s over SPI at 20 MHz and
+// an access for each jump to a new position
+#define CARD_BYTES_PER_MS 2000
+#define CARD_ACCESS_US 1000
+
+void accountEnergy() {
+}
+
+typedef std::vector<uint8_t> Bytes;
+
+// Some audio and an ID3v1 tag naming the file
+Bytes trackFile(int number, int version) {
+  Bytes bytes(2048 + version, 0);
+  char tag[128] = { 'T', 'A', 'G' };
+  snprintf(tag + 3, 30, "Title %d", number);
+  snprintf(tag + 33, 30, "Artist %d", number % 50);
+  snprintf(tag + 63, 30, "Album %d", number % 200);
+  tag[126] = number % 20 + 1;
+  bytes.insert(bytes.end(), tag, tag + sizeof(tag));
+  return bytes;
+}
+
+// Path of a library file, zero-padded so path order is creation order
+std::string trackPath(int number) {
+  char path[32];
+  snprintf(path, sizeof(path), MUSIC_DIR "/%05d.mp3", number);
+  return path;
+}
+
+// A card with LIBRARY_FILES tracks and an empty index partition
+void makeLibrary() {
+  SD.clear();
+  SPIFFS.clear();
+  closeTrackIndex();
+  addFakePartition(TRACK_INDEX_PARTITION, INDEX_PARTITION_SIZE);
+  trackIndexPartition = NULL;
+  for (int i = 1; i <= LIBRARY_FILES; i++) {
+    SD.addFile(trackPath(i), trackFile(i, 0), 1);
+  }
+}
+
+// Rewrite a file in place, keeping its directory position
+void changeFile(int number) {
+  FakeFileEntry& entry = SD.files[trackPath(number)];
+  *entry.data = trackFile(number, 1);
+  entry.modified = 2;
+}
+
+// What one scan cost
+struct ScanCost {
+  double hostMs;
+  unsigned long bytesRead;
+  unsigned long accesses;
+  double cardMs;
+};
+
+// Run loadTrackInfo() like a boot does and measure it
+ScanCost bootScan() {
+  unsigned long bytes = fakeFileBytesRead;
+  unsigned long accesses = fakeFileReads + fakeFileSeeks;
+  auto start = std::chrono::steady_clock::now();
+  loadTrackInfo();
+  ScanCost cost;
+  cost.hostMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  cost.bytesRead = fakeFileBytesRead - bytes;
+  cost.accesses = fakeFileReads + fakeFileSeeks - accesses;
+  cost.cardMs = (double)cost.bytesRead / CARD_BYTES_PER_MS + cost.accesses * CARD_ACCESS_US / 1000.0;
+  return cost;
+}
+
+// Every track reads back with the names its tag gave it
+void checkLibrary(int changedFrom) {
+  CHECK_EQ(trackIndexCount, LIBRARY_FILES);
+  for (int i = 0; i < LIBRARY_FILES; i += 97) {
+    TrackInfo info;
+    CHECK(getIndexedTrack(i, &info));
+    char title[32];
+    snprintf(title, sizeof(title), "Title %d", i + 1);
+    CHECK(strcmp(info.title, title) == 0);
+    CHECK(strcmp(info.filename, trackPath(i + 1).c_str()) == 0);
+    CHECK_EQ(info.fileSize, 2048 + 128 + (i + 1 >= changedFrom ? 1 : 0));
+  }
+}
+
+// A full scan against a rescan with 1% of the files changed
+void testRescanBenchmark() {
+  makeLibrary();
+  ScanCost full = bootScan();
+  CHECK_EQ(trackIndexGeneration, 1);
+  checkLibrary(LIBRARY_FILES + 1);
+
+  // An unchanged card is only compared, nothing is written
+  ScanCost unchanged = bootScan();
+  CHECK_EQ(trackIndexGeneration, 1);
+  CHECK_EQ(unchanged.bytesRead, 0);
+
+  // Change every hundredth file from the middle on, spread over the card
+  int changedFrom = LIBRARY_FILES / 2;
+  for (int i = 0; i < CHANGED_FILES; i++) {
+    changeFile(changedFrom + i * (LIBRARY_FILES - changedFrom) / CHANGED_FILES);
+  }
+  ScanCost rescan = bootScan();
+  CHECK_EQ(trackIndexGeneration, 2);
+  CHECK(rescan.bytesRead * 50 < full.bytesRead);
+  CHECK(rescan.cardMs * 20 < full.cardMs);
+
+  TrackInfo info;
+  CHECK(getIndexedTrack(changedFrom - 1, &info));
+  CHECK_EQ(info.fileSize, 2048 + 128 + 1);
+  CHECK(getIndexedTrack(changedFrom - 2, &info));
+  CHECK_EQ(info.fileSize, 2048 + 128);
+
+  printf("%d files: full scan %.0f ms card (%lu bytes), %.0f ms host\n",
+         LIBRARY_FILES, full.cardMs, full.bytesRead, full.hostMs);
+  printf("%d changed: rescan %.0f ms card (%lu bytes), %.0f ms host\n",
+         CHANGED_FILES, rescan.cardMs, rescan.bytesRead, rescan.hostMs);
+  printf("unchanged: check %.0f ms card, %.0f ms host\n", unchanged.cardMs, unchanged.hostMs);
+}
+
+// Slot contents of the active index
+uint8_t* activeSlot() {
+  return fakePartitionData(TRACK_INDEX_PARTITION).data() + trackIndexSlot * trackIndexSlotSize;
+}
+
+// Record i of the active index, writable
+TrackRecord* activeRecord(int i) {
+  TrackIndexHeader header;
+  memcpy(&header, activeSlot(), sizeof(header));
+  return (TrackRecord*)(activeSlot() + header.recordsOffset) + i;
+}
+
+// A string offset pointing out of the slot is caught, and with no other
+// slot to fall back on the card is scanned again from scratch
+void testDamagedRecord() {
+  makeLibrary();
+  bootScan();
+  activeRecord(123)->title = trackIndexSlotSize + 0x1000;
+  CHECK(!openTrackIndex());
+  CHECK(trackIndexDamaged);
+
+  ScanCost rebuild = bootScan();
+  CHECK(rebuild.bytesRead > 0);
+  CHECK(!trackIndexDamaged);
+  checkLibrary(LIBRARY_FILES + 1);
+}
+
+// A damaged browse order in the newest slot falls back to the older one,
+// and the next scan writes a good index even though the card is unchanged
+void testDamagedSortOrder() {
+  makeLibrary();
+  bootScan();
+  changeFile(LIBRARY_FILES);
+  bootScan();
+  CHECK_EQ(trackIndexGeneration, 2);
+  uint8_t damagedSlot = trackIndexSlot;
+
+  TrackIndexHeader header;
+  memcpy(&header, activeSlot(), sizeof(header));
+  uint16_t* order = (uint16_t*)(activeSlot() + header.sortOffset[SORT_BY_PATH]);
+  order[10] = LIBRARY_FILES + 7;
+  CHECK(openTrackIndex());
+  CHECK(trackIndexDamaged);
+  CHECK_EQ(trackIndexGeneration, 1);
+  CHECK(trackIndexSlot != damagedSlot);
+
+  bootScan();
+  CHECK(!trackIndexDamaged);
+  CHECK_EQ(trackIndexSlot, damagedSlot);
+  CHECK_EQ(trackIndexGeneration, 2);
+  checkLibrary(LIBRARY_FILES);
+}
+
+// A checkpoint whose record count doesn't match its cursor is not resumed
+void testDamagedCheckpoint() {
+  makeLibrary();
+  bootScan();
+  changeFile(LIBRARY_FILES);
+  CHECK(beginTrackIndex());
+  for (int i = 0; i < 10; i++) {
+    addIndexedTrack(trackPath(i + 1).c_str(), "T", "A", "B", 1, 1, 1);
+  }
+  saveScanCheckpoint(10, 10);
+  abortTrackIndex();
+
+  TrackIndexCheckpoint checkpoint;
+  CHECK(loadScanCheckpoint(&checkpoint));
+  CHECK(resumeTrackIndex(checkpoint));
+  abortTrackIndex();
+  checkpoint.count = 5000;
+  CHECK(!resumeTrackIndex(checkpoint));
+
+  // Written back with a valid CRC, the scan starts over instead
+  checkpoint.crc = esp_rom_crc32_le(0, (const uint8_t*)&checkpoint, offsetof(TrackIndexCheckpoint, crc));
+  File file = SPIFFS.open(SCAN_CHECKPOINT_FILE, "w");
+  file.write((const uint8_t*)&checkpoint, sizeof(checkpoint));
+  file.close();
+  bootScan();
+  CHECK_EQ(trackIndexGeneration, 2);
+  checkLibrary(LIBRARY_FILES);
+}
+
+int main() {
+  testRescanBenchmark();
+  testDamagedRecord();
+  testDamagedSortOrder();
+  testDamagedCheckpoint();
+  return testResult("test_library_scan");
+}
@@ -0,0 +1,144 @@
+// ESP32 Soundpod - Marquee Allocation Benchmark
+// Scrolls a long title and artist through the real UI path for a few
+// thousand frames and counts heap allocations per frame, next to the
+// String truncation the marquee replaced. The host String stub allocates
+// through operator new, so counting new counts every String built.
+
+#include <chrono>
+#include <new>
+#include "testing.h"
+#include "display.h"
+
+#define STEADY_FRAMES 2000
+#define LONG_TITLE "A title much too long for the screen to show in one go"
+#define LONG_ARTIST "An artist with a name as long as the title itself"
+
+bool governorBoost() {
+  return false;
+}
+
+void governorRelease(bool boosted) {
+}
+
+void recordTaskWork(unsigned long startMicros) {
+}
+
+// Heap allocations made anywhere in the test
+unsigned long heapAllocations = 0;
+
+void* operator new(size_t size) {
+  heapAllocations++;
+  void* block = malloc(size);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  free(block);
+}
+
+void operator delete(void* block, size_t size) noexcept {
+  free(block);
+}
+
+// Run the UI task until it has drawn frames more frames, sleeping to each
+// deadline it reports and sending each frame as the flush task would
+void runFrames(unsigned long frames) {
+  unsigned long target = framesRendered + frames;
+  unsigned long giveUp = millis() + frames * MARQUEE_HOLD_MS;
+  while (framesRendered < target && millis() < giveUp) {
+    unsigned long wait = displayNextDeadline();
+    advanceMillis(wait == NO_DEADLINE || wait == 0 ? 1 : wait);
+    updateDisplay();
+    if (displayFlushBusy) {
+      sendDisplayFrame();
+    }
+  }
+  CHECK(framesRendered >= target);
+}
+
+// The row drawing the marquee replaced: copy the name, cut it to fit with
+// an ellipsis and print it, on every frame
+void drawTruncatedRows(const String& title, const String& artist) {
+  display.setCursor(0, TITLE_ROW_Y);
+  String trackDisplay = title;
+  if (trackDisplay.length() > 21) {
+    trackDisplay = trackDisplay.substring(0, 18) + "...";
+  }
+  display.println(trackDisplay.c_str());
+
+  display.setCursor(0, ARTIST_ROW_Y);
+  String artistDisplay = artist;
+  if (artistDisplay.length() > 21) {
+    artistDisplay = artistDisplay.substring(0, 18) + "...";
+  }
+  display.println(artistDisplay.c_str());
+}
+
+// Allocations and host time per frame
+struct FrameCost {
+  double allocations;
+  double nanos;
+};
+
+// Steady scrolling, past the first frame and the hold
+FrameCost scrollCost() {
+  runFrames(10);
+  unsigned long allocations = heapAllocations;
+  unsigned long frames = framesRendered;
+  auto start = std::chrono::steady_clock::now();
+  runFrames(STEADY_FRAMES);
+  double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return { (double)(heapAllocations - allocations) / (framesRendered - frames), nanos / (framesRendered - frames) };
+}
+
+FrameCost truncatedCost() {
+  String title = LONG_TITLE;
+  String artist = LONG_ARTIST;
+  unsigned long allocations = heapAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < STEADY_FRAMES; i++) {
+    display.fillRect(0, TITLE_ROW_Y, SCREEN_WIDTH, ARTIST_ROW_Y + 8 - TITLE_ROW_Y, SSD1306_BLACK);
+    drawTruncatedRows(title, artist);
+  }
+  double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return { (double)(heapAllocations - allocations) / STEADY_FRAMES, nanos / STEADY_FRAMES };
+}
+
+// Scrolling both rows allocates nothing, frame after frame
+void testSteadyScrolling() {
+  publishTrack(1, 10, LONG_TITLE, LONG_ARTIST);
+  initDisplay();
+  showNowPlaying();
+  FrameCost marquee = scrollCost();
+  CHECK_EQ(currentDisplayState, DISPLAY_NOW_PLAYING);
+  CHECK(titleMarquee.offset != 0 || artistMarquee.offset != 0);
+  CHECK_EQ(marquee.allocations, 0);
+
+  FrameCost truncated = truncatedCost();
+  CHECK(truncated.allocations >= 4);
+  printf("%d frames: marquee %.1f allocations, %.0f ns per frame (render and flush); "
+         "truncated Strings %.1f allocations, %.0f ns per frame (render only)\n",
+         STEADY_FRAMES, marquee.allocations, marquee.nanos, truncated.allocations, truncated.nanos);
+}
+
+// New names restart the scroll without allocating either
+void testTrackChange() {
+  unsigned long allocations = heapAllocations;
+  for (int track = 2; track < 20; track++) {
+    publishTrack(track, 20, track % 2 ? LONG_TITLE : "Short", LONG_ARTIST);
+    runFrames(5);
+    if (track % 2 == 0) {
+      CHECK_EQ(titleMarquee.offset, 0); // Fits, never scrolls
+    }
+  }
+  CHECK_EQ(heapAllocations, allocations);
+}
+
+int main() {
+  testSteadyScrolling();
+  testTrackChange();
+  return testResult("test_marquee");
+}
@@ -0,0 +1,121 @@
+// ESP32 Soundpod - Playlist Format Tests
+// Round-trips playlists through the binary format and checks that every
+// kind of damage is caught instead of decoding into wrong tracks.
+
+#include <vector>
+#include "testing.h"
+#include "playlistFormat.h"
+
+// Write a playlist into a fresh in-memory file
+File writePlaylist(const std::vector<int>& tracks) {
+  File file = File::empty();
+  CHECK(writePlaylistFile(file, tracks.data(), tracks.size()));
+  file.seek(0);
+  return file;
+}
+
+// Decode a whole playlist file, -1 entries read if it was rejected
+int readPlaylist(File& file, std::vector<int>* tracks, int first = 0, int capacity = -1) {
+  file.seek(0);
+  PlaylistHeader header;
+  if (!readPlaylistHeader(file, &header)) {
+    return -1;
+  }
+  if (capacity < 0) {
+    capacity = header.count;
+  }
+  tracks->assign(capacity > 0 ? capacity : 1, 0);
+  int stored = readPlaylistFile(file, header, first, tracks->data(), capacity);
+  if (stored >= 0) {
+    tracks->resize(stored);
+  }
+  return stored;
+}
+
+// Every shape of playlist reads back exactly
+void testRoundTrip() {
+  std::vector<std::vector<int>> playlists;
+  playlists.push_back({});
+  playlists.push_back({ 0 });
+  playlists.push_back({ 5, 4, 3, 2, 1 });
+  playlists.push_back({ 0, 100000, 7, 2000000000, 0, -3 });
+  
+  std::vector<int> sequential, shuffled;
+  for (int i = 0; i < 5000; i++) {
+    sequential.push_back(i);
+    shuffled.push_back(rand() % 20000);
+  }
+  playlists.push_back(sequential);
+  playlists.push_back(shuffled);
+  
+  for (const std::vector<int>& tracks : playlists) {
+    File file = writePlaylist(tracks);
+    std::vector<int> read;
+    CHECK_EQ(readPlaylist(file, &read), tracks.size());
+    CHECK(read == tracks);
+  }
+  
+  // Sequential runs cost one byte per entry
+  File file = writePlaylist(sequential);
+  CHECK_EQ(file.size(), sizeof(PlaylistHeader) + sequential.size());
+}
+
+// A window into the list reads only that part
+void testWindow() {
+  std::vector<int> tracks;
+  for (int i = 0; i < 1000; i++) {
+    tracks.push_back(i * 3);
+  }
+  File file = writePlaylist(tracks);
+  std::vector<int> read;
+  CHECK_EQ(readPlaylist(file, &read, 990, 20), 10);
+  CHECK_EQ(read[0], 990 * 3);
+  CHECK_EQ(read[9], 999 * 3);
+  CHECK_EQ(readPlaylist(file, &read, 2000, 20), 0);
+}
+
+// Flipping any bit or cutting the file short is caught
+void testCorruption() {
+  std::vector<int> tracks = { 3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 900, 8000 };
+  File good = writePlaylist(tracks);
+  std::vector<uint8_t> bytes = good.contents();
+  
+  for (size_t i = 0; i < bytes.size(); i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      std::vector<uint8_t> damaged = bytes;
+      damaged[i] ^= 1 << bit;
+      File file(damaged);
+      std::vector<int> read;
+      CHECK_EQ(readPlaylist(file, &read), -1);
+    }
+  }
+  
+  for (size_t length = 0; length < bytes.size(); length++) {
+    File file(std::vector<uint8_t>(bytes.begin(), bytes.begin() + length));
+    std::vector<int> read;
+    CHECK_EQ(readPlaylist(file, &read), -1);
+  }
+}
+
+// A write that runs out of space fails
+void testFullFilesystem() {
+  std::vector<int> tracks;
+  for (int i = 0; i < 2000; i++) {
+    tracks.push_back(i * 7);
+  }
+  File file = File::empty();
+  file.writeLimit = 1000;
+  CHECK(!writePlaylistFile(file, tracks.data(), tracks.size()));
+  
+  file = File::empty();
+  file.writeLimit = sizeof(PlaylistHeader) - 1;
+  CHECK(!writePlaylistFile(file, tracks.data(), tracks.size()));
+}
+
+int main() {
+  testRoundTrip();
+  testWindow();
+  testCorruption();
+  testFullFilesystem();
+  return testResult("test_playlist_format");
+}
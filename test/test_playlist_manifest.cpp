@@ -0,0 +1,173 @@
+// ESP32 Soundpod - Playlist Manifest Benchmark
+// Fills the SPIFFS root with hundreds of files that aren't playlists next
+// to a few dozen playlists, then pages through the playlist list from the
+// manifest and compares it with the directory walk a rebuild does: files
+// opened and bytes read. Also checks that a rebuild, after damage or an
+// interrupted update, keeps every playlist's ID.
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "testing.h"
+#include "dbHandler.h"
+
+#define OTHER_FILES 400
+#define PLAYLISTS 60
+#define PAGE_SIZE 8
+
+void accountEnergy() {
+}
+
+// The root of a well-used device: settings, cover art, logs and playlists
+void fillRoot() {
+  SPIFFS.clear();
+  int total;
+  listPlaylists(0, NULL, 0, &total); // An empty manifest, creates keep it up to date
+  for (int i = 0; i < OTHER_FILES; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), i % 3 == 0 ? "/art%03d.bmp" : (i % 3 == 1 ? "/log%03d.txt" : "/cfg%03d.json"), i);
+    SPIFFS.addFile(path, std::vector<uint8_t>(256 + (i * 37) % 2048, 'x'));
+
+    // Playlists are created in between, over the life of the device
+    if (i % (OTHER_FILES / PLAYLISTS) == 0 && i / (OTHER_FILES / PLAYLISTS) < PLAYLISTS) {
+      int number = i / (OTHER_FILES / PLAYLISTS);
+      std::vector<int> tracks(10 + number * 7);
+      for (size_t t = 0; t < tracks.size(); t++) {
+        tracks[t] = (number * 31 + t * 3) % 5000;
+      }
+      char name[16];
+      snprintf(name, sizeof(name), "Mix %d", number);
+      CHECK(createPlaylist(name, tracks.size(), tracks.data()));
+    }
+  }
+}
+
+// What one pass over the list cost
+struct ListCost {
+  unsigned long opens;
+  unsigned long bytesRead;
+  double micros;
+  int playlists;
+};
+
+// Page through every playlist as a list screen would
+ListCost pageThroughList() {
+  unsigned long opens = fakeFileOpens;
+  unsigned long bytes = fakeFileBytesRead;
+  auto start = std::chrono::steady_clock::now();
+  int seen = 0;
+  int total = 0;
+  do {
+    PlaylistEntry page[PAGE_SIZE];
+    int copied = listPlaylists(seen, page, PAGE_SIZE, &total);
+    if (copied == 0) {
+      break;
+    }
+    seen += copied;
+  } while (seen < total);
+  double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  CHECK_EQ(seen, total);
+  return { fakeFileOpens - opens, fakeFileBytesRead - bytes, micros, seen };
+}
+
+// IDs by playlist name, as the manifest has them
+std::map<std::string, uint32_t> playlistIds() {
+  std::map<std::string, uint32_t> ids;
+  int total = 0;
+  for (int first = 0; first == 0 || first < total; first += PAGE_SIZE) {
+    PlaylistEntry page[PAGE_SIZE];
+    int copied = listPlaylists(first, page, PAGE_SIZE, &total);
+    for (int i = 0; i < copied; i++) {
+      ids[page[i].name] = page[i].id;
+    }
+    if (copied == 0) {
+      break;
+    }
+  }
+  return ids;
+}
+
+// The manifest lists playlists without touching the other files
+void benchmarkListing() {
+  fillRoot();
+  ListCost manifest = pageThroughList();
+  CHECK_EQ(manifest.playlists, PLAYLISTS);
+  CHECK_EQ(manifest.opens, (PLAYLISTS + PAGE_SIZE - 1) / PAGE_SIZE);
+
+  // Without a manifest the first page walks the root and reads each
+  // playlist's header, as the listing did before there was one
+  SPIFFS.remove(PLAYLIST_MANIFEST_FILE);
+  ListCost walk = pageThroughList();
+  CHECK_EQ(walk.playlists, PLAYLISTS);
+  CHECK(walk.opens > OTHER_FILES + PLAYLISTS);
+  CHECK(manifest.opens * 20 < walk.opens);
+
+  printf("%d playlists among %d other files, pages of %d: manifest %lu opens, %lu bytes, %.0f us; "
+         "walk %lu opens, %lu bytes, %.0f us\n",
+         PLAYLISTS, OTHER_FILES, PAGE_SIZE, manifest.opens, manifest.bytesRead, manifest.micros,
+         walk.opens, walk.bytesRead, walk.micros);
+}
+
+// A damaged manifest is rebuilt from the files with the same IDs
+void testRebuildKeepsIds() {
+  fillRoot();
+  CHECK(deletePlaylist("Mix 3"));
+  CHECK(deletePlaylist("Mix 10"));
+  int tracks[] = { 1, 2, 3 };
+  CHECK(createPlaylist("Late", 3, tracks));
+  std::map<std::string, uint32_t> before = playlistIds();
+  CHECK_EQ(before.size(), PLAYLISTS - 1);
+  CHECK_EQ(before["Late"], PLAYLISTS + 1);
+
+  // Corrupt the count, the CRC no longer matches
+  SPIFFS.files[PLAYLIST_MANIFEST_FILE].data->at(8) ^= 0x01;
+  CHECK(playlistIds() == before);
+
+  // New playlists get IDs no playlist had, also not a deleted one's
+  CHECK(createPlaylist("Later", 3, tracks));
+  CHECK_EQ(playlistIds()["Later"], PLAYLISTS + 2);
+}
+
+// An update cut short leaves the old manifest set aside, the rebuild
+// takes the IDs from there
+void testInterruptedUpdateKeepsIds() {
+  fillRoot();
+  CHECK(deletePlaylist("Mix 0"));
+  std::map<std::string, uint32_t> before = playlistIds();
+
+  File oldManifest, newManifest;
+  CHECK(beginPlaylistManifestUpdate(&oldManifest, &newManifest));
+  oldManifest.close();
+  newManifest.close();
+  CHECK(!SPIFFS.exists(PLAYLIST_MANIFEST_FILE));
+  CHECK(SPIFFS.exists(PLAYLIST_MANIFEST_OLD));
+
+  CHECK(playlistIds() == before);
+  CHECK(!SPIFFS.exists(PLAYLIST_MANIFEST_OLD));
+  int tracks[] = { 4 };
+  CHECK(createPlaylist("After", 1, tracks));
+  CHECK_EQ(playlistIds()["After"], PLAYLISTS + 1);
+}
+
+// With nothing to go by, IDs start over from 1
+void testRebuildWithoutManifest() {
+  fillRoot();
+  SPIFFS.remove(PLAYLIST_MANIFEST_FILE);
+  std::map<std::string, uint32_t> ids = playlistIds();
+  CHECK_EQ(ids.size(), PLAYLISTS);
+  std::vector<bool> used(PLAYLISTS + 1, false);
+  for (auto& it : ids) {
+    CHECK(it.second >= 1 && it.second <= PLAYLISTS);
+    CHECK(!used[it.second]);
+    used[it.second] = true;
+  }
+}
+
+int main() {
+  benchmarkListing();
+  testRebuildKeepsIds();
+  testInterruptedUpdateKeepsIds();
+  testRebuildWithoutManifest();
+  return testResult("test_playlist_manifest");
+}
@@ -0,0 +1,139 @@
+// ESP32 Soundpod - Deep Sleep Resume State Tests
+// Checks that the state kept in RTC memory is only trusted when it is
+// intact and in range, is used up by the first wake that reads it, and
+// that the resume counters tell fast resumes from fallbacks.
+
+#include "testing.h"
+#include "rtcState.h"
+
+// What a new boot does to the RAM side, RTC memory is left as it was
+void rebootRtc() {
+  rtcResumeFellBack = false;
+}
+
+// A power-on reset clears RTC memory too
+void powerOnRtc() {
+  memset(&rtcResumeState, 0, sizeof(rtcResumeState));
+  rtcFastResumes = 0;
+  memset(rtcFallbacks, 0, sizeof(rtcFallbacks));
+  rebootRtc();
+}
+
+// A valid state comes back once, with the index it was saved against
+void testRoundTrip() {
+  powerOnRtc();
+  trackIndexCount = 120;
+  trackIndexGeneration = 77;
+  saveRtcState(42, 18, true, 125);
+  
+  rebootRtc();
+  RtcResumeState state;
+  CHECK(takeRtcState(&state));
+  CHECK_EQ(state.track, 42);
+  CHECK_EQ(state.volume, 18);
+  CHECK_EQ(state.flags, 1);
+  CHECK_EQ(state.totalTracks, 125);
+  CHECK_EQ(state.libraryTracks, 120);
+  CHECK_EQ(state.indexGeneration, 77);
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_INVALID], 0);
+  
+  // Only the play button resumes playing
+  PlaybackState playback = rtcPlaybackState(state, false);
+  CHECK_EQ(playback.lastTrack, 42);
+  CHECK_EQ(playback.lastVolume, 18);
+  CHECK(!playback.wasPlaying);
+  CHECK(rtcPlaybackState(state, true).wasPlaying);
+  
+  // Used up, a second reset boots the long way
+  rebootRtc();
+  CHECK(!takeRtcState(&state));
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_INVALID], 1);
+}
+
+// Memory left zero by a power-on reset is not a state
+void testPowerOn() {
+  powerOnRtc();
+  RtcResumeState state;
+  CHECK(!takeRtcState(&state));
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_INVALID], 1);
+}
+
+// Any damaged bit is caught by the magic or the CRC
+void testCorruption() {
+  powerOnRtc();
+  saveRtcState(3, 10, false, 50);
+  RtcResumeState saved = rtcResumeState;
+  int caught = 0;
+  for (size_t i = 0; i < sizeof(saved); i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      rtcResumeState = saved;
+      ((uint8_t*)&rtcResumeState)[i] ^= 1 << bit;
+      RtcResumeState state;
+      if (!takeRtcState(&state)) {
+        caught++;
+      }
+    }
+  }
+  CHECK_EQ(caught, sizeof(saved) * 8); // The struct has no padding
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_INVALID], caught);
+}
+
+// A state with a good CRC but out-of-range values is still refused
+void testBounds() {
+  powerOnRtc();
+  RtcResumeState state;
+  
+  saveRtcState(0, 10, true, 50);
+  CHECK(!takeRtcState(&state));
+  saveRtcState(51, 10, true, 50);
+  CHECK(!takeRtcState(&state));
+  saveRtcState(5, MAX_VOLUME + 1, true, 50);
+  CHECK(!takeRtcState(&state));
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_INVALID], 3);
+  
+  saveRtcState(50, MAX_VOLUME, true, 50);
+  CHECK(takeRtcState(&state));
+}
+
+// A wake counts as fast only if none of the later checks fell back
+void testResumeCounters() {
+  powerOnRtc();
+  RtcResumeState state;
+  
+  saveRtcState(7, 10, true, 20);
+  rebootRtc();
+  CHECK(takeRtcState(&state));
+  noteRtcFastResume();
+  CHECK_EQ(rtcFastResumes, 1);
+  
+  // The DFPlayer reports another card
+  saveRtcState(7, 10, true, 20);
+  rebootRtc();
+  CHECK(takeRtcState(&state));
+  noteRtcFallback(RTC_FALLBACK_CARD);
+  noteRtcFastResume();
+  CHECK_EQ(rtcFastResumes, 1);
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_CARD], 1);
+  
+  // The next wake starts clean again, and the counters survive it
+  saveRtcState(8, 10, true, 20);
+  rebootRtc();
+  CHECK(takeRtcState(&state));
+  noteRtcFastResume();
+  CHECK_EQ(rtcFastResumes, 2);
+  CHECK_EQ(rtcFallbacks[RTC_FALLBACK_CARD], 1);
+  
+  Serial.output.clear();
+  printRtcStats();
+  CHECK(Serial.output.find("rtc,fast_resume,2\n") != std::string::npos);
+  CHECK(Serial.output.find("rtc,fallback_card,1\n") != std::string::npos);
+}
+
+int main() {
+  testRoundTrip();
+  testPowerOn();
+  testCorruption();
+  testBounds();
+  testResumeCounters();
+  return testResult("test_rtc_state");
+}
@@ -0,0 +1,282 @@
+// ESP32 Soundpod - Sorted Index Benchmark
+// Builds a 10,000-track library and times case-folded prefix lookups and
+// artist steps in the index's artist order against a linear scan of the
+// same order, counting the keys each reads from flash. Then drives the
+// artist browser the way the buttons do and draws its screen.
+
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+#include "testing.h"
+#include "display.h"
+
+#define LIBRARY_TRACKS 10000
+#define ARTIST_COUNT 1200
+#define PREFIX_LOOKUPS 2000
+
+bool governorBoost() {
+  return false;
+}
+
+void governorRelease(bool boosted) {
+}
+
+void recordTaskWork(unsigned long startMicros) {
+}
+
+// Artist names with mixed case, digits and a few missing tags
+const char* const nameStarts[] = {
+  "Al", "Be", "Ca", "Da", "El", "Fa", "Ga", "Ha", "Io", "Ja", "Ka", "Lu", "Ma",
+  "Ne", "Ol", "Pa", "Qu", "Ro", "Sa", "Ti", "Ul", "Va", "Wi", "Xe", "Yo", "Ze"
+};
+const char* const nameEnds[] = { "ria", "nton", "lles", "mo", "ssa", "rik", "ndo", "vy" };
+
+void artistName(int artist, char* name) {
+  if (artist % 97 == 0) {
+    name[0] = '\0';
+    return;
+  }
+  if (artist % 53 == 0) {
+    sprintf(name, "%d Crew", artist);
+    return;
+  }
+  const char* start = nameStarts[(artist * 7) % 26];
+  const char* end = nameEnds[artist % 8];
+  sprintf(name, artist % 5 == 0 ? "the %s%s %d" : "%s%s %d", start, end, artist);
+  if (artist % 11 == 0) {
+    name[0] = tolower(name[0]);
+  }
+}
+
+// Artists as the index groups them, case-folded
+size_t distinctArtists() {
+  std::set<std::string> folded;
+  for (int artist = 0; artist < ARTIST_COUNT; artist++) {
+    char name[64];
+    artistName(artist, name);
+    for (char* c = name; *c; c++) {
+      *c = foldIndexChar(*c);
+    }
+    folded.insert(name);
+  }
+  return folded.size();
+}
+
+// Build the library, tracks by one artist are spread over the card
+void buildLibrary() {
+  addFakePartition(TRACK_INDEX_PARTITION, 0x400000);
+  CHECK(beginTrackIndex());
+  for (int i = 0; i < LIBRARY_TRACKS; i++) {
+    char filename[64], title[64], artist[64], album[64];
+    int artistNumber = (i * 7919) % ARTIST_COUNT;
+    artistName(artistNumber, artist);
+    snprintf(filename, sizeof(filename), "/%05d.mp3", i + 1);
+    snprintf(title, sizeof(title), "Song %d", i + 1);
+    snprintf(album, sizeof(album), "Album %d", artistNumber * 3 + i % 3);
+    CHECK(addIndexedTrack(filename, title, artist, album, i % 12 + 1, 3000000 + i, 0));
+  }
+  CHECK(commitTrackIndex());
+  CHECK_EQ(trackIndexCount, LIBRARY_TRACKS);
+}
+
+// Keys the binary search may read for one bound, one more than log2(n)
+unsigned long searchBound() {
+  return (unsigned long)ceil(log2(trackIndexCount + 1.0));
+}
+
+// What findSortedPrefix() should return, by walking the whole order
+int linearPrefix(const char* prefix, int* count) {
+  int first = -1;
+  *count = 0;
+  for (uint32_t i = 0; i < trackIndexCount; i++) {
+    if (comparePrefixFolded(sortedKeyAt(SORT_BY_ARTIST, i), prefix) == 0) {
+      if (first < 0) {
+        first = i;
+      }
+      (*count)++;
+    }
+  }
+  return first;
+}
+
+// Prefixes a browse screen would ask for: single letters, then two and
+// three letters of real artists in either case and some that match nothing
+std::vector<std::string> lookupPrefixes() {
+  std::vector<std::string> prefixes;
+  for (char c = 'A'; c <= 'Z'; c++) {
+    prefixes.push_back(std::string(1, c));
+  }
+  srand(8);
+  while (prefixes.size() < PREFIX_LOOKUPS) {
+    char name[64];
+    artistName(random(ARTIST_COUNT), name);
+    std::string prefix(name, strnlen(name, 2 + random(2)));
+    if (random(2) == 0) {
+      for (char& c : prefix) {
+        c = toupper(c);
+      }
+    }
+    prefixes.push_back(random(10) == 0 ? prefix + "zz" : prefix);
+  }
+  return prefixes;
+}
+
+// Prefix lookups in O(log n) key reads, and the same answers as a scan
+void benchmarkPrefixLookups() {
+  std::vector<std::string> prefixes = lookupPrefixes();
+
+  unsigned long maxReads = 0;
+  unsigned long reads = sortedKeyReads;
+  std::vector<std::pair<int, int>> found;
+  auto start = std::chrono::steady_clock::now();
+  for (const std::string& prefix : prefixes) {
+    unsigned long before = sortedKeyReads;
+    int count;
+    int first = findSortedPrefix(SORT_BY_ARTIST, prefix.c_str(), &count);
+    maxReads = max(maxReads, sortedKeyReads - before);
+    found.push_back({ first, count });
+  }
+  double indexNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  double averageReads = (double)(sortedKeyReads - reads) / prefixes.size();
+
+  reads = sortedKeyReads;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    int count;
+    int first = linearPrefix(prefixes[i].c_str(), &count);
+    CHECK_EQ(found[i].second, count);
+    if (count > 0) {
+      CHECK_EQ(found[i].first, first);
+    }
+  }
+  double scanNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  double scanReads = (double)(sortedKeyReads - reads) / prefixes.size();
+
+  // Two bounds, each a binary search over the order
+  CHECK(maxReads <= 2 * searchBound());
+  CHECK(indexNanos < scanNanos);
+  printf("%d tracks, %zu prefix lookups: %.1f keys read (max %lu), %.0f ns each vs a scan's %.0f keys, %.0f ns\n",
+         LIBRARY_TRACKS, prefixes.size(), averageReads, maxReads, indexNanos / prefixes.size(), scanReads,
+         scanNanos / prefixes.size());
+
+  // "Artists starting with M" matches however the tag is cased
+  int count;
+  int first = findSortedPrefix(SORT_BY_ARTIST, "m", &count);
+  CHECK(count > 0);
+  CHECK(foldIndexChar(*sortedKeyAt(SORT_BY_ARTIST, first)) == 'm');
+  CHECK(foldIndexChar(*sortedKeyAt(SORT_BY_ARTIST, first + count - 1)) == 'm');
+}
+
+// Stepping through every artist reads O(log n) keys per step
+void benchmarkArtistSteps() {
+  int artists = 1;
+  unsigned long maxReads = 0;
+  unsigned long reads = 0;
+  for (int position = 0;;) {
+    unsigned long before = sortedKeyReads;
+    int next = nextSortedGroup(SORT_BY_ARTIST, position);
+    reads += sortedKeyReads - before;
+    maxReads = max(maxReads, sortedKeyReads - before);
+    if (next < 0) {
+      break;
+    }
+    CHECK(compareFolded(sortedKeyAt(SORT_BY_ARTIST, position), sortedKeyAt(SORT_BY_ARTIST, next)) < 0);
+    CHECK(compareFolded(sortedKeyAt(SORT_BY_ARTIST, position), sortedKeyAt(SORT_BY_ARTIST, next - 1)) == 0);
+    position = next;
+    artists++;
+  }
+  CHECK_EQ(artists, distinctArtists());
+  CHECK(maxReads <= searchBound() + 1);
+  printf("%d artists stepped: %.1f keys read per step (max %lu)\n", artists,
+         (double)reads / artists, maxReads);
+}
+
+// The browser lands on artist group starts and follows the buttons
+void testBrowser() {
+  // Opens at the playing track's artist
+  TrackInfo info = {};
+  CHECK(getIndexedTrack(4321, &info));
+  CHECK(openBrowser(4322));
+  CHECK(browserOpen(millis()));
+  CHECK(compareFolded(sortedKeyAt(SORT_BY_ARTIST, browsePosition), info.artist) == 0);
+  CHECK(browsePosition == 0 || compareFolded(sortedKeyAt(SORT_BY_ARTIST, browsePosition - 1), info.artist) < 0);
+
+  // Volume down walks the initials in order, skipping none that exist
+  browsePosition = 0;
+  char last = '@';
+  for (int i = 0; i < BROWSE_LETTERS; i++) {
+    unsigned long before = sortedKeyReads;
+    browseLetterStep(1);
+    CHECK(sortedKeyReads - before <= 2 * searchBound() + 1);
+    char letter = browseLetterOf(browsePosition);
+    CHECK(letter > last);
+    CHECK(browsePosition == artistGroupStart(browsePosition));
+    last = letter;
+  }
+  CHECK_EQ(last, 'Z');
+  browseLetterStep(1);
+  CHECK_EQ(browseLetterOf(browsePosition), 'A');
+  browseLetterStep(-1);
+  CHECK_EQ(browseLetterOf(browsePosition), 'Z');
+
+  // Prev undoes next, also across the wrap at either end
+  for (int start : { 0, artistGroupStart(trackIndexCount - 1), artistGroupStart(5000) }) {
+    browsePosition = start;
+    browseArtistStep(1);
+    browseArtistStep(-1);
+    CHECK_EQ(browsePosition, start);
+    browseArtistStep(-1);
+    browseArtistStep(1);
+    CHECK_EQ(browsePosition, start);
+  }
+
+  // Play starts the artist's first track in artist order
+  browsePosition = artistGroupStart(5000);
+  int record = getSortedTrack(SORT_BY_ARTIST, browsePosition);
+  CHECK_EQ(closeBrowser(), record + 1);
+  CHECK(!browserOpen(millis()));
+}
+
+// Run the UI task's pass and send the frame, as the flush task would
+void drawFrame() {
+  updateDisplay();
+  if (displayFlushBusy) {
+    sendDisplayFrame();
+  }
+}
+
+// The UI task draws the browser while it is open, then goes back
+void testBrowserScreen() {
+  publishTrack(1, LIBRARY_TRACKS, "Song 1", "Artist");
+  initDisplay();
+  CHECK(openBrowser(1));
+  unsigned long frames = framesRendered;
+  advanceMillis(1000);
+  drawFrame();
+  CHECK_EQ(currentDisplayState, DISPLAY_BROWSE);
+  CHECK_EQ(framesRendered, frames + 1);
+
+  // Each move redraws
+  browseArtistStep(1);
+  advanceMillis(100);
+  drawFrame();
+  CHECK_EQ(framesRendered, frames + 2);
+
+  // Closes on its own without buttons
+  CHECK(displayNextDeadline() <= BROWSE_TIMEOUT_MS + 1);
+  advanceMillis(BROWSE_TIMEOUT_MS + 1);
+  drawFrame();
+  CHECK_EQ(currentDisplayState, DISPLAY_NOW_PLAYING);
+}
+
+int main() {
+  buildLibrary();
+  benchmarkPrefixLookups();
+  benchmarkArtistSteps();
+  testBrowser();
+  testBrowserScreen();
+  return testResult("test_sorted_index");
+}
@@ -0,0 +1,131 @@
+// ESP32 Soundpod - State Journal Tests
+// Cuts the power at every programmed byte of an append, over more than a
+// full revolution of the ring, and checks that the next boot reads either
+// the state before the append or the one it was writing.
+
+#include "testing.h"
+#include "stateJournal.h"
+
+#define JOURNAL_SIZE 0x4000 // Four sectors, like partitions.csv
+
+// The state the n-th append writes
+PlaybackState journalState(uint32_t n) {
+  PlaybackState state;
+  state.lastTrack = n % 1000 + 1;
+  state.lastVolume = n % (MAX_VOLUME + 1);
+  state.wasPlaying = (n & 1) != 0;
+  return state;
+}
+
+bool sameState(const PlaybackState& a, const PlaybackState& b) {
+  return a.lastTrack == b.lastTrack && a.lastVolume == b.lastVolume && a.wasPlaying == b.wasPlaying;
+}
+
+// Forget everything held in RAM, as a reset would
+void rebootJournal() {
+  restoreFlashPower();
+  stateJournalReady = false;
+  stateJournalPartition = NULL;
+  stateJournalCursor = 0;
+  stateJournalSequence = 0;
+}
+
+// Boot and read the current state
+bool bootAndRead(PlaybackState* state) {
+  rebootJournal();
+  return readStateJournal(state);
+}
+
+// An empty partition reads as no state, and one append reads back
+void testEmptyJournal() {
+  PlaybackState state;
+  CHECK(!bootAndRead(&state));
+  CHECK(appendStateJournal(journalState(1)));
+  CHECK(bootAndRead(&state));
+  CHECK(sameState(state, journalState(1)));
+}
+
+// Power cut at every byte of every append for more than one revolution
+void testTornWriteSweep() {
+  const uint32_t appends = JOURNAL_SIZE / sizeof(StateRecord) + STATE_RECORDS_PER_SECTOR + 3;
+  std::vector<uint8_t>& flash = fakePartitionData(STATE_JOURNAL_PARTITION);
+  int cuts = 0;
+  int sectorCuts = 0;
+  
+  for (uint32_t n = 2; n <= appends; n++) {
+    std::vector<uint8_t> before = flash;
+    rebootJournal();
+    CHECK(openStateJournal());
+    bool entersSector = stateJournalCursor % STATE_RECORDS_PER_SECTOR == 0;
+    long cost = sizeof(StateRecord) + (entersSector ? 1 : 0);
+    
+    for (long budget = 0; budget < cost; budget++) {
+      flash = before;
+      rebootJournal();
+      cutFlashPowerAfter(budget);
+      CHECK(!appendStateJournal(journalState(n)));
+      cuts++;
+      if (entersSector) {
+        sectorCuts++;
+      }
+      
+      // The old state, or the new one if only bits already clear were left
+      PlaybackState state;
+      CHECK(bootAndRead(&state));
+      if (!sameState(state, journalState(n - 1)) && !sameState(state, journalState(n))) {
+        fprintf(stderr, "append %u, budget %ld: read track %d\n", (unsigned)n, budget, state.lastTrack);
+        CHECK(false);
+      }
+      
+      // The journal must still take writes after the cut
+      PlaybackState marker = { 4321, 7, true };
+      CHECK(appendStateJournal(marker));
+      CHECK(bootAndRead(&state));
+      CHECK(sameState(state, marker));
+    }
+    
+    // Now the append that completes
+    flash = before;
+    rebootJournal();
+    CHECK(appendStateJournal(journalState(n)));
+    PlaybackState state;
+    CHECK(bootAndRead(&state));
+    CHECK(sameState(state, journalState(n)));
+  }
+  
+  CHECK(cuts > 0);
+  CHECK(sectorCuts > 0);
+}
+
+// A slot that does not verify is skipped and the next one used
+void testBadSlotSkipped() {
+  rebootJournal();
+  CHECK(openStateJournal());
+  uint32_t bad = stateJournalCursor;
+  if (bad % STATE_RECORDS_PER_SECTOR == 0) {
+    CHECK(appendStateJournal(journalState(1)));
+    bad = stateJournalCursor;
+  }
+  
+  // A stuck bit in the slot about to be written
+  std::vector<uint8_t>& flash = fakePartitionData(STATE_JOURNAL_PARTITION);
+  flash[bad * sizeof(StateRecord)] = 0x00;
+  
+  PlaybackState state = { 77, 12, false };
+  CHECK(appendStateJournal(state));
+  CHECK_EQ(stateJournalCursor, bad + 2);
+  PlaybackState read;
+  CHECK(bootAndRead(&read));
+  CHECK(sameState(read, state));
+}
+
+int main() {
+  // The stub CRC must match the ROM's, the standard CRC-32 check value
+  CHECK_EQ(esp_rom_crc32_le(0, (const uint8_t*)"123456789", 9), 0xCBF43926UL);
+  
+  addFakePartition(STATE_JOURNAL_PARTITION, JOURNAL_SIZE);
+  testEmptyJournal();
+  testTornWriteSweep();
+  testBadSlotSkipped();
+  return testResult("test_state_journal");
+}
@@ -0,0 +1,149 @@
+// ESP32 Soundpod - State Save Tests
+// Replays button-mashing traces through the published player state and the
+// storage task's serviceStateSave() calls, and counts the journal writes the
+// write-behind coalescing leaves against the changes it was asked to save.
+
+#include <vector>
+#include "testing.h"
+#include "dbHandler.h"
+
+#define JOURNAL_SIZE 0x4000
+#define STORAGE_POLL_MS 10 // How often the trace runs the storage task
+
+void accountEnergy() {
+}
+
+// A button press at a time from the trace start, and what it changes
+struct Press {
+  uint32_t at;
+  int volumeStep; // +1/-1 volume, 0 = next track
+};
+
+int traceTrack = 1;
+int traceVolume = 15;
+std::vector<unsigned long> writeTimes;
+
+// Fresh journal and save state, the player at track 1, volume 15
+void resetStateSave() {
+  addFakePartition(STATE_JOURNAL_PARTITION, JOURNAL_SIZE);
+  stateJournalReady = false;
+  stateJournalPartition = NULL;
+  traceTrack = 1;
+  traceVolume = 15;
+  publishTrack(traceTrack, 100, "", "");
+  publishVolume(traceVolume);
+  publishPlaying(true);
+  advanceMillis(60000);
+  loadPlaybackState();
+  flushStateSave();
+  readPlayerState(&savedView, 0);
+  stateSavePending = false;
+  stateChangeCount = 0;
+  statePersistCount = 0;
+  writeTimes.clear();
+  advanceMillis(STATE_SAVE_INTERVAL); // The boot write is long past
+}
+
+// Play a trace for durationMs, running the storage task as it would
+void playTrace(const std::vector<Press>& presses, uint32_t durationMs) {
+  size_t next = 0;
+  for (uint32_t t = 0; t <= durationMs; t++) {
+    while (next < presses.size() && presses[next].at == t) {
+      if (presses[next].volumeStep != 0) {
+        traceVolume = constrain(traceVolume + presses[next].volumeStep, 0, MAX_VOLUME);
+        publishVolume(traceVolume);
+      } else {
+        traceTrack++;
+        publishTrack(traceTrack, 100, "", "");
+      }
+      next++;
+    }
+    if (t % STORAGE_POLL_MS == 0) {
+      unsigned long before = statePersistCount;
+      serviceStateSave();
+      if (statePersistCount != before) {
+        writeTimes.push_back(millis());
+      }
+    }
+    advanceMillis(1);
+  }
+}
+
+// The journal holds what the player shows now
+void checkJournalMatches() {
+  stateJournalReady = false;
+  stateJournalPartition = NULL;
+  PlaybackState state;
+  CHECK(readStateJournal(&state));
+  CHECK_EQ(state.lastTrack, traceTrack);
+  CHECK_EQ(state.lastVolume, traceVolume);
+}
+
+// Writes never come closer than the save interval
+void checkWriteSpacing() {
+  for (size_t i = 1; i < writeTimes.size(); i++) {
+    CHECK(writeTimes[i] - writeTimes[i - 1] >= STATE_SAVE_INTERVAL);
+  }
+}
+
+// Twenty volume steps in three seconds: the first is written at once, the
+// rest share one write when the interval is up
+void testVolumeMash() {
+  resetStateSave();
+  std::vector<Press> presses;
+  for (int i = 0; i < 20; i++) {
+    presses.push_back({ (uint32_t)i * 150, +1 });
+  }
+  playTrace(presses, 8000);
+  CHECK_EQ(stateChangeCount, 15); // Volume stops at MAX_VOLUME
+  CHECK_EQ(statePersistCount, 2);
+  checkWriteSpacing();
+  checkJournalMatches();
+  printf("volume mash: %lu changes, %lu writes\n", stateChangeCount, statePersistCount);
+}
+
+// A minute of skipping a track every 400 ms costs one write per interval
+void testSkipping() {
+  resetStateSave();
+  std::vector<Press> presses;
+  for (uint32_t t = 0; t < 60000; t += 400) {
+    presses.push_back({ t, 0 });
+  }
+  playTrace(presses, 66000);
+  CHECK_EQ(stateChangeCount, presses.size());
+  CHECK(statePersistCount <= 60000 / STATE_SAVE_INTERVAL + 1);
+  CHECK(statePersistCount >= 60000 / STATE_SAVE_INTERVAL);
+  checkWriteSpacing();
+  checkJournalMatches();
+  printf("skipping: %lu changes, %lu writes\n", stateChangeCount, statePersistCount);
+}
+
+// Volume up and back down inside one interval writes nothing
+void testBurstThatReturns() {
+  resetStateSave();
+  playTrace({ { 0, +1 } }, 100);
+  CHECK_EQ(statePersistCount, 1);
+  playTrace({ { 0, +1 }, { 100, +1 }, { 200, -1 }, { 300, -1 } }, 8000);
+  CHECK_EQ(stateChangeCount, 5);
+  CHECK_EQ(statePersistCount, 1);
+  checkJournalMatches();
+}
+
+// Going to sleep mid-burst writes the pending state straight away
+void testFlushBeforeSleep() {
+  resetStateSave();
+  playTrace({ { 0, 0 }, { 200, 0 }, { 400, -1 } }, 1000);
+  CHECK_EQ(statePersistCount, 1);
+  flushStateSave();
+  CHECK_EQ(statePersistCount, 2);
+  CHECK_EQ(stateSaveNextDeadline(), NO_DEADLINE);
+  checkJournalMatches();
+}
+
+int main() {
+  testVolumeMash();
+  testSkipping();
+  testBurstThatReturns();
+  testFlushBeforeSleep();
+  return testResult("test_state_save");
+}
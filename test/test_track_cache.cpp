@@ -0,0 +1,149 @@
+// ESP32 Soundpod - Track Cache Tests
+// Builds a large library index on a fake flash partition and skips through
+// it the ways people do: straight through, back and forth, in shuffle, in a
+// playlist and with jumps. Next and previous have to be cache hits in every
+// order. Reports the hit rate and the RAM the cache and play order use.
+
+#include <vector>
+#include "testing.h"
+#include "mp3Handler.h"
+#include "fakeDfPlayer.h"
+
+#define LIBRARY_TRACKS 2000
+#define INDEX_PARTITION_SIZE 0x100000
+#define PLAYLIST_TRACKS 300
+
+HardwareSerial playerSerial;
+FakeDfPlayer player;
+
+// A playlist spread over the whole library, library indices
+std::vector<int> scatteredPlaylist;
+
+int loadPlaylist(String name, int first, int* tracks, int capacity, int* trackCount) {
+  *trackCount = scatteredPlaylist.size();
+  int copied = 0;
+  for (int i = first; i < (int)scatteredPlaylist.size() && copied < capacity; i++) {
+    tracks[copied++] = scatteredPlaylist[i];
+  }
+  return copied;
+}
+
+// Index a library of LIBRARY_TRACKS tracks, each with its own names
+void buildLibrary() {
+  addFakePartition(TRACK_INDEX_PARTITION, INDEX_PARTITION_SIZE);
+  CHECK(beginTrackIndex());
+  for (int i = 0; i < LIBRARY_TRACKS; i++) {
+    char filename[32];
+    char title[32];
+    char artist[32];
+    snprintf(filename, sizeof(filename), "/music/%04d.mp3", i + 1);
+    snprintf(title, sizeof(title), "Title %d", i + 1);
+    snprintf(artist, sizeof(artist), "Artist %d", i % 97);
+    CHECK(addIndexedTrack(filename, title, artist, "Album", 1, 4000000, 0));
+  }
+  CHECK(commitTrackIndex());
+  CHECK_EQ(trackIndexCount, LIBRARY_TRACKS);
+  trackLibraryReady = true;
+  totalTracks = LIBRARY_TRACKS;
+  resumePending = false;
+  dfPlayerBegin(player);
+
+  srand(11);
+  for (int i = 0; i < PLAYLIST_TRACKS; i++) {
+    scatteredPlaylist.push_back(random(LIBRARY_TRACKS));
+  }
+}
+
+// Heap the play order holds: the shuffle order and the decoded playlist
+size_t playOrderHeap() {
+  size_t bytes = 0;
+  if (shuffleOrder != NULL) {
+    bytes += shuffleLength * sizeof(uint16_t);
+  }
+  if (activePlaylistTracks != NULL) {
+    bytes += activePlaylistLength * sizeof(int);
+  }
+  return bytes;
+}
+
+// Start at a track with a cold cache, then skip `steps` times: forward
+// with probability nextPercent, else back, and every jumpEvery steps to a
+// random library track (0 = never). Returns the cache misses.
+unsigned long skipThrough(const char* pattern, int steps, int nextPercent, int jumpEvery) {
+  clearTrackCache();
+  orderPosition = 0;
+  currentTrack = trackAtPosition(0);
+  startPlayback();
+  trackCacheHits = 0;
+  trackCacheMisses = 0;
+  trackCachePrefetches = 0;
+  size_t peakHeap = playOrderHeap();
+
+  for (int step = 1; step <= steps; step++) {
+    if (jumpEvery != 0 && step % jumpEvery == 0) {
+      playTrackByNumber(1 + random(LIBRARY_TRACKS));
+    } else if (random(100) < nextPercent) {
+      playNextTrack();
+    } else {
+      playPreviousTrack();
+    }
+    peakHeap = max(peakHeap, playOrderHeap());
+    handleAudioPlayback();
+    advanceMillis(200);
+  }
+
+  unsigned long lookups = trackCacheHits + trackCacheMisses;
+  printf("%-10s %4lu/%4lu hits (%5.1f%%), %4lu prefetched, play order heap %5zu bytes\n",
+         pattern, trackCacheHits, lookups, trackCacheHits * 100.0 / lookups,
+         trackCachePrefetches, peakHeap);
+  return trackCacheMisses;
+}
+
+// Straight through and back and forth in library order
+void testLibraryOrder() {
+  setShuffle(false);
+  CHECK_EQ(skipThrough("sequential", 300, 100, 0), 0);
+  CHECK_EQ(skipThrough("browse", 500, 70, 0), 0);
+  CHECK_EQ(playOrderHeap(), 0);
+}
+
+// Shuffle order: the neighbours are in the order, not in the library
+void testShuffleOrder() {
+  setShuffle(true);
+  CHECK_EQ(skipThrough("shuffle", 500, 70, 0), 0);
+  CHECK_EQ(playOrderHeap(), LIBRARY_TRACKS * sizeof(uint16_t));
+  setShuffle(false);
+}
+
+// A playlist scattered over the library, shuffled and not
+void testPlaylistOrder() {
+  CHECK(setActivePlaylist("scattered"));
+  CHECK_EQ(skipThrough("playlist", 500, 70, 0), 0);
+  setShuffle(true);
+  CHECK_EQ(skipThrough("pl shuffle", 500, 70, 0), 0);
+  CHECK_EQ(playOrderHeap(), PLAYLIST_TRACKS * (sizeof(uint16_t) + sizeof(int)));
+  setShuffle(false);
+  setActivePlaylist(NULL);
+}
+
+// Jumping to a track misses at most once, skipping on from it doesn't
+void testJumps() {
+  CHECK(skipThrough("jumps", 500, 70, 25) <= 500 / 25);
+}
+
+// The cache is a fixed array, its size doesn't follow the library
+void testCacheSize() {
+  printf("track cache: %d entries, %zu bytes of RAM for a %d track library\n",
+         TRACK_CACHE_SIZE, sizeof(trackCache), LIBRARY_TRACKS);
+  CHECK(sizeof(trackCache) <= TRACK_CACHE_SIZE * (3 * (TRACK_CACHE_TEXT_MAX + 1) + 16));
+}
+
+int main() {
+  buildLibrary();
+  testLibraryOrder();
+  testShuffleOrder();
+  testPlaylistOrder();
+  testJumps();
+  testCacheSize();
+  return testResult("test_track_cache");
+}
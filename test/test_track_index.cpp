@@ -0,0 +1,208 @@
+// ESP32 Soundpod - Track Index Benchmark
+// Builds the flash track index for 100, 1,000 and 10,000 tracks on a
+// file-mapped partition and compares it with the layout it replaced, a RAM
+// array of Strings copied out by value: RAM used, heap allocations and
+// time per lookup.
+
+#include <chrono>
+#include <new>
+#include <vector>
+#include "testing.h"
+#include "trackIndex.h"
+
+#define INDEX_PARTITION_SIZE 0x400000
+#define INDEX_FILE "track_index.bin"
+#define LOOKUPS 200000
+
+// Device figures for the old layout: an Arduino String is a buffer pointer,
+// a capacity and a length, and every heap block carries a header
+#define DEVICE_STRING_OBJECT 12
+#define DEVICE_INT 4
+#define DEVICE_HEAP_HEADER 8
+#define DEVICE_FREE_HEAP 300000 // About what an ESP32 sketch has left
+
+// Heap allocations made anywhere in the test
+unsigned long heapAllocations = 0;
+
+void* operator new(size_t size) {
+  heapAllocations++;
+  void* block = malloc(size);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  free(block);
+}
+
+void operator delete(void* block, size_t size) noexcept {
+  free(block);
+}
+
+// The layout the index replaced: Strings per track in a RAM array, copied
+// out by value on every lookup
+struct LegacyTrackInfo {
+  String filename;
+  String title;
+  String artist;
+  String album;
+  int trackNumber;
+};
+
+std::vector<LegacyTrackInfo> legacyList;
+
+LegacyTrackInfo getLegacyTrackInfo(int index) {
+  return legacyList[index];
+}
+
+// Names of track i, about as long as real tags
+void trackNames(int i, char* filename, char* title, char* artist, char* album) {
+  snprintf(filename, 96, "/music/%05d - Artist number %d - Song title %d.mp3", i + 1, i % 97, i + 1);
+  snprintf(title, 64, "Song title number %d", i + 1);
+  snprintf(artist, 64, "Artist number %d", i % 97);
+  snprintf(album, 64, "Album number %d of the library", i % 499);
+}
+
+// Bytes the old array takes on the device for the loaded tracks
+size_t legacyDeviceBytes() {
+  size_t bytes = legacyList.size() * (4 * DEVICE_STRING_OBJECT + DEVICE_INT);
+  for (const LegacyTrackInfo& track : legacyList) {
+    for (const String* text : { &track.filename, &track.title, &track.artist, &track.album }) {
+      bytes += ((text->length() + 1 + 3) & ~3) + DEVICE_HEAP_HEADER;
+    }
+  }
+  return bytes;
+}
+
+// RAM the index reader keeps, the same whatever the library size
+size_t indexRamBytes() {
+  return sizeof(trackIndexPartition) + sizeof(trackIndexSlotSize) + sizeof(trackIndexMapHandle) +
+         sizeof(trackIndexMap) + sizeof(trackIndexRecords) + sizeof(trackIndexCount) +
+         sizeof(trackIndexSlot) + sizeof(trackIndexGeneration) + sizeof(trackIndexDamaged) +
+         sizeof(trackIndexSorted);
+}
+
+// Flash the active slot uses: header sector, records, sort orders and pool
+size_t indexFlashBytes() {
+  TrackIndexHeader header;
+  memcpy(&header, trackIndexMap, sizeof(header));
+  size_t used = header.recordsOffset + header.trackCount * sizeof(TrackRecord);
+  used += SORT_KEY_COUNT * header.trackCount * sizeof(uint16_t);
+  return used + trackIndexSlotSize - header.poolOffset;
+}
+
+// Build both layouts for count tracks
+void buildLibrary(int count) {
+  closeTrackIndex();
+  trackIndexPartition = NULL;
+  addFileMappedPartition(TRACK_INDEX_PARTITION, INDEX_PARTITION_SIZE, INDEX_FILE);
+  legacyList.clear();
+
+  CHECK(beginTrackIndex());
+  for (int i = 0; i < count; i++) {
+    char filename[96], title[64], artist[64], album[64];
+    trackNames(i, filename, title, artist, album);
+    CHECK(addIndexedTrack(filename, title, artist, album, i % 20 + 1, 4000000 + i, 0));
+    legacyList.push_back({ filename, title, artist, album, i % 20 + 1 });
+  }
+  CHECK(commitTrackIndex());
+  CHECK_EQ(trackIndexCount, count);
+}
+
+// Nanoseconds per lookup of a random track, and heap allocations per lookup
+struct LookupCost {
+  double nanos;
+  double allocations;
+};
+
+LookupCost timeLegacy(const std::vector<int>& order) {
+  size_t sink = 0;
+  unsigned long allocations = heapAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int index : order) {
+    LegacyTrackInfo info = getLegacyTrackInfo(index);
+    sink += info.title.length() + info.artist.length();
+  }
+  double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  CHECK(sink > 0);
+  return { nanos / order.size(), (double)(heapAllocations - allocations) / order.size() };
+}
+
+LookupCost timeIndex(const std::vector<int>& order) {
+  size_t sink = 0;
+  unsigned long allocations = heapAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int index : order) {
+    TrackInfo info;
+    getIndexedTrack(index, &info);
+    sink += strlen(info.title) + strlen(info.artist);
+  }
+  double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  CHECK(sink > 0);
+  return { nanos / order.size(), (double)(heapAllocations - allocations) / order.size() };
+}
+
+// Both layouts give the same names for every track
+void checkSameNames() {
+  for (size_t i = 0; i < legacyList.size(); i++) {
+    TrackInfo info;
+    CHECK(getIndexedTrack(i, &info));
+    CHECK(strcmp(info.filename, legacyList[i].filename.c_str()) == 0);
+    CHECK(strcmp(info.title, legacyList[i].title.c_str()) == 0);
+    CHECK(strcmp(info.artist, legacyList[i].artist.c_str()) == 0);
+    CHECK(strcmp(info.album, legacyList[i].album.c_str()) == 0);
+    CHECK_EQ(info.trackNumber, legacyList[i].trackNumber);
+  }
+}
+
+void benchmark(int count) {
+  buildLibrary(count);
+  checkSameNames();
+
+  std::vector<int> order(LOOKUPS);
+  srand(count);
+  for (int& index : order) {
+    index = random(count);
+  }
+
+  // Warm both once, then time them
+  timeLegacy(order);
+  timeIndex(order);
+  unsigned long maps = fakePartitionMaps;
+  LookupCost legacy = timeLegacy(order);
+  LookupCost indexed = timeIndex(order);
+
+  // Lookups read the mapping in place, they neither map nor allocate
+  CHECK_EQ(fakePartitionMaps, maps);
+  CHECK_EQ(indexed.allocations, 0);
+  CHECK(legacy.allocations >= 3); // Short artists fit the host's small-string buffer
+  CHECK(indexed.nanos < legacy.nanos);
+
+  size_t legacyRam = legacyDeviceBytes();
+  size_t indexRam = indexRamBytes();
+  CHECK(indexRam < legacyRam);
+  printf("%5d tracks: RAM %7zu bytes as Strings%s vs %3zu bytes for the index (%7zu bytes of flash); "
+         "lookup %6.1f ns, %.0f allocations vs %5.1f ns, %.0f allocations\n",
+         count, legacyRam, legacyRam > DEVICE_FREE_HEAP ? " (more than the heap)" : "", indexRam,
+         indexFlashBytes(), legacy.nanos, legacy.allocations, indexed.nanos, indexed.allocations);
+}
+
+// The index survives a reopen from the file, as after a reboot
+void testReopen() {
+  uint32_t generation = trackIndexGeneration;
+  closeTrackIndex();
+  CHECK(openTrackIndex());
+  CHECK_EQ(trackIndexGeneration, generation);
+  checkSameNames();
+}
+
+int main() {
+  benchmark(100);
+  benchmark(1000);
+  benchmark(10000);
+  testReopen();
+  unlink(INDEX_FILE);
+  return testResult("test_track_index");
+}
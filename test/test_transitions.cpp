@@ -0,0 +1,195 @@
+// ESP32 Soundpod - Track Transition Tests
+// Plays a shuffled library through the fake DFPlayer with volume traffic on
+// the UART, and measures the gap from each "finished" message to the next
+// play command. Also checks the shuffle is a fair permutation.
+
+#include <algorithm>
+#include <set>
+#include <vector>
+#include "testing.h"
+#include "mp3Handler.h"
+#include "fakeDfPlayer.h"
+
+#define LIBRARY_TRACKS 40
+#define PLAYER_LATENCY_MS 30 // Command out, ACK back, at 9600 baud
+
+HardwareSerial playerSerial;
+
+int loadPlaylist(String name, int first, int* tracks, int capacity, int* trackCount) {
+  return -1;
+}
+
+// Start from a fresh player and library
+FakeDfPlayer* startPlayer() {
+  static FakeDfPlayer* player = NULL;
+  delete player;
+  player = new FakeDfPlayer();
+  player->latency = PLAYER_LATENCY_MS;
+  dfPlayerBegin(*player);
+  totalTracks = LIBRARY_TRACKS;
+  resumePending = false;
+  transitionGapCount = 0;
+  transitionGapNext = 0;
+  return player;
+}
+
+// True if the order steps by the same amount every time, like a stride
+bool isProgression(const std::vector<int>& order) {
+  int n = order.size();
+  int step = (order[1] - order[0] + n) % n;
+  for (int i = 2; i < n; i++) {
+    if ((order[i] - order[i - 1] + n) % n != step) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every shuffle is a permutation, positionOfTrack undoes it, and it is not
+// a fixed stride through the library
+void testShuffleIsPermutation() {
+  startPlayer();
+  setShuffle(true);
+  int progressions = 0;
+  for (int round = 0; round < 200; round++) {
+    reshuffle();
+    std::vector<int> order;
+    std::set<int> seen;
+    for (int position = 0; position < LIBRARY_TRACKS; position++) {
+      int track = trackAtPosition(position);
+      CHECK(track >= 1 && track <= LIBRARY_TRACKS);
+      CHECK_EQ(positionOfTrack(track), position);
+      order.push_back(track - 1);
+      seen.insert(track);
+    }
+    CHECK_EQ(seen.size(), LIBRARY_TRACKS);
+    progressions += isProgression(order);
+  }
+  CHECK_EQ(progressions, 0);
+  setShuffle(false);
+  CHECK(shuffleOrder == NULL);
+  CHECK_EQ(trackAtPosition(5), 6);
+}
+
+// All 24 orders of four tracks come up about equally often
+void testShuffleIsUniform() {
+  startPlayer();
+  totalTracks = 4;
+  setShuffle(true);
+  std::map<std::vector<int>, int> counts;
+  for (int round = 0; round < 24000; round++) {
+    reshuffle();
+    std::vector<int> order;
+    for (int position = 0; position < 4; position++) {
+      order.push_back(trackAtPosition(position));
+    }
+    counts[order]++;
+  }
+  CHECK_EQ(counts.size(), 24);
+  for (auto& count : counts) {
+    CHECK(count.second > 800 && count.second < 1200);
+  }
+  setShuffle(false);
+}
+
+// Play the shuffled library through with repeat all. Each track ends with
+// a "finished" message and its repeat, and volume presses keep commands in
+// flight. The play command has to be the first thing sent after a finish.
+void testTransitionGaps() {
+  FakeDfPlayer* player = startPlayer();
+  srand(7);
+  setRepeatMode(REPEAT_ALL);
+  setShuffle(true);
+  orderPosition = 0;
+  currentTrack = trackAtPosition(0);
+  startPlayback();
+
+  std::vector<int> played = { currentTrack };
+  std::vector<unsigned long> gaps;
+  size_t handled = 0; // Play commands the fake has scheduled a finish for
+  bool awaitingPlay = false;
+  size_t commandsAtFinish = 0;
+  unsigned long finishAt = 0;
+  unsigned long nextPress = millis() + 100;
+  bool pressUp = true;
+
+  while (played.size() < LIBRARY_TRACKS + TRANSITION_GAP_SAMPLES) {
+    // The fake plays each track 1-3 s and reports the end twice
+    size_t plays = 0;
+    for (const FakeCommand& command : player->received) {
+      if (command.command == DF_CMD_PLAY_TRACK && ++plays > handled) {
+        unsigned long length = 1000 + random(2000);
+        player->sendFrame(DF_MSG_PLAY_FINISHED, command.param, length);
+        player->sendFrame(DF_MSG_PLAY_FINISHED, command.param, length + 10);
+        finishAt = millis() + length;
+        handled = plays;
+      }
+    }
+    if (millis() == finishAt) {
+      awaitingPlay = true;
+      commandsAtFinish = player->received.size();
+    }
+
+    // Someone fiddles with the volume every few hundred ms
+    if (millis() >= nextPress) {
+      pressUp ? increaseVolume() : decreaseVolume();
+      pressUp = !pressUp;
+      nextPress = millis() + 100 + random(400);
+    }
+
+    unsigned long gapsBefore = dfGapCount;
+    handleAudioPlayback();
+    if (dfGapCount != gapsBefore) {
+      gaps.push_back(dfLastGapMicros);
+      played.push_back(currentTrack);
+    }
+    if (awaitingPlay && player->received.size() > commandsAtFinish) {
+      CHECK_EQ(player->received[commandsAtFinish].command, DF_CMD_PLAY_TRACK);
+      CHECK_EQ(player->received[commandsAtFinish].param, currentTrack);
+      awaitingPlay = false;
+    }
+    advanceMillis(1);
+  }
+
+  // One play per finish, the repeats start nothing
+  size_t plays = 0;
+  for (const FakeCommand& command : player->received) {
+    plays += command.command == DF_CMD_PLAY_TRACK;
+  }
+  CHECK_EQ(plays, played.size());
+
+  // Each pass of the order plays every track once
+  std::set<int> firstPass(played.begin(), played.begin() + LIBRARY_TRACKS);
+  CHECK_EQ(firstPass.size(), LIBRARY_TRACKS);
+  CHECK_EQ(played[LIBRARY_TRACKS], played[0]);
+
+  // Every gap is recorded, including the ones a command in flight held back
+  CHECK_EQ(transitionGapCount, TRANSITION_GAP_SAMPLES);
+  std::vector<unsigned long> recent(gaps.end() - TRANSITION_GAP_SAMPLES, gaps.end());
+  std::sort(recent.begin(), recent.end());
+  std::sort(gaps.begin(), gaps.end());
+  unsigned long p50 = gaps[(gaps.size() - 1) / 2];
+  unsigned long p99 = gaps[(gaps.size() - 1) * 99 / 100];
+  CHECK(p50 < 1000);
+  CHECK(p99 <= PLAYER_LATENCY_MS * 1000);
+  CHECK(gaps.back() <= PLAYER_LATENCY_MS * 1000);
+  CHECK(gaps.back() > 0); // Some finishes did land behind a volume command
+
+  Serial.output.clear();
+  printTransitionStats();
+  char expected[96];
+  snprintf(expected, sizeof(expected), "Track gap p50 %lu us, p99 %lu us over %d transitions\n",
+           recent[(TRANSITION_GAP_SAMPLES - 1) / 2], recent[(TRANSITION_GAP_SAMPLES - 1) * 99 / 100],
+           TRANSITION_GAP_SAMPLES);
+  CHECK(Serial.output == expected);
+
+  printf("track gaps over %zu transitions: p50 %lu us, p99 %lu us, max %lu us\n",
+         gaps.size(), p50, p99, gaps.back());
+}
+
+int main() {
+  testShuffleIsPermutation();
+  testShuffleIsUniform();
+  testTransitionGaps();
+  return testResult("test_transitions");
+}
@@ -0,0 +1,219 @@
+// ESP32 Soundpod - Task Wakeup Tests
+// Runs the audio, UI and storage tasks the way FreeRTOS would schedule
+// them: each blocks until its modules' next deadline or a notification,
+// and the loop task light-sleeps when all of them wait. Counts wakeups per
+// minute while playing and while paused, and the share of time asleep.
+
+#include "testing.h"
+#include "display.h"
+#include "mp3Handler.h"
+#include "dbHandler.h"
+#include "powerManagement.h"
+#include "buttons.h"
+#include "tasks.h"
+#include "fakeDfPlayer.h"
+
+#define SIMULATED_MINUTES 10
+#define TRACK_LENGTH_MS 180000
+
+HardwareSerial playerSerial;
+FakeDfPlayer player;
+
+// What the sketch does
+bool isIdle() {
+  return tasksBlocked() && buttonsIdle() && dfPlayerIdle() && !displayFlushBusy;
+}
+
+void printStats() {
+}
+
+// Absolute wake time of a task blocked for a deadline in ms
+unsigned long wakeTime(unsigned long deadline) {
+  return deadline == NO_DEADLINE ? NO_DEADLINE : millis() + deadline;
+}
+
+// Simulated scheduler state
+unsigned long audioWakeAt = 0;
+unsigned long uiWakeAt = 0;
+unsigned long storageWakeAt = 0;
+uint32_t notifiedVersion = 0;
+size_t finishesScheduled = 0;
+
+// One pass of each task that is due, as its loop in tasks.h runs it.
+// Returns true if any ran.
+bool runDueTasks() {
+  bool ran = false;
+
+  // Player frames wake the audio task from the UART callback, queued
+  // commands from postPlayerCommand()
+  if (player.available() > 0) {
+    dfPlayerOnReceive();
+    audioWakeAt = millis();
+  }
+  if (!playerCommandQueue->items.empty()) {
+    audioWakeAt = millis();
+  }
+  if (millis() >= audioWakeAt) {
+    audioWakeups++;
+    audioTaskPass();
+    audioWakeAt = wakeTime(dfPlayerNextDeadline());
+    ran = true;
+  }
+
+  // Player state changes notify the UI and storage tasks
+  if (playerState.version != notifiedVersion) {
+    notifiedVersion = playerState.version;
+    uiWakeAt = millis();
+    storageWakeAt = millis();
+  }
+  if (millis() >= uiWakeAt) {
+    uiWakeups++;
+    uiTaskPass();
+    if (displayFlushBusy) {
+      // The flush task has the bus, the UI task doesn't wait for it
+      unsigned long now = fakeMicros;
+      sendDisplayFrame();
+      fakeMicros = now;
+    }
+    uiWakeAt = wakeTime(displayNextDeadline());
+    ran = true;
+  }
+  if (millis() >= storageWakeAt) {
+    storageWakeups++;
+    storageTaskPass();
+    storageWakeAt = wakeTime(storageNextDeadline());
+    ran = true;
+  }
+  return ran;
+}
+
+// The player reports the end of each track it was told to play, twice
+void scheduleFinishes() {
+  size_t plays = 0;
+  for (const FakeCommand& command : player.received) {
+    if (command.command == DF_CMD_PLAY_TRACK && ++plays > finishesScheduled) {
+      player.sendFrame(DF_MSG_PLAY_FINISHED, command.param, TRACK_LENGTH_MS);
+      player.sendFrame(DF_MSG_PLAY_FINISHED, command.param, TRACK_LENGTH_MS + 10);
+      finishesScheduled = plays;
+    }
+  }
+}
+
+// Wakeups of the four tasks together
+unsigned long taskWakeups() {
+  return audioWakeups + inputWakeups + uiWakeups + storageWakeups;
+}
+
+// Per-minute figures of one simulated stretch
+struct WakeupReport {
+  double audio;
+  double ui;
+  double storage;
+  double total;
+  double asleepPercent;
+};
+
+// Run the scheduler for minutes of simulated time
+WakeupReport simulate(const char* name, unsigned long minutes) {
+  unsigned long audio = audioWakeups;
+  unsigned long ui = uiWakeups;
+  unsigned long storage = storageWakeups;
+  unsigned long total = taskWakeups();
+  unsigned long asleep = lightSleepMillis;
+  unsigned long start = millis();
+  unsigned long end = start + minutes * 60000;
+
+  while (millis() < end) {
+    scheduleFinishes();
+    if (!runDueTasks()) {
+      // Nothing ran this tick: the loop task gets the core. A light sleep
+      // moves the fake clock to the deadline it armed.
+      unsigned long before = fakeMicros;
+      unsigned long sleeps = lightSleepCount;
+      sleepUntilNextDeadline();
+      if (lightSleepCount != sleeps) {
+        // Woken tasks recompute their deadlines, see sleepUntilNextDeadline()
+        audioWakeAt = uiWakeAt = storageWakeAt = millis();
+        continue;
+      }
+      if (fakeMicros != before) {
+        continue;
+      }
+    }
+    advanceMillis(1);
+  }
+
+  WakeupReport report;
+  report.audio = (audioWakeups - audio) / (double)minutes;
+  report.ui = (uiWakeups - ui) / (double)minutes;
+  report.storage = (storageWakeups - storage) / (double)minutes;
+  report.total = (taskWakeups() - total) / (double)minutes;
+  report.asleepPercent = (lightSleepMillis - asleep) * 100.0 / (millis() - start);
+  printf("%-22s wakeups/min: audio %5.1f, ui %6.1f, storage %4.1f, total %6.1f; asleep %5.1f%%\n",
+         name, report.audio, report.ui, report.storage, report.total, report.asleepPercent);
+  return report;
+}
+
+// Boot the modules the tasks drive, on the fake player
+void bootFirmware() {
+  addFakePartition(STATE_JOURNAL_PARTITION, 0x4000);
+  initDisplay();
+  initButtons(handleButtonEvent);
+  dfPlayerBegin(player);
+  dfPlayerListen(player);
+  fakeAdcMillivolts = 1950; // A healthy cell behind the divider
+  totalTracks = 50;
+  resumePending = false;
+  initPowerManagement();
+  startTasks();
+  recordActivity();
+}
+
+// Playing with names that fit the screen: the UI only wakes for changes
+void testPlaying() {
+  recordActivity();
+  currentTrack = 1;
+  startPlayback();
+  simulate("settling", 1);
+  WakeupReport playing = simulate("playing", SIMULATED_MINUTES);
+  CHECK(playing.total < 30);
+  CHECK(playing.ui < 10);
+  CHECK_EQ(playing.asleepPercent, 0); // UART wakeup would lose the finish message
+}
+
+// A scrolling title costs a frame per marquee step, less the hold at the
+// start of each pass and never above DISPLAY_MAX_FPS, and nothing else
+void testPlayingScrolling() {
+  publishTrack(currentTrack, totalTracks, "A title much too long for the screen to show", "Artist");
+  WakeupReport scrolling = simulate("playing, long title", 2);
+  CHECK(scrolling.ui > 60000 / MARQUEE_STEP_MS / 4);
+  CHECK(scrolling.ui <= 60 * DISPLAY_MAX_FPS + 60);
+  CHECK(scrolling.storage < 10);
+  publishTrack(currentTrack, totalTracks, "Short", "Artist");
+}
+
+// Paused, the chip is asleep between the battery reading and the rest
+void testPaused() {
+  recordActivity();
+  postPlayerCommand(PLAYER_TOGGLE);
+  simulate("pausing", 1);
+  CHECK(!isPlaying);
+  unsigned long sleeps = lightSleepCount;
+  WakeupReport paused = simulate("paused", SIMULATED_MINUTES);
+  CHECK(lightSleepCount > sleeps);
+  CHECK(paused.total < 10);
+  CHECK(paused.asleepPercent > 95);
+  CHECK_EQ(fakeDeepSleeps, 0);
+
+  Serial.output.clear();
+  printSleepStats();
+  printf("%s", Serial.output.c_str());
+}
+
+int main() {
+  bootFirmware();
+  testPlaying();
+  testPlayingScrolling();
+  testPaused();
+  return testResult("test_wakeups");
+}
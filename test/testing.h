@@ -0,0 +1,41 @@
+// ESP32 Soundpod - Host Test Checks
+// Minimal checks for the host tests: a failed check prints where and what
+// and the test's main() returns the failure count.
+
+#ifndef TEST_TESTING_H
+#define TEST_TESTING_H
+
+#include <stdio.h>
+
+int testFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      testFailures++; \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    long long actualValue = (long long)(actual); \
+    long long expectedValue = (long long)(expected); \
+    if (actualValue != expectedValue) { \
+      testFailures++; \
+      fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+              #actual, #expected, actualValue, expectedValue); \
+    } \
+  } while (0)
+
+// Report and return the exit code for main()
+int testResult(const char* name) {
+  if (testFailures == 0) {
+    printf("%s: all checks passed\n", name);
+    return 0;
+  }
+  printf("%s: %d checks failed\n", name, testFailures);
+  return 1;
+}
+
+#endif // TEST_TESTING_H
@@ -0,0 +1,115 @@
+// ESP32 Soundpod - Track Cache
+// Small LRU cache of decoded track metadata in RAM, in front of the flash
+// track index. Entries are plain copies, so they stay valid when a rescan
+// switches index slots, and the play order prefetches the tracks either
+// side of the playing one so next/previous never touch flash.
+
+#ifndef TRACKCACHE_H
+#define TRACKCACHE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "trackIndex.h"
+
+#define TRACK_CACHE_TEXT_MAX 63 // Longer names are cut short in the cache
+
+// One decoded track
+struct CachedTrack {
+  int index;              // Library index, -1 = empty entry
+  char title[TRACK_CACHE_TEXT_MAX + 1];
+  char artist[TRACK_CACHE_TEXT_MAX + 1];
+  char album[TRACK_CACHE_TEXT_MAX + 1];
+  int trackNumber;
+  uint32_t lastUsed;      // LRU clock value of the last lookup
+};
+
+CachedTrack trackCache[TRACK_CACHE_SIZE];
+uint32_t trackCacheClock = 0;
+unsigned long trackCacheHits = 0;
+unsigned long trackCacheMisses = 0;
+unsigned long trackCachePrefetches = 0;
+volatile bool trackLibraryReady = false; // False while the index is being scanned
+
+// Function declarations
+void clearTrackCache();
+const CachedTrack* getCachedTrack(int index);
+void prefetchTrack(int index);
+void printTrackCacheStats();
+
+// Drop all entries, needed whenever the index is rebuilt
+void clearTrackCache() {
+  for (int i = 0; i < TRACK_CACHE_SIZE; i++) {
+    trackCache[i].index = -1;
+    trackCache[i].lastUsed = 0;
+  }
+}
+
+// Find an entry, or load it into the least recently used one
+// Returns NULL if the index has no such track.
+CachedTrack* lookupTrackCache(int index, bool prefetch) {
+  CachedTrack* victim = &trackCache[0];
+  for (int i = 0; i < TRACK_CACHE_SIZE; i++) {
+    if (trackCache[i].index == index) {
+      if (!prefetch) {
+        trackCacheHits++;
+      }
+      trackCache[i].lastUsed = ++trackCacheClock;
+      return &trackCache[i];
+    }
+    if (trackCache[i].lastUsed < victim->lastUsed) {
+      victim = &trackCache[i];
+    }
+  }
+  
+  TrackInfo info;
+  if (!getIndexedTrack(index, &info)) {
+    return NULL;
+  }
+  
+  if (prefetch) {
+    trackCachePrefetches++;
+  } else {
+    trackCacheMisses++;
+  }
+  victim->index = index;
+  strlcpy(victim->title, info.title, sizeof(victim->title));
+  strlcpy(victim->artist, info.artist, sizeof(victim->artist));
+  strlcpy(victim->album, info.album, sizeof(victim->album));
+  victim->trackNumber = info.trackNumber;
+  victim->lastUsed = ++trackCacheClock;
+  return victim;
+}
+
+// Get decoded metadata for a library index (0-based), NULL if invalid
+const CachedTrack* getCachedTrack(int index) {
+  if (!trackLibraryReady) {
+    return NULL;
+  }
+  return lookupTrackCache(index, false);
+}
+
+// Load a track ahead of its lookup, without counting it as a hit or miss
+void prefetchTrack(int index) {
+  if (!trackLibraryReady || index < 0) {
+    return;
+  }
+  lookupTrackCache(index, true);
+}
+
+// Report cache effectiveness and the heap low-water mark
+void printTrackCacheStats() {
+  unsigned long lookups = trackCacheHits + trackCacheMisses;
+  Serial.print("Track cache: ");
+  Serial.print(trackCacheHits);
+  Serial.print("/");
+  Serial.print(lookups);
+  Serial.print(" hits (");
+  Serial.print(lookups > 0 ? trackCacheHits * 100 / lookups : 0);
+  Serial.print("%), ");
+  Serial.print(trackCachePrefetches);
+  Serial.print(" prefetched, min free heap ");
+  Serial.print(ESP.getMinFreeHeap());
+  Serial.println(" bytes");
+}
+
+#endif // TRACKCACHE_H
\ No newline at end of file
@@ -0,0 +1,785 @@
+// ESP32 Soundpod - Track Index
+// Compact on-flash library index: fixed-width track records plus an
+// interned string pool, read in place through a memory mapping
+
+#ifndef TRACKINDEX_H
+#define TRACKINDEX_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include "config.h"
+
+// The partition holds two index slots. A rebuild writes the inactive slot
+// while the active one stays mapped, and the slot with the newest valid
+// header wins. Layout of a slot:
+//   [header sector][records, growing up ->      <- string pool, growing down]
+// String offsets are relative to the slot start. The header is written
+// last, so an interrupted build never leaves a half-valid index behind.
+// Commit appends one sorted array of record numbers per browse key after
+// the records, so browsing and prefix search are binary searches in flash.
+// The path order is one of them, rescans use it to find moved files.
+#define TRACK_INDEX_MAGIC 0x58444954 // "TIDX"
+#define TRACK_INDEX_VERSION 4
+#define TRACK_INDEX_SECTOR 4096
+#define TRACK_INDEX_SLOTS 2
+#define TRACK_INDEX_INTERN_SLOTS 2048 // Dedup table size while building (power of 2)
+#define TRACK_STRING_MAX 255          // Longer tag strings are truncated
+#define TRACK_MATCH_WINDOW 16         // Records searched ahead when matching a rescan
+
+// Browse orders kept in the index
+enum TrackSortKey {
+  SORT_BY_ARTIST,         // Artist, then album, then track number
+  SORT_BY_ALBUM,          // Album, then track number
+  SORT_BY_TITLE,
+  SORT_BY_PATH,           // Exact file path, for rescan matching
+  SORT_KEY_COUNT
+};
+
+struct TrackIndexHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t generation;    // Higher wins between the two slots
+  uint32_t trackCount;
+  uint32_t recordsOffset;
+  uint32_t poolOffset;    // Lowest byte used by the string pool
+  uint32_t sortOffset[SORT_KEY_COUNT]; // uint16_t record numbers in browse order, 0 if missing
+  uint32_t crc;           // CRC32 of the fields above
+};
+
+struct TrackRecord {
+  uint32_t filename;      // String pool offsets
+  uint32_t title;
+  uint32_t artist;
+  uint32_t album;
+  uint32_t fileSize;      // Fingerprint used to skip unchanged files on rescan
+  uint32_t modified;
+  uint16_t trackNumber;
+  uint16_t reserved;
+};
+
+// Track information, a view into the mapped index
+struct TrackInfo {
+  const char* filename;
+  const char* title;
+  const char* artist;
+  const char* album;
+  int trackNumber;
+  uint32_t fileSize;
+  uint32_t modified;
+};
+
+// Builder position, persisted so an interrupted scan can resume
+struct TrackIndexCheckpoint {
+  uint32_t magic;
+  uint32_t generation;    // Generation the build will commit as
+  uint32_t slot;
+  uint32_t count;
+  uint32_t recordCursor;
+  uint32_t poolCursor;
+  uint32_t entriesDone;   // Directory entries already processed by the scan
+  uint32_t matchCursor;   // Where rescan matching continues in the old index
+  uint32_t crc;           // CRC32 of the fields above
+};
+
+struct InternSlot {
+  uint32_t hash;
+  uint32_t offset;        // 0 = empty slot
+};
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_partition_mmap_handle_t TrackIndexMapHandle;
+#define TRACK_INDEX_MMAP_DATA ESP_PARTITION_MMAP_DATA
+#else
+typedef spi_flash_mmap_handle_t TrackIndexMapHandle;
+#define TRACK_INDEX_MMAP_DATA SPI_FLASH_MMAP_DATA
+#endif
+
+// Reader state
+const esp_partition_t* trackIndexPartition = NULL;
+uint32_t trackIndexSlotSize = 0;
+TrackIndexMapHandle trackIndexMapHandle;
+const uint8_t* trackIndexMap = NULL;
+const TrackRecord* trackIndexRecords = NULL;
+uint32_t trackIndexCount = 0;
+uint8_t trackIndexSlot = 0;
+uint32_t trackIndexGeneration = 0; // 0 = no index
+bool trackIndexDamaged = false;    // A slot had a good header over bad records
+const uint16_t* trackIndexSorted[SORT_KEY_COUNT];
+unsigned long sortedKeyReads = 0; // Keys read by the browse searches, each a flash access
+
+// Sort state for qsort() while committing
+const uint8_t* sortMap = NULL;
+const TrackRecord* sortRecords = NULL;
+uint8_t sortKey = SORT_BY_ARTIST;
+
+// Builder state
+uint8_t buildSlot = 0;
+uint32_t buildBase = 0;        // Partition offset of the slot being built
+uint32_t buildRecordCursor = 0;
+uint32_t buildPoolCursor = 0;
+uint32_t buildErasedLow = 0;   // Records may be written below this
+uint32_t buildErasedHigh = 0;  // Strings may be written at or above this
+uint32_t buildCount = 0;
+InternSlot* buildIntern = NULL;
+uint32_t buildInternUsed = 0;
+bool buildActive = false;   // Between beginTrackIndex() and commitTrackIndex()
+bool buildFailed = false;   // Index filled up, later tracks are dropped
+
+// Function declarations
+bool openTrackIndex();
+void closeTrackIndex();
+bool getIndexedTrack(int index, TrackInfo* info);
+int findIndexedFile(const char* filename, int from);
+bool beginTrackIndex();
+bool resumeTrackIndex(const TrackIndexCheckpoint& checkpoint);
+void getTrackIndexCheckpoint(TrackIndexCheckpoint* checkpoint);
+bool addIndexedTrack(const char* filename, const char* title, const char* artist,
+                     const char* album, int trackNumber, uint32_t fileSize, uint32_t modified);
+bool commitTrackIndex();
+void abortTrackIndex();
+int getSortedTrack(TrackSortKey key, int position);
+int findSortedPrefix(TrackSortKey key, const char* prefix, int* count);
+int nextSortedGroup(TrackSortKey key, int position);
+const char* sortedKeyAt(TrackSortKey key, int position);
+
+// Locate the index partition
+bool findTrackIndexPartition() {
+  if (trackIndexPartition == NULL) {
+    trackIndexPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                   ESP_PARTITION_SUBTYPE_ANY,
+                                                   TRACK_INDEX_PARTITION);
+    if (trackIndexPartition == NULL) {
+      Serial.println("Track index partition not found");
+      return false;
+    }
+    // Slots start on a 64 KB boundary so each can be mapped on its own
+    trackIndexSlotSize = (trackIndexPartition->size / TRACK_INDEX_SLOTS) & ~0xFFFFUL;
+  }
+  return true;
+}
+
+// Read and validate one slot header, returns its generation or 0
+uint32_t readTrackIndexHeader(uint8_t slot, TrackIndexHeader* header) {
+  if (esp_partition_read(trackIndexPartition, slot * trackIndexSlotSize, header, sizeof(*header)) != ESP_OK) {
+    return 0;
+  }
+  
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)header, offsetof(TrackIndexHeader, crc));
+  uint32_t recordsEnd = header->recordsOffset + header->trackCount * sizeof(TrackRecord);
+  if (header->magic != TRACK_INDEX_MAGIC || header->version != TRACK_INDEX_VERSION ||
+      header->recordSize != sizeof(TrackRecord) || header->crc != crc ||
+      recordsEnd > header->poolOffset || header->poolOffset > trackIndexSlotSize) {
+    return 0;
+  }
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    if (header->sortOffset[key] != 0 &&
+        header->sortOffset[key] + header->trackCount * sizeof(uint16_t) > header->poolOffset) {
+      return 0;
+    }
+  }
+  return header->generation;
+}
+
+// Drop the mapping behind trackIndexMapHandle
+void unmapTrackIndex() {
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_partition_munmap(trackIndexMapHandle);
+#else
+  spi_flash_munmap(trackIndexMapHandle);
+#endif
+}
+
+// Check everything the reader follows in a mapped slot: string offsets
+// inside the pool, the pool ending in a terminator so every string does,
+// and browse orders naming real records. The header CRC doesn't cover
+// these, a write cut short or a worn sector can leave them damaged.
+bool checkTrackIndexRecords(const uint8_t* map, const TrackIndexHeader& header) {
+  if (header.trackCount > 0 && map[trackIndexSlotSize - 1] != '\0') {
+    return false;
+  }
+  const TrackRecord* records = (const TrackRecord*)(map + header.recordsOffset);
+  for (uint32_t i = 0; i < header.trackCount; i++) {
+    const uint32_t offsets[] = { records[i].filename, records[i].title, records[i].artist, records[i].album };
+    for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+      if (offsets[j] < header.poolOffset || offsets[j] >= trackIndexSlotSize) {
+        return false;
+      }
+    }
+  }
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    if (header.sortOffset[key] == 0) {
+      continue;
+    }
+    const uint16_t* order = (const uint16_t*)(map + header.sortOffset[key]);
+    for (uint32_t i = 0; i < header.trackCount; i++) {
+      if (order[i] >= header.trackCount) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Map the newest valid index, returns false if there is none
+// A slot with damaged records is passed over for the other one, and
+// trackIndexDamaged tells the scan to write a new index.
+bool openTrackIndex() {
+  closeTrackIndex();
+  if (!findTrackIndexPartition()) {
+    return false;
+  }
+  
+  trackIndexDamaged = false;
+  
+  TrackIndexHeader headers[TRACK_INDEX_SLOTS];
+  uint32_t generations[TRACK_INDEX_SLOTS];
+  for (uint8_t slot = 0; slot < TRACK_INDEX_SLOTS; slot++) {
+    generations[slot] = readTrackIndexHeader(slot, &headers[slot]);
+  }
+  
+  // Newest first, falling back to the older slot if its records are bad
+  const void* mapped = NULL;
+  int best = -1;
+  uint32_t bestGeneration = 0;
+  for (;;) {
+    best = -1;
+    bestGeneration = 0;
+    for (uint8_t slot = 0; slot < TRACK_INDEX_SLOTS; slot++) {
+      if (generations[slot] > bestGeneration) {
+        best = slot;
+        bestGeneration = generations[slot];
+      }
+    }
+    if (best < 0) {
+      Serial.println("No valid track index");
+      return false;
+    }
+    
+    if (esp_partition_mmap(trackIndexPartition, best * trackIndexSlotSize, trackIndexSlotSize,
+                           TRACK_INDEX_MMAP_DATA, &mapped, &trackIndexMapHandle) != ESP_OK) {
+      Serial.println("Failed to map track index");
+      return false;
+    }
+    if (checkTrackIndexRecords((const uint8_t*)mapped, headers[best])) {
+      break;
+    }
+    
+    Serial.print("Track index slot ");
+    Serial.print(best);
+    Serial.println(" damaged");
+    unmapTrackIndex();
+    generations[best] = 0;
+    trackIndexDamaged = true;
+  }
+  
+  trackIndexMap = (const uint8_t*)mapped;
+  trackIndexRecords = (const TrackRecord*)(trackIndexMap + headers[best].recordsOffset);
+  trackIndexCount = headers[best].trackCount;
+  trackIndexSlot = best;
+  trackIndexGeneration = bestGeneration;
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    uint32_t offset = headers[best].sortOffset[key];
+    trackIndexSorted[key] = offset ? (const uint16_t*)(trackIndexMap + offset) : NULL;
+  }
+  return true;
+}
+
+// Release the mapping, any TrackInfo views become invalid
+void closeTrackIndex() {
+  if (trackIndexMap != NULL) {
+    unmapTrackIndex();
+    trackIndexMap = NULL;
+  }
+  trackIndexRecords = NULL;
+  trackIndexCount = 0;
+  trackIndexGeneration = 0;
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    trackIndexSorted[key] = NULL;
+  }
+}
+
+// Fill a view of one track, strings point straight into flash
+bool getIndexedTrack(int index, TrackInfo* info) {
+  if (index < 0 || (uint32_t)index >= trackIndexCount) {
+    return false;
+  }
+  
+  const TrackRecord& record = trackIndexRecords[index];
+  info->filename = (const char*)(trackIndexMap + record.filename);
+  info->title = (const char*)(trackIndexMap + record.title);
+  info->artist = (const char*)(trackIndexMap + record.artist);
+  info->album = (const char*)(trackIndexMap + record.album);
+  info->trackNumber = record.trackNumber;
+  info->fileSize = record.fileSize;
+  info->modified = record.modified;
+  return true;
+}
+
+// Find a file in the mapped index, looking a short way ahead of from first
+// Rescans walk the card in the same order as the last scan, so a match is
+// almost always at from itself. After a run of deleted or renamed files
+// the path order finds it anywhere, so the caller can re-anchor there.
+// Returns -1 if the file isn't indexed.
+int findIndexedFile(const char* filename, int from) {
+  for (int i = from; i < (int)trackIndexCount && i < from + TRACK_MATCH_WINDOW; i++) {
+    if (strcmp((const char*)(trackIndexMap + trackIndexRecords[i].filename), filename) == 0) {
+      return i;
+    }
+  }
+  
+  // Binary search by path, or a full pass if the index has no path order
+  const uint16_t* order = trackIndexSorted[SORT_BY_PATH];
+  if (order == NULL) {
+    for (int i = 0; i < (int)trackIndexCount; i++) {
+      if (strcmp((const char*)(trackIndexMap + trackIndexRecords[i].filename), filename) == 0) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  int low = 0;
+  int high = trackIndexCount;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (strcmp((const char*)(trackIndexMap + trackIndexRecords[order[mid]].filename), filename) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < (int)trackIndexCount &&
+      strcmp((const char*)(trackIndexMap + trackIndexRecords[order[low]].filename), filename) == 0) {
+    return order[low];
+  }
+  return -1;
+}
+
+// Erase sectors so records can be written up to (but not including) end
+// Once the two erased regions meet, everything in between is already erased.
+bool eraseIndexUpTo(uint32_t end) {
+  while (end > buildErasedLow && buildErasedLow < buildErasedHigh) {
+    if (esp_partition_erase_range(trackIndexPartition, buildBase + buildErasedLow, TRACK_INDEX_SECTOR) != ESP_OK) {
+      return false;
+    }
+    buildErasedLow += TRACK_INDEX_SECTOR;
+  }
+  return true;
+}
+
+// Erase sectors so strings can be written down to start
+bool eraseIndexDownTo(uint32_t start) {
+  while (start < buildErasedHigh && buildErasedHigh > buildErasedLow) {
+    buildErasedHigh -= TRACK_INDEX_SECTOR;
+    if (esp_partition_erase_range(trackIndexPartition, buildBase + buildErasedHigh, TRACK_INDEX_SECTOR) != ESP_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// FNV-1a hash for string interning
+uint32_t hashIndexString(const char* text, size_t length) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)text[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+// Add a string to the pool, reusing an identical earlier copy if known
+// Returns the pool offset, or 0 if the index is full.
+uint32_t internIndexString(const char* text) {
+  char value[TRACK_STRING_MAX + 1];
+  strlcpy(value, text ? text : "", sizeof(value));
+  size_t length = strlen(value);
+  uint32_t hash = hashIndexString(value, length);
+  
+  // Look for an existing copy
+  uint32_t slot = hash & (TRACK_INDEX_INTERN_SLOTS - 1);
+  if (buildIntern != NULL) {
+    char stored[TRACK_STRING_MAX + 1];
+    while (buildIntern[slot].offset != 0) {
+      if (buildIntern[slot].hash == hash &&
+          esp_partition_read(trackIndexPartition, buildBase + buildIntern[slot].offset, stored, length + 1) == ESP_OK &&
+          memcmp(stored, value, length + 1) == 0) {
+        return buildIntern[slot].offset;
+      }
+      slot = (slot + 1) & (TRACK_INDEX_INTERN_SLOTS - 1);
+    }
+  }
+  
+  // Write a new copy below the current pool
+  uint32_t offset = buildPoolCursor - (length + 1);
+  if (offset < buildRecordCursor + sizeof(TrackRecord) || !eraseIndexDownTo(offset) ||
+      esp_partition_write(trackIndexPartition, buildBase + offset, value, length + 1) != ESP_OK) {
+    return 0;
+  }
+  buildPoolCursor = offset;
+  
+  // Remember it while the table is below 75% load, later strings just aren't shared
+  if (buildIntern != NULL && buildInternUsed < TRACK_INDEX_INTERN_SLOTS * 3 / 4) {
+    buildIntern[slot].hash = hash;
+    buildIntern[slot].offset = offset;
+    buildInternUsed++;
+  }
+  return offset;
+}
+
+// Set up builder state for a slot, the mapped index stays readable
+bool prepareTrackIndexBuild(uint8_t slot) {
+  if (!findTrackIndexPartition()) {
+    return false;
+  }
+  buildSlot = slot;
+  buildBase = slot * trackIndexSlotSize;
+  
+  // The header sector only ever holds the header, clear it so a build that
+  // stops before commitTrackIndex() never reads back as valid
+  if (esp_partition_erase_range(trackIndexPartition, buildBase, TRACK_INDEX_SECTOR) != ESP_OK) {
+    return false;
+  }
+  
+  buildIntern = (InternSlot*)calloc(TRACK_INDEX_INTERN_SLOTS, sizeof(InternSlot));
+  buildInternUsed = 0;
+  buildActive = true;
+  buildFailed = false;
+  return true;
+}
+
+// Start writing a new index into the slot that isn't in use
+bool beginTrackIndex() {
+  uint8_t slot = (trackIndexGeneration == 0) ? 0 : (trackIndexSlot + 1) % TRACK_INDEX_SLOTS;
+  if (!prepareTrackIndexBuild(slot)) {
+    return false;
+  }
+  
+  buildRecordCursor = TRACK_INDEX_SECTOR;
+  buildErasedLow = TRACK_INDEX_SECTOR;
+  buildPoolCursor = trackIndexSlotSize;
+  buildErasedHigh = trackIndexSlotSize;
+  buildCount = 0;
+  return true;
+}
+
+// Rewrite one sector with [keepBelow, keepFrom) blanked
+// Bytes written after the last checkpoint may sit between the two cursors,
+// and flash can't be written again without an erase.
+bool scrubIndexSector(uint32_t sector, uint32_t keepBelow, uint32_t keepFrom) {
+  uint32_t from = keepBelow > sector ? keepBelow - sector : 0;
+  uint32_t to = keepFrom < sector + TRACK_INDEX_SECTOR ? keepFrom - sector : TRACK_INDEX_SECTOR;
+  if (from >= to) {
+    return true;
+  }
+  
+  uint8_t* data = (uint8_t*)malloc(TRACK_INDEX_SECTOR);
+  if (data == NULL) {
+    return false;
+  }
+  bool ok = esp_partition_read(trackIndexPartition, buildBase + sector, data, TRACK_INDEX_SECTOR) == ESP_OK;
+  if (ok) {
+    memset(data + from, 0xFF, to - from);
+    ok = esp_partition_erase_range(trackIndexPartition, buildBase + sector, TRACK_INDEX_SECTOR) == ESP_OK &&
+         esp_partition_write(trackIndexPartition, buildBase + sector, data, TRACK_INDEX_SECTOR) == ESP_OK;
+  }
+  free(data);
+  return ok;
+}
+
+// Continue an interrupted build from a checkpoint
+// Strings written before the checkpoint are no longer shared with new ones,
+// which only costs some pool space.
+bool resumeTrackIndex(const TrackIndexCheckpoint& checkpoint) {
+  if (!findTrackIndexPartition()) {
+    return false;
+  }
+  
+  // The checkpoint must continue a build on top of the index we have now
+  bool usesActiveSlot = (trackIndexGeneration != 0 && checkpoint.slot == trackIndexSlot);
+  if (checkpoint.generation != trackIndexGeneration + 1 || usesActiveSlot ||
+      checkpoint.slot >= TRACK_INDEX_SLOTS || checkpoint.recordCursor < TRACK_INDEX_SECTOR ||
+      checkpoint.recordCursor > checkpoint.poolCursor || checkpoint.poolCursor > trackIndexSlotSize ||
+      checkpoint.recordCursor != TRACK_INDEX_SECTOR + checkpoint.count * sizeof(TrackRecord) ||
+      !prepareTrackIndexBuild(checkpoint.slot)) {
+    return false;
+  }
+  
+  buildRecordCursor = checkpoint.recordCursor;
+  buildPoolCursor = checkpoint.poolCursor;
+  buildCount = checkpoint.count;
+  
+  // Clean up the partly used sectors at both cursors, anything past them is
+  // erased again when the build reaches it
+  uint32_t recordSector = buildRecordCursor & ~(TRACK_INDEX_SECTOR - 1);
+  uint32_t poolSector = buildPoolCursor & ~(TRACK_INDEX_SECTOR - 1);
+  bool ok = scrubIndexSector(recordSector, buildRecordCursor, buildPoolCursor);
+  if (ok && poolSector != recordSector) {
+    ok = scrubIndexSector(poolSector, buildRecordCursor, buildPoolCursor);
+  }
+  buildErasedLow = (buildRecordCursor != recordSector) ? recordSector + TRACK_INDEX_SECTOR : buildRecordCursor;
+  buildErasedHigh = (buildPoolCursor != poolSector) ? poolSector : buildPoolCursor;
+  
+  if (!ok) {
+    abortTrackIndex();
+  }
+  return ok;
+}
+
+// Snapshot the builder position, the caller fills in the scan fields
+void getTrackIndexCheckpoint(TrackIndexCheckpoint* checkpoint) {
+  checkpoint->generation = trackIndexGeneration + 1;
+  checkpoint->slot = buildSlot;
+  checkpoint->count = buildCount;
+  checkpoint->recordCursor = buildRecordCursor;
+  checkpoint->poolCursor = buildPoolCursor;
+}
+
+// Append one track to the index being built
+bool addIndexedTrack(const char* filename, const char* title, const char* artist,
+                     const char* album, int trackNumber, uint32_t fileSize, uint32_t modified) {
+  if (!buildActive || buildFailed) {
+    return false;
+  }
+  
+  TrackRecord record;
+  record.filename = internIndexString(filename);
+  record.title = internIndexString(title);
+  record.artist = internIndexString(artist);
+  record.album = internIndexString(album);
+  record.fileSize = fileSize;
+  record.modified = modified;
+  record.trackNumber = trackNumber;
+  record.reserved = 0;
+  
+  uint32_t end = buildRecordCursor + sizeof(TrackRecord);
+  if (record.filename == 0 || record.title == 0 || record.artist == 0 || record.album == 0 ||
+      end > buildPoolCursor || !eraseIndexUpTo(end) ||
+      esp_partition_write(trackIndexPartition, buildBase + buildRecordCursor, &record, sizeof(record)) != ESP_OK) {
+    Serial.println("Track index full");
+    buildFailed = true;
+    return false;
+  }
+  
+  buildRecordCursor = end;
+  buildCount++;
+  return true;
+}
+
+// Drop an unfinished build, the active index is untouched
+void abortTrackIndex() {
+  free(buildIntern);
+  buildIntern = NULL;
+  buildActive = false;
+}
+
+// Fold a Latin-1 character for case-insensitive ordering
+uint8_t foldIndexChar(uint8_t c) {
+  if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7)) {
+    return c + 0x20;
+  }
+  return c;
+}
+
+// Case-folded compare of two strings
+int compareFolded(const char* a, const char* b) {
+  while (*a && foldIndexChar(*a) == foldIndexChar(*b)) {
+    a++;
+    b++;
+  }
+  return (int)foldIndexChar(*a) - (int)foldIndexChar(*b);
+}
+
+// Case-folded compare of the start of text against prefix, 0 if text starts with it
+int comparePrefixFolded(const char* text, const char* prefix) {
+  while (*prefix) {
+    int diff = (int)foldIndexChar(*text) - (int)foldIndexChar(*prefix);
+    if (diff != 0 || *text == '\0') {
+      return diff;
+    }
+    text++;
+    prefix++;
+  }
+  return 0;
+}
+
+// The string a record is sorted by for a key
+const char* sortKeyText(const uint8_t* map, const TrackRecord& record, uint8_t key) {
+  uint32_t offset = (key == SORT_BY_ARTIST) ? record.artist :
+                    (key == SORT_BY_ALBUM) ? record.album :
+                    (key == SORT_BY_PATH) ? record.filename : record.title;
+  return (const char*)(map + offset);
+}
+
+// qsort() comparator for record numbers in the build slot
+int compareSortedRecords(const void* left, const void* right) {
+  uint16_t a = *(const uint16_t*)left;
+  uint16_t b = *(const uint16_t*)right;
+  const TrackRecord& ra = sortRecords[a];
+  const TrackRecord& rb = sortRecords[b];
+  
+  // Paths are looked up exactly, so they sort byte by byte
+  if (sortKey == SORT_BY_PATH) {
+    return strcmp(sortKeyText(sortMap, ra, sortKey), sortKeyText(sortMap, rb, sortKey));
+  }
+  
+  int diff = compareFolded(sortKeyText(sortMap, ra, sortKey), sortKeyText(sortMap, rb, sortKey));
+  if (diff == 0 && sortKey == SORT_BY_ARTIST) {
+    diff = compareFolded(sortKeyText(sortMap, ra, SORT_BY_ALBUM), sortKeyText(sortMap, rb, SORT_BY_ALBUM));
+  }
+  if (diff == 0 && sortKey != SORT_BY_TITLE) {
+    diff = (int)ra.trackNumber - (int)rb.trackNumber;
+  }
+  return diff != 0 ? diff : (int)a - (int)b;
+}
+
+// Sort the finished records by each browse key and append the orders
+// Missing orders (out of RAM or flash) are left at 0 and browsing by that
+// key is unavailable until the next rebuild.
+void writeSortedIndexes(TrackIndexHeader* header) {
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    header->sortOffset[key] = 0;
+  }
+  if (buildCount == 0 || buildCount > 0xFFFF) {
+    return;
+  }
+  
+  uint16_t* order = (uint16_t*)malloc(buildCount * sizeof(uint16_t));
+  const void* mapped = NULL;
+  TrackIndexMapHandle handle;
+  if (order == NULL || esp_partition_mmap(trackIndexPartition, buildBase, trackIndexSlotSize,
+                                          TRACK_INDEX_MMAP_DATA, &mapped, &handle) != ESP_OK) {
+    free(order);
+    Serial.println("Not enough memory to sort track index");
+    return;
+  }
+  sortMap = (const uint8_t*)mapped;
+  sortRecords = (const TrackRecord*)(sortMap + TRACK_INDEX_SECTOR);
+  
+  uint32_t length = buildCount * sizeof(uint16_t);
+  for (uint8_t key = 0; key < SORT_KEY_COUNT; key++) {
+    for (uint32_t i = 0; i < buildCount; i++) {
+      order[i] = i;
+    }
+    sortKey = key;
+    qsort(order, buildCount, sizeof(uint16_t), compareSortedRecords);
+  
+    uint32_t offset = (buildRecordCursor + 3) & ~3UL;
+    if (offset + length > buildPoolCursor || !eraseIndexUpTo(offset + length) ||
+        esp_partition_write(trackIndexPartition, buildBase + offset, order, length) != ESP_OK) {
+      break;
+    }
+    header->sortOffset[key] = offset;
+    buildRecordCursor = offset + length;
+  }
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_partition_munmap(handle);
+#else
+  spi_flash_munmap(handle);
+#endif
+  sortMap = NULL;
+  sortRecords = NULL;
+  free(order);
+}
+
+// Record number at a position in a browse order, -1 if unavailable
+int getSortedTrack(TrackSortKey key, int position) {
+  if (trackIndexSorted[key] == NULL || position < 0 || (uint32_t)position >= trackIndexCount) {
+    return -1;
+  }
+  return trackIndexSorted[key][position];
+}
+
+// Text a browse order is keyed on at a position
+const char* sortedKeyAt(TrackSortKey key, int position) {
+  sortedKeyReads++;
+  return sortKeyText(trackIndexMap, trackIndexRecords[trackIndexSorted[key][position]], key);
+}
+
+// Find the tracks whose key starts with prefix (case-insensitive)
+// Returns the first position in the browse order and sets count to the
+// number of matches. Two binary searches, O(log n) flash reads.
+int findSortedPrefix(TrackSortKey key, const char* prefix, int* count) {
+  *count = 0;
+  if (trackIndexSorted[key] == NULL) {
+    return -1;
+  }
+  
+  // First position not before the prefix
+  int low = 0;
+  int high = trackIndexCount;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (comparePrefixFolded(sortedKeyAt(key, mid), prefix) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  int first = low;
+  
+  // First position after the prefix
+  high = trackIndexCount;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (comparePrefixFolded(sortedKeyAt(key, mid), prefix) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  
+  *count = low - first;
+  return first;
+}
+
+// Position of the next different key value, e.g. the next artist
+int nextSortedGroup(TrackSortKey key, int position) {
+  if (trackIndexSorted[key] == NULL || position < 0 || (uint32_t)position >= trackIndexCount) {
+    return -1;
+  }
+  
+  const char* current = sortedKeyAt(key, position);
+  int low = position + 1;
+  int high = trackIndexCount;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (compareFolded(sortedKeyAt(key, mid), current) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low < (int)trackIndexCount ? low : -1;
+}
+
+// Finish the build by writing its header, then switch to the new index
+bool commitTrackIndex() {
+  if (!buildActive) {
+    return false;
+  }
+  free(buildIntern);
+  buildIntern = NULL;
+  buildActive = false;
+  
+  TrackIndexHeader header;
+  header.magic = TRACK_INDEX_MAGIC;
+  header.version = TRACK_INDEX_VERSION;
+  header.recordSize = sizeof(TrackRecord);
+  header.generation = trackIndexGeneration + 1;
+  header.trackCount = buildCount;
+  header.recordsOffset = TRACK_INDEX_SECTOR;
+  writeSortedIndexes(&header);
+  header.poolOffset = buildPoolCursor;
+  header.crc = esp_rom_crc32_le(0, (const uint8_t*)&header, offsetof(TrackIndexHeader, crc));
+  
+  if (esp_partition_write(trackIndexPartition, buildBase, &header, sizeof(header)) != ESP_OK) {
+    Serial.println("Failed to write track index header");
+    return false;
+  }
+  
+  return openTrackIndex();
+}
+
+#endif // TRACKINDEX_H
\ No newline at end of file